@@ -40,67 +40,445 @@ static ConVar net_showevents( "net_showevents", "0", FCVAR_CHEAT, "Dump game eve
 // Expose CVEngineServer to the engine.
 
 EXPOSE_SINGLE_INTERFACE_GLOBALVAR( CGameEventManager, IGameEventManager2, INTERFACEVERSION_GAMEEVENTSMANAGER2, s_GameEventManager );
+// INTERFACEVERSION_GAMEEVENTSMANAGER2_VERSION_2 is compatible with the latest since events only got methods added to the end, so expose that as well.
+EXPOSE_SINGLE_INTERFACE_GLOBALVAR( CGameEventManager, IGameEventManager002, INTERFACEVERSION_GAMEEVENTSMANAGER2_VERSION_2, s_GameEventManager );
+
+// most freed events kept around for reuse
+#define MAX_FREE_GAME_EVENTS	256
+
+static int s_nNextKeyLayout = 0;
+
+void CGameEventValue::FreeString()
+{
+	delete [] m_pszString;
+	m_pszString = NULL;
+	m_nStringSize = 0;
+}
+
+char *CGameEventValue::AllocString( int nSize )
+{
+	if ( nSize > m_nStringSize )
+	{
+		delete [] m_pszString;
+		m_nStringSize = MAX( nSize, 32 );
+		m_pszString = new char[m_nStringSize];
+	}
+
+	return m_pszString;
+}
+
+int CGameEventValue::GetInt( int defaultValue )
+{
+	switch ( m_nType )
+	{
+	case VALUE_INT: return m_iValue;
+	case VALUE_FLOAT: return (int)m_flValue;
+	case VALUE_STRING: return Q_atoi( m_pszString );
+	default: return defaultValue;
+	}
+}
+
+float CGameEventValue::GetFloat( float defaultValue )
+{
+	switch ( m_nType )
+	{
+	case VALUE_INT: return (float)m_iValue;
+	case VALUE_FLOAT: return m_flValue;
+	case VALUE_STRING: return (float)Q_atof( m_pszString );
+	default: return defaultValue;
+	}
+}
+
+const char *CGameEventValue::GetString( const char *defaultValue )
+{
+	switch ( m_nType )
+	{
+	case VALUE_INT: Q_snprintf( AllocString( 32 ), 32, "%d", m_iValue ); return m_pszString;
+	case VALUE_FLOAT: Q_snprintf( AllocString( 32 ), 32, "%f", m_flValue ); return m_pszString;
+	case VALUE_STRING: return m_pszString;
+	default: return defaultValue;
+	}
+}
+
+void CGameEventValue::SetInt( int value )
+{
+	m_nType = VALUE_INT;
+	m_iValue = value;
+}
+
+void CGameEventValue::SetFloat( float value )
+{
+	m_nType = VALUE_FLOAT;
+	m_flValue = value;
+}
+
+void CGameEventValue::SetString( const char *value )
+{
+	if ( !value )
+		value = "";
+
+	int nSize = Q_strlen( value ) + 1;
+
+	// the value may be our own string
+	if ( nSize > m_nStringSize )
+	{
+		char *pszString = new char[MAX( nSize, 32 )];
+		Q_memcpy( pszString, value, nSize );
+		delete [] m_pszString;
+		m_pszString = pszString;
+		m_nStringSize = MAX( nSize, 32 );
+	}
+	else if ( value != m_pszString )
+	{
+		Q_memmove( m_pszString, value, nSize );
+	}
+
+	m_nType = VALUE_STRING;
+}
+
+void CGameEventValue::SetValue( const CGameEventValue &value )
+{
+	switch ( value.m_nType )
+	{
+	case VALUE_INT: SetInt( value.m_iValue ); break;
+	case VALUE_FLOAT: SetFloat( value.m_flValue ); break;
+	case VALUE_STRING: SetString( value.m_pszString ); break;
+	default: Clear(); break;
+	}
+}
+
+void CGameEventValue::CopyToKey( KeyValues *keys, const char *keyName ) const
+{
+	switch ( m_nType )
+	{
+	case VALUE_INT: keys->SetInt( keyName, m_iValue ); break;
+	case VALUE_FLOAT: keys->SetFloat( keyName, m_flValue ); break;
+	case VALUE_STRING: keys->SetString( keyName, m_pszString ); break;
+	default: break;
+	}
+}
 
 CGameEvent::CGameEvent( CGameEventDescriptor *descriptor )
+{
+	m_pDataKeys = NULL;
+	m_nValues = 0;
+	m_nExtraValues = 0;
+	Init( descriptor );
+}
+
+CGameEvent::~CGameEvent()
+{
+	InvalidateDataKeys();
+
+	for ( int i = 0; i < m_Values.Count(); i++ )
+	{
+		m_Values[i].FreeString();
+	}
+
+	for ( int i = 0; i < m_ExtraValues.Count(); i++ )
+	{
+		m_ExtraValues[i].FreeString();
+	}
+}
+
+void CGameEvent::Init( CGameEventDescriptor *descriptor )
 {
 	Assert( descriptor );
 	m_pDescriptor = descriptor;
-	m_pDataKeys = new KeyValues( descriptor->name );
+	m_nLayout = descriptor->layout;
+
+	InvalidateDataKeys();
+
+	// keep the values of earlier uses, they own string memory
+	m_nValues = descriptor->keyList.Count();
+	if ( m_Values.Count() < m_nValues )
+	{
+		m_Values.EnsureCount( m_nValues );
+	}
+
+	for ( int i = 0; i < m_nValues; i++ )
+	{
+		m_Values[i].Clear();
+	}
+
+	m_nExtraValues = 0;
 }
 
-CGameEvent::~CGameEvent()
+void CGameEvent::CopyFrom( const CGameEvent *event )
+{
+	Assert( event->m_pDescriptor == m_pDescriptor && event->m_nValues == m_nValues );
+
+	for ( int i = 0; i < m_nValues; i++ )
+	{
+		m_Values[i].SetValue( event->m_Values[i] );
+	}
+
+	for ( int i = 0; i < event->m_nExtraValues; i++ )
+	{
+		const CGameEventExtraValue &extra = event->m_ExtraValues[i];
+		FindValue( extra.m_szName, true )->SetValue( extra );
+	}
+}
+
+void CGameEvent::InvalidateDataKeys()
+{
+	if ( m_pDataKeys )
+	{
+		m_pDataKeys->deleteThis();
+		m_pDataKeys = NULL;
+	}
+}
+
+int CGameEvent::FindKeyIndex( const char *keyName ) const
+{
+	if ( !keyName || m_nLayout != m_pDescriptor->layout )
+		return -1;
+
+	// key names are case insensitive like KeyValues
+	const CUtlVector<GameEventKey_t> &keyList = m_pDescriptor->keyList;
+	for ( int i = 0; i < keyList.Count(); i++ )
+	{
+		if ( !Q_stricmp( keyList[i].name, keyName ) )
+			return i;
+	}
+
+	return -1;
+}
+
+int CGameEvent::GetKeyLayout() const
 {
-	m_pDataKeys->deleteThis();
+	return m_nLayout;
+}
+
+CGameEventValue *CGameEvent::GetValue( int keyIndex )
+{
+	Assert( keyIndex >= -1 && keyIndex < m_nValues );
+
+	if ( keyIndex < 0 || keyIndex >= m_nValues )
+		return NULL;
+
+	return &m_Values[keyIndex];
+}
+
+CGameEventValue *CGameEvent::FindValue( const char *keyName, bool bCreate )
+{
+	if ( !keyName )
+		return NULL;
+
+	int keyIndex = FindKeyIndex( keyName );
+	if ( keyIndex >= 0 )
+		return &m_Values[keyIndex];
+
+	for ( int i = 0; i < m_nExtraValues; i++ )
+	{
+		if ( !Q_stricmp( m_ExtraValues[i].m_szName, keyName ) )
+			return &m_ExtraValues[i];
+	}
+
+	if ( !bCreate )
+		return NULL;
+
+	if ( m_ExtraValues.Count() <= m_nExtraValues )
+	{
+		m_ExtraValues.AddToTail();
+	}
+
+	CGameEventExtraValue *extra = &m_ExtraValues[m_nExtraValues++];
+	Q_strncpy( extra->m_szName, keyName, sizeof( extra->m_szName ) );
+	extra->Clear();
+	return extra;
 }
 
 bool CGameEvent::GetBool( const char *keyName, bool defaultValue)
 {
-	return m_pDataKeys->GetInt( keyName, defaultValue ) != 0;
+	return GetInt( keyName, defaultValue ) != 0;
 }
 
 int CGameEvent::GetInt( const char *keyName, int defaultValue)
 {
-	return m_pDataKeys->GetInt( keyName, defaultValue );
+	CGameEventValue *value = FindValue( keyName, false );
+	return value ? value->GetInt( defaultValue ) : defaultValue;
 }
 
 float CGameEvent::GetFloat( const char *keyName, float defaultValue )
 {
-	return m_pDataKeys->GetFloat( keyName, defaultValue );
+	CGameEventValue *value = FindValue( keyName, false );
+	return value ? value->GetFloat( defaultValue ) : defaultValue;
 }
 
 const char *CGameEvent::GetString( const char *keyName, const char *defaultValue )
 {
-	return m_pDataKeys->GetString( keyName, defaultValue );
+	CGameEventValue *value = FindValue( keyName, false );
+	return value ? value->GetString( defaultValue ) : defaultValue;
 }
 
 void CGameEvent::SetBool( const char *keyName, bool value )
 {
-	m_pDataKeys->SetInt( keyName, value?1:0 );
+	SetInt( keyName, value?1:0 );
 }
 
 void CGameEvent::SetInt( const char *keyName, int value )
 {
-	m_pDataKeys->SetInt( keyName, value );
+	CGameEventValue *pValue = FindValue( keyName, true );
+	if ( pValue )
+	{
+		InvalidateDataKeys();
+		pValue->SetInt( value );
+	}
 }
 
 void CGameEvent::SetFloat( const char *keyName, float value )
 {
-	m_pDataKeys->SetFloat( keyName, value );
+	CGameEventValue *pValue = FindValue( keyName, true );
+	if ( pValue )
+	{
+		InvalidateDataKeys();
+		pValue->SetFloat( value );
+	}
 }
 
 void CGameEvent::SetString( const char *keyName, const char *value )
 {
-	m_pDataKeys->SetString( keyName, value );
+	CGameEventValue *pValue = FindValue( keyName, true );
+	if ( pValue )
+	{
+		InvalidateDataKeys();
+		pValue->SetString( value );
+	}
+}
+
+bool CGameEvent::GetBoolByIndex( int keyIndex, bool defaultValue )
+{
+	return GetIntByIndex( keyIndex, defaultValue ) != 0;
+}
+
+int CGameEvent::GetIntByIndex( int keyIndex, int defaultValue )
+{
+	CGameEventValue *value = GetValue( keyIndex );
+	return value ? value->GetInt( defaultValue ) : defaultValue;
+}
+
+float CGameEvent::GetFloatByIndex( int keyIndex, float defaultValue )
+{
+	CGameEventValue *value = GetValue( keyIndex );
+	return value ? value->GetFloat( defaultValue ) : defaultValue;
+}
+
+const char *CGameEvent::GetStringByIndex( int keyIndex, const char *defaultValue )
+{
+	CGameEventValue *value = GetValue( keyIndex );
+	return value ? value->GetString( defaultValue ) : defaultValue;
+}
+
+void CGameEvent::SetBoolByIndex( int keyIndex, bool value )
+{
+	SetIntByIndex( keyIndex, value?1:0 );
+}
+
+void CGameEvent::SetIntByIndex( int keyIndex, int value )
+{
+	CGameEventValue *pValue = GetValue( keyIndex );
+	if ( pValue )
+	{
+		InvalidateDataKeys();
+		pValue->SetInt( value );
+	}
+}
+
+void CGameEvent::SetFloatByIndex( int keyIndex, float value )
+{
+	CGameEventValue *pValue = GetValue( keyIndex );
+	if ( pValue )
+	{
+		InvalidateDataKeys();
+		pValue->SetFloat( value );
+	}
+}
+
+void CGameEvent::SetStringByIndex( int keyIndex, const char *value )
+{
+	CGameEventValue *pValue = GetValue( keyIndex );
+	if ( pValue )
+	{
+		InvalidateDataKeys();
+		pValue->SetString( value );
+	}
 }
 
 bool CGameEvent::IsEmpty( const char *keyName )
 {
-	return m_pDataKeys->IsEmpty( keyName );
+	if ( !keyName )
+	{
+		if ( m_nExtraValues )
+			return false;
+
+		for ( int i = 0; i < m_nValues; i++ )
+		{
+			if ( !m_Values[i].IsEmpty() )
+				return false;
+		}
+
+		return true;
+	}
+
+	CGameEventValue *value = FindValue( keyName, false );
+	return !value || value->IsEmpty();
+}
+
+KeyValues *CGameEvent::GetDataKeys()
+{
+	if ( m_pDataKeys )
+		return m_pDataKeys;
+
+	m_pDataKeys = new KeyValues( m_pDescriptor->name );
+
+	if ( m_nLayout == m_pDescriptor->layout )
+	{
+		const CUtlVector<GameEventKey_t> &keyList = m_pDescriptor->keyList;
+		for ( int i = 0; i < m_nValues; i++ )
+		{
+			m_Values[i].CopyToKey( m_pDataKeys, keyList[i].name );
+		}
+	}
+	else
+	{
+		// the event description was reloaded since this event was made, the names of the
+		// values stored by key index are gone. Values set since then are found by name below.
+		for ( int i = 0; i < m_nValues; i++ )
+		{
+			if ( !m_Values[i].IsEmpty() )
+			{
+				DevMsg( "CGameEvent::GetDataKeys: event '%s' outlived a reload of its description, dropping its declared keys.\n", m_pDescriptor->name );
+				break;
+			}
+		}
+	}
+
+	for ( int i = 0; i < m_nExtraValues; i++ )
+	{
+		m_ExtraValues[i].CopyToKey( m_pDataKeys, m_ExtraValues[i].m_szName );
+	}
+
+	return m_pDataKeys;
+}
+
+void CGameEvent::SetFromKeyValues( KeyValues *keys )
+{
+	for ( KeyValues *key = keys->GetFirstSubKey(); key; key = key->GetNextKey() )
+	{
+		switch ( key->GetDataType() )
+		{
+		case KeyValues::TYPE_NONE: break;
+		case KeyValues::TYPE_INT: SetInt( key->GetName(), key->GetInt() ); break;
+		case KeyValues::TYPE_FLOAT: SetFloat( key->GetName(), key->GetFloat() ); break;
+		default: SetString( key->GetName(), key->GetString() ); break;
+		}
+	}
 }
 
 const char *CGameEvent::GetName() const
 {
-	return m_pDataKeys->GetName();
+	return m_pDescriptor->name;
 }
 
 bool CGameEvent::IsLocal() const
@@ -156,6 +534,12 @@ void CGameEventManager::Reset()
 
 	m_GameEvents.Purge();
 	m_Listeners.PurgeAndDeleteElements();
+
+	{
+		AUTO_LOCK( m_FreeEventsMutex );
+		m_FreeEvents.PurgeAndDeleteElements();
+	}
+
 	m_EventFiles.RemoveAll();
 	m_EventFileNames.RemoveAll();
 	m_bClientListenersChanged = true;
@@ -258,6 +642,8 @@ bool CGameEventManager::ParseEventList(SVC_GameEventList *msg)
 			datatype = msg->m_DataIn.ReadUBitLong( 3 );
 		}
 
+		BuildKeyLayout( descriptor );
+
 		descriptor->eventid = id;
 	}
 
@@ -306,7 +692,23 @@ void CGameEventManager::WriteListenEventList(CLC_ListenEvents *msg)
 
 IGameEvent *CGameEventManager::CreateEvent( CGameEventDescriptor *descriptor )
 {
-	return new CGameEvent ( descriptor );
+	CGameEvent *event = NULL;
+
+	{
+		AUTO_LOCK( m_FreeEventsMutex );
+
+		if ( m_FreeEvents.Count() )
+		{
+			event = m_FreeEvents.Tail();
+			m_FreeEvents.RemoveMultipleFromTail( 1 );
+		}
+	}
+
+	if ( !event )
+		return new CGameEvent( descriptor );
+
+	event->Init( descriptor );
+	return event;
 }
 
 IGameEvent *CGameEventManager::CreateEvent( const char *name, bool bForce )
@@ -330,7 +732,7 @@ IGameEvent *CGameEventManager::CreateEvent( const char *name, bool bForce )
 	}
 
 	// create & return the new event 
-	return new CGameEvent ( descriptor );
+	return CreateEvent( descriptor );
 }
 
 bool CGameEventManager::FireEvent( IGameEvent *event, bool bServerOnly )
@@ -350,14 +752,10 @@ IGameEvent *CGameEventManager::DuplicateEvent( IGameEvent *event )
 	if ( !gameEvent )
 		return NULL;
 
-	// create new instance
-	CGameEvent *newEvent = new CGameEvent ( gameEvent->m_pDescriptor );
+	// create new instance and copy the values
+	CGameEvent *newEvent = static_cast<CGameEvent*>( CreateEvent( gameEvent->m_pDescriptor ) );
 
-	// free keys
-	newEvent->m_pDataKeys->deleteThis();
-
-	// and make copy
-	newEvent->m_pDataKeys = gameEvent->m_pDataKeys->MakeCopy();
+	newEvent->CopyFrom( gameEvent );
 
 	return newEvent;
 }
@@ -369,22 +767,17 @@ void CGameEventManager::ConPrintEvent( IGameEvent *event)
 	if ( !descriptor )
 		return;
 
-	KeyValues *key = descriptor->keys->GetFirstSubKey(); 
-
-	while ( key )
+	for ( int i = 0; i < descriptor->keyList.Count(); i++ )
 	{
-		const char * keyName = key->GetName();
-
-		int type = key->GetInt();
+		const char * keyName = descriptor->keyList[i].name;
 
-		switch ( type )
+		switch ( descriptor->keyList[i].type )
 		{
-		case TYPE_LOCAL : ConMsg( "- \"%s\" = \"%s\" (local)\n", keyName, event->GetString(keyName) ); break;
-		case TYPE_STRING : ConMsg( "- \"%s\" = \"%s\"\n", keyName, event->GetString(keyName) ); break;
-		case TYPE_FLOAT : ConMsg( "- \"%s\" = \"%.2f\"\n", keyName, event->GetFloat(keyName) ); break;
-		default: ConMsg( "- \"%s\" = \"%i\"\n", keyName, event->GetInt(keyName) ); break;
+		case TYPE_LOCAL : ConMsg( "- \"%s\" = \"%s\" (local)\n", keyName, event->GetStringByIndex(i) ); break;
+		case TYPE_STRING : ConMsg( "- \"%s\" = \"%s\"\n", keyName, event->GetStringByIndex(i) ); break;
+		case TYPE_FLOAT : ConMsg( "- \"%s\" = \"%.2f\"\n", keyName, event->GetFloatByIndex(i) ); break;
+		default: ConMsg( "- \"%s\" = \"%i\"\n", keyName, event->GetIntByIndex(i) ); break;
 		}
-		key = key->GetNextKey();
 	}
 }
 
@@ -458,7 +851,7 @@ bool CGameEventManager::FireEventIntern( IGameEvent *event, bool bServerOnly, bo
 			IGameEventListener *pCallback = static_cast<IGameEventListener*>(listener->m_pCallback);
 			CGameEvent *pEvent = static_cast<CGameEvent*>(event);
 
-			pCallback->FireGameEvent( pEvent->m_pDataKeys );
+			pCallback->FireGameEvent( pEvent->GetDataKeys() );
 		}
 		else
 		{
@@ -485,43 +878,38 @@ bool CGameEventManager::SerializeEvent( IGameEvent *event, bf_write* buf )
 
 	buf->WriteUBitLong( descriptor->eventid, MAX_EVENT_BITS );
 
-	// now iterate trough all fields described in gameevents.res and put them in the buffer
+	// now iterate trough all fields described in gameevents.res and put them in the buffer,
+	// values are stored in the same order
 
-	KeyValues * key = descriptor->keys->GetFirstSubKey();
+	CGameEvent *gameEvent = static_cast<CGameEvent*>( event );
+	bool bShowEvents = net_showevents.GetInt() > 2;
 
-	if ( net_showevents.GetInt() > 2 )
+	if ( bShowEvents )
 	{
 		DevMsg("Serializing event '%s' (%i):\n", descriptor->name, descriptor->eventid );
 	}
 	
-	while ( key )
+	for ( int i = 0; i < descriptor->keyList.Count(); i++ )
 	{
-		const char * keyName = key->GetName();
+		const GameEventKey_t &key = descriptor->keyList[i];
 
-		int type = key->GetInt();
-
-		if ( net_showevents.GetInt() > 2 )
+		if ( bShowEvents )
 		{
-			DevMsg(" - %s (%i)\n", keyName, type );
+			DevMsg(" - %s (%i)\n", key.name, key.type );
 		}
 
-		//Make sure every key is used in the event
-		// Assert( event->FindKey(keyName) && "GameEvent field not found in passed KeyValues" );
-
 		// see s_GameEnventTypeMap for index
-		switch ( type )
+		switch ( key.type )
 		{
 			case TYPE_LOCAL : break; // don't network this guy
-			case TYPE_STRING: buf->WriteString( event->GetString( keyName, "") ); break;
-			case TYPE_FLOAT : buf->WriteFloat( event->GetFloat( keyName, 0.0f) ); break;
-			case TYPE_LONG	: buf->WriteLong( event->GetInt( keyName, 0) ); break;
-			case TYPE_SHORT	: buf->WriteShort( event->GetInt( keyName, 0) ); break;
-			case TYPE_BYTE	: buf->WriteByte( event->GetInt( keyName, 0) ); break;
-			case TYPE_BOOL	: buf->WriteOneBit( event->GetInt( keyName, 0) ); break;
-			default: DevMsg(1, "CGameEventManager: unkown type %i for key '%s'.\n", type, key->GetName() ); break;
+			case TYPE_STRING: buf->WriteString( gameEvent->GetStringByIndex( i, "") ); break;
+			case TYPE_FLOAT : buf->WriteFloat( gameEvent->GetFloatByIndex( i, 0.0f) ); break;
+			case TYPE_LONG	: buf->WriteLong( gameEvent->GetIntByIndex( i, 0) ); break;
+			case TYPE_SHORT	: buf->WriteShort( gameEvent->GetIntByIndex( i, 0) ); break;
+			case TYPE_BYTE	: buf->WriteByte( gameEvent->GetIntByIndex( i, 0) ); break;
+			case TYPE_BOOL	: buf->WriteOneBit( gameEvent->GetIntByIndex( i, 0) ); break;
+			default: DevMsg(1, "CGameEventManager: unkown type %i for key '%s'.\n", key.type, key.name ); break;
 		}
-
-		key = key->GetNextKey();
 	}
 
 	return !buf->IsOverflowed();
@@ -553,29 +941,23 @@ IGameEvent *CGameEventManager::UnserializeEvent( bf_read *buf)
 		return NULL;
 	}
 
-	KeyValues * key = descriptor->keys->GetFirstSubKey(); 
-
-	while ( key )
+	for ( int i = 0; i < descriptor->keyList.Count(); i++ )
 	{
-		const char * keyName = key->GetName();
+		const GameEventKey_t &key = descriptor->keyList[i];
 
-		int type = key->GetInt();
-
-		switch ( type )
+		switch ( key.type )
 		{
 			case TYPE_LOCAL		: break; // ignore 
 			case TYPE_STRING	: if ( buf->ReadString( databuf, sizeof(databuf) ) )
-									event->SetString( keyName, databuf );
+									event->SetStringByIndex( i, databuf );
 								  break;
-			case TYPE_FLOAT		: event->SetFloat( keyName, buf->ReadFloat() ); break;
-			case TYPE_LONG		: event->SetInt( keyName, buf->ReadLong() ); break;
-			case TYPE_SHORT		: event->SetInt( keyName, buf->ReadShort() ); break;
-			case TYPE_BYTE		: event->SetInt( keyName, buf->ReadByte() ); break;
-			case TYPE_BOOL		: event->SetInt( keyName, buf->ReadOneBit() ); break;
-			default: DevMsg(1, "CGameEventManager: unknown type %i for key '%s'.\n", type, key->GetName() ); break;
+			case TYPE_FLOAT		: event->SetFloatByIndex( i, buf->ReadFloat() ); break;
+			case TYPE_LONG		: event->SetIntByIndex( i, buf->ReadLong() ); break;
+			case TYPE_SHORT		: event->SetIntByIndex( i, buf->ReadShort() ); break;
+			case TYPE_BYTE		: event->SetIntByIndex( i, buf->ReadByte() ); break;
+			case TYPE_BOOL		: event->SetIntByIndex( i, buf->ReadOneBit() ); break;
+			default: DevMsg(1, "CGameEventManager: unknown type %i for key '%s'.\n", key.type, key.name ); break;
 		}
-
-		key = key->GetNextKey();
 	}
 
 	return event;
@@ -821,10 +1203,27 @@ bool CGameEventManager::RegisterEvent( KeyValues * event)
 		
 		subkey = subkey->GetNextKey();
 	}
+
+	BuildKeyLayout( descriptor );
 	
 	return true;
 }
 
+void CGameEventManager::BuildKeyLayout( CGameEventDescriptor *descriptor )
+{
+	descriptor->keyList.RemoveAll();
+
+	for ( KeyValues *key = descriptor->keys->GetFirstSubKey(); key; key = key->GetNextKey() )
+	{
+		GameEventKey_t &eventKey = descriptor->keyList[ descriptor->keyList.AddToTail() ];
+		eventKey.name = key->GetName();
+		eventKey.type = key->GetInt();
+	}
+
+	// events made for the old layout don't match key indices anymore
+	descriptor->layout = s_nNextKeyLayout++;
+}
+
 CGameEventDescriptor *CGameEventManager::GetEventDescriptor(IGameEvent *event)
 {
 	CGameEvent *gameevent = dynamic_cast<CGameEvent*>(event);
@@ -856,7 +1255,19 @@ void CGameEventManager::FreeEvent( IGameEvent *event )
 	if ( !event )
 		return;
 
-	delete event;
+	CGameEvent *gameEvent = static_cast<CGameEvent*>( event );
+
+	{
+		AUTO_LOCK( m_FreeEventsMutex );
+
+		if ( m_FreeEvents.Count() < MAX_FREE_GAME_EVENTS )
+		{
+			m_FreeEvents.AddToTail( gameEvent );
+			return;
+		}
+	}
+
+	delete gameEvent;
 }
 
 CGameEventDescriptor *CGameEventManager::GetEventDescriptor(const char * name)
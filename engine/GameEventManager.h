@@ -18,6 +18,7 @@
 #include <KeyValues.h>
 #include <networkstringtabledefs.h>
 #include <utlsymbol.h>
+#include "tier0/threadtools.h"
 
 class SVC_GameEventList;
 class CLC_ListenEvents;
@@ -29,6 +30,12 @@ public:
 	int					m_nListenerType;	// client or server side ?
 };
 
+struct GameEventKey_t
+{
+	const char	*name;		// points into the descriptor keys
+	int			type;		// TYPE_LOCAL etc
+};
+
 class CGameEventDescriptor
 {
 public:
@@ -37,6 +44,7 @@ public:
 		name[0] = 0;
 		eventid = -1;
 		keys = NULL;
+		layout = -1;
 		local = false;
 		reliable = true;
 	}
@@ -45,11 +53,71 @@ public:
 	char		name[MAX_EVENT_NAME_LENGTH];	// name of this event
 	int			eventid;	// network index number, -1 = not networked
 	KeyValues	*keys;		// KeyValue describing data types, if NULL only name 
+	CUtlVector<GameEventKey_t> keyList;	// same keys in order, event values are stored by their index
+	int			layout;		// unique id of keyList, changes every time it's rebuilt
 	bool		local;		// local event, never tell clients about that
 	bool		reliable;	// send this event as reliable message
     CUtlVector<CGameEventCallback*>	listeners;	// registered listeners
 };
 
+// A single event value, converted on access the way KeyValues does
+class CGameEventValue
+{
+public:
+	enum
+	{
+		VALUE_NONE = 0,
+		VALUE_INT,
+		VALUE_FLOAT,
+		VALUE_STRING
+	};
+
+	CGameEventValue()
+	{
+		m_nType = VALUE_NONE;
+		m_iValue = 0;
+		m_pszString = NULL;
+		m_nStringSize = 0;
+	}
+
+	bool IsEmpty() const { return m_nType == VALUE_NONE; }
+	void Clear() { m_nType = VALUE_NONE; }
+	void FreeString();
+
+	int   GetInt( int defaultValue );
+	float GetFloat( float defaultValue );
+	const char *GetString( const char *defaultValue );
+
+	void SetInt( int value );
+	void SetFloat( float value );
+	void SetString( const char *value );
+	void SetValue( const CGameEventValue &value );
+	void CopyToKey( KeyValues *keys, const char *keyName ) const;
+
+private:
+	char *AllocString( int nSize );
+
+	int		m_nType;
+	union
+	{
+		int		m_iValue;
+		float	m_flValue;
+	};
+	char	*m_pszString;	// string value, or a number formatted by GetString(). Kept when the event is reused.
+	int		m_nStringSize;
+};
+
+#define MAX_EVENT_KEY_NAME_LENGTH	64
+
+// A value set for a key that isn't in the event description
+class CGameEventExtraValue : public CGameEventValue
+{
+public:
+	CGameEventExtraValue() { m_szName[0] = 0; }
+
+	char	m_szName[MAX_EVENT_KEY_NAME_LENGTH];
+};
+
 class CGameEvent : public IGameEvent
 {
 public:
@@ -57,6 +125,9 @@ public:
 	CGameEvent( CGameEventDescriptor *descriptor );
 	virtual ~CGameEvent();
 
+	void Init( CGameEventDescriptor *descriptor );
+	void CopyFrom( const CGameEvent *event );
+
 	const char *GetName() const;
 	bool  IsEmpty(const char *keyName = NULL);
 	bool  IsLocal() const;
@@ -71,9 +142,37 @@ public:
 	void SetInt( const char *keyName, int value );
 	void SetFloat( const char *keyName, float value );
 	void SetString( const char *keyName, const char *value );
+
+	int   GetKeyLayout() const;
+	int   FindKeyIndex( const char *keyName ) const;
+
+	bool  GetBoolByIndex( int keyIndex, bool defaultValue = false );
+	int   GetIntByIndex( int keyIndex, int defaultValue = 0 );
+	float GetFloatByIndex( int keyIndex, float defaultValue = 0.0f );
+	const char *GetStringByIndex( int keyIndex, const char *defaultValue = "" );
+
+	void SetBoolByIndex( int keyIndex, bool value );
+	void SetIntByIndex( int keyIndex, int value );
+	void SetFloatByIndex( int keyIndex, float value );
+	void SetStringByIndex( int keyIndex, const char *value );
+
+	// legacy support, old listeners get the values as KeyValues
+	KeyValues *GetDataKeys();
+	void SetFromKeyValues( KeyValues *keys );
 	
 	CGameEventDescriptor	*m_pDescriptor;
-	KeyValues				*m_pDataKeys;
+
+private:
+	CGameEventValue *FindValue( const char *keyName, bool bCreate );
+	CGameEventValue *GetValue( int keyIndex );
+	void InvalidateDataKeys();
+
+	int								m_nLayout;		// descriptor layout the values were made for
+	CUtlVector<CGameEventValue>		m_Values;		// by key index, more than m_nValues when reused
+	int								m_nValues;
+	CUtlVector<CGameEventExtraValue> m_ExtraValues;	// undeclared keys, more than m_nExtraValues when reused
+	int								m_nExtraValues;
+	KeyValues						*m_pDataKeys;	// built for old listeners only
 };
 
 class CGameEventManager : public IGameEventManager2
@@ -147,6 +246,7 @@ protected:
 
 	IGameEvent *CreateEvent( CGameEventDescriptor *descriptor );
 	bool RegisterEvent( KeyValues * keys );
+	void BuildKeyLayout( CGameEventDescriptor *descriptor );
 	void UnregisterEvent(int index);
 	bool FireEventIntern( IGameEvent *event, bool bServerSide, bool bClientOnly );
 	CGameEventCallback* FindEventListener( void* listener );
@@ -156,6 +256,9 @@ protected:
 	CUtlSymbolTable						m_EventFiles;	// list of all loaded event files
 	CUtlVector<CUtlSymbol>				m_EventFileNames; 
 
+	CUtlVector<CGameEvent*>				m_FreeEvents;	// freed events, reused by CreateEvent
+	CThreadFastMutex					m_FreeEventsMutex;
+
 	bool	m_bClientListenersChanged;	// true every time client changed listeners
 };
 
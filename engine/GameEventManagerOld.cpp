@@ -115,8 +115,9 @@ bool CGameEventManagerOld::FireEventIntern( KeyValues *keys, bool bServerSideOnl
 	if ( !event )
 		return false;
 
-	event->m_pDataKeys->deleteThis();
-	event->m_pDataKeys = keys;
+	// the event owns the keys like before
+	event->SetFromKeyValues( keys );
+	keys->deleteThis();
 
 	if ( bClientSideOnly )
 	{
@@ -1351,16 +1351,13 @@ const char *CBaseServer::CompressPackedEntity(ServerClass *pServerClass, const c
 	return s_packedData;
 }
 
-// uncompresses a 
-const char* CBaseServer::UncompressPackedEntity(PackedEntity *pPackedEntity, int &bits)
+// uncompresses a packed entity into pUnpacked, returns pUnpacked & bits
+const char* CBaseServer::UncompressPackedEntity(PackedEntity *pPackedEntity, int &bits, char *pUnpacked)
 {
-	UnpackedDataCache_t *pdc = framesnapshotmanager->GetCachedUncompressedEntity( pPackedEntity );
-
-	if ( pdc->bits > 0 )
+	if ( framesnapshotmanager->GetCachedUncompressedEntity( pPackedEntity, pUnpacked, bits ) )
 	{
 		// found valid uncompressed version in cache
-		bits= pdc->bits;
-		return pdc->data;
+		return pUnpacked;
 	}
 
 	// not in cache, so uncompress it
@@ -1375,7 +1372,7 @@ const char* CBaseServer::UncompressPackedEntity(PackedEntity *pPackedEntity, int
 	// store this baseline in u.m_pUpdateBaselines
 	bf_read oldBuf( "UncompressPackedEntity1", pBaseline, nBaselineBytes );
 	bf_read newBuf( "UncompressPackedEntity2", pPackedEntity->GetData(), Bits2Bytes(pPackedEntity->GetNumBits()) );
-	bf_write outBuf( "UncompressPackedEntity3", pdc->data, MAX_PACKEDENTITY_DATA );
+	bf_write outBuf( "UncompressPackedEntity3", pUnpacked, MAX_PACKEDENTITY_DATA );
 
 	Assert( pPackedEntity->m_pClientClass );
 
@@ -1385,9 +1382,11 @@ const char* CBaseServer::UncompressPackedEntity(PackedEntity *pPackedEntity, int
 		&newBuf,
 		&outBuf );
 
-	bits = pdc->bits = outBuf.GetNumBitsWritten();
+	bits = outBuf.GetNumBitsWritten();
+
+	framesnapshotmanager->AddCachedUncompressedEntity( pPackedEntity, pUnpacked, bits );
 		
-	return pdc->data;
+	return pUnpacked;
 }
 
 /*
@@ -102,7 +102,8 @@ public: // IServer implementation
 
 	virtual void	DisconnectClient(IClient *client, const char *reason );
 	
-	virtual void	WriteDeltaEntities( CBaseClient *client, CClientFrame *to, CClientFrame *from,	bf_write &pBuf );
+	// returns the number of entities written with all props, those depend on the client baseline
+	virtual int		WriteDeltaEntities( CBaseClient *client, CClientFrame *to, CClientFrame *from,	bf_write &pBuf );
 	virtual void	WriteTempEntities( CBaseClient *client, CFrameSnapshot *to, CFrameSnapshot *from, bf_write &pBuf, int nMaxEnts );
 	
 public: // IConnectionlessPacketHandler implementation
@@ -127,7 +128,7 @@ public: // IConnectionlessPacketHandler implementation
 	void	SendPendingServerInfo(void);
 
 	const char	*CompressPackedEntity(ServerClass *pServerClass, const char *data, int &bits);
-	const char	*UncompressPackedEntity(PackedEntity *pPackedEntity, int &size);
+	const char	*UncompressPackedEntity(PackedEntity *pPackedEntity, int &size, char *pUnpacked); // pUnpacked holds MAX_PACKEDENTITY_DATA
 
 	INetworkStringTable *GetInstanceBaselineTable( void );
 	INetworkStringTable *GetLightStyleTable( void );
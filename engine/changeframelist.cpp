@@ -7,81 +7,304 @@
 
 #include "basetypes.h"
 #include "changeframelist.h"
-#include "dt.h"
-#include "utlvector.h"
+#include "dt_common.h"
+#include "bitvec.h"
+#include "mathlib/ssemath.h"
+#include "tier0/memalloc.h"
+#include "tier0/threadtools.h"
 
 // memdbgon must be the last include file in a .cpp file!!!
 #include "tier0/memdbgon.h"
 
 
-class CChangeFrameList : public IChangeFrameList
+// Number of per-tick change masks remembered for each entity. Clients almost always
+// ack a tick inside this window, older ticks fall back to scanning the tick array.
+#define CHANGEFRAME_HISTORY		16
+
+// Masks are padded to whole fltx4s so they can be merged 4 ints at a time.
+#define CHANGEFRAME_MASK_ALIGN	4
+
+
+//-----------------------------------------------------------------------------
+// Change state of a CChangeFrameList. It is shared between copies of a list
+// and only duplicated when one of them records new changes.
+//
+// Three levels are kept:
+//  - m_nMaxTick, the newest tick any property changed at, so entities that did
+//    not change since the requested tick are rejected without touching props.
+//  - a ring of per-tick changed-prop masks for the most recent change ticks.
+//  - the last change tick of every property, used when the requested tick is
+//    older than the mask history.
+//-----------------------------------------------------------------------------
+class CChangeFrameData
 {
 public:
+	static CChangeFrameData *Alloc( int nProperties, int iCurTick );
+	CChangeFrameData	*Clone() const;
 
-	void	Init( int nProperties, int iCurTick )
+	void	AddRef()			{ ++m_nRefs; }
+	void	Release()			{ if ( --m_nRefs == 0 ) MemAlloc_FreeAligned( this ); }
+	bool	IsShared() const	{ return m_nRefs > 1; }
+
+	uint32	*GetMask( int iSlot )		{ return m_pMasks + iSlot * m_nMaskInts; }
+	const uint32 *GetMask( int iSlot ) const	{ return m_pMasks + iSlot * m_nMaskInts; }
+
+	void	SetChangeTick( const int *pPropIndices, int nPropIndices, const int iTick );
+	int		GetPropsChangedAfterTick( int iTick, int *iOutProps, int nMaxOutProps ) const;
+
+private:
+	static int	ComputeSize( int nProperties, int nMaskInts );
+	void		SetupPointers();
+	int			ScanTicks( int iTick, int *iOutProps ) const;
+	int			ScanMask( const uint32 *pMask, int *iOutProps ) const;
+
+public:
+	CInterlockedInt	m_nRefs;
+	int			m_nProps;
+	int			m_nMaskInts;		// ints per mask, multiple of CHANGEFRAME_MASK_ALIGN
+	int			m_nMaxTick;			// newest change tick of any property
+	int			m_nHistoryFloor;	// every change newer than this tick is in the mask history
+	int			m_nHistory;			// number of valid history slots
+	int			m_iHistoryHead;		// slot holding the newest mask
+	int			m_HistoryTicks[CHANGEFRAME_HISTORY];
+
+	uint32		*m_pMasks;			// CHANGEFRAME_HISTORY masks, 16 byte aligned
+	int			*m_pTicks;			// last change tick for each property
+};
+
+
+int CChangeFrameData::ComputeSize( int nProperties, int nMaskInts )
+{
+	int nHeader = AlignValue( (int)sizeof( CChangeFrameData ), 16 );
+	return nHeader + CHANGEFRAME_HISTORY * nMaskInts * sizeof( uint32 ) + nProperties * sizeof( int );
+}
+
+void CChangeFrameData::SetupPointers()
+{
+	m_pMasks = (uint32*)( (byte*)this + AlignValue( (int)sizeof( CChangeFrameData ), 16 ) );
+	m_pTicks = (int*)( m_pMasks + CHANGEFRAME_HISTORY * m_nMaskInts );
+}
+
+CChangeFrameData *CChangeFrameData::Alloc( int nProperties, int iCurTick )
+{
+	int nMaskInts = AlignValue( ( nProperties + 31 ) >> 5, CHANGEFRAME_MASK_ALIGN );
+	nMaskInts = MAX( nMaskInts, CHANGEFRAME_MASK_ALIGN );
+
+	CChangeFrameData *pData = (CChangeFrameData*)MemAlloc_AllocAligned( ComputeSize( nProperties, nMaskInts ), 16 );
+	pData->m_nRefs = 1;
+	pData->m_nProps = nProperties;
+	pData->m_nMaskInts = nMaskInts;
+	pData->m_nMaxTick = iCurTick;
+	pData->m_nHistoryFloor = iCurTick;
+	pData->m_nHistory = 0;
+	pData->m_iHistoryHead = 0;
+	pData->SetupPointers();
+
+	for ( int i=0; i < nProperties; i++ )
+		pData->m_pTicks[i] = iCurTick;
+
+	return pData;
+}
+
+CChangeFrameData *CChangeFrameData::Clone() const
+{
+	int nSize = ComputeSize( m_nProps, m_nMaskInts );
+
+	CChangeFrameData *pData = (CChangeFrameData*)MemAlloc_AllocAligned( nSize, 16 );
+	memcpy( pData, this, nSize );
+	pData->m_nRefs = 1;
+	pData->SetupPointers();
+	return pData;
+}
+
+void CChangeFrameData::SetChangeTick( const int *pPropIndices, int nPropIndices, const int iTick )
+{
+	Assert( !IsShared() );
+
+	if ( m_nHistory > 0 && iTick < m_HistoryTicks[m_iHistoryHead] )
 	{
-		m_ChangeTicks.SetSize( nProperties );
-		for ( int i=0; i < nProperties; i++ )
-			m_ChangeTicks[i] = iCurTick;
+		// ticks went backwards, the masks can't describe that. Forget them,
+		// every query older than m_nMaxTick falls back to the tick array.
+		m_nHistoryFloor = m_nMaxTick;
+		m_nHistory = 0;
 	}
 
+	uint32 *pMask;
+	if ( m_nHistory > 0 && m_HistoryTicks[m_iHistoryHead] == iTick )
+	{
+		// more changes for the newest tick
+		pMask = GetMask( m_iHistoryHead );
+	}
+	else
+	{
+		if ( m_nHistory == CHANGEFRAME_HISTORY )
+		{
+			// recycle the oldest mask, changes up to its tick are only in m_pTicks now
+			int iOldest = ( m_iHistoryHead + 1 ) % CHANGEFRAME_HISTORY;
+			m_nHistoryFloor = MAX( m_nHistoryFloor, m_HistoryTicks[iOldest] );
+			--m_nHistory;
+		}
 
-// IChangeFrameList implementation.
-public:
+		m_iHistoryHead = ( m_iHistoryHead + 1 ) % CHANGEFRAME_HISTORY;
+		m_HistoryTicks[m_iHistoryHead] = iTick;
+		++m_nHistory;
 
-	virtual void	Release()
+		pMask = GetMask( m_iHistoryHead );
+		memset( pMask, 0, m_nMaskInts * sizeof( uint32 ) );
+	}
+
+	for ( int i=0; i < nPropIndices; i++ )
 	{
-		delete this;
+		int iProp = pPropIndices[i];
+		Assert( iProp >= 0 && iProp < m_nProps );
+
+		m_pTicks[iProp] = iTick;
+		pMask[iProp >> 5] |= ( 1u << ( iProp & 31 ) );
 	}
 
-	virtual IChangeFrameList* Copy()
+	m_nMaxTick = MAX( m_nMaxTick, iTick );
+}
+
+int CChangeFrameData::ScanTicks( int iTick, int *iOutProps ) const
+{
+	int nOutProps = 0;
+
+	for ( int i=0; i < m_nProps; i++ )
 	{
-		CChangeFrameList *pRet = new CChangeFrameList;
+		if ( m_pTicks[i] > iTick )
+		{
+			iOutProps[nOutProps] = i;
+			++nOutProps;
+		}
+	}
 
-		int numProps = m_ChangeTicks.Count();
+	return nOutProps;
+}
 
-		pRet->m_ChangeTicks.SetSize( numProps );
+int CChangeFrameData::ScanMask( const uint32 *pMask, int *iOutProps ) const
+{
+	int nOutProps = 0;
 
-		for ( int i=0; i < numProps; i++ )
+	for ( int i=0; i < m_nMaskInts; i += CHANGEFRAME_MASK_ALIGN )
+	{
+		// skip 128 unchanged props at once
+		if ( !( pMask[i] | pMask[i+1] | pMask[i+2] | pMask[i+3] ) )
+			continue;
+
+		for ( int j = i; j < i + CHANGEFRAME_MASK_ALIGN; j++ )
 		{
-			pRet->m_ChangeTicks[ i ] = m_ChangeTicks[ i ];
+			uint32 nBits = pMask[j];
+			while ( nBits )
+			{
+				iOutProps[nOutProps++] = FirstBitInWord( nBits, j << 5 );
+				nBits &= nBits - 1;
+			}
 		}
+	}
 
-		return pRet;
+	return nOutProps;
+}
 
+int CChangeFrameData::GetPropsChangedAfterTick( int iTick, int *iOutProps, int nMaxOutProps ) const
+{
+	// summary level, nothing changed since iTick
+	if ( iTick >= m_nMaxTick )
+		return 0;
+
+	Assert( m_nProps <= nMaxOutProps );
+
+	if ( iTick < m_nHistoryFloor )
+	{
+		// older than the mask history
+		return ScanTicks( iTick, iOutProps );
 	}
 
-	virtual int		GetNumProps()
+	// collect the masks of all ticks newer than iTick, newest first
+	int iSlot = m_iHistoryHead;
+	int nSlots = 0;
+	const uint32 *pSlotMasks[CHANGEFRAME_HISTORY];
+
+	for ( int i=0; i < m_nHistory && m_HistoryTicks[iSlot] > iTick; i++ )
 	{
-		return m_ChangeTicks.Count();
+		pSlotMasks[nSlots++] = GetMask( iSlot );
+		iSlot = ( iSlot + CHANGEFRAME_HISTORY - 1 ) % CHANGEFRAME_HISTORY;
 	}
 
-	virtual void	SetChangeTick( const int *pPropIndices, int nPropIndices, const int iTick )
+	Assert( nSlots > 0 );
+
+	if ( nSlots == 1 )
 	{
-		for ( int i=0; i < nPropIndices; i++ )
+		// client acked the previous change, the common case
+		return ScanMask( pSlotMasks[0], iOutProps );
+	}
+
+	ALIGN16 uint32 changed[ MAX_DATATABLE_PROPS / 32 ] ALIGN16_POST;
+	Assert( m_nMaskInts <= ARRAYSIZE( changed ) );
+
+	for ( int i=0; i < m_nMaskInts; i += CHANGEFRAME_MASK_ALIGN )
+	{
+		fltx4 merged = LoadAlignedSIMD( pSlotMasks[0] + i );
+		for ( int j=1; j < nSlots; j++ )
 		{
-			m_ChangeTicks[ pPropIndices[i] ] = iTick;
+			merged = OrSIMD( merged, LoadAlignedSIMD( pSlotMasks[j] + i ) );
 		}
+		StoreAlignedSIMD( (float*)( changed + i ), merged );
 	}
 
-	virtual int		GetPropsChangedAfterTick( int iTick, int *iOutProps, int nMaxOutProps )
+	return ScanMask( changed, iOutProps );
+}
+
+
+class CChangeFrameList : public IChangeFrameList
+{
+public:
+
+	void	Init( int nProperties, int iCurTick )
 	{
-		int nOutProps = 0;
+		m_pData = CChangeFrameData::Alloc( nProperties, iCurTick );
+	}
+
+
+// IChangeFrameList implementation.
+public:
+
+	virtual void	Release()
+	{
+		delete this;
+	}
+
+	virtual IChangeFrameList* Copy()
+	{
+		// copies share the change data until one of them changes
+		CChangeFrameList *pRet = new CChangeFrameList;
+		pRet->m_pData = m_pData;
+		m_pData->AddRef();
+		return pRet;
+	}
 
-		int c = m_ChangeTicks.Count();
-		
-		Assert( c <= nMaxOutProps );
+	virtual int		GetNumProps()
+	{
+		return m_pData->m_nProps;
+	}
+
+	virtual void	SetChangeTick( const int *pPropIndices, int nPropIndices, const int iTick )
+	{
+		if ( nPropIndices == 0 )
+			return;
 
-		for ( int i=0; i < c; i++ )
+		if ( m_pData->IsShared() )
 		{
-			if ( m_ChangeTicks[i] > iTick )
-			{
-				iOutProps[nOutProps] = i;
-				++nOutProps;
-			}
+			CChangeFrameData *pData = m_pData->Clone();
+			m_pData->Release();
+			m_pData = pData;
 		}
 
-		return nOutProps;
+		m_pData->SetChangeTick( pPropIndices, nPropIndices, iTick );
+	}
+
+	virtual int		GetPropsChangedAfterTick( int iTick, int *iOutProps, int nMaxOutProps )
+	{
+		return m_pData->GetPropsChangedAfterTick( iTick, iOutProps, nMaxOutProps );
 	}
 
 // IChangeFrameList implementation.
@@ -89,11 +312,11 @@ protected:
 
 	virtual			~CChangeFrameList()
 	{
+		m_pData->Release();
 	}
 
 private:
-	// Change frames for each property.
-	CUtlVector<int>		m_ChangeTicks;
+	CChangeFrameData	*m_pData;
 };
 
 
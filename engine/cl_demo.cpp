@@ -838,6 +838,8 @@ void CDemoPlayer::StopPlayback( void )
 	demoaction->StopPlaying();
 
 	m_DemoFile.Close();
+	m_Keyframes.RemoveAll();
+	m_nPendingKeyframe = -1;
 	m_bPlayingBack = false;
 	m_bLoading = false;
 	m_bPlaybackPaused = false;
@@ -924,7 +926,31 @@ void CDemoPlayer::SkipToTick( int tick, bool bRelative, bool bPause )
 	if ( tick < 0 )
 		return;
 
-	if ( tick < GetPlaybackTick() )
+	// use the closest keyframe at or before tick if it saves reading the stream
+	int iKeyframe = -1;
+	if ( cl.IsActive() )
+	{
+		FOR_EACH_VEC( m_Keyframes, i )
+		{
+			if ( m_Keyframes[i].tick > tick )
+				break;
+
+			iKeyframe = i;
+		}
+
+		if ( iKeyframe != -1 && tick >= GetPlaybackTick() && m_Keyframes[iKeyframe].tick <= GetPlaybackTick() )
+		{
+			// already past it
+			iKeyframe = -1;
+		}
+	}
+
+	if ( iKeyframe != -1 )
+	{
+		ETWMark1I( "DemoPlayer: Seeking to keyframe", m_Keyframes[iKeyframe].tick );
+		m_nPendingKeyframe = iKeyframe;
+	}
+	else if ( tick < GetPlaybackTick() )
 	{
 		// we have to reload the whole demo file
 		// we need to create a temp copy of the filename
@@ -1080,6 +1106,85 @@ bool CDemoPlayer::ParseAheadForInterval( int curtick, int intervalticks )
 // Purpose: Read in next demo message and send to local client over network channel, if it's time.
 // Output : netpacket_t* -- NULL if there is no packet available at this time.
 //-----------------------------------------------------------------------------
+bool CDemoPlayer::ReadDemoStringTables( void )
+{
+	bool bOk = false;
+	void *data = NULL;
+	int dataLen = 512 * 1024;
+	while ( dataLen <= DEMO_FILE_MAX_STRINGTABLE_SIZE )
+	{
+		data = realloc( data, dataLen );
+		bf_read buf( "dem_stringtables", data, dataLen );
+		// did we successfully read
+		if ( m_DemoFile.ReadStringTables( &buf ) > 0 )
+		{
+			buf.Seek( 0 );
+			if ( !networkStringTableContainerClient->ReadStringTables( buf ) )
+			{
+				Host_Error( "Error parsing string tables during demo playback." );
+			}
+			bOk = true;
+			break;
+		}
+
+		// Didn't fit.  Try doubling the size of the buffer
+		dataLen *= 2;
+	}
+
+	if ( dataLen > DEMO_FILE_MAX_STRINGTABLE_SIZE )
+	{
+		Warning( "ReadPacket failed to read string tables. Trying to read string tables that's bigger than max string table size\n" );
+	}
+
+	free( data );
+	return bOk;
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Restores the pending keyframe: full string tables and a non-delta
+//			entity packet, then moves the read position behind the packet
+//			the keyframe was taken at.
+// Output : true if m_DemoPacket holds the keyframe packet
+//-----------------------------------------------------------------------------
+bool CDemoPlayer::ReadKeyframe( void )
+{
+	const demoindexentry_t &keyframe = m_Keyframes[ m_nPendingKeyframe ];
+	m_nPendingKeyframe = -1;
+
+	int curpos = m_DemoFile.GetCurPos( true );
+
+	m_DemoFile.SeekTo( keyframe.keyframepos, true );
+
+	if ( !ReadDemoStringTables() )
+	{
+		m_DemoFile.SeekTo( curpos, true );
+		return false;
+	}
+
+	int length = m_DemoFile.ReadRawData( (char*)m_DemoPacket.data, NET_MAX_PAYLOAD );
+
+	m_DemoFile.SeekTo( keyframe.streampos, true );
+
+	// skipping goes on from the keyframe tick
+	m_nStartTick = host_tickcount - keyframe.tick;
+	m_bResetInterpolation = true;
+
+	cl.m_NetChannel->SetSequenceData( 0, keyframe.sequence, keyframe.sequence );
+
+	if ( demo_debug.GetBool() )
+	{
+		Msg( "%d keyframe [%d]\n", keyframe.tick, length );
+	}
+
+	if ( length <= 0 )
+		return false;
+
+	m_DemoPacket.received = realtime;
+	m_DemoPacket.size = length;
+	m_DemoPacket.message.StartReading( m_DemoPacket.data, m_DemoPacket.size );
+	return true;
+}
+
 netpacket_t *CDemoPlayer::ReadPacket( void )
 {
 	int			tick = 0;
@@ -1118,6 +1223,10 @@ netpacket_t *CDemoPlayer::ReadPacket( void )
 		m_nSkipPacketsPlayed = 0;
 	}
 
+	// restore a keyframe SkipToTick picked, reading continues after it
+	if ( m_nPendingKeyframe != -1 && ReadKeyframe() )
+		return &m_DemoPacket;
+
 	// External editor has paused playback
 	if ( CheckPausedPlayback() )
 		return NULL;
@@ -1244,33 +1353,7 @@ netpacket_t *CDemoPlayer::ReadPacket( void )
 			break;
 		case dem_stringtables:
 			{
-				void *data = NULL;
-				int dataLen = 512 * 1024;
-				while ( dataLen <= DEMO_FILE_MAX_STRINGTABLE_SIZE )
-				{
-					data = realloc( data, dataLen );
-					bf_read buf( "dem_stringtables", data, dataLen );
-					// did we successfully read
-					if ( m_DemoFile.ReadStringTables( &buf ) > 0 )
-					{
-						buf.Seek( 0 );
-						if ( !networkStringTableContainerClient->ReadStringTables( buf ) )
-						{
-							Host_Error( "Error parsing string tables during demo playback." );
-						}
-						break;
-					}
-
-					// Didn't fit.  Try doubling the size of the buffer
-					dataLen *= 2;
-				}
-
-				if ( dataLen > DEMO_FILE_MAX_STRINGTABLE_SIZE )
-				{
-					Warning( "ReadPacket failed to read string tables. Trying to read string tables that's bigger than max string table size\n" );
-				}
-
-				free( data );
+				ReadDemoStringTables();
 			}
 			break;
 		case dem_usercmd:
@@ -1621,6 +1704,7 @@ CDemoPlayer::CDemoPlayer()
 	m_bPlaybackPaused = false;
 	m_nSkipToTick = -1;
 	m_nSkipPacketsPlayed = 0;
+	m_nPendingKeyframe = -1;
 	m_nSnapshotTick = 0;
 	m_SnapshotFilename[0] = 0;
 	m_bResetInterpolation = false;
@@ -1669,6 +1753,10 @@ bool CDemoPlayer::StartPlayback( const char *filename, bool bAsTimeDemo )
 		cl.demonum = -1;
 		return false;
 	}
+
+	// seek index written by SourceTV, optional
+	m_nPendingKeyframe = -1;
+	m_DemoFile.ReadDemoIndex( m_Keyframes );
 	
 	ConMsg ("Playing demo from %s.\n", filename);
 
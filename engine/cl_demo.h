@@ -57,7 +57,7 @@ public: // IDemoPlayer interface implementation:
 	virtual bool	IsPlaybackPaused( void );
 	virtual bool	IsPlayingTimeDemo( void );
 	virtual bool	IsSkipping( void );
-	virtual bool	CanSkipBackwards( void ) { return false; }
+	virtual bool	CanSkipBackwards( void ) { return m_Keyframes.Count() > 0; }
 	
 	virtual void	SetPlaybackTimeScale( float timescale );
 	virtual void	InterpolateViewpoint(); // override viewpoint
@@ -81,6 +81,8 @@ public:	// other public functions
 
 protected:
 	bool	OverrideView( democmdinfo_t& info );
+	bool	ReadDemoStringTables( void );
+	bool	ReadKeyframe( void );
 
 	virtual void	OnStopCommand();
 
@@ -100,6 +102,9 @@ public:
 
 	unsigned		m_nSkipPacketsPlayed; // Track consecutive skip packets returned to avoid excess
 
+	CUtlVector<demoindexentry_t> m_Keyframes;	// seek index, empty if the demo has none
+	int				m_nPendingKeyframe;	// keyframe to restore before the next packet, -1 = none
+
 	// view origin/angle interpolation:
 	CUtlVector< DemoCommandQueue >	m_DestCmdInfo;
 	democmdinfo_t					m_LastCmdInfo;
@@ -485,6 +485,97 @@ void CDemoFile::WriteFileBytes( FileHandle_t fh, int length )
 	g_pFileSystem->Flush ( fh );
 }
 
+//-----------------------------------------------------------------------------
+// Purpose: Appends the seek index and its footer at the current write position
+//-----------------------------------------------------------------------------
+void CDemoFile::WriteDemoIndex( const CUtlVector<demoindexentry_t> &index )
+{
+	DemoFileDbg( "WriteDemoIndex()\n" );
+	Assert( m_pBuffer && m_pBuffer->IsValid() );
+
+	demoindexfooter_t footer;
+	Q_memset( &footer, 0, sizeof(footer) );
+	footer.numkeyframes = index.Count();
+	footer.indexpos = m_pBuffer->TellPut();
+	Q_strncpy( footer.indexfilestamp, DEMO_INDEX_ID, sizeof(footer.indexfilestamp) );
+
+	for ( int i = 0; i < index.Count(); i++ )
+	{
+		m_pBuffer->PutInt( index[i].tick );
+		m_pBuffer->PutInt( index[i].keyframepos );
+		m_pBuffer->PutInt( index[i].streampos );
+		m_pBuffer->PutInt( index[i].sequence );
+	}
+
+	m_pBuffer->PutInt( footer.numkeyframes );
+	m_pBuffer->PutInt( footer.indexpos );
+	m_pBuffer->Put( footer.indexfilestamp, sizeof(footer.indexfilestamp) );
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Reads the seek index from the end of the file, returns false if
+//			there is none. Doesn't move the read position.
+//-----------------------------------------------------------------------------
+bool CDemoFile::ReadDemoIndex( CUtlVector<demoindexentry_t> &index )
+{
+	index.RemoveAll();
+
+	if ( !m_pBuffer || !m_pBuffer->IsValid() )
+		return false;
+
+	int nSize = GetSize();
+	int nFooterPos = nSize - (int)sizeof(demoindexfooter_t);
+
+	if ( nFooterPos < (int)sizeof(demoheader_t) )
+		return false;
+
+	int nReadPos = m_pBuffer->TellGet();
+
+	demoindexfooter_t footer;
+	m_pBuffer->SeekGet( CUtlBuffer::SEEK_HEAD, nFooterPos );
+	footer.numkeyframes = m_pBuffer->GetInt();
+	footer.indexpos = m_pBuffer->GetInt();
+	m_pBuffer->Get( footer.indexfilestamp, sizeof(footer.indexfilestamp) );
+
+	bool bOk = m_pBuffer->IsValid() &&
+		!Q_strncmp( footer.indexfilestamp, DEMO_INDEX_ID, sizeof(footer.indexfilestamp) ) &&
+		footer.numkeyframes >= 0 &&
+		footer.indexpos >= (int)sizeof(demoheader_t) &&
+		footer.indexpos + footer.numkeyframes * 4 * (int)sizeof(int) == nFooterPos;
+
+	if ( bOk )
+	{
+		m_pBuffer->SeekGet( CUtlBuffer::SEEK_HEAD, footer.indexpos );
+		index.SetCount( footer.numkeyframes );
+
+		for ( int i = 0; i < footer.numkeyframes; i++ )
+		{
+			index[i].tick = m_pBuffer->GetInt();
+			index[i].keyframepos = m_pBuffer->GetInt();
+			index[i].streampos = m_pBuffer->GetInt();
+			index[i].sequence = m_pBuffer->GetInt();
+
+			if ( index[i].keyframepos < (int)sizeof(demoheader_t) || index[i].keyframepos >= footer.indexpos ||
+				 index[i].streampos < (int)sizeof(demoheader_t) || index[i].streampos >= footer.indexpos ||
+				 ( i > 0 && index[i].tick < index[i-1].tick ) )
+			{
+				bOk = false;
+				break;
+			}
+		}
+
+		bOk = bOk && m_pBuffer->IsValid();
+	}
+
+	if ( !bOk )
+	{
+		index.RemoveAll();
+	}
+
+	m_pBuffer->SeekGet( CUtlBuffer::SEEK_HEAD, nReadPos );
+	return bOk;
+}
+
 bool CDemoFile::Open(const char *name, bool bReadOnly, bool bMemoryBuffer, int nBufferSize/*=0*/, bool bAllowHeaderWrite/*=true*/)
 {
 	if ( m_pBuffer && m_pBuffer->IsValid() )
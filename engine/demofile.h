@@ -75,6 +75,10 @@ public:
 
 	void	WriteFileBytes( FileHandle_t fh, int length );
 
+	// seek index after dem_stop, see demoformat.h
+	void	WriteDemoIndex( const CUtlVector<demoindexentry_t> &index );
+	bool	ReadDemoIndex( CUtlVector<demoindexentry_t> &index );
+
 	// Returns the PROTOCOL_VERSION used when .dem was recorded
 	int		GetProtocolVersion();
 public:
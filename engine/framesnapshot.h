@@ -12,6 +12,8 @@
 
 #include <mempool.h>
 #include <utllinkedlist.h>
+#include <utlhashtable.h>
+#include <generichash.h>
 
 
 class PackedEntity;
@@ -19,6 +21,7 @@ class HLTVEntityData;
 class ReplayEntityData;
 class ServerClass;
 class CEventInfo;
+class bf_write;
 
 #define INVALID_PACKED_ENTITY_HANDLE (0)
 typedef intptr_t PackedEntityHandle_t;
@@ -51,13 +54,75 @@ public:
 	unsigned int	m_nNodeCluster;  // if (1<<31) is set it's a node, otherwise a cluster
 };
 
-typedef struct
+#define INVALID_UNPACKED_CACHE_INDEX ((unsigned short)~0)
+
+struct UnpackedDataCache_t
 {
 	PackedEntity	*pEntity;	// original packed entity
-	int				counter;	// increaseing counter to find LRU entries
 	int				bits;		// uncompressed data length in bits
-	char			data[MAX_PACKEDENTITY_DATA]; // uncompressed data cache
-} UnpackedDataCache_t;
+	unsigned short	nPrev;		// LRU list, towards the most recently used entry
+	unsigned short	nNext;		// LRU list, towards the least recently used entry
+	CUtlMemory<char> data;		// uncompressed data cache
+};
+
+//-----------------------------------------------------------------------------
+// Purpose: Identifies one encoded entity delta. Clients that delta the same pair
+//  of packed entities from the same tick and with the same proxy recipient
+//  state get exactly the same prop bits.
+//-----------------------------------------------------------------------------
+struct EntityDeltaKey_t
+{
+	PackedEntity	*m_pOldPack;
+	PackedEntity	*m_pNewPack;
+	int				m_nFromTick;
+	unsigned int	m_nRecipientBits;	// client's bit of each recipient proxy in both packs
+};
+
+struct EntityDeltaKeyHashFunctor
+{
+	unsigned int operator()( const EntityDeltaKey_t &key ) const { return HashItem( key ); }
+};
+
+struct EntityDeltaKeyEqualFunctor
+{
+	bool operator()( const EntityDeltaKey_t &a, const EntityDeltaKey_t &b ) const
+	{
+		return a.m_pOldPack == b.m_pOldPack && a.m_pNewPack == b.m_pNewPack &&
+			a.m_nFromTick == b.m_nFromTick && a.m_nRecipientBits == b.m_nRecipientBits;
+	}
+};
+
+//-----------------------------------------------------------------------------
+// Purpose: Entity delta bits written for a snapshot, shared by all clients that
+//  receive it. Entries are never moved, so the returned bits can be read
+//  without holding the lock.
+//-----------------------------------------------------------------------------
+class CEntityDeltaMemo
+{
+public:
+	CEntityDeltaMemo();
+	~CEntityDeltaMemo();
+
+	// Returns false if this delta wasn't written yet
+	bool	FindDeltaBits( const EntityDeltaKey_t &key, const unsigned char *&pData, int &nBits );
+
+	// Copies nBits written to pBuffer after nStartBit
+	void	AddDeltaBits( const EntityDeltaKey_t &key, bf_write *pBuffer, int nStartBit, int nBits );
+
+	void	Purge();
+
+private:
+	struct DeltaBits_t
+	{
+		unsigned char	*m_pData;
+		int				m_nBits;
+	};
+
+	CUtlHashtable<EntityDeltaKey_t, DeltaBits_t, EntityDeltaKeyHashFunctor, EntityDeltaKeyEqualFunctor> m_Entries;
+	CUtlVector<unsigned char*>	m_Blocks;
+	int							m_nBlockUsed;	// bytes used in the last block
+	CThreadFastMutex			m_Mutex;
+};
 
 
 
@@ -105,6 +170,9 @@ public:
 
 	CUtlVector<int>			m_iExplicitDeleteSlots;
 
+	// Entity deltas written while sending this snapshot
+	CEntityDeltaMemo		m_DeltaMemo;
+
 private:
 
 	// Snapshots auto-delete themselves when their refcount goes to zero.
@@ -155,22 +223,46 @@ public:
 
 	PackedEntity*	GetPreviouslySentPacket( int iEntity, int iSerialNumber );
 
-	// Return the entity sitting in iEntity's slot if iSerialNumber matches its number.
-	UnpackedDataCache_t *GetCachedUncompressedEntity( PackedEntity *pPackedEntity );
+	// Copies the cached uncompressed data of a packed entity into pData, returns false if it isn't cached.
+	bool			GetCachedUncompressedEntity( PackedEntity *pPackedEntity, char *pData, int &bits );
+
+	// Stores the uncompressed data of a packed entity, replacing the least recently used entry.
+	void			AddCachedUncompressedEntity( PackedEntity *pPackedEntity, const char *pData, int bits );
 
 	CThreadFastMutex	&GetMutex();
 
 	// List of entities to explicitly delete
 	void			AddExplicitDelete( int iSlot );
 
+	// While deletes are deferred, snapshots whose last reference is released are
+	// queued instead of freed, so parallel snapshot writers can keep walking the
+	// snapshot list. Must be called from the main thread.
+	void			BeginDeferredDeletes();
+	void			EndDeferredDeletes();
+
 private:
 	void	DeleteFrameSnapshot( CFrameSnapshot* pSnapshot );
+	void	ReleaseFrameSnapshot( CFrameSnapshot* pSnapshot );
+
+	// Unpacked entity cache helpers, m_PackedEntityCacheMutex must be held
+	void	ResetPackedEntityCache( int nEntries );
+	void	UnlinkPackedEntityCache( int iEntry );
+	void	LinkPackedEntityCacheHead( int iEntry );
+	void	RemoveCachedUncompressedEntity( PackedEntity *pPackedEntity );
 
 	CUtlLinkedList<CFrameSnapshot*, unsigned short>		m_FrameSnapshots;
+	CThreadFastMutex				m_FrameSnapshotsMutex;	// guards m_FrameSnapshots and m_DeferredDeletes
+
+	int								m_nDeferDeletes;
+	CUtlVector<CFrameSnapshot*>		m_DeferredDeletes;
 	CClassMemoryPool< PackedEntity >					m_PackedEntitiesPool;
 
-	int								m_nPackedEntityCacheCounter;  // increase with every cache access
-	CUtlVector<UnpackedDataCache_t>	m_PackedEntityCache;	// cache for uncompressed packed entities
+	// cache for uncompressed packed entities, hashed by packed entity and kept in LRU order
+	CUtlVector<UnpackedDataCache_t>	m_PackedEntityCache;
+	CUtlHashtable<PackedEntity*, unsigned short, PointerHashFunctor, PointerEqualFunctor> m_PackedEntityCacheIndex;
+	unsigned short					m_nPackedEntityCacheHead;	// most recently used
+	unsigned short					m_nPackedEntityCacheTail;	// least recently used
+	CThreadFastMutex				m_PackedEntityCacheMutex;
 
 	// The most recently sent packets for each entity
 	PackedEntityHandle_t	m_pPackedData[ MAX_EDICTS ];
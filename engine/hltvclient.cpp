@@ -470,18 +470,32 @@ void CHLTVClient::SendSnapshot( CClientFrame * pFrame )
 		pLastFrame = (CHLTVFrame*) pLastFrame->m_pNext;
 	}
 
-	// now create client snapshot packet
+	// now create client snapshot packet, spectators with the same delta state get the same one
 
-	// send tick time
-	NET_Tick tickmsg( pFrame->tick_count, host_frametime_unbounded, host_frametime_stddeviation );
-	tickmsg.WriteToBuffer( msg );
+	const CSnapshotCacheEntry_s *pCachedSnapshot = ( pDeltaFrame && !IsTracing() ) ? m_pHLTV->FindCachedSnapshot( this, pDeltaFrame->tick_count ) : NULL;
 
-	// Update shared client/server string tables. Must be done before sending entities
-	m_Server->m_StringTables->WriteUpdateMessage( NULL, GetMaxAckTickCount(), msg );
+	if ( pCachedSnapshot )
+	{
+		msg.WriteBits( pCachedSnapshot->pData, pCachedSnapshot->nBits );
+	}
+	else
+	{
+		// send tick time
+		NET_Tick tickmsg( pFrame->tick_count, host_frametime_unbounded, host_frametime_stddeviation );
+		tickmsg.WriteToBuffer( msg );
+
+		// Update shared client/server string tables. Must be done before sending entities
+		m_Server->m_StringTables->WriteUpdateMessage( NULL, GetMaxAckTickCount(), msg );
 
-	// TODO delta cache whole snapshots, not just packet entities. then use net_Align
-	// send entity update, delta compressed if deltaFrame != NULL
-	m_Server->WriteDeltaEntities( this, pFrame, pDeltaFrame, msg );
+		// send entity update, delta compressed if deltaFrame != NULL
+		int nFullProps = m_Server->WriteDeltaEntities( this, pFrame, pDeltaFrame, msg );
+
+		// entities written with all props depend on this client's baselines
+		if ( pDeltaFrame && nFullProps == 0 && !IsTracing() )
+		{
+			m_pHLTV->AddCachedSnapshot( this, pDeltaFrame->tick_count, msg );
+		}
+	}
 
 	// write message to packet and check for overflow
 	if ( msg.IsOverflowed() )
@@ -731,10 +731,11 @@ void CHLTVClientState::ReadDeltaEnt( CEntityReadInfo &u )
 	ALIGN4 char packedData[MAX_PACKEDENTITY_DATA] ALIGN4_POST;
 	const void *pFromData;
 	int nFromBits;
+	ALIGN4 char unpackedData[MAX_PACKEDENTITY_DATA] ALIGN4_POST;
 
 	if ( pFromPackedEntity->IsCompressed() )
 	{
-		pFromData = m_pHLTV->UncompressPackedEntity( pFromPackedEntity, nFromBits );
+		pFromData = m_pHLTV->UncompressPackedEntity( pFromPackedEntity, nFromBits, unpackedData );
 	}
 	else
 	{
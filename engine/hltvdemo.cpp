@@ -30,6 +30,8 @@
 
 extern CNetworkStringTableContainer *networkStringTableContainerServer;
 
+static ConVar tv_demo_keyframe_interval( "tv_demo_keyframe_interval", "30", 0, "Seconds between seek keyframes in SourceTV demos, 0 = no keyframes.", true, 0, false, 0 );
+
 //////////////////////////////////////////////////////////////////////
 // Construction/Destruction
 //////////////////////////////////////////////////////////////////////
@@ -37,6 +39,8 @@ extern CNetworkStringTableContainer *networkStringTableContainerServer;
 CHLTVDemoRecorder::CHLTVDemoRecorder()
 {
 	m_bIsRecording = false;
+	m_hKeyframeFile = FILESYSTEM_INVALID_HANDLE;
+	m_szKeyframeFileName[0] = 0;
 }
 
 CHLTVDemoRecorder::~CHLTVDemoRecorder()
@@ -106,6 +110,20 @@ void CHLTVDemoRecorder::StartRecording( const char *filename, bool bContinuously
 
 	m_SequenceInfo = 1;
 	m_nDeltaTick = -1;
+
+	m_Keyframes.RemoveAll();
+	m_nNextKeyframeTick = 0;
+
+	if ( tv_demo_keyframe_interval.GetFloat() > 0 )
+	{
+		Q_snprintf( m_szKeyframeFileName, sizeof(m_szKeyframeFileName), "%s.keyframes", filename );
+		m_hKeyframeFile = g_pFileSystem->Open( m_szKeyframeFileName, "wb" );
+
+		if ( m_hKeyframeFile == FILESYSTEM_INVALID_HANDLE )
+		{
+			ConMsg( "StartRecording: couldn't open keyframe file %s, demo won't be seekable.\n", m_szKeyframeFileName );
+		}
+	}
 }
 
 bool CHLTVDemoRecorder::IsRecording()
@@ -121,6 +139,9 @@ void CHLTVDemoRecorder::StopRecording()
 	// Demo playback should read this as an incoming message.
 	m_DemoFile.WriteCmdHeader( dem_stop, GetRecordingTick() );
 
+	// append keyframes and seek index behind dem_stop
+	WriteKeyframeIndex();
+
 	// update demo header info
 	m_DemoFile.m_DemoHeader.playback_ticks = GetRecordingTick();
 	m_DemoFile.m_DemoHeader.playback_time =  host_state.interval_per_tick *	GetRecordingTick();
@@ -248,9 +269,12 @@ void CHLTVDemoRecorder::RecordServerClasses( ServerClass *pClasses )
 	m_DemoFile.WriteNetworkDataTables( &buf, GetRecordingTick() );
 }
 
-void CHLTVDemoRecorder::RecordStringTables()
+//-----------------------------------------------------------------------------
+// Purpose: Writes all server string tables into buf, returns the buffer
+//			memory the caller has to free() or NULL if the tables don't fit
+//-----------------------------------------------------------------------------
+static void *WriteAllStringTables( bf_write &buf )
 {
-
 	// !KLUDGE! It would be nice if the bit buffer could write into a stream
 	// with the power to grow itself.  But it can't.  Hence this really bad
 	// kludge
@@ -259,29 +283,37 @@ void CHLTVDemoRecorder::RecordStringTables()
 	while ( dataLen <= DEMO_FILE_MAX_STRINGTABLE_SIZE )
 	{
 		data = realloc( data, dataLen );
-		bf_write buf( data, dataLen );
+		buf.StartWriting( data, dataLen );
 		buf.SetDebugName("CHLTVDemoRecorder_StringTables");
 		buf.SetAssertOnOverflow( false ); // Doesn't turn off all the spew / asserts, but turns off one
 		networkStringTableContainerServer->WriteStringTables( buf );
 
 		// Did we fit?
 		if ( !buf.IsOverflowed() )
-		{
-
-			// Now write the buffer into the demo file
-			m_DemoFile.WriteStringTables( &buf, GetRecordingTick() );
-			break;
-		}
+			return data;
 
 		// Didn't fit.  Try doubling the size of the buffer
 		dataLen *= 2;
 	}
 
-	if ( dataLen > DEMO_FILE_MAX_STRINGTABLE_SIZE )
+	free(data);
+	return NULL;
+}
+
+void CHLTVDemoRecorder::RecordStringTables()
+{
+	bf_write buf;
+	void *data = WriteAllStringTables( buf );
+
+	if ( !data )
 	{
 		Warning( "Failed to RecordStringTables. Trying to record string table that's bigger than max string table size\n" );
+		return;
 	}
 
+	// Now write the buffer into the demo file
+	m_DemoFile.WriteStringTables( &buf, GetRecordingTick() );
+
 	free(data);
 }
 
@@ -384,6 +416,109 @@ void CHLTVDemoRecorder::WriteFrame( CHLTVFrame *pFrame )
 
 	// write packet to demo file
 	WriteMessages( dem_packet, msg ); 
+
+	if ( m_hKeyframeFile != FILESYSTEM_INVALID_HANDLE && GetRecordingTick() >= m_nNextKeyframeTick )
+	{
+		WriteKeyframe( pFrame );
+	}
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Saves the full state after the packet just written, the string
+//			tables and a non-delta entity packet. A player seeking to this
+//			tick can restore it and continue reading right after that packet.
+//-----------------------------------------------------------------------------
+void CHLTVDemoRecorder::WriteKeyframe( CHLTVFrame *pFrame )
+{
+	m_nNextKeyframeTick = GetRecordingTick() + MAX( 1, TIME_TO_TICKS( tv_demo_keyframe_interval.GetFloat() ) );
+
+	bf_write tables;
+	void *pTableData = WriteAllStringTables( tables );
+
+	if ( !pTableData )
+		return;
+
+	ALIGN4 byte		buffer[ NET_MAX_PAYLOAD ] ALIGN4_POST;
+	bf_write	msg( "CHLTVDemo::WriteKeyframe", buffer, sizeof( buffer ) );
+	msg.SetAssertOnOverflow( false );
+
+	NET_Tick tickmsg( pFrame->tick_count, host_frametime_unbounded, host_frametime_stddeviation );
+	tickmsg.WriteToBuffer( msg );
+
+	// the keyframe must not change the baseline state the next regular packet is written with
+	CGameClient *pClient = hltv->m_MasterClient;
+	int nBaselineUpdateTick = pClient->m_nBaselineUpdateTick;
+
+	sv.WriteDeltaEntities( pClient, pFrame, NULL, msg );
+
+	pClient->m_nBaselineUpdateTick = nBaselineUpdateTick;
+
+	if ( !msg.IsOverflowed() )
+	{
+		// fill last bits in last byte with NOP, like WriteMessages
+		int nRemainingBits = msg.GetNumBitsWritten() % 8;
+		if ( nRemainingBits > 0 && nRemainingBits <= (8-NETMSG_TYPE_BITS) )
+		{
+			msg.WriteUBitLong( net_NOP, NETMSG_TYPE_BITS );
+		}
+
+		demoindexentry_t &entry = m_Keyframes[ m_Keyframes.AddToTail() ];
+		entry.tick = GetRecordingTick();
+		entry.keyframepos = g_pFileSystem->Tell( m_hKeyframeFile ); // relative until appended to the demo
+		entry.streampos = m_DemoFile.GetCurPos( false );
+		entry.sequence = m_SequenceInfo - 1;
+
+		// same layout as CDemoFile::WriteRawData
+		int len = LittleLong( tables.GetNumBytesWritten() );
+		g_pFileSystem->Write( &len, sizeof(len), m_hKeyframeFile );
+		g_pFileSystem->Write( tables.GetBasePointer(), tables.GetNumBytesWritten(), m_hKeyframeFile );
+
+		len = LittleLong( msg.GetNumBytesWritten() );
+		g_pFileSystem->Write( &len, sizeof(len), m_hKeyframeFile );
+		g_pFileSystem->Write( msg.GetBasePointer(), msg.GetNumBytesWritten(), m_hKeyframeFile );
+
+		if ( tv_debug.GetInt() > 1 )
+		{
+			Msg( "Writing SourceTV demo keyframe at tick %i, %i bytes\n", entry.tick, tables.GetNumBytesWritten() + msg.GetNumBytesWritten() );
+		}
+	}
+
+	free( pTableData );
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Moves the keyframes from the temp file into the demo and writes
+//			the index, see demoformat.h
+//-----------------------------------------------------------------------------
+void CHLTVDemoRecorder::WriteKeyframeIndex()
+{
+	if ( m_hKeyframeFile == FILESYSTEM_INVALID_HANDLE )
+		return;
+
+	g_pFileSystem->Close( m_hKeyframeFile );
+	m_hKeyframeFile = FILESYSTEM_INVALID_HANDLE;
+
+	if ( m_Keyframes.Count() )
+	{
+		FileHandle_t fh = g_pFileSystem->Open( m_szKeyframeFileName, "rb" );
+
+		if ( fh != FILESYSTEM_INVALID_HANDLE )
+		{
+			int nBase = m_DemoFile.GetCurPos( false );
+			m_DemoFile.WriteFileBytes( fh, g_pFileSystem->Size( fh ) );
+			g_pFileSystem->Close( fh );
+
+			FOR_EACH_VEC( m_Keyframes, i )
+			{
+				m_Keyframes[i].keyframepos += nBase;
+			}
+
+			m_DemoFile.WriteDemoIndex( m_Keyframes );
+		}
+	}
+
+	g_pFileSystem->RemoveFile( m_szKeyframeFileName );
+	m_Keyframes.RemoveAll();
 }
 
 void CHLTVDemoRecorder::WriteMessages( unsigned char cmd, bf_write &message )
@@ -53,6 +53,9 @@ public:
 	void	WriteMessages( unsigned char cmd, bf_write &message );
 	int		GetMaxAckTickCount();
 
+	void	WriteKeyframe( CHLTVFrame *pFrame );
+	void	WriteKeyframeIndex();
+
 public:
 
 	CDemoFile		m_DemoFile;
@@ -63,6 +66,12 @@ public:
 	int				m_nDeltaTick;	
 	int				m_nSignonTick;
 	bf_write		m_MessageData; // temp buffer for all network messages
+
+	// seek keyframes, kept in a temp file until they are appended after dem_stop
+	FileHandle_t	m_hKeyframeFile;
+	char			m_szKeyframeFileName[MAX_OSPATH];
+	CUtlVector<demoindexentry_t> m_Keyframes;
+	int				m_nNextKeyframeTick;
 };
 
 
@@ -86,6 +86,7 @@ ConVar tv_transmitall( "tv_transmitall", "0", FCVAR_REPLICATED, "Transmit all en
 ConVar tv_debug( "tv_debug", "0", 0, "SourceTV debug info." );
 ConVar tv_title( "tv_title", "SourceTV", 0, "Set title for SourceTV spectator UI", tv_title_changed_f );
 static ConVar tv_deltacache( "tv_deltacache", "2", 0, "Enable delta entity bit stream cache" );
+static ConVar tv_sharedsnapshots( "tv_sharedsnapshots", "1", 0, "Serialize each snapshot once per delta tick and send it to every spectator using that tick" );
 static ConVar tv_relayvoice( "tv_relayvoice", "1", 0, "Relay voice data: 0=off, 1=on" );
 
 CDeltaEntityCache::CDeltaEntityCache()
@@ -93,6 +94,7 @@ CDeltaEntityCache::CDeltaEntityCache()
 	Q_memset( m_Cache, 0, sizeof(m_Cache) );
 	m_nTick = 0;
 	m_nMaxEntities = 0;
+	m_nAllocatedEntities = 0;
 	m_nCacheSize = 0;
 }
 
@@ -103,10 +105,10 @@ CDeltaEntityCache::~CDeltaEntityCache()
 
 void CDeltaEntityCache::Flush()
 {
-	if ( m_nMaxEntities != 0 )
+	if ( m_nAllocatedEntities != 0 )
 	{
 		// at least one entity was set
-		for ( int i=0; i<m_nMaxEntities; i++ )
+		for ( int i=0; i<m_nAllocatedEntities; i++ )
 		{
 			if ( m_Cache[i] != NULL )
 			{
@@ -115,25 +117,53 @@ void CDeltaEntityCache::Flush()
 			}
 		}
 
-		m_nMaxEntities = 0;
+		m_nAllocatedEntities = 0;
 	}
 
+	m_nMaxEntities = 0;
 	m_nCacheSize = 0;
 }
 
+void CDeltaEntityCache::Clear()
+{
+	// forget all entries but keep their memory, an empty block starts with an unused entry
+	for ( int i=0; i<m_nAllocatedEntities; i++ )
+	{
+		if ( m_Cache[i] != NULL )
+		{
+			m_Cache[i]->pNext = NULL;
+			m_Cache[i]->nDeltaTick = -1;
+			m_Cache[i]->nBits = -1;
+		}
+	}
+
+	m_nMaxEntities = 0;
+}
+
 void CDeltaEntityCache::SetTick( int nTick, int nMaxEntities )
 {
 	if ( nTick == m_nTick )
 		return;
 
-	Flush();
+	int nCacheSize = tv_deltacache.GetInt() * 1024;
+
+	if ( nCacheSize != m_nCacheSize )
+	{
+		// blocks have the wrong size
+		Flush();
+	}
+	else
+	{
+		Clear();
+	}
 
-	m_nCacheSize = tv_deltacache.GetInt() * 1024;
+	m_nCacheSize = nCacheSize;
 
 	if ( m_nCacheSize <= 0 )
 		return;
 
 	m_nMaxEntities = min(nMaxEntities,MAX_EDICTS);
+	m_nAllocatedEntities = max( m_nAllocatedEntities, m_nMaxEntities );
 	m_nTick = nTick;
 }
 
@@ -179,6 +209,12 @@ void CDeltaEntityCache::AddDeltaBits( int nEntityIndex, int nDeltaTick, int nBit
 
 		pEntry = m_Cache[nEntityIndex] = (DeltaEntityEntry_s *) malloc( m_nCacheSize );
 	}
+	else if ( pEntry->nDeltaTick == -1 )
+	{
+		// block kept from an earlier tick, reuse its first entry
+		if ( (int)(nBufferSize+sizeof(DeltaEntityEntry_s)) > m_nCacheSize )
+			return;
+	}
 	else
 	{
 		char *pEnd = (char*)(pEntry) + m_nCacheSize;	// end marker
@@ -1532,6 +1568,60 @@ CClientFrame *CHLTVServer::GetDeltaFrame( int nTick )
 	return entry.pFrame;
 }
 
+const CSnapshotCacheEntry_s *CHLTVServer::FindCachedSnapshot( CHLTVClient *client, int nDeltaTick )
+{
+	if ( !tv_sharedsnapshots.GetBool() )
+		return NULL;
+
+	int nStringTableTick = client->GetMaxAckTickCount();
+	int nStringTableChanges = m_StringTables->GetChangeCount();
+
+	FOR_EACH_VEC( m_SnapshotCache, i )
+	{
+		const CSnapshotCacheEntry_s &entry = m_SnapshotCache[i];
+
+		if ( entry.nDeltaTick == nDeltaTick &&
+			 entry.nStringTableTick == nStringTableTick &&
+			 entry.nStringTableChanges == nStringTableChanges &&
+			 entry.nBaselineUsed == client->m_nBaselineUsed &&
+			 entry.nEntityIndex == client->m_nEntityIndex )
+		{
+			return &entry;
+		}
+	}
+
+	return NULL;
+}
+
+void CHLTVServer::AddCachedSnapshot( CHLTVClient *client, int nDeltaTick, bf_write &msg )
+{
+	if ( !tv_sharedsnapshots.GetBool() || msg.IsOverflowed() )
+		return;
+
+	int i = m_SnapshotCache.AddToTail();
+
+	CSnapshotCacheEntry_s &entry = m_SnapshotCache[i];
+
+	entry.nDeltaTick = nDeltaTick;
+	entry.nStringTableTick = client->GetMaxAckTickCount();
+	entry.nStringTableChanges = m_StringTables->GetChangeCount();
+	entry.nBaselineUsed = client->m_nBaselineUsed;
+	entry.nEntityIndex = client->m_nEntityIndex;
+	entry.nBits = msg.GetNumBitsWritten();
+	entry.pData = (byte*) malloc( msg.GetNumBytesWritten() );
+	Q_memcpy( entry.pData, msg.GetData(), msg.GetNumBytesWritten() );
+}
+
+void CHLTVServer::FlushSnapshotCache( void )
+{
+	FOR_EACH_VEC( m_SnapshotCache, i )
+	{
+		free( m_SnapshotCache[i].pData );
+	}
+
+	m_SnapshotCache.RemoveAll();
+}
+
 void CHLTVServer::RunFrame()
 {
 	VPROF_BUDGET( "CHLTVServer::RunFrame", "HLTV" );
@@ -1638,6 +1728,7 @@ void CHLTVServer::UpdateTick( void )
 	}
 
 	m_FrameCache.RemoveAll();
+	FlushSnapshotCache();
 }
 
 const char *CHLTVServer::GetName( void ) const
@@ -1677,6 +1768,7 @@ void CHLTVServer::Clear( void )
 
 	m_DeltaCache.Flush();
 	m_FrameCache.RemoveAll();
+	FlushSnapshotCache();
 }
 
 bool CHLTVServer::ProcessConnectionlessPacket( netpacket_t * packet )
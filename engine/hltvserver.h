@@ -59,6 +59,18 @@ struct CFrameCacheEntry_s
 	int	nTick;
 };
 
+// snapshot packet serialized once and sent to every spectator with the same delta state
+struct CSnapshotCacheEntry_s
+{
+	int		nDeltaTick;
+	int		nStringTableTick;
+	int		nStringTableChanges;	// relays change their tables between frames
+	int		nBaselineUsed;
+	int		nEntityIndex;
+	int		nBits;
+	byte	*pData;
+};
+
 class CDeltaEntityCache
 {
 	struct DeltaEntityEntry_s
@@ -78,8 +90,11 @@ public:
 	void Flush();
 
 protected:
+	void Clear();
+
 	int	m_nTick;	// current tick
 	int	m_nMaxEntities;	// max entities = length of cache
+	int m_nAllocatedEntities;	// entries are kept allocated up to here between ticks
 	int m_nCacheSize;
 	DeltaEntityEntry_s* m_Cache[MAX_EDICTS]; // array of pointers to delta entries
 };
@@ -187,6 +202,10 @@ public:
 	bool	DispatchToRelay( CHLTVClient *pClient);
 	bf_write *GetBuffer( int nBuffer);
 	CClientFrame *GetDeltaFrame( int nTick );
+
+	const CSnapshotCacheEntry_s *FindCachedSnapshot( CHLTVClient *client, int nDeltaTick );
+	void	AddCachedSnapshot( CHLTVClient *client, int nDeltaTick, bf_write &msg );
+	void	FlushSnapshotCache( void );
 		
 	inline  CHLTVClient* Client( int i ) { return static_cast<CHLTVClient*>(m_Clients[i]); }
 
@@ -246,6 +265,7 @@ public:
 
 	CDeltaEntityCache				m_DeltaCache;
 	CUtlVector<CFrameCacheEntry_s>	m_FrameCache;
+	CUtlVector<CSnapshotCacheEntry_s> m_SnapshotCache;	// packets of the current frame by delta state
 
 	// demoplayer stuff:
 	CDemoFile		m_DemoFile;		// for demo playback
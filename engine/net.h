@@ -137,6 +137,9 @@ void		NET_OutOfBandPrintf(int sock, const netadr_t &adr, PRINTF_FORMAT_STRING co
 int			NET_SendPacket ( INetChannel *chan, int sock,  const netadr_t &to, const  unsigned char *data, int length, bf_write *pVoicePayload = NULL, bool bUseCompression = false );
 // Called periodically to maybe send any queued packets (up to 4 per frame)
 void		NET_SendQueuedPackets();
+// Collect packets sent in between and flush them with batched socket calls
+void		NET_BeginSendBatch();
+void		NET_EndSendBatch();
 // Start set current network configuration
 void		NET_SetMutiplayer(bool multiplayer);
 // Set net_time
@@ -167,6 +170,8 @@ unsigned short NET_NetToHostShort( unsigned short us_in );
 
 // Find out what port is mapped to a local socket
 unsigned short NET_GetUDPPort(int socket);
+// UDP handle of a socket that is read on the main thread, 0 if none
+int NET_GetMainThreadSocket(int socket);
 
 // add/remove extra sockets for testing
 int NET_AddExtraSocket( int port );
@@ -12,6 +12,7 @@
 #include "tier0/vprof.h"
 #include "net_ws_headers.h"
 #include "net_ws_queued_packet_sender.h"
+#include "net_ws_queued_packet_receiver.h"
 #include "fmtstr.h"
 #include "master.h"
 
@@ -44,6 +45,10 @@ static ConVar fakeloss		( "net_fakeloss", "0", FCVAR_CHEAT, "Simulate packet los
 static ConVar droppackets	( "net_droppackets", "0", FCVAR_CHEAT, "Drops next n packets on client" ); 
 static ConVar fakejitter	( "net_fakejitter", "0", FCVAR_CHEAT, "Jitter fakelag packet time" );
 
+#ifdef LINUX
+static ConVar net_batchio( "net_batchio", "1", 0, "Receive and send UDP datagrams in batches with recvmmsg/sendmmsg" );
+#endif
+
 static ConVar net_compressvoice( "net_compressvoice", "0", 0, "Attempt to compress out of band voice payloads (360 only)." );
 ConVar net_usesocketsforloopback( "net_usesocketsforloopback", "0", 0, "Use network sockets layer even for listen server local player's packets (multiplayer only)." );
 
@@ -185,7 +190,7 @@ static	bool net_nodns = false;	// Disable DNS request to avoid long timeouts
 static  bool net_notcp = true;	// Disable TCP support
 static	bool net_nohltv = false; // disable HLTV support
 static	bool net_dedicated = false;	// true is dedicated system
-static	int  net_error = 0;			// global error code updated with NET_GetLastError()
+static	CTHREADLOCALINT net_error;	// error code updated with NET_GetLastError(), per thread since sockets are read and written from several
 
 
 static CUtlVectorMT< CUtlVector< CNetChan* > >			s_NetChannels;
@@ -337,14 +342,15 @@ void NET_ClearLastError( void )
 int NET_GetLastError( void )
 {
 #if defined( _WIN32 )
-	net_error = WSAGetLastError();
+	int nError = WSAGetLastError();
 #else
-	net_error = errno;
+	int nError = errno;
 #endif
 #if !defined( NO_VCR )
-	VCRGenericValue( "WSAGetLastError", &net_error, sizeof( net_error ) );
+	VCRGenericValue( "WSAGetLastError", &nError, sizeof( nError ) );
 #endif
-	return net_error;
+	net_error = nError;
+	return nError;
 }
 
 /*
@@ -1137,7 +1143,7 @@ static CUtlVector<vecSplitPacketEntries_t> net_splitpackets;
 //-----------------------------------------------------------------------------
 // Purpose: 
 //-----------------------------------------------------------------------------
-void NET_DiscardStaleSplitpackets( const int sock )
+void NET_DiscardStaleSplitpackets( const int sock, double flNow )
 {
 	vecSplitPacketEntries_t &splitPacketEntries = net_splitpackets[sock];
 	int i;
@@ -1146,7 +1152,7 @@ void NET_DiscardStaleSplitpackets( const int sock )
 		CSplitPacketEntry *entry = &splitPacketEntries[ i ];
 		Assert( entry );
 
-		if ( net_time < ( entry->lastactivetime + SPLIT_PACKET_STALE_TIME ) )
+		if ( flNow < ( entry->lastactivetime + SPLIT_PACKET_STALE_TIME ) )
 			continue;
 
 		splitPacketEntries.Remove( i );
@@ -1157,7 +1163,7 @@ void NET_DiscardStaleSplitpackets( const int sock )
 		while ( splitPacketEntries.Count() > SPLIT_PACKET_TRACKING_MAX )
 		{
 			CSplitPacketEntry *entry = &splitPacketEntries[ i ];
-			if ( net_time != entry->lastactivetime )
+			if ( flNow != entry->lastactivetime )
 				splitPacketEntries.Remove(0); // we add to tail each time, so head is the oldest entry, kill them first
 		}
 	}
@@ -1279,7 +1285,7 @@ bool NET_GetLong( const int sock, netpacket_t *packet )
 	if ( !entry )
 		return false;
 
-	entry->lastactivetime = net_time;
+	entry->lastactivetime = packet->received;
 	Assert( packet->from.CompareAdr( entry->from ) );
 
 	// First packet in split series?
@@ -1300,7 +1306,7 @@ bool NET_GetLong( const int sock, netpacket_t *packet )
 			nSplitSizeMinusHeader,
 			entry->netsplit.nExpectedSplitSize
 			);
-		entry->lastactivetime = net_time + SPLIT_PACKET_STALE_TIME;
+		entry->lastactivetime = packet->received + SPLIT_PACKET_STALE_TIME;
 		return false;
 	}
 
@@ -1400,7 +1406,124 @@ bool NET_GetLoopPacket ( netpacket_t * packet )
 	return ( NET_LagPacket( true, packet ) );	
 }
 
-bool NET_ReceiveDatagram ( const int sock, netpacket_t * packet )
+#ifdef LINUX
+//-----------------------------------------------------------------------------
+// Batched socket I/O. Incoming datagrams are drained with one recvmmsg call
+// into a per socket ring and handed out one by one, outgoing datagrams of a
+// send batch (see NET_BeginSendBatch) are flushed with sendmmsg.
+//-----------------------------------------------------------------------------
+#define NET_BATCH_SIZE			32
+#define NET_BATCH_SLOT_SIZE		65536	// largest UDP datagram, unsplit and compressed packets can be up to that
+
+struct netbatchrecv_t
+{
+	int					hUDP;		// socket the ring was filled from
+	int					nCount;		// datagrams in the ring
+	int					nNext;		// next datagram to hand out
+	struct mmsghdr		msgs[NET_BATCH_SIZE];
+	struct iovec		iov[NET_BATCH_SIZE];
+	struct sockaddr		from[NET_BATCH_SIZE];
+	byte				data[NET_BATCH_SIZE][NET_BATCH_SLOT_SIZE];
+};
+
+static netbatchrecv_t	*s_pBatchRecv[MAX_SOCKETS];
+static bool				s_bBatchIOFailed = false;	// kernel doesn't support recvmmsg/sendmmsg
+
+static bool NET_UseBatchIO()
+{
+	return net_batchio.GetBool() && !s_bBatchIOFailed && VCRGetMode() == VCR_Disabled;
+}
+
+static void NET_ClearBatchRecv()
+{
+	for ( int i = 0; i < MAX_SOCKETS; i++ )
+	{
+		if ( s_pBatchRecv[i] )
+		{
+			s_pBatchRecv[i]->nCount = 0;
+			s_pBatchRecv[i]->nNext = 0;
+		}
+	}
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: recvfrom replacement, refills the socket's ring with recvmmsg
+//  whenever it runs empty. Returns -1 and sets errno like recvfrom.
+//-----------------------------------------------------------------------------
+static int NET_ReceiveBatched( int sock, int net_socket, unsigned char *pData, int nMaxBytes, struct sockaddr *pFrom, int *pFromLen )
+{
+	netbatchrecv_t *pRing = s_pBatchRecv[sock];
+	if ( !pRing )
+	{
+		pRing = s_pBatchRecv[sock] = (netbatchrecv_t *)calloc( 1, sizeof( netbatchrecv_t ) );
+	}
+
+	if ( pRing->hUDP != net_socket )
+	{
+		// socket was reopened, whatever is left belongs to the old one
+		pRing->hUDP = net_socket;
+		pRing->nCount = 0;
+		pRing->nNext = 0;
+	}
+
+	if ( pRing->nNext >= pRing->nCount )
+	{
+		pRing->nCount = 0;
+		pRing->nNext = 0;
+
+		for ( int i = 0; i < NET_BATCH_SIZE; i++ )
+		{
+			pRing->iov[i].iov_base = pRing->data[i];
+			pRing->iov[i].iov_len = NET_BATCH_SLOT_SIZE;
+
+			struct msghdr &hdr = pRing->msgs[i].msg_hdr;
+			memset( &hdr, 0, sizeof( hdr ) );
+			hdr.msg_name = &pRing->from[i];
+			hdr.msg_namelen = sizeof( pRing->from[i] );
+			hdr.msg_iov = &pRing->iov[i];
+			hdr.msg_iovlen = 1;
+		}
+
+		int ret;
+		{
+			VPROF_BUDGET( "recvmmsg", VPROF_BUDGETGROUP_OTHER_NETWORKING );
+			ret = recvmmsg( net_socket, pRing->msgs, NET_BATCH_SIZE, MSG_DONTWAIT, NULL );
+		}
+
+		if ( ret <= 0 )
+		{
+			if ( ret < 0 && errno == ENOSYS )
+			{
+				s_bBatchIOFailed = true;
+				return VCRHook_recvfrom( net_socket, (char *)pData, nMaxBytes, 0, pFrom, pFromLen );
+			}
+			return ret;
+		}
+
+		pRing->nCount = ret;
+		VPROF_INCREMENT_COUNTER( "recvmmsg datagrams", ret );
+	}
+
+	const struct mmsghdr &msg = pRing->msgs[pRing->nNext];
+	const byte *pSlot = pRing->data[pRing->nNext];
+	++pRing->nNext;
+
+	Q_memcpy( pFrom, msg.msg_hdr.msg_name, MIN( (int)msg.msg_hdr.msg_namelen, *pFromLen ) );
+	*pFromLen = msg.msg_hdr.msg_namelen;
+
+	if ( msg.msg_hdr.msg_flags & MSG_TRUNC )
+	{
+		// can't happen with slots the size of the largest datagram, treated as oversize like recvfrom filling the buffer
+		return nMaxBytes;
+	}
+
+	int nBytes = MIN( (int)msg.msg_len, nMaxBytes );
+	Q_memcpy( pData, pSlot, nBytes );
+	return nBytes;
+}
+#endif
+
+static bool NET_ReadDatagram( const int sock, netpacket_t * packet )
 {
 	VPROF_BUDGET( "NET_ReceiveDatagram", VPROF_BUDGETGROUP_OTHER_NETWORKING );
 
@@ -1412,6 +1535,13 @@ bool NET_ReceiveDatagram ( const int sock, netpacket_t * packet )
 	int				net_socket = net_sockets[packet->source].hUDP;
 
 	int ret = 0;
+#ifdef LINUX
+	if ( NET_UseBatchIO() && sock < MAX_SOCKETS )
+	{
+		ret = NET_ReceiveBatched( sock, net_socket, packet->data, NET_MAX_MESSAGE, &from, &fromlen );
+	}
+	else
+#endif
 	{
 		VPROF_BUDGET( "recvfrom", VPROF_BUDGETGROUP_OTHER_NETWORKING );
 		ret = VCRHook_recvfrom(net_socket, (char *)packet->data, NET_MAX_MESSAGE, 0, (struct sockaddr *)&from, (int *)&fromlen );
@@ -1424,7 +1554,7 @@ bool NET_ReceiveDatagram ( const int sock, netpacket_t * packet )
 
 		if ( net_showudp_wire.GetBool() )
 		{
-			Msg( "WIRE:  UDP sz=%d tm=%f rt %f from %s\n", ret, net_time, Plat_FloatTime(), packet->from.ToString() );
+			Msg( "WIRE:  UDP sz=%d tm=%f rt %f from %s\n", ret, packet->received, Plat_FloatTime(), packet->from.ToString() );
 		}
 
 		MEM_ALLOC_CREDIT();
@@ -1512,7 +1642,7 @@ bool NET_ReceiveDatagram ( const int sock, netpacket_t * packet )
 					if ( net_showudp.GetBool() )
 					{
 						Msg( "UDP:  discarding %d bytes from %s due to decompression error [%d decomp, actual %d] at tm=%f rt=%f\n", ret, packet->from.ToString(), uDecompressedSize, actualSize, 
-							(float)net_time, (float)Plat_FloatTime() );
+							(float)packet->received, (float)Plat_FloatTime() );
 					}
 					return false;
 				}
@@ -1546,7 +1676,7 @@ bool NET_ReceiveDatagram ( const int sock, netpacket_t * packet )
 				packet->size = fixup.GetNumBytesWritten();
 			}
 
-			return NET_LagPacket( true, packet );
+			return true;
 		}
 		else
 		{
@@ -1576,7 +1706,13 @@ bool NET_ReceiveDatagram ( const int sock, netpacket_t * packet )
 	return false;
 }
 
-bool NET_ReceiveValidDatagram ( const int sock, netpacket_t * packet )
+bool NET_ReceiveDatagram ( const int sock, netpacket_t * packet )
+{
+	// allow lag system to modify packet
+	return NET_ReadDatagram( sock, packet ) && NET_LagPacket( true, packet );
+}
+
+bool NET_ReceiveValidDatagram ( const int sock, netpacket_t * packet, bool bLagPacket = true )
 {
 #ifdef _DEBUG
 	if ( recvpackets.GetInt() >= 0 )
@@ -1605,7 +1741,7 @@ bool NET_ReceiveValidDatagram ( const int sock, netpacket_t * packet )
 	{
 		// Attempt to receive a valid packet.
 		NET_ClearLastError();
-		if ( NET_ReceiveDatagram ( sock, packet ) )
+		if ( bLagPacket ? NET_ReceiveDatagram( sock, packet ) : NET_ReadDatagram( sock, packet ) )
 		{
 			// Received a valid packet.
 			return true;
@@ -1621,15 +1757,88 @@ bool NET_ReceiveValidDatagram ( const int sock, netpacket_t * packet )
 }
 
 
-netpacket_t *NET_GetPacket (int sock, byte *scratch )
+//-----------------------------------------------------------------------------
+// Purpose: Takes the next datagram the socket's receive thread already read
+//-----------------------------------------------------------------------------
+static bool NET_ReceiveQueuedDatagram( const int sock, netpacket_t * packet, QueuedPacketClass_t *pClass )
+{
+	while ( g_pQueuedPacketReceiver->GetPacket( sock, packet, pClass ) )
+	{
+		// fake lag may hand back an older packet than the one just taken
+		if ( s_FakeLag > 0.0f )
+		{
+			*pClass = QUEUED_PACKET_UNCLASSIFIED;
+		}
+
+		if ( NET_LagPacket( true, packet ) )
+			return true;
+	}
+
+	return false;
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: net_time of a datagram the receive thread read at Plat_FloatTime() flRealtime
+//-----------------------------------------------------------------------------
+static double s_flNetTimeRealtime = 0.0;	// Plat_FloatTime() of the last NET_SetTime
+
+double NET_RealtimeToNetTime( double flRealtime )
+{
+	// anything read after this frame started counts as arriving now
+	double flBeforeFrame = clamp( s_flNetTimeRealtime - flRealtime, 0.0, 1.0 );
+	return net_time - flBeforeFrame * host_timescale.GetFloat();
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Starts or stops the receive thread of a socket to match net_queued_packet_receive
+//-----------------------------------------------------------------------------
+static void NET_UpdateReceiveThread( int sock )
+{
+	bool bWantThread = net_queued_packet_receive.GetBool() && NET_IsMultiplayer() && sock < MAX_SOCKETS &&
+		net_sockets[sock].hUDP && VCRGetMode() == VCR_Disabled;
+
+	if ( !bWantThread )
+	{
+		if ( g_pQueuedPacketReceiver->IsRunning( sock ) )
+		{
+			g_pQueuedPacketReceiver->StopSocket( sock );
+
+			// split packets of the thread are aged by Plat_FloatTime(), not net_time
+			net_splitpackets[sock].RemoveAll();
+		}
+		return;
+	}
+
+	if ( g_pQueuedPacketReceiver->GetSocketHandle( sock ) != net_sockets[sock].hUDP )
+	{
+		g_pQueuedPacketReceiver->StopSocket( sock );
+		net_splitpackets[sock].RemoveAll();
+
+		if ( !g_pQueuedPacketReceiver->StartSocket( sock, net_sockets[sock].hUDP ) )
+		{
+			Warning( "NET_UpdateReceiveThread: couldn't start the receive thread, turning net_queued_packet_receive off.\n" );
+			net_queued_packet_receive.SetValue( 0 );
+		}
+	}
+}
+
+netpacket_t *NET_GetPacket (int sock, byte *scratch, QueuedPacketClass_t *pClass )
 {
 	VPROF_BUDGET( "NET_GetPacket", VPROF_BUDGETGROUP_OTHER_NETWORKING );
 
 	// Each socket has its own netpacket to allow multithreading
 	netpacket_t &inpacket = net_packets[sock];
 
+	// the receive thread owns the split packets of its socket
+	bool bReceiveThread = g_pQueuedPacketReceiver->IsRunning( sock );
+
 	NET_AdjustLag();
-	NET_DiscardStaleSplitpackets( sock );
+	if ( !bReceiveThread )
+	{
+		NET_DiscardStaleSplitpackets( sock, net_time );
+	}
+
+	*pClass = QUEUED_PACKET_UNCLASSIFIED;
 
 	// setup new packet
 	inpacket.from.SetType( NA_IP );
@@ -1651,8 +1860,11 @@ netpacket_t *NET_GetPacket (int sock, byte *scratch )
 		}
 
 		// then check UDP data 
-		if ( !NET_ReceiveValidDatagram( sock, &inpacket ) )
+		bool bReceived = bReceiveThread ? NET_ReceiveQueuedDatagram( sock, &inpacket, pClass ) : NET_ReceiveValidDatagram( sock, &inpacket );
+		if ( !bReceived )
 		{
+			*pClass = QUEUED_PACKET_UNCLASSIFIED;
+
 			// at last check if the lag system has a packet for us
 			if ( !NET_LagPacket (false, &inpacket) )
 			{
@@ -1844,13 +2056,16 @@ void NET_ProcessSocket( int sock, IConnectionlessPacketHandler *handler )
 		}
 	}
 
+	NET_UpdateReceiveThread( sock );
+
 	// now get datagrams from sockets
 	NetScratchBuffer_t *scratch = g_NetScratchBuffers.Pop();
 	if ( !scratch )
 	{
 		scratch = new NetScratchBuffer_t;
 	}
-	while ( ( packet = NET_GetPacket ( sock, scratch->data ) ) != NULL )
+	QueuedPacketClass_t packetClass;
+	while ( ( packet = NET_GetPacket ( sock, scratch->data, &packetClass ) ) != NULL )
 	{
 		if ( Filter_ShouldDiscard ( packet->from ) )	// filtering is done by network layer
 		{
@@ -1858,8 +2073,12 @@ void NET_ProcessSocket( int sock, IConnectionlessPacketHandler *handler )
 			continue;
 		} 
 
-		// check for connectionless packet (0xffffffff) first
-		if ( LittleLong( *(unsigned int *)packet->data ) == CONNECTIONLESS_HEADER )
+		// check for connectionless packet (0xffffffff) first, the receive thread already did for its packets
+		bool bConnectionless = ( packetClass == QUEUED_PACKET_UNCLASSIFIED ) ?
+			( LittleLong( *(unsigned int *)packet->data ) == CONNECTIONLESS_HEADER ) :
+			( packetClass == QUEUED_PACKET_CONNECTIONLESS );
+
+		if ( bConnectionless )
 		{
 			packet->message.ReadLong();	// read the -1
 
@@ -1922,6 +2141,149 @@ void NET_LogBadPacket(netpacket_t * packet)
 	}
 }
 
+#ifdef LINUX
+struct netbatchsend_t
+{
+	SOCKET				hSocket;
+	int					nOffset;	// into s_SendBatchData
+	int					nLength;
+	struct sockaddr		to;
+};
+
+static CThreadFastMutex				s_SendBatchMutex;	// guards everything below
+static int							s_nSendBatchDepth = 0;
+static CUtlVector<netbatchsend_t>	s_SendBatch;
+static CUtlVector<byte>				s_SendBatchData;
+
+//-----------------------------------------------------------------------------
+// Purpose: Adds a datagram to the current send batch, returns false if no
+//  batch is open and the datagram must be sent right away.
+//-----------------------------------------------------------------------------
+static bool NET_AddToSendBatch( SOCKET s, const char *buf, int len, const struct sockaddr *to, int tolen )
+{
+	if ( tolen > (int)sizeof( struct sockaddr ) )
+		return false;
+
+	AUTO_LOCK( s_SendBatchMutex );
+
+	if ( !s_nSendBatchDepth )
+		return false;
+
+	netbatchsend_t &send = s_SendBatch[ s_SendBatch.AddToTail() ];
+	send.hSocket = s;
+	send.nOffset = s_SendBatchData.Count();
+	send.nLength = len;
+	Q_memset( &send.to, 0, sizeof( send.to ) );
+	Q_memcpy( &send.to, to, tolen );
+
+	s_SendBatchData.AddMultipleToTail( len, (const byte *)buf );
+	return true;
+}
+
+static void NET_FlushSendBatch()
+{
+	struct mmsghdr	msgs[NET_BATCH_SIZE];
+	struct iovec	iov[NET_BATCH_SIZE];
+
+	int nSends = s_SendBatch.Count();
+	int iFirst = 0;
+
+	while ( iFirst < nSends )
+	{
+		// sendmmsg takes one socket, batch up runs of datagrams to the same one
+		SOCKET hSocket = s_SendBatch[iFirst].hSocket;
+		int nMsgs = 0;
+
+		while ( iFirst + nMsgs < nSends && nMsgs < NET_BATCH_SIZE && s_SendBatch[iFirst + nMsgs].hSocket == hSocket )
+		{
+			netbatchsend_t &send = s_SendBatch[iFirst + nMsgs];
+
+			iov[nMsgs].iov_base = s_SendBatchData.Base() + send.nOffset;
+			iov[nMsgs].iov_len = send.nLength;
+
+			struct msghdr &hdr = msgs[nMsgs].msg_hdr;
+			memset( &hdr, 0, sizeof( hdr ) );
+			hdr.msg_name = &send.to;
+			hdr.msg_namelen = sizeof( send.to );
+			hdr.msg_iov = &iov[nMsgs];
+			hdr.msg_iovlen = 1;
+
+			++nMsgs;
+		}
+
+		int nSent;
+		{
+			VPROF_BUDGET( "sendmmsg", VPROF_BUDGETGROUP_OTHER_NETWORKING );
+			nSent = sendmmsg( hSocket, msgs, nMsgs, 0 );
+		}
+
+		if ( nSent < 0 )
+		{
+			NET_GetLastError();
+
+			if ( errno == ENOSYS )
+			{
+				// old kernel, send them one by one from now on
+				s_bBatchIOFailed = true;
+				for ( int i = 0; i < nMsgs; i++ )
+				{
+					sendto( hSocket, (const char *)iov[i].iov_base, iov[i].iov_len, 0, &s_SendBatch[iFirst + i].to, sizeof( struct sockaddr ) );
+				}
+				nSent = nMsgs;
+			}
+			else
+			{
+				// the first datagram failed, skip it like a failed sendto
+				if ( net_error != WSAEWOULDBLOCK && net_error != WSAECONNRESET )
+				{
+					netadr_t adr;
+					adr.SetFromSockadr( &s_SendBatch[iFirst].to );
+					ConDMsg( "NET_FlushSendBatch Warning: %s : %s\n", NET_ErrorString( net_error ), adr.ToString() );
+				}
+				nSent = 1;
+			}
+		}
+
+		VPROF_INCREMENT_COUNTER( "sendmmsg datagrams", nSent );
+		iFirst += nSent;
+	}
+
+	s_SendBatch.RemoveAll();
+	s_SendBatchData.RemoveAll();
+}
+#endif
+
+//-----------------------------------------------------------------------------
+// Purpose: Datagrams sent between these calls are collected and sent with as
+//  few system calls as possible when the outermost batch ends. Can be nested,
+//  sends from any thread are added to the open batch.
+//-----------------------------------------------------------------------------
+void NET_BeginSendBatch()
+{
+#ifdef LINUX
+	if ( !NET_UseBatchIO() )
+		return;
+
+	AUTO_LOCK( s_SendBatchMutex );
+	++s_nSendBatchDepth;
+#endif
+}
+
+void NET_EndSendBatch()
+{
+#ifdef LINUX
+	AUTO_LOCK( s_SendBatchMutex );
+
+	if ( !s_nSendBatchDepth )
+		return;
+
+	if ( --s_nSendBatchDepth == 0 )
+	{
+		NET_FlushSendBatch();
+	}
+#endif
+}
+
 int NET_SendToImpl( SOCKET s, const char FAR * buf, int len, const struct sockaddr FAR * to, int tolen, int iGameDataLength )
 {
 	int nSend = 0;
@@ -1950,6 +2312,13 @@ int NET_SendToImpl( SOCKET s, const char FAR * buf, int len, const struct sockad
 	}
 	else
 #endif //defined( _X360 )
+#ifdef LINUX
+	if ( NET_AddToSendBatch( s, buf, len, to, tolen ) )
+	{
+		nSend = len;
+	}
+	else
+#endif
 	{
 		nSend = sendto( s, buf, len, 0, to, tolen );
 	}
@@ -2538,6 +2907,9 @@ NET_CloseAllSockets
 */
 void NET_CloseAllSockets (void)
 {
+	// receive threads must not read from closed sockets
+	g_pQueuedPacketReceiver->Shutdown();
+
 	// shut down any existing and open sockets
 	for (int i=0 ; i<net_sockets.Count() ; i++)
 	{
@@ -2574,6 +2946,13 @@ void NET_FlushAllSockets( void )
 	char data[2048];
 	struct sockaddr	from;
 	int	fromlen = sizeof(from);
+
+	// threads are restarted by the next NET_ProcessSocket
+	g_pQueuedPacketReceiver->Shutdown();
+
+#ifdef LINUX
+	NET_ClearBatchRecv();
+#endif
 	
 	for (int i=0 ; i<net_sockets.Count() ; i++)
 	{
@@ -2728,6 +3107,16 @@ int NET_AddExtraSocket( int port )
 
 	OpenSocketInternal( newSocket, port, PORT_ANY, "extra", IPPROTO_UDP, true );
 
+	// receive threads index the split packets, they restart on the next NET_ProcessSocket
+	for ( int i = 0; i < MAX_SOCKETS; i++ )
+	{
+		if ( g_pQueuedPacketReceiver->IsRunning( i ) )
+		{
+			g_pQueuedPacketReceiver->StopSocket( i );
+			net_splitpackets[i].RemoveAll();
+		}
+	}
+
 	net_packets.EnsureCount( newSocket+1 );
 	net_splitpackets.EnsureCount( newSocket+1 );
 
@@ -2757,6 +3146,25 @@ unsigned short NET_GetUDPPort(int socket)
 	return net_sockets[socket].nPort;
 }
 
+/*
+================
+NET_GetMainThreadSocket
+
+Returns the UDP handle of a socket if it is open and its datagrams are read
+by NET_ProcessSocket rather than a receive thread, 0 otherwise.
+================
+*/
+int NET_GetMainThreadSocket( int socket )
+{
+	if ( socket < 0 || socket >= net_sockets.Count() )
+		return 0;
+
+	if ( socket < MAX_SOCKETS && g_pQueuedPacketReceiver->IsRunning( socket ) )
+		return 0;
+
+	return net_sockets[socket].hUDP;
+}
+
 
 /*
 ================
@@ -2962,6 +3370,7 @@ void NET_SetTime( double flRealtime )
 
 	// adjust network time so fakelag works with host_timescale
 	net_time += frametime * host_timescale.GetFloat();
+	s_flNetTimeRealtime = Plat_FloatTime();
 }
 
 /*
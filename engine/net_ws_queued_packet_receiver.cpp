@@ -0,0 +1,273 @@
+//========= Copyright Valve Corporation, All rights reserved. ============//
+//
+// Purpose: Reads datagrams on a thread per socket, so they are reassembled,
+//			decompressed and timestamped as they arrive instead of at the
+//			start of the next frame.
+//
+//=============================================================================
+
+#include "net_ws_headers.h"
+#include "net_ws_queued_packet_receiver.h"
+
+// memdbgon must be the last include file in a .cpp file!!!
+#include "tier0/memdbgon.h"
+
+ConVar net_queued_packet_receive( "net_queued_packet_receive", "0", 0, "Read incoming datagrams on a thread per socket instead of at the start of each frame." );
+
+extern bool NET_ReceiveValidDatagram( const int sock, netpacket_t *packet, bool bLagPacket );
+extern void NET_DiscardStaleSplitpackets( const int sock, double flNow );
+extern double NET_RealtimeToNetTime( double flRealtime );
+extern CNetChan *NET_FindNetChannel( int socket, netadr_t &adr );
+
+// Most datagrams a socket thread keeps for the frame, the oldest are dropped after that
+#define MAX_QUEUED_RECEIVED_PACKETS	4096
+
+class CSocketReceiveThread : public CThread
+{
+public:
+	CSocketReceiveThread( int sock, int hUDP );
+	~CSocketReceiveThread();
+
+	bool Start( unsigned int nBytesStack = 0 );
+	void Stop();
+
+	struct CReceivedPacket
+	{
+		netadr_t		from;
+		double			received;	// Plat_FloatTime() when read
+		QueuedPacketClass_t packetClass;
+		int				size;
+		int				wiresize;
+		unsigned char	data[1];	// size bytes
+	};
+
+	int		GetSocketHandle() const { return m_hUDP; }
+	bool	GetPacket( netpacket_t *packet, QueuedPacketClass_t *pClass );
+
+private:
+	virtual int Run();
+
+	bool	WaitForData( uint32 msecTimeout );
+	void	QueuePacket( const netpacket_t &packet, QueuedPacketClass_t packetClass );
+
+	int		m_nSock;
+	int		m_hUDP;
+	volatile bool m_bThreadShouldExit;
+	unsigned char *m_pScratch;	// NET_MAX_MESSAGE bytes
+
+	CTSQueue<CReceivedPacket *> m_Packets;
+};
+
+CSocketReceiveThread::CSocketReceiveThread( int sock, int hUDP )
+{
+	SetName( "SocketReceiver" );
+	m_nSock = sock;
+	m_hUDP = hUDP;
+	m_bThreadShouldExit = false;
+	m_pScratch = new unsigned char[ NET_MAX_MESSAGE ];
+}
+
+CSocketReceiveThread::~CSocketReceiveThread()
+{
+	Stop();
+
+	CReceivedPacket *pPacket;
+	while ( m_Packets.PopItem( &pPacket ) )
+	{
+		free( pPacket );
+	}
+
+	delete [] m_pScratch;
+}
+
+bool CSocketReceiveThread::Start( unsigned int nBytesStack )
+{
+	m_bThreadShouldExit = false;
+
+	if ( !CThread::Start( nBytesStack ) )
+		return false;
+
+#ifdef IS_WINDOWS_PC
+	SetPriority( THREAD_PRIORITY_HIGHEST );
+#endif
+	return true;
+}
+
+void CSocketReceiveThread::Stop()
+{
+	if ( !IsAlive() )
+		return;
+
+	// the thread notices within one WaitForData timeout
+	m_bThreadShouldExit = true;
+	Join();
+}
+
+bool CSocketReceiveThread::WaitForData( uint32 msecTimeout )
+{
+	fd_set readSet;
+	FD_ZERO( &readSet );
+	FD_SET( (SOCKET)m_hUDP, &readSet );
+
+	struct timeval tv;
+	tv.tv_sec = msecTimeout / 1000;
+	tv.tv_usec = ( msecTimeout % 1000 ) * 1000;
+
+	return select( m_hUDP + 1, &readSet, NULL, NULL, &tv ) > 0;
+}
+
+void CSocketReceiveThread::QueuePacket( const netpacket_t &packet, QueuedPacketClass_t packetClass )
+{
+	if ( m_Packets.Count() >= MAX_QUEUED_RECEIVED_PACKETS )
+	{
+		// the frame isn't keeping up, drop the oldest like a full socket buffer would
+		CReceivedPacket *pOldest;
+		if ( m_Packets.PopItem( &pOldest ) )
+		{
+			free( pOldest );
+		}
+	}
+
+	CReceivedPacket *pPacket = (CReceivedPacket *)malloc( sizeof( CReceivedPacket ) + packet.size );
+	pPacket->from = packet.from;
+	pPacket->received = packet.received;
+	pPacket->packetClass = packetClass;
+	pPacket->size = packet.size;
+	pPacket->wiresize = packet.wiresize;
+	Q_memcpy( pPacket->data, packet.data, packet.size );
+
+	m_Packets.PushItem( pPacket );
+}
+
+bool CSocketReceiveThread::GetPacket( netpacket_t *packet, QueuedPacketClass_t *pClass )
+{
+	CReceivedPacket *pPacket;
+	if ( !m_Packets.PopItem( &pPacket ) )
+		return false;
+
+	packet->from = pPacket->from;
+	packet->received = NET_RealtimeToNetTime( pPacket->received );
+	packet->size = pPacket->size;
+	packet->wiresize = pPacket->wiresize;
+	Q_memcpy( packet->data, pPacket->data, pPacket->size );
+	*pClass = pPacket->packetClass;
+
+	free( pPacket );
+	return true;
+}
+
+int CSocketReceiveThread::Run()
+{
+	netpacket_t packet;
+
+	while ( !m_bThreadShouldExit )
+	{
+		// wake up every 50ms to see if we should exit
+		if ( !WaitForData( 50 ) )
+			continue;
+
+		// this thread never touches net_time, its packets and split packets are timed by Plat_FloatTime()
+		NET_DiscardStaleSplitpackets( m_nSock, Plat_FloatTime() );
+
+		// read everything that's there, fake lag is applied when the frame takes the packet
+		while ( !m_bThreadShouldExit )
+		{
+			packet.from.SetType( NA_IP );
+			packet.from.Clear();
+			packet.received = Plat_FloatTime();
+			packet.source = m_nSock;
+			packet.data = m_pScratch;
+			packet.size = 0;
+			packet.wiresize = 0;
+			packet.stream = false;
+			packet.pNext = NULL;
+
+			if ( !NET_ReceiveValidDatagram( m_nSock, &packet, false ) )
+				break;
+
+			QueuedPacketClass_t packetClass = QUEUED_PACKET_CONNECTIONLESS;
+			if ( LittleLong( *(unsigned int *)packet.data ) != CONNECTIONLESS_HEADER )
+			{
+				// the frame would drop sequenced packets nobody is connected from, don't queue them
+				if ( !NET_FindNetChannel( m_nSock, packet.from ) )
+					continue;
+
+				packetClass = QUEUED_PACKET_NETCHANNEL;
+			}
+
+			QueuePacket( packet, packetClass );
+		}
+	}
+
+	return 0;
+}
+
+
+class CQueuedPacketReceiver : public IQueuedPacketReceiver
+{
+public:
+	CQueuedPacketReceiver()
+	{
+		Q_memset( m_pThreads, 0, sizeof( m_pThreads ) );
+	}
+
+	~CQueuedPacketReceiver()
+	{
+		Shutdown();
+	}
+
+	virtual bool StartSocket( int sock, int hUDP )
+	{
+		Assert( sock >= 0 && sock < MAX_SOCKETS );
+
+		StopSocket( sock );
+
+		CSocketReceiveThread *pThread = new CSocketReceiveThread( sock, hUDP );
+		if ( !pThread->Start() )
+		{
+			delete pThread;
+			return false;
+		}
+
+		m_pThreads[sock] = pThread;
+		return true;
+	}
+
+	virtual void StopSocket( int sock )
+	{
+		if ( m_pThreads[sock] )
+		{
+			delete m_pThreads[sock];
+			m_pThreads[sock] = NULL;
+		}
+	}
+
+	virtual void Shutdown()
+	{
+		for ( int i = 0; i < MAX_SOCKETS; i++ )
+		{
+			StopSocket( i );
+		}
+	}
+
+	virtual bool IsRunning( int sock ) const
+	{
+		return sock >= 0 && sock < MAX_SOCKETS && m_pThreads[sock] != NULL;
+	}
+
+	virtual int GetSocketHandle( int sock ) const
+	{
+		return IsRunning( sock ) ? m_pThreads[sock]->GetSocketHandle() : 0;
+	}
+
+	virtual bool GetPacket( int sock, netpacket_t *packet, QueuedPacketClass_t *pClass )
+	{
+		return IsRunning( sock ) && m_pThreads[sock]->GetPacket( packet, pClass );
+	}
+
+private:
+	CSocketReceiveThread	*m_pThreads[MAX_SOCKETS];
+};
+
+static CQueuedPacketReceiver g_QueuedPacketReceiver;
+IQueuedPacketReceiver *g_pQueuedPacketReceiver = &g_QueuedPacketReceiver;
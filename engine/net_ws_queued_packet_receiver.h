@@ -0,0 +1,41 @@
+//========= Copyright Valve Corporation, All rights reserved. ============//
+//
+// Purpose:
+//
+//=============================================================================
+
+#ifndef NET_WS_QUEUED_PACKET_RECEIVER_H
+#define NET_WS_QUEUED_PACKET_RECEIVER_H
+#ifdef _WIN32
+#pragma once
+#endif
+
+struct netpacket_s;
+
+enum QueuedPacketClass_t
+{
+	QUEUED_PACKET_UNCLASSIFIED = 0,	// not read by a receive thread, check the header
+	QUEUED_PACKET_CONNECTIONLESS,
+	QUEUED_PACKET_NETCHANNEL,		// a net channel for the sender existed when it arrived
+};
+
+class IQueuedPacketReceiver
+{
+public:
+	// Starts reading datagrams of a socket on its own thread
+	virtual bool StartSocket( int sock, int hUDP ) = 0;
+	virtual void StopSocket( int sock ) = 0;
+	virtual void Shutdown() = 0;
+	virtual bool IsRunning( int sock ) const = 0;
+	// Socket handle the thread reads from, 0 if none
+	virtual int GetSocketHandle( int sock ) const = 0;
+
+	// Copies the oldest datagram received on the socket into packet, returns false if there is none.
+	// Must be called from the main thread, the receive time is converted to net_time here.
+	virtual bool GetPacket( int sock, struct netpacket_s *packet, QueuedPacketClass_t *pClass ) = 0;
+};
+
+extern IQueuedPacketReceiver *g_pQueuedPacketReceiver;
+extern ConVar net_queued_packet_receive;
+
+#endif // NET_WS_QUEUED_PACKET_RECEIVER_H
@@ -21,6 +21,7 @@
 // memdbgon must be the last include file in a .cpp file!!!
 #include "tier0/memdbgon.h"
 ConVar sv_dumpstringtables( "sv_dumpstringtables", "0", FCVAR_CHEAT );
+ConVar sv_stringtable_update_cache( "sv_stringtable_update_cache", "1", 0, "Share encoded string table updates between clients that acked the same table state." );
 ConVar sv_compressstringtablebaselines_threshhold( "sv_compressstringtablebaselines_threshold", "2048", 0, "Minimum size (in bytes) for stringtablebaseline buffer to be compressed." );
 
 #define SUBSTRING_BITS	5
@@ -220,6 +221,10 @@ CNetworkStringTable::CNetworkStringTable( TABLEID id, const char *tableName, int
 	m_nLastChangedTick = 0;
 	m_bChangeHistoryEnabled = false;
 	m_bLocked = false;
+#ifndef SHARED_NET_STRING_TABLES
+	m_nChangeCount = 1;
+	m_bChangedItemsValid = true;
+#endif
 
 	m_nMaxEntries = maxentries;
 	m_nEntryBits = Q_log2( m_nMaxEntries );
@@ -323,6 +328,9 @@ CNetworkStringTable::~CNetworkStringTable( void )
 	delete[] m_pszTableName;
 	delete m_pItems;
 	delete m_pItemsClientSide;
+#ifndef SHARED_NET_STRING_TABLES
+	m_UpdateCache.PurgeAndDeleteElements();
+#endif
 }
 
 //-----------------------------------------------------------------------------
@@ -347,6 +355,10 @@ void CNetworkStringTable::DeleteAllStrings( void )
 		m_pItemsClientSide->Insert( "___clientsideitemsplaceholder0___" ); // 0 slot can't be used
 		m_pItemsClientSide->Insert( "___clientsideitemsplaceholder1___" ); // -1 can't be used since it looks like the "invalid" index from other string lookups
 	}
+
+#ifndef SHARED_NET_STRING_TABLES
+	InvalidateUpdateCache( true );
+#endif
 }
 
 //-----------------------------------------------------------------------------
@@ -440,6 +452,7 @@ void CNetworkStringTable::RestoreTick(int tick)
 	// TODO optimize this, most of the time the tables doens't really change
 
 	m_nLastChangedTick = 0;
+	InvalidateUpdateCache( true );
 
 	int count = m_pItems->Count();
 		
@@ -499,7 +512,173 @@ void CNetworkStringTable::UpdateMirrorTable( int tick_ack  )
 	}
 }
 
+//-----------------------------------------------------------------------------
+// Purpose: Drops the cached updates, and the changed item index with them
+//			if it can't be kept up to date
+//-----------------------------------------------------------------------------
+void CNetworkStringTable::InvalidateUpdateCache( bool bChangedItems )
+{
+	AUTO_LOCK( m_UpdateCacheMutex );
+
+	m_UpdateCache.PurgeAndDeleteElements();
+	++m_nChangeCount;
+
+	if ( bChangedItems )
+	{
+		m_ChangedItems.Purge();
+		m_bChangedItemsValid = false;
+	}
+}
+
+static int __cdecl CompareChangedItemTicks( const void *a, const void *b )
+{
+	int nTickA = *(const int *)a;
+	int nTickB = *(const int *)b;
+	return ( nTickA < nTickB ) ? -1 : ( nTickA > nTickB );
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Rebuilds the changed item index from the items
+//-----------------------------------------------------------------------------
+void CNetworkStringTable::BuildChangedItems( void )
+{
+	int count = m_pItems->Count();
+
+	m_ChangedItems.RemoveAll();
+	m_ChangedItems.EnsureCapacity( count * 2 );
+
+	for ( int i = 0; i < count; i++ )
+	{
+		CNetworkStringTableItem *p = &m_pItems->Element( i );
+
+		// both ticks change what an update looks like
+		ChangedItem_t &created = m_ChangedItems[ m_ChangedItems.AddToTail() ];
+		created.tick = p->GetTickCreated();
+		created.item = i;
+
+		if ( p->GetTickChanged() != p->GetTickCreated() )
+		{
+			ChangedItem_t &changed = m_ChangedItems[ m_ChangedItems.AddToTail() ];
+			changed.tick = p->GetTickChanged();
+			changed.item = i;
+		}
+	}
+
+	qsort( m_ChangedItems.Base(), m_ChangedItems.Count(), sizeof( ChangedItem_t ), CompareChangedItemTicks );
+	m_bChangedItemsValid = true;
+}
+
+static int __cdecl CompareItemIndices( const int *a, const int *b )
+{
+	return *a - *b;
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Writes the items a client that acked tick_ack is missing.  The
+//			encoding only depends on which items changed or were created
+//			after tick_ack, so clients whose acks fall between the same two
+//			changes get the same bits.  Those are cached until the table
+//			changes again, a map change join storm encodes the tables once.
+//-----------------------------------------------------------------------------
 int CNetworkStringTable::WriteUpdate( CBaseClient *client, bf_write &buf, int tick_ack )
+{
+	// rollback tables change under the index, tracing writes per entry info
+	if ( m_bChangeHistoryEnabled || ( client && client->IsTracing() ) || !sv_stringtable_update_cache.GetBool() )
+	{
+		CUtlVector< int > items;
+		int count = m_pItems->Count();
+		for ( int i = 0; i < count; i++ )
+		{
+			// Client is up to date
+			if ( m_pItems->Element( i ).GetTickChanged() > tick_ack )
+			{
+				items.AddToTail( i );
+			}
+		}
+
+		return WriteUpdateEntries( client, buf, tick_ack, items.Base(), items.Count() );
+	}
+
+	// the first client to miss encodes, the others sending at the same time wait for its copy
+	AUTO_LOCK( m_UpdateCacheMutex );
+
+	FOR_EACH_VEC( m_UpdateCache, it )
+	{
+		const CachedUpdate_t *pCached = m_UpdateCache[ it ];
+		if ( tick_ack >= pCached->tickFrom && tick_ack < pCached->tickTo )
+		{
+			buf.WriteBits( pCached->data.Base(), pCached->nBits );
+			ETWMark2I( GetTableName(), pCached->entries, pCached->nBits );
+			return pCached->entries;
+		}
+	}
+
+	if ( !m_bChangedItemsValid )
+	{
+		BuildChangedItems();
+	}
+
+	// items changed since tick_ack, and the changes around it the same update is good for
+	int tickFrom = INT_MIN;
+	int tickTo = INT_MAX;
+	CUtlVector< int > items;
+	for ( int i = m_ChangedItems.Count() - 1; i >= 0; i-- )
+	{
+		const ChangedItem_t &changed = m_ChangedItems[ i ];
+		if ( changed.tick <= tick_ack )
+		{
+			tickFrom = changed.tick;
+			break;
+		}
+
+		tickTo = changed.tick;
+		if ( m_pItems->Element( changed.item ).GetTickChanged() == changed.tick )
+		{
+			// the item's last change, earlier ones are skipped
+			items.AddToTail( changed.item );
+		}
+	}
+	items.Sort( CompareItemIndices );
+
+	// an item can change more than once in a tick
+	int nUnique = 0;
+	for ( int i = 0; i < items.Count(); i++ )
+	{
+		if ( !nUnique || items[ nUnique - 1 ] != items[ i ] )
+		{
+			items[ nUnique++ ] = items[ i ];
+		}
+	}
+	items.SetCountNonDestructively( nUnique );
+
+	int nStartBit = buf.GetNumBitsWritten();
+	int entries = WriteUpdateEntries( client, buf, tick_ack, items.Base(), items.Count() );
+	if ( buf.IsOverflowed() )
+		return entries;
+
+	CachedUpdate_t *pCached = new CachedUpdate_t;
+	pCached->tickFrom = tickFrom;
+	pCached->tickTo = tickTo;
+	pCached->entries = entries;
+	pCached->nBits = buf.GetNumBitsWritten() - nStartBit;
+	pCached->data.SetCount( Bits2Bytes( pCached->nBits ) );
+
+	bf_read written( buf.GetBasePointer(), buf.GetNumBytesWritten() );
+	written.Seek( nStartBit );
+	written.ReadBits( pCached->data.Base(), pCached->nBits );
+
+	// acks usually bunch up on a few ticks, keep the latest ones
+	if ( m_UpdateCache.Count() >= 8 )
+	{
+		delete m_UpdateCache[ 0 ];
+		m_UpdateCache.Remove( 0 );
+	}
+	m_UpdateCache.AddToTail( pCached );
+
+	return entries;
+}
+
+int CNetworkStringTable::WriteUpdateEntries( CBaseClient *client, bf_write &buf, int tick_ack, const int *pItems, int nItems )
 {
 	CUtlVector< StringHistoryEntry > history;
 
@@ -507,16 +686,11 @@ int CNetworkStringTable::WriteUpdate( CBaseClient *client, bf_write &buf, int ti
 	int lastEntry = -1;
 	int nTableStartBit = buf.GetNumBitsWritten();
 
-	int count = m_pItems->Count();
-
-	for ( int i = 0; i < count; i++ )
+	for ( int iItem = 0; iItem < nItems; iItem++ )
 	{
+		int i = pItems[ iItem ];
 		CNetworkStringTableItem *p = &m_pItems->Element( i );
 
-		// Client is up to date
-		if ( p->GetTickChanged() <= tick_ack )
-			continue;
-
 		int nStartBit = buf.GetNumBitsWritten();
 
 		// Write Entry index
@@ -1016,6 +1190,32 @@ void CNetworkStringTable::DataChanged( int stringNumber, CNetworkStringTableItem
 
 	// Mark table as changed
 	m_nLastChangedTick = m_nTickCount;
+
+#ifndef SHARED_NET_STRING_TABLES
+	InvalidateUpdateCache( false );
+
+	// client side items aren't networked
+	AUTO_LOCK( m_UpdateCacheMutex );
+	if ( stringNumber >= 0 && m_bChangedItemsValid )
+	{
+		if ( m_ChangedItems.Count() && m_ChangedItems.Tail().tick > m_nTickCount )
+		{
+			// out of order, CopyStringTable replays old ticks
+			InvalidateUpdateCache( true );
+		}
+		else if ( m_ChangedItems.Count() > 2 * (int)m_pItems->Count() + 64 )
+		{
+			// mostly items that changed again since, rebuild it when it's needed
+			InvalidateUpdateCache( true );
+		}
+		else
+		{
+			ChangedItem_t &changed = m_ChangedItems[ m_ChangedItems.AddToTail() ];
+			changed.tick = m_nTickCount;
+			changed.item = stringNumber;
+		}
+	}
+#endif
 	
 	// Invoke callback if one was installed
 	
@@ -1259,6 +1459,7 @@ CNetworkStringTableContainer::CNetworkStringTableContainer( void )
 	m_bLocked = true;
 	m_nTickCount = 0;
 	m_bEnableRollback = false;
+	m_nRemovedTableChanges = 0;
 }
 
 //-----------------------------------------------------------------------------
@@ -1493,13 +1694,13 @@ bool CNetworkStringTableContainer::ReadStringTables( bf_read& buf )
 		Assert( table );
 
 		// Now read the data for the table
-		if ( table && !table->ReadStringTable( buf ) )
+		if ( !table )
 		{
-			Host_Error( "Error reading string table %s\n", tablename );
+			Warning( "Could not find table \"%s\"\n", tablename );
 		}
-		else
+		else if ( !table->ReadStringTable( buf ) )
 		{
-			Warning( "Could not find table \"%s\"\n", tablename );
+			Host_Error( "Error reading string table %s\n", tablename );
 		}
 	}
 
@@ -1569,6 +1770,22 @@ void CNetworkStringTableContainer::DirectUpdate( int tick_ack )
 	}
 }
 
+//-----------------------------------------------------------------------------
+// Purpose: Returns a count that changes whenever the networked items of any
+//			table do, or tables are created or removed
+//-----------------------------------------------------------------------------
+int CNetworkStringTableContainer::GetChangeCount( void ) const
+{
+	int nChanges = m_nRemovedTableChanges;
+
+	for ( int i = 0; i < m_Tables.Count(); i++ )
+	{
+		nChanges += m_Tables[ i ]->GetChangeCount();
+	}
+
+	return nChanges;
+}
+
 void CNetworkStringTableContainer::EnableRollback( bool bState )
 {
 	// we can't dis/enable rollback if we already created tabled
@@ -1634,6 +1851,9 @@ void CNetworkStringTableContainer::RemoveAllTables( void )
 	{
 		CNetworkStringTable *table = m_Tables[ 0 ];
 		m_Tables.Remove( 0 );
+#ifndef SHARED_NET_STRING_TABLES
+		m_nRemovedTableChanges += table->GetChangeCount();
+#endif
 		delete table;
 	}
 }
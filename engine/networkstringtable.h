@@ -16,6 +16,7 @@
 #include <utldict.h>
 #include <utlbuffer.h>
 #include "tier1/bitbuf.h"
+#include "tier0/threadtools.h"
 
 class SVC_CreateStringTable;
 class CBaseClient;
@@ -90,6 +91,8 @@ public:
 	void			WriteStringTable( bf_write& buf );
 	bool			ReadStringTable( bf_read& buf );
 
+	int				GetChangeCount( void ) const	{ return m_nChangeCount; }	// changes every time the networked items do
+
 	bool			WriteBaselines( SVC_CreateStringTable &msg, char *msg_buffer, int msg_buffer_size );
 #endif
 
@@ -107,6 +110,13 @@ public:
 protected:
 	void			DataChanged( int stringNumber, CNetworkStringTableItem *item );
 
+#ifndef SHARED_NET_STRING_TABLES
+	// Changed item index & update cache
+	void			InvalidateUpdateCache( bool bChangedItems );
+	void			BuildChangedItems( void );
+	int				WriteUpdateEntries( CBaseClient *client, bf_write &buf, int tick_ack, const int *pItems, int nItems );
+#endif
+
 	// Destroy string table
 	void			DeleteAllStrings( void );
 
@@ -139,6 +149,34 @@ protected:
 
 	INetworkStringDict		*m_pItems;
 	INetworkStringDict		*m_pItemsClientSide;	 // For m_bAllowClientSideAddString, these items are non-networked and are referenced by a negative string index!!!
+
+#ifndef SHARED_NET_STRING_TABLES
+	struct ChangedItem_t
+	{
+		int		tick;		// tick the item was created or changed
+		int		item;
+	};
+
+	// Encoded update of every client that acked a tick in [tickFrom, tickTo)
+	struct CachedUpdate_t
+	{
+		int					tickFrom;
+		int					tickTo;
+		int					entries;
+		int					nBits;
+		CUtlVector< byte >	data;
+	};
+
+	// Networked items in the order they were created or changed, so updates don't scan the whole table
+	CUtlVector< ChangedItem_t >		m_ChangedItems;
+	bool							m_bChangedItemsValid;
+
+	CUtlVector< CachedUpdate_t * >	m_UpdateCache;
+	int								m_nChangeCount;
+
+	// snapshots are sent on the job pool, clients share the cache and the index
+	CThreadFastMutex				m_UpdateCacheMutex;
+#endif
 };
 
 //-----------------------------------------------------------------------------
@@ -182,6 +220,8 @@ public:
 	void		WriteUpdateMessage( CBaseClient *client, int tick_ack, bf_write &buf );
 	void		WriteBaselines( bf_write &buf );
 	void		DirectUpdate( int tick_ack );	// fill mirror table directly with updates
+
+	int			GetChangeCount( void ) const;	// changes every time any table does, for caching what is built from the tables
 #endif
 
 	void		TriggerCallbacks( int tick_ack ); // fire callback functions 
@@ -205,6 +245,7 @@ private:
 	int			m_nTickCount;		// current tick
 	bool		m_bLocked;			// currently locked?
 	bool		m_bEnableRollback;	// enables rollback feature
+	int			m_nRemovedTableChanges;	// changes of tables that were removed, keeps GetChangeCount() from going back
 
 	CUtlVector < CNetworkStringTable* > m_Tables;	// the string tables
 };
@@ -180,6 +180,7 @@ class IServerGameTags;
 extern IServerGameDLL	*serverGameDLL;
 extern int g_iServerGameDLLVersion;
 extern IServerGameEnts *serverGameEnts;
+extern int g_iServerGameEntsVersion;	// This matches the number at the end of the interface name (so for "ServerGameEnts002", this would be 2).
 
 extern IServerGameClients *serverGameClients;
 extern int g_iServerGameClientsVersion;	// This matches the number at the end of the interface name (so for "ServerGameClients004", this would be 4).
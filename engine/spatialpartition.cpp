@@ -10,6 +10,7 @@
 //===========================================================================//
 
 #include "mathlib/vector.h"
+#include "mathlib/ssemath.h"
 #include "utlhash.h"
 #include "utllinkedlist.h"
 #include "utllinkedlist.h"
@@ -116,6 +117,8 @@ struct LeafListData_t
 {
 	UtlHashFixedHandle_t		m_hVoxel;	// Voxel handle the entity is in.
 	intp					m_iEntity;	// Entity list index for voxel
+	intp					m_iVoxelLeaf;	// Bounds leaf of the voxel (m_aVoxelLeafs).
+	int						m_iLeafSlot;	// Entity's slot in the bounds leaf.
 };
 
 typedef CUtlFixedLinkedList<LeafListData_t>	CLeafList;
@@ -139,6 +142,8 @@ static Color s_pVoxelColor[9] =
 };
 
 
+static ConVar partition_voxel_leaf_bounds( "partition_voxel_leaf_bounds", "1", 0, "Enumerate spatial partition voxels from their element bounds arrays instead of their entity lists." );
+
 // bounds of the spatial partition
 static Vector s_PartitionMin( MIN_COORD_FLOAT, MIN_COORD_FLOAT, MIN_COORD_FLOAT );
 static Vector s_PartitionMax( MAX_COORD_FLOAT, MAX_COORD_FLOAT, MAX_COORD_FLOAT );
@@ -161,6 +166,113 @@ public:
 	SpatialPartitionHandle_t m_handle;
 	uint16 m_nListMask;
 };
+
+//-----------------------------------------------------------------------------
+// Bounds of four elements of a voxel, one register per axis so they can be
+// tested against a query with SIMD compares.
+//-----------------------------------------------------------------------------
+struct VoxelBoundsGroup_t
+{
+	fltx4	m_f4Mins[3];
+	fltx4	m_f4Maxs[3];
+};
+
+struct VoxelLeafElement_t
+{
+	SpatialPartitionHandle_t	m_handle;
+	uint16						m_nListMask;
+	intp						m_iLeafList;	// Leaf list entry that points at this slot.
+};
+
+//-----------------------------------------------------------------------------
+// Elements of a single voxel stored as arrays. Queries reject elements from the
+// contiguous bounds without following the entity list into each EntityInfo_t.
+// Unused lanes of the last group hold an inverted box that never intersects.
+//-----------------------------------------------------------------------------
+class CVoxelLeaf
+{
+public:
+	CVoxelLeaf() : m_nVoxel( 0 ) {}
+
+	int Count() const	{ return m_Elements.Count(); }
+
+	// Returns the slot of the new element
+	int AddElement( SpatialPartitionHandle_t hPartition, uint16 nListMask, intp iLeafList, const Vector &vecMin, const Vector &vecMax );
+
+	// Fills the slot with the last element, returns the leaf list entry of the
+	// element that moved or CLeafList::InvalidIndex()
+	intp RemoveElement( int iSlot );
+
+	void SetBounds( int iSlot, const Vector &vecMin, const Vector &vecMax );
+
+	unsigned int																	m_nVoxel;
+	CUtlVector< VoxelBoundsGroup_t, CUtlMemoryAligned< VoxelBoundsGroup_t, 16 > >	m_Groups;
+	CUtlVector< VoxelLeafElement_t >												m_Elements;
+};
+
+int CVoxelLeaf::AddElement( SpatialPartitionHandle_t hPartition, uint16 nListMask, intp iLeafList, const Vector &vecMin, const Vector &vecMax )
+{
+	int iSlot = m_Elements.AddToTail();
+	m_Elements[iSlot].m_handle = hPartition;
+	m_Elements[iSlot].m_nListMask = nListMask;
+	m_Elements[iSlot].m_iLeafList = iLeafList;
+
+	if ( ( iSlot & 3 ) == 0 )
+	{
+		VoxelBoundsGroup_t &group = m_Groups[ m_Groups.AddToTail() ];
+		for ( int i = 0; i < 3; ++i )
+		{
+			group.m_f4Mins[i] = Four_FLT_MAX;
+			group.m_f4Maxs[i] = Four_Negative_FLT_MAX;
+		}
+	}
+
+	SetBounds( iSlot, vecMin, vecMax );
+	return iSlot;
+}
+
+intp CVoxelLeaf::RemoveElement( int iSlot )
+{
+	int iLast = m_Elements.Count() - 1;
+	VoxelBoundsGroup_t &lastGroup = m_Groups[ iLast >> 2 ];
+
+	intp iMoved = CLeafList::InvalidIndex();
+	if ( iSlot != iLast )
+	{
+		VoxelBoundsGroup_t &group = m_Groups[ iSlot >> 2 ];
+		for ( int i = 0; i < 3; ++i )
+		{
+			SubFloat( group.m_f4Mins[i], iSlot & 3 ) = SubFloat( lastGroup.m_f4Mins[i], iLast & 3 );
+			SubFloat( group.m_f4Maxs[i], iSlot & 3 ) = SubFloat( lastGroup.m_f4Maxs[i], iLast & 3 );
+		}
+		m_Elements[iSlot] = m_Elements[iLast];
+		iMoved = m_Elements[iSlot].m_iLeafList;
+	}
+
+	for ( int i = 0; i < 3; ++i )
+	{
+		SubFloat( lastGroup.m_f4Mins[i], iLast & 3 ) = FLT_MAX;
+		SubFloat( lastGroup.m_f4Maxs[i], iLast & 3 ) = -FLT_MAX;
+	}
+	m_Elements.Remove( iLast );
+
+	if ( ( iLast & 3 ) == 0 )
+	{
+		m_Groups.Remove( m_Groups.Count() - 1 );
+	}
+	return iMoved;
+}
+
+inline void CVoxelLeaf::SetBounds( int iSlot, const Vector &vecMin, const Vector &vecMax )
+{
+	VoxelBoundsGroup_t &group = m_Groups[ iSlot >> 2 ];
+	for ( int i = 0; i < 3; ++i )
+	{
+		SubFloat( group.m_f4Mins[i], iSlot & 3 ) = vecMin[i];
+		SubFloat( group.m_f4Maxs[i], iSlot & 3 ) = vecMax[i];
+	}
+}
+
 //-----------------------------------------------------------------------------
 // A single voxel hash
 //-----------------------------------------------------------------------------
@@ -186,6 +298,9 @@ public:
 	void RemoveFromTree( SpatialPartitionHandle_t hPartition );
 	void UpdateListMask( SpatialPartitionHandle_t hPartition );
 
+	// Copies the handle's bounds and list mask into the bounds leaves of its voxels
+	void UpdateLeafBounds( SpatialPartitionHandle_t hPartition );
+
 	// Debug!
 	void RenderAllObjectsInTree( float flTime );
 	void RenderObjectsInPlayerLeafs( const Vector &vecPlayerMin, const Vector &vecPlayerMax, float flTime );
@@ -224,6 +339,9 @@ public:
 	// Enumeration method when only 1 voxel is ever visited
 	template <class T> bool EnumerateElementsInSingleVoxel( Voxel_t voxel, const T &intersectTest, SpatialPartitionListMask_t listMask, IPartitionEnumerator* pIterator );
 
+	// Enumerates a voxel from its bounds leaf, four elements at a time
+	template <class T> bool EnumerateElementsInVoxelLeaf( Voxel_t voxel, const T &intersectTest, SpatialPartitionListMask_t listMask, IPartitionEnumerator* pIterator, bool bVisit );
+
 	bool EnumerateElementsAlongRay_ExtrudedRaySlice( SpatialPartitionListMask_t listMask, IPartitionEnumerator *pIterator, const CIntersectSweptBox &intersectSweptBox,	int voxelMin[3], int voxelMax[3], int iAxis, int *pStep );
 private:
 	bool EnumerateElementsAlongRay_Ray( SpatialPartitionListMask_t listMask, const Ray_t &ray, const Vector &vecInvDelta, const Vector &vecEnd, IPartitionEnumerator* pIterator );
@@ -237,6 +355,8 @@ private:
 	CHashTable										m_aVoxelHash;		// Voxel tree (hash) - data = entity list head handle (m_aEntityList)
 	int												m_nVoxelDelta[3];	// Voxel world - width(Dx), height(Dy), depth(Dz)
 	CUtlFixedLinkedList<CSpatialEntry>				m_aEntityList;	// Pool - Linked list(multilist) of entities per leaf.
+	CHashTable										m_aVoxelLeafHash;	// Voxel tree (hash) - data = bounds leaf index (m_aVoxelLeafs)
+	CUtlFixedLinkedList<CVoxelLeaf>					m_aVoxelLeafs;		// Pool - Element bounds per voxel.
 	CVoxelTree										*m_pTree;
 	int												m_nLevel;
 	float											m_flVoxelSize;
@@ -681,6 +801,10 @@ void CVoxelHash::Init( CVoxelTree *pPartition, const Vector &worldmin, const Vec
 	}
 	m_aEntityList.Purge();
 	m_aEntityList.SetGrowSize( nGrowSize );
+
+	m_aVoxelLeafHash.RemoveAll();
+	m_aVoxelLeafs.Purge();
+	m_aVoxelLeafs.SetGrowSize( nGrowSize );
 }
 
 
@@ -691,6 +815,8 @@ void CVoxelHash::Shutdown( void )
 {
 	m_aEntityList.Purge();
 	m_aVoxelHash.Purge();
+	m_aVoxelLeafs.Purge();
+	m_aVoxelLeafHash.Purge();
 }
 
 
@@ -748,11 +874,27 @@ void CVoxelHash::InsertIntoTree( SpatialPartitionHandle_t hPartition, Voxel_t vo
 					m_aEntityList.LinkBefore( iHead, iEntity );
 					m_aVoxelHash[hHash] = iEntity;
 				}
+
+				// Bounds leaf.
+				intp iVoxelLeaf;
+				UtlHashFixedHandle_t hLeafHash = m_aVoxelLeafHash.Find( voxel.uiVoxel );
+				if ( hLeafHash == m_aVoxelLeafHash.InvalidHandle() )
+				{
+					iVoxelLeaf = m_aVoxelLeafs.Alloc( true );
+					m_aVoxelLeafs[iVoxelLeaf].m_nVoxel = voxel.uiVoxel;
+					m_aVoxelLeafHash.FastInsert( voxel.uiVoxel, iVoxelLeaf );
+				}
+				else
+				{
+					iVoxelLeaf = m_aVoxelLeafHash.Element( hLeafHash );
+				}
 				
 				// Leaf list.
 				intp iLeafList = leafList.Alloc( true );
 				leafList[iLeafList].m_hVoxel = hHash;
 				leafList[iLeafList].m_iEntity = iEntity;
+				leafList[iLeafList].m_iVoxelLeaf = iVoxelLeaf;
+				leafList[iLeafList].m_iLeafSlot = m_aVoxelLeafs[iVoxelLeaf].AddElement( hPartition, nListMask, iLeafList, info.m_vecMin, info.m_vecMax );
 				
 				if ( info.m_iLeafList[treeId] == leafList.InvalidIndex() )
 				{
@@ -786,6 +928,24 @@ void CVoxelHash::RemoveFromTree( SpatialPartitionHandle_t hPartition )
 		// Get the next voxel - if any.
 		iNext = leafList.Next( iLeaf );
 
+		// Remove from the bounds leaf, the element that took over the slot has to point at it.
+		intp iVoxelLeaf = leafList[iLeaf].m_iVoxelLeaf;
+		if ( iVoxelLeaf != m_aVoxelLeafs.InvalidIndex() )
+		{
+			CVoxelLeaf &voxelLeaf = m_aVoxelLeafs[iVoxelLeaf];
+			intp iMoved = voxelLeaf.RemoveElement( leafList[iLeaf].m_iLeafSlot );
+			if ( iMoved != leafList.InvalidIndex() )
+			{
+				leafList[iMoved].m_iLeafSlot = leafList[iLeaf].m_iLeafSlot;
+			}
+
+			if ( voxelLeaf.Count() == 0 )
+			{
+				m_aVoxelLeafHash.Remove( m_aVoxelLeafHash.Find( voxelLeaf.m_nVoxel ) );
+				m_aVoxelLeafs.Remove( iVoxelLeaf );
+			}
+		}
+
 		UtlHashFixedHandle_t hHash = leafList[iLeaf].m_hVoxel;
 		if ( hHash == m_aVoxelHash.InvalidHandle() )
 		{
@@ -878,6 +1038,22 @@ void CVoxelHash::UpdateListMask( SpatialPartitionHandle_t hPartition )
 			}
 		}
 	}
+
+	UpdateLeafBounds( hPartition );
+}
+
+void CVoxelHash::UpdateLeafBounds( SpatialPartitionHandle_t hPartition )
+{
+	EntityInfo_t &info = m_pTree->EntityInfo( hPartition );
+	CLeafList &leafList = m_pTree->LeafList();
+
+	for ( intp iLeaf = info.m_iLeafList[m_pTree->GetTreeId()]; iLeaf != leafList.InvalidIndex(); iLeaf = leafList.Next( iLeaf ) )
+	{
+		CVoxelLeaf &voxelLeaf = m_aVoxelLeafs[ leafList[iLeaf].m_iVoxelLeaf ];
+		int iSlot = leafList[iLeaf].m_iLeafSlot;
+		voxelLeaf.m_Elements[iSlot].m_nListMask = info.m_fList;
+		voxelLeaf.SetBounds( iSlot, info.m_vecMin, info.m_vecMax );
+	}
 }
 
 //-----------------------------------------------------------------------------
@@ -964,6 +1140,11 @@ public:
 	{
 		m_pVisits = pPartition->GetVisits();
 		m_iTree = pPartition->GetTreeId();
+		for ( int i = 0; i < 3; ++i )
+		{
+			m_f4QueryMins[i] = Four_Negative_FLT_MAX;
+			m_f4QueryMaxs[i] = Four_FLT_MAX;
+		}
 	}
 
 	~CPartitionVisitor()
@@ -982,11 +1163,45 @@ public:
 		return true;
 	}
 
+	// Box that contains everything the query can intersect
+	void SetQueryBounds( const Vector &vecMins, const Vector &vecMaxs )
+	{
+		for ( int i = 0; i < 3; ++i )
+		{
+			m_f4QueryMins[i] = ReplicateX4( vecMins[i] );
+			m_f4QueryMaxs[i] = ReplicateX4( vecMaxs[i] );
+		}
+	}
+
+	// Returns a bit per element of the group whose bounds touch the query bounds
+	int IntersectsQueryBounds( const VoxelBoundsGroup_t &group ) const
+	{
+		fltx4 f4Hit = AndSIMD( CmpLeSIMD( group.m_f4Mins[0], m_f4QueryMaxs[0] ), CmpGeSIMD( group.m_f4Maxs[0], m_f4QueryMins[0] ) );
+		f4Hit = AndSIMD( f4Hit, AndSIMD( CmpLeSIMD( group.m_f4Mins[1], m_f4QueryMaxs[1] ), CmpGeSIMD( group.m_f4Maxs[1], m_f4QueryMins[1] ) ) );
+		f4Hit = AndSIMD( f4Hit, AndSIMD( CmpLeSIMD( group.m_f4Mins[2], m_f4QueryMaxs[2] ), CmpGeSIMD( group.m_f4Maxs[2], m_f4QueryMins[2] ) ) );
+		return TestSignSIMD( f4Hit );
+	}
+
 private:
 	CPartitionVisits *m_pVisits;
 	int m_iTree;
+	fltx4 m_f4QueryMins[3];
+	fltx4 m_f4QueryMaxs[3];
 };
 
+// Bounds of a ray or swept box, bloated so they never reject what the exact test accepts
+static void ComputeRayQueryBounds( const Ray_t &ray, Vector &vecMins, Vector &vecMaxs )
+{
+	Vector vecEnd;
+	VectorAdd( ray.m_Start, ray.m_Delta, vecEnd );
+	VectorMin( ray.m_Start, vecEnd, vecMins );
+	VectorMax( ray.m_Start, vecEnd, vecMaxs );
+
+	Vector vecBloat( ray.m_Extents.x + SPHASH_EPS, ray.m_Extents.y + SPHASH_EPS, ray.m_Extents.z + SPHASH_EPS );
+	VectorSubtract( vecMins, vecBloat, vecMins );
+	VectorAdd( vecMaxs, vecBloat, vecMaxs );
+}
+
 /*
 class CIntersectPoint : public CPartitionVisitor
 {
@@ -1016,6 +1231,7 @@ class CIntersectBox : public CPartitionVisitor
 public:
 	CIntersectBox( CVoxelTree *pPartition, const Vector &vecMins, const Vector &vecMaxs ) : CPartitionVisitor( pPartition ), m_vecMins( vecMins ), m_vecMaxs( vecMaxs )
 	{
+		SetQueryBounds( vecMins, vecMaxs );
 	}
 
 	bool Intersects( const float *pMins, const float *pMaxs ) const
@@ -1043,6 +1259,10 @@ public:
 		m_f4Start = LoadAlignedSIMD( ray.m_Start.Base() );
 		m_f4Delta = LoadAlignedSIMD( ray.m_Delta.Base() );
 		m_f4InvDelta = LoadUnaligned3SIMD( vecInvDelta.Base() );
+
+		Vector vecMins, vecMaxs;
+		ComputeRayQueryBounds( ray, vecMins, vecMaxs );
+		SetQueryBounds( vecMins, vecMaxs );
 	}
 
 	bool Intersects( const float *pMins, const float *pMaxs ) const
@@ -1073,6 +1293,10 @@ public:
 		m_f4Delta = LoadAlignedSIMD( ray.m_Delta.Base() );
 		m_f4Extents = LoadAlignedSIMD( ray.m_Extents.Base() );
 		m_f4InvDelta = LoadUnaligned3SIMD( vecInvDelta.Base() );
+
+		Vector vecMins, vecMaxs;
+		ComputeRayQueryBounds( ray, vecMins, vecMaxs );
+		SetQueryBounds( vecMins, vecMaxs );
 	}
 
 	bool Intersects( const float *pMins, const float *pMaxs ) const
@@ -1102,6 +1326,9 @@ private:
 template <class T> 
 bool CVoxelHash::EnumerateElementsInVoxel( Voxel_t voxel, const T &intersectTest, SpatialPartitionListMask_t listMask, IPartitionEnumerator* pIterator )
 {
+	if ( partition_voxel_leaf_bounds.GetBool() )
+		return EnumerateElementsInVoxelLeaf( voxel, intersectTest, listMask, pIterator, true );
+
 	// If the voxel doesn't exist, nothing to iterate over
 	UtlHashFixedHandle_t hHash = m_aVoxelHash.Find( voxel.uiVoxel );
 	if ( hHash == m_aVoxelHash.InvalidHandle() )
@@ -1150,6 +1377,9 @@ bool CVoxelHash::EnumerateElementsInSingleVoxel( Voxel_t voxel, const T &interse
 {
 	// NOTE: We don't have to do the enum id checking, nor do we have to up the
 	// nesting level, since this only visits 1 voxel.
+	if ( partition_voxel_leaf_bounds.GetBool() )
+		return EnumerateElementsInVoxelLeaf( voxel, intersectTest, listMask, pIterator, false );
+
 	intp iEntityList;
 	UtlHashFixedHandle_t hHash = m_aVoxelHash.Find( voxel.uiVoxel );
 	if ( hHash != m_aVoxelHash.InvalidHandle() )
@@ -1183,6 +1413,74 @@ bool CVoxelHash::EnumerateElementsInSingleVoxel( Voxel_t voxel, const T &interse
 	return true;
 }
 
+
+//-----------------------------------------------------------------------------
+// Enumerates a voxel from its bounds leaf. Elements whose bounds miss the query
+// bounds are rejected four at a time without touching their EntityInfo_t.
+//-----------------------------------------------------------------------------
+template <class T> 
+bool CVoxelHash::EnumerateElementsInVoxelLeaf( Voxel_t voxel, const T &intersectTest, 
+	SpatialPartitionListMask_t listMask, IPartitionEnumerator* pIterator, bool bVisit )
+{
+	UtlHashFixedHandle_t hHash = m_aVoxelLeafHash.Find( voxel.uiVoxel );
+	if ( hHash == m_aVoxelLeafHash.InvalidHandle() )
+		return true;
+
+	// The enumerator can remove, move or insert elements, which reorders the leaf
+	// or frees it. So the hits are copied out before the first callback.
+	CUtlVectorFixedGrowable< SpatialPartitionHandle_t, 128 > hits;
+	{
+		const CVoxelLeaf &voxelLeaf = m_aVoxelLeafs[ m_aVoxelLeafHash.Element( hHash ) ];
+		for ( int iGroup = 0; iGroup < voxelLeaf.m_Groups.Count(); ++iGroup )
+		{
+			int nHits = intersectTest.IntersectsQueryBounds( voxelLeaf.m_Groups[iGroup] );
+			for ( int iSlot = iGroup * 4; nHits != 0; ++iSlot, nHits >>= 1 )
+			{
+				if ( !( nHits & 1 ) || iSlot >= voxelLeaf.Count() )
+					continue;
+
+				const VoxelLeafElement_t &element = voxelLeaf.m_Elements[iSlot];
+				if ( element.m_handle == PARTITION_INVALID_HANDLE )
+					continue;
+
+				// Keep going if this dude isn't in the list
+				if ( !( listMask & element.m_nListMask ) )
+					continue;
+
+				hits.AddToTail( element.m_handle );
+			}
+		}
+	}
+
+	int treeId = m_pTree->GetTreeId();
+	for ( int i = 0; i < hits.Count(); ++i )
+	{
+		SpatialPartitionHandle_t handle = hits[i];
+		EntityInfo_t &hInfo = m_pTree->EntityInfo( handle );
+
+		// An earlier callback may have taken it out of the tree or the list
+		if ( hInfo.m_nVisitBit[treeId] == (unsigned short)-1 || !( listMask & hInfo.m_fList ) )
+			continue;
+
+		if ( hInfo.m_flags & ENTITY_HIDDEN )
+			continue;
+
+		// Has this handle already been visited?
+		if ( bVisit && !intersectTest.Visit( handle, hInfo ) )
+			continue;
+
+		// Intersection test
+		if ( !intersectTest.Intersects( hInfo.m_vecMin.Base(), hInfo.m_vecMax.Base() ) )
+			continue;
+
+		// Okay, this one is good...
+		if ( pIterator->EnumElement( hInfo.m_pHandleEntity ) == ITERATION_STOP )
+			return false;
+	}
+
+	return true;
+}
+
 	
 //-----------------------------------------------------------------------------
 // Purpose:
@@ -2026,7 +2324,21 @@ void CVoxelTree::InsertIntoTree( SpatialPartitionHandle_t hPartition, const Vect
 	info.m_vecMin = vecMin;
 	info.m_vecMax = vecMax;
 
-	if ( bDoInsert )
+	if ( !bDoInsert )
+	{
+		// Same voxels, only the copies of the bounds in their leaves change
+		bool bWasReading = ( m_pVisits[g_nThreadID] != NULL );
+		if ( !bWasReading )
+		{
+			m_lock.LockForRead();
+		}
+		m_pVoxelHash[ info.m_nLevel[m_TreeId] ].UpdateLeafBounds( hPartition );
+		if ( !bWasReading )
+		{
+			m_lock.UnlockRead();
+		}
+	}
+	else
 	{
 		bool bWasReading = ( m_pVisits[g_nThreadID] != NULL );
 		if ( bWasReading )
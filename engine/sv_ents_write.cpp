@@ -339,11 +339,12 @@ static inline void SV_WritePropsFromPackedEntity(
 
 	const void *pToData;
 	int nToBits;
+	ALIGN4 char unpackedData[MAX_PACKEDENTITY_DATA] ALIGN4_POST;
 
 	if ( pTo->IsCompressed() )
 	{
 		// let server uncompress PackedEntity
-		pToData = u.m_pServer->UncompressPackedEntity( pTo, nToBits );
+		pToData = u.m_pServer->UncompressPackedEntity( pTo, nToBits, unpackedData );
 	}
 	else
 	{
@@ -458,6 +459,48 @@ static bool SV_NeedsExplicitCreate( CEntityWriteInfo &u )
 }
 
 
+//-----------------------------------------------------------------------------
+// Purpose: Builds the key of this entity delta in the snapshot's delta memo.
+//  Returns false if the delta can't be shared with other clients.
+//-----------------------------------------------------------------------------
+static inline bool SV_GetEntityDeltaKey( CEntityWriteInfo &u, EntityDeltaKey_t &key )
+{
+	// HLTV relays have their own delta cache, the DTI instrumentation
+	// wants to see every encode. Only snapshots of the game server are
+	// purged after sending, see CGameServer::SendClientMessages.
+	if ( !u.m_bCullProps || g_bServerDTIEnabled || u.m_pServer->IsHLTV() || u.m_pServer->IsReplay() )
+		return false;
+
+	// the proxy recipients are the only per client input when culling props
+	const CSendProxyRecipients *pOldRecipients = u.m_pOldPack->GetRecipients();
+	const CSendProxyRecipients *pNewRecipients = u.m_pNewPack->GetRecipients();
+	int nOldRecipients = u.m_pOldPack->GetNumRecipients();
+	int nNewRecipients = u.m_pNewPack->GetNumRecipients();
+
+	if ( nOldRecipients + nNewRecipients > 32 )
+		return false;
+
+	int iClient = u.m_nClientEntity - 1;
+	unsigned int nRecipientBits = 0;
+
+	for ( int i=0; i < nOldRecipients; i++ )
+	{
+		nRecipientBits = ( nRecipientBits << 1 ) | ( pOldRecipients[i].m_Bits.Get( iClient ) ? 1 : 0 );
+	}
+
+	for ( int i=0; i < nNewRecipients; i++ )
+	{
+		nRecipientBits = ( nRecipientBits << 1 ) | ( pNewRecipients[i].m_Bits.Get( iClient ) ? 1 : 0 );
+	}
+
+	key.m_pOldPack = u.m_pOldPack;
+	key.m_pNewPack = u.m_pNewPack;
+	key.m_nFromTick = u.m_pFromSnapshot->m_nTickCount;
+	key.m_nRecipientBits = nRecipientBits;
+	return true;
+}
+
+
 static inline void SV_DetermineUpdateType( CEntityWriteInfo &u )
 {
 	// Figure out how we want to update the entity.
@@ -533,6 +576,39 @@ static inline void SV_DetermineUpdateType( CEntityWriteInfo &u )
 	}
 #endif
 
+	// clients that ack the same tick share the delta bits written for this snapshot
+	EntityDeltaKey_t deltaKey;
+	bool bDeltaMemo = SV_GetEntityDeltaKey( u, deltaKey );
+
+	if ( bDeltaMemo )
+	{
+		const unsigned char *pDeltaBits;
+		int nDeltaBits;
+
+		if ( u.m_pToSnapshot->m_DeltaMemo.FindDeltaBits( deltaKey, pDeltaBits, nDeltaBits ) )
+		{
+			if ( nDeltaBits > 0 )
+			{
+				// Write a header.
+				SV_WriteDeltaHeader( u, u.m_nNewEntity, FHDR_ZERO );
+
+				// just write the shared bit stream
+				u.m_pBuf->WriteBits( pDeltaBits, nDeltaBits );
+
+				u.m_UpdateType = DeltaEnt;
+			}
+			else
+			{
+				u.m_UpdateType = PreserveEnt;
+			}
+
+			VPROF_INCREMENT_COUNTER( "EntityDeltaMemo hits", 1 );
+			return;
+		}
+
+		VPROF_INCREMENT_COUNTER( "EntityDeltaMemo misses", 1 );
+	}
+
 	int checkProps[MAX_DATATABLE_PROPS];
 	int nCheckProps = u.m_pNewPack->GetPropsChangedAfterTick( u.m_pFromSnapshot->m_nTickCount, checkProps, ARRAYSIZE( checkProps ) );
 	
@@ -543,10 +619,12 @@ static inline void SV_DetermineUpdateType( CEntityWriteInfo &u )
 
 		const void *pOldData, *pNewData;
 		int nOldBits, nNewBits;
+		ALIGN4 char unpackedOldData[MAX_PACKEDENTITY_DATA] ALIGN4_POST;
+		ALIGN4 char unpackedNewData[MAX_PACKEDENTITY_DATA] ALIGN4_POST;
 
 		if ( u.m_pOldPack->IsCompressed() )
 		{
-			pOldData = u.m_pServer->UncompressPackedEntity( u.m_pOldPack, nOldBits );
+			pOldData = u.m_pServer->UncompressPackedEntity( u.m_pOldPack, nOldBits, unpackedOldData );
 		}
 		else
 		{
@@ -556,7 +634,7 @@ static inline void SV_DetermineUpdateType( CEntityWriteInfo &u )
 
 		if ( u.m_pNewPack->IsCompressed() )
 		{
-			pNewData = u.m_pServer->UncompressPackedEntity( u.m_pNewPack, nNewBits );
+			pNewData = u.m_pServer->UncompressPackedEntity( u.m_pNewPack, nNewBits, unpackedNewData );
 		}
 		else
 		{
@@ -590,11 +668,18 @@ static inline void SV_DetermineUpdateType( CEntityWriteInfo &u )
 #if defined( DEBUG_NETWORKING )
 		int startBit = u.m_pBuf->GetNumBitsWritten();
 #endif
+		int nPropsStartBit = u.m_pBuf->GetNumBitsWritten();
 		SV_WritePropsFromPackedEntity( u, checkProps, nCheckProps );
 #if defined( DEBUG_NETWORKING )
 		int endBit = u.m_pBuf->GetNumBitsWritten();
 		TRACE_PACKET( ( "    Delta Bits (%d) = %d (%d bytes)\n", u.m_nNewEntity, (endBit - startBit), ( (endBit - startBit) + 7 ) / 8 ) );
 #endif
+		if ( bDeltaMemo && !u.m_pBuf->IsOverflowed() )
+		{
+			int nDeltaBits = u.m_pBuf->GetNumBitsWritten() - nPropsStartBit;
+			u.m_pToSnapshot->m_DeltaMemo.AddDeltaBits( deltaKey, u.m_pBuf, nPropsStartBit, nDeltaBits );
+		}
+
 		// If the numbers are the same, then the entity was in the old and new packet.
 		// Just delta compress the differences.
 		u.m_UpdateType = DeltaEnt;
@@ -619,6 +704,12 @@ static inline void SV_DetermineUpdateType( CEntityWriteInfo &u )
 #endif
 		}
 #endif
+		if ( bDeltaMemo )
+		{
+			// no bits changed, PreserveEnt
+			u.m_pToSnapshot->m_DeltaMemo.AddDeltaBits( deltaKey, NULL, 0, 0 );
+		}
+
 		u.m_UpdateType = PreserveEnt;
 	}
 }
@@ -698,10 +789,11 @@ static inline void SV_WriteEnterPVS( CEntityWriteInfo &u )
 
 	const void *pToData;
 	int nToBits;
+	ALIGN4 char unpackedData[MAX_PACKEDENTITY_DATA] ALIGN4_POST;
 
 	if ( u.m_pNewPack->IsCompressed() )
 	{
-		pToData = u.m_pServer->UncompressPackedEntity( u.m_pNewPack, nToBits );
+		pToData = u.m_pServer->UncompressPackedEntity( u.m_pNewPack, nToBits, unpackedData );
 	}
 	else
 	{
@@ -867,7 +959,7 @@ Returns the size IN BITS of the message buffer created.
 =============
 */
 
-void CBaseServer::WriteDeltaEntities( CBaseClient *client, CClientFrame *to, CClientFrame *from, bf_write &pBuf )
+int CBaseServer::WriteDeltaEntities( CBaseClient *client, CClientFrame *to, CClientFrame *from, bf_write &pBuf )
 {
 	VPROF_BUDGET( "CBaseServer::WriteDeltaEntities", VPROF_BUDGETGROUP_OTHER_NETWORKING );
 	// Setup the CEntityWriteInfo structure.
@@ -1035,6 +1127,8 @@ void CBaseServer::WriteDeltaEntities( CBaseClient *client, CClientFrame *to, CCl
 	{
 		client->TraceNetworkData( pBuf, "Delta Finish" );
 	}
+
+	return u.m_nFullProps;
 }
 
 
@@ -21,6 +21,8 @@ DEFINE_FIXEDSIZE_ALLOCATOR( CFrameSnapshot, 64, 64 );
 
 
 static ConVar sv_creationtickcheck( "sv_creationtickcheck", "1", FCVAR_CHEAT | FCVAR_DEVELOPMENTONLY, "Do extended check for encoding of timestamps against tickcount" );
+static ConVar sv_packedentitycache( "sv_packedentitycache", "1024", 0, "Number of uncompressed packed entities to cache", true, 16, true, 16384 );
+static ConVar sv_deltamemo( "sv_deltamemo", "2048", 0, "Size in KB of the per snapshot cache of entity deltas shared between clients, 0 disables it", true, 0, false, 0 );
 extern	CGlobalVars g_ServerGlobalVariables;
 
 // Expose interface
@@ -32,6 +34,9 @@ CFrameSnapshotManager *framesnapshotmanager = &g_FrameSnapshotManager;
 //-----------------------------------------------------------------------------
 CFrameSnapshotManager::CFrameSnapshotManager( void ) : m_PackedEntitiesPool( MAX_EDICTS / 16, CUtlMemoryPool::GROW_SLOW )
 {
+	m_nDeferDeletes = 0;
+	m_nPackedEntityCacheHead = INVALID_UNPACKED_CACHE_INDEX;
+	m_nPackedEntityCacheTail = INVALID_UNPACKED_CACHE_INDEX;
 	COMPILE_TIME_ASSERT( INVALID_PACKED_ENTITY_HANDLE == 0 );
 	Q_memset( m_pPackedData, 0x00, MAX_EDICTS * sizeof(PackedEntityHandle_t) );
 
@@ -58,7 +63,9 @@ void CFrameSnapshotManager::LevelChanged()
 	Assert( m_FrameSnapshots.Count() == 0 );
 
 	// Release the most recent snapshot...
-	m_PackedEntityCache.RemoveAll();
+	m_PackedEntityCacheMutex.Lock();
+	ResetPackedEntityCache( 0 );
+	m_PackedEntityCacheMutex.Unlock();
 	COMPILE_TIME_ASSERT( INVALID_PACKED_ENTITY_HANDLE == 0 );
 	Q_memset( m_pPackedData, 0x00, MAX_EDICTS * sizeof(PackedEntityHandle_t) );
 }
@@ -68,6 +75,9 @@ CFrameSnapshot*	CFrameSnapshotManager::NextSnapshot( const CFrameSnapshot *pSnap
 	if ( !pSnapshot || ((unsigned short)pSnapshot->m_ListIndex == m_FrameSnapshots.InvalidIndex()) )
 		return NULL;
 
+	// other snapshot writers may be appending baselines to the list
+	AUTO_LOCK( m_FrameSnapshotsMutex );
+
 	int next = m_FrameSnapshots.Next(pSnapshot->m_ListIndex);
 
 	if ( next == m_FrameSnapshots.InvalidIndex() )
@@ -79,7 +89,10 @@ CFrameSnapshot*	CFrameSnapshotManager::NextSnapshot( const CFrameSnapshot *pSnap
 
 CFrameSnapshot*	CFrameSnapshotManager::CreateEmptySnapshot( int tickcount, int maxEntities )
 {
+	m_FrameSnapshotsMutex.Lock();
 	CFrameSnapshot *snap = new CFrameSnapshot;
+	m_FrameSnapshotsMutex.Unlock();
+
 	snap->AddReference();
 	snap->m_nTickCount = tickcount;
 	snap->m_nNumEntities = maxEntities;
@@ -100,6 +113,7 @@ CFrameSnapshot*	CFrameSnapshotManager::CreateEmptySnapshot( int tickcount, int m
 		entry++;
 	}
 
+	AUTO_LOCK( m_FrameSnapshotsMutex );
 	snap->m_ListIndex = m_FrameSnapshots.AddToTail( snap );
 	return snap;
 }
@@ -190,10 +204,60 @@ void CFrameSnapshotManager::DeleteFrameSnapshot( CFrameSnapshot* pSnapshot )
 		}
 	}
 
+	AUTO_LOCK( m_FrameSnapshotsMutex );
 	m_FrameSnapshots.Remove( pSnapshot->m_ListIndex );
 	delete pSnapshot;
 }
 
+//-----------------------------------------------------------------------------
+// Called when the last reference to a snapshot goes away
+//-----------------------------------------------------------------------------
+void CFrameSnapshotManager::ReleaseFrameSnapshot( CFrameSnapshot* pSnapshot )
+{
+	{
+		AUTO_LOCK( m_FrameSnapshotsMutex );
+
+		if ( m_nDeferDeletes > 0 )
+		{
+			// someone may still walk over this snapshot in WriteTempEntities
+			m_DeferredDeletes.AddToTail( pSnapshot );
+			return;
+		}
+	}
+
+	DeleteFrameSnapshot( pSnapshot );
+}
+
+void CFrameSnapshotManager::BeginDeferredDeletes()
+{
+	Assert( ThreadInMainThread() );
+
+	AUTO_LOCK( m_FrameSnapshotsMutex );
+	m_nDeferDeletes++;
+}
+
+void CFrameSnapshotManager::EndDeferredDeletes()
+{
+	Assert( ThreadInMainThread() );
+
+	CUtlVector<CFrameSnapshot*> deletes;
+
+	{
+		AUTO_LOCK( m_FrameSnapshotsMutex );
+		Assert( m_nDeferDeletes > 0 );
+
+		if ( --m_nDeferDeletes > 0 )
+			return;
+
+		deletes.Swap( m_DeferredDeletes );
+	}
+
+	FOR_EACH_VEC( deletes, i )
+	{
+		DeleteFrameSnapshot( deletes[i] );
+	}
+}
+
 void CFrameSnapshotManager::RemoveEntityReference( PackedEntityHandle_t handle )
 {
 	Assert( handle != INVALID_PACKED_ENTITY_HANDLE );
@@ -204,19 +268,12 @@ void CFrameSnapshotManager::RemoveEntityReference( PackedEntityHandle_t handle )
 	{
 		AUTO_LOCK( m_WriteMutex );
 
-		m_PackedEntitiesPool.Free( packedEntity );
-
 		// if we have a uncompression cache, remove reference too
-		FOR_EACH_VEC( m_PackedEntityCache, i )
-		{
-			UnpackedDataCache_t &pdc = m_PackedEntityCache[i];
-			if ( pdc.pEntity == packedEntity )
-			{
-				pdc.pEntity = NULL;
-				pdc.counter = 0;
-				break;
-			}
-		}
+		m_PackedEntityCacheMutex.Lock();
+		RemoveCachedUncompressedEntity( packedEntity );
+		m_PackedEntityCacheMutex.Unlock();
+
+		m_PackedEntitiesPool.Free( packedEntity );
 	}
 }
 
@@ -373,57 +430,153 @@ PackedEntity* CFrameSnapshotManager::GetPackedEntity( CFrameSnapshot* pSnapshot,
 
 
 // ------------------------------------------------------------------------------------------------ //
-// purpose: lookup cache if we have an uncompressed version of this packed entity
+// Uncompressed packed entity cache. Entries are found through m_PackedEntityCacheIndex and kept
+// in a LRU list, the tail entry is the one replaced on a miss. Data is copied in and out under
+// the cache mutex so parallel snapshot writers never see an entry replaced under them.
 // ------------------------------------------------------------------------------------------------ //
-UnpackedDataCache_t *CFrameSnapshotManager::GetCachedUncompressedEntity( PackedEntity *packedEntity )
+void CFrameSnapshotManager::ResetPackedEntityCache( int nEntries )
 {
-	if ( m_PackedEntityCache.Count() == 0 )
+	m_PackedEntityCacheIndex.RemoveAll();
+	m_PackedEntityCache.Purge();
+	m_PackedEntityCache.SetCount( nEntries );
+
+	// all entries start out unused in the list
+	FOR_EACH_VEC( m_PackedEntityCache, i )
 	{
-		// ops, we have no cache yet, create one and reset counter
-		m_nPackedEntityCacheCounter = 0;
-		m_PackedEntityCache.SetCount( 128 );
+		UnpackedDataCache_t &pdc = m_PackedEntityCache[i];
+		pdc.pEntity = NULL;
+		pdc.bits = 0;
+		pdc.nPrev = ( i > 0 ) ? i - 1 : INVALID_UNPACKED_CACHE_INDEX;
+		pdc.nNext = ( i < nEntries - 1 ) ? i + 1 : INVALID_UNPACKED_CACHE_INDEX;
+	}
 
-		FOR_EACH_VEC( m_PackedEntityCache, i )
-		{
-			m_PackedEntityCache[i].pEntity = NULL;
-			m_PackedEntityCache[i].counter = 0;
-		}
+	m_nPackedEntityCacheHead = nEntries ? 0 : INVALID_UNPACKED_CACHE_INDEX;
+	m_nPackedEntityCacheTail = nEntries ? nEntries - 1 : INVALID_UNPACKED_CACHE_INDEX;
+}
+
+void CFrameSnapshotManager::UnlinkPackedEntityCache( int iEntry )
+{
+	UnpackedDataCache_t &pdc = m_PackedEntityCache[iEntry];
+
+	if ( pdc.nPrev != INVALID_UNPACKED_CACHE_INDEX )
+		m_PackedEntityCache[pdc.nPrev].nNext = pdc.nNext;
+	else
+		m_nPackedEntityCacheHead = pdc.nNext;
+
+	if ( pdc.nNext != INVALID_UNPACKED_CACHE_INDEX )
+		m_PackedEntityCache[pdc.nNext].nPrev = pdc.nPrev;
+	else
+		m_nPackedEntityCacheTail = pdc.nPrev;
+
+	pdc.nPrev = pdc.nNext = INVALID_UNPACKED_CACHE_INDEX;
+}
+
+void CFrameSnapshotManager::LinkPackedEntityCacheHead( int iEntry )
+{
+	UnpackedDataCache_t &pdc = m_PackedEntityCache[iEntry];
+
+	pdc.nPrev = INVALID_UNPACKED_CACHE_INDEX;
+	pdc.nNext = m_nPackedEntityCacheHead;
+
+	if ( m_nPackedEntityCacheHead != INVALID_UNPACKED_CACHE_INDEX )
+		m_PackedEntityCache[m_nPackedEntityCacheHead].nPrev = iEntry;
+	else
+		m_nPackedEntityCacheTail = iEntry;
+
+	m_nPackedEntityCacheHead = iEntry;
+}
+
+void CFrameSnapshotManager::RemoveCachedUncompressedEntity( PackedEntity *packedEntity )
+{
+	UtlHashHandle_t h = m_PackedEntityCacheIndex.Find( packedEntity );
+	if ( h == m_PackedEntityCacheIndex.InvalidHandle() )
+		return;
+
+	int iEntry = m_PackedEntityCacheIndex[h];
+	m_PackedEntityCacheIndex.RemoveByHandle( h );
+
+	// free entries are the first to be reused
+	UnlinkPackedEntityCache( iEntry );
+
+	UnpackedDataCache_t &pdc = m_PackedEntityCache[iEntry];
+	pdc.pEntity = NULL;
+	pdc.bits = 0;
+	pdc.nPrev = m_nPackedEntityCacheTail;
+	if ( m_nPackedEntityCacheTail != INVALID_UNPACKED_CACHE_INDEX )
+		m_PackedEntityCache[m_nPackedEntityCacheTail].nNext = iEntry;
+	else
+		m_nPackedEntityCacheHead = iEntry;
+	m_nPackedEntityCacheTail = iEntry;
+}
+
+// ------------------------------------------------------------------------------------------------ //
+// purpose: lookup cache if we have an uncompressed version of this packed entity
+// ------------------------------------------------------------------------------------------------ //
+bool CFrameSnapshotManager::GetCachedUncompressedEntity( PackedEntity *packedEntity, char *pData, int &bits )
+{
+	AUTO_LOCK( m_PackedEntityCacheMutex );
+
+	UtlHashHandle_t h = m_PackedEntityCacheIndex.Find( packedEntity );
+	if ( h == m_PackedEntityCacheIndex.InvalidHandle() )
+	{
+		VPROF_INCREMENT_COUNTER( "PackedEntityCache misses", 1 );
+		return false;
 	}
 
-	m_nPackedEntityCacheCounter++;
+	VPROF_INCREMENT_COUNTER( "PackedEntityCache hits", 1 );
 
-	// remember oldest cache entry
-	UnpackedDataCache_t *pdcOldest = NULL;
-	int oldestValue = m_nPackedEntityCacheCounter;
+	// hit, found it, move to the front
+	int iEntry = m_PackedEntityCacheIndex[h];
+	if ( iEntry != m_nPackedEntityCacheHead )
+	{
+		UnlinkPackedEntityCache( iEntry );
+		LinkPackedEntityCacheHead( iEntry );
+	}
 
+	const UnpackedDataCache_t &pdc = m_PackedEntityCache[iEntry];
+	Q_memcpy( pData, pdc.data.Base(), Bits2Bytes( pdc.bits ) );
+	bits = pdc.bits;
+	return true;
+}
 
-	FOR_EACH_VEC( m_PackedEntityCache, i )
+void CFrameSnapshotManager::AddCachedUncompressedEntity( PackedEntity *packedEntity, const char *pData, int bits )
+{
+	AUTO_LOCK( m_PackedEntityCacheMutex );
+
+	if ( m_PackedEntityCache.Count() != sv_packedentitycache.GetInt() )
 	{
-		UnpackedDataCache_t *pdc = &m_PackedEntityCache[i];
+		// no cache yet or it was resized
+		ResetPackedEntityCache( sv_packedentitycache.GetInt() );
+	}
 
-		if ( pdc->pEntity == packedEntity )
-		{
-			// hit, found it, update counter
-			pdc->counter = m_nPackedEntityCacheCounter;
-			return pdc;
-		}
+	// another snapshot writer may have added it meanwhile
+	if ( m_PackedEntityCacheIndex.Find( packedEntity ) != m_PackedEntityCacheIndex.InvalidHandle() )
+		return;
 
-		if( pdc->counter < oldestValue )
-		{
-			oldestValue = pdc->counter;
-			pdcOldest = pdc;
-		}
+	// not in cache, replace the oldest one
+	int iEntry = m_nPackedEntityCacheTail;
+	Assert( iEntry != INVALID_UNPACKED_CACHE_INDEX );
+
+	UnpackedDataCache_t &pdc = m_PackedEntityCache[iEntry];
+	if ( pdc.pEntity )
+	{
+		m_PackedEntityCacheIndex.Remove( pdc.pEntity );
 	}
 
-	Assert ( pdcOldest );
+	int nBytes = Bits2Bytes( bits );
+	if ( pdc.data.Count() < nBytes )
+	{
+		pdc.data.Grow( nBytes - pdc.data.Count() );
+	}
+	Q_memcpy( pdc.data.Base(), pData, nBytes );
 
-	// hmm, not in cache, clear & return oldest one
-	pdcOldest->counter = m_nPackedEntityCacheCounter;
-	pdcOldest->bits = -1;	// important, this is the signal for the caller to fill this structure
-	pdcOldest->pEntity = packedEntity;
-	return pdcOldest;
-}
+	pdc.pEntity = packedEntity;
+	pdc.bits = bits;
+	m_PackedEntityCacheIndex.Insert( packedEntity, iEntry );
 
+	UnlinkPackedEntityCache( iEntry );
+	LinkPackedEntityCacheHead( iEntry );
+}
 
 
 
@@ -493,10 +646,11 @@ void CFrameSnapshot::ReleaseReference()
 {
 	Assert( m_nReferences > 0 );
 
-	--m_nReferences;
-	if ( m_nReferences == 0 )
+	// test the result of the decrement itself, client frames may be
+	// released from several snapshot writer threads at once
+	if ( --m_nReferences == 0 )
 	{
-		g_FrameSnapshotManager.DeleteFrameSnapshot( this );
+		g_FrameSnapshotManager.ReleaseFrameSnapshot( this );
 	}
 }
 
@@ -506,3 +660,85 @@ CFrameSnapshot* CFrameSnapshot::NextSnapshot() const
 }
 
 
+// Entity deltas are copied into blocks of this size, bigger deltas aren't cached
+#define DELTA_MEMO_BLOCK_SIZE	(64*1024)
+
+CEntityDeltaMemo::CEntityDeltaMemo()
+{
+	m_nBlockUsed = DELTA_MEMO_BLOCK_SIZE;
+}
+
+CEntityDeltaMemo::~CEntityDeltaMemo()
+{
+	Purge();
+}
+
+void CEntityDeltaMemo::Purge()
+{
+	AUTO_LOCK( m_Mutex );
+
+	m_Entries.Purge();
+
+	FOR_EACH_VEC( m_Blocks, i )
+	{
+		free( m_Blocks[i] );
+	}
+
+	m_Blocks.Purge();
+	m_nBlockUsed = DELTA_MEMO_BLOCK_SIZE;
+}
+
+bool CEntityDeltaMemo::FindDeltaBits( const EntityDeltaKey_t &key, const unsigned char *&pData, int &nBits )
+{
+	AUTO_LOCK( m_Mutex );
+
+	UtlHashHandle_t h = m_Entries.Find( key );
+	if ( h == m_Entries.InvalidHandle() )
+		return false;
+
+	const DeltaBits_t &bits = m_Entries[h];
+	pData = bits.m_pData;
+	nBits = bits.m_nBits;
+	return true;
+}
+
+void CEntityDeltaMemo::AddDeltaBits( const EntityDeltaKey_t &key, bf_write *pBuffer, int nStartBit, int nBits )
+{
+	int nBytes = PAD_NUMBER( Bits2Bytes( nBits ), 4 );
+	if ( nBytes > DELTA_MEMO_BLOCK_SIZE )
+		return;
+
+	AUTO_LOCK( m_Mutex );
+
+	// another client may have written the same delta in the meantime
+	if ( m_Entries.Find( key ) != m_Entries.InvalidHandle() )
+		return;
+
+	DeltaBits_t bits;
+	bits.m_pData = NULL;
+	bits.m_nBits = nBits;
+
+	if ( nBits > 0 )
+	{
+		if ( m_nBlockUsed + nBytes > DELTA_MEMO_BLOCK_SIZE )
+		{
+			if ( ( m_Blocks.Count() + 1 ) * DELTA_MEMO_BLOCK_SIZE > sv_deltamemo.GetInt() * 1024 )
+				return;	// memo is full
+
+			m_Blocks.AddToTail( (unsigned char*)malloc( DELTA_MEMO_BLOCK_SIZE ) );
+			m_nBlockUsed = 0;
+		}
+
+		bits.m_pData = m_Blocks.Tail() + m_nBlockUsed;
+		m_nBlockUsed += nBytes;
+
+		bf_read inBuffer;
+		inBuffer.StartReading( pBuffer->GetData(), pBuffer->m_nDataBytes, nStartBit );
+		bf_write outBuffer( bits.m_pData, nBytes );
+		outBuffer.WriteBitsFromBuffer( &inBuffer, nBits );
+	}
+
+	m_Entries.Insert( key, bits );
+}
+
+
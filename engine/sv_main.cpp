@@ -1818,31 +1818,33 @@ void CGameServer::CopyTempEntities( CFrameSnapshot* pSnapshot )
 	}
 }
 
-// If enabled, random crashes start to appear in WriteTempEntities, etc. It looks like
-// one thread can be in WriteDeltaEntities while another is in WriteTempEntities, and both are
-// partying on g_FrameSnapshotManager.m_FrameSnapshots. Bruce sent e-mail from a customer
-// that stated these crashes don't occur when parallel_sendsnapshot is disabled. Zoid said:
-//
-//   Easiest is just turn off parallel snapshots, it's not much of a win on servers where we
-//   are running many instances anyway. It's off in Dota and CSGO dedicated servers.
-//
-// Bruce also had a patch to disable this in //ValveGames/staging/game/tf/cfg/unencrypted/print_instance_config.py
-static ConVar sv_parallel_sendsnapshot( "sv_parallel_sendsnapshot", "0" );
+// Snapshots are written for all clients in parallel. The frame snapshot manager defers
+// snapshot deletes while this is running so that WriteTempEntities can safely walk
+// the snapshot list while other clients release their old snapshots.
+static ConVar sv_parallel_sendsnapshot( "sv_parallel_sendsnapshot", "1", 0, "Send client snapshots in parallel on the job thread pool." );
+
+// HLTV and replay clients both update the mirror tables of the server string
+// table container and must not run at the same time as each other.
+static CThreadFastMutex s_BroadcastSnapshotMutex;
 
 static void SV_ParallelSendSnapshot( CGameClient *& pClient )
 {
-	// HLTV and replay clients must be handled on the main thread
-	// because they access and modify global state. Skip them.
-	if ( pClient->IsHLTV() )
-		return;
-#if defined( REPLAY_ENABLED )
-	if ( pClient->IsReplay() )
-		return;
-#endif
 	CClientFrame *pFrame = pClient->GetSendFrame();
 	if ( pFrame )
 	{
-		pClient->SendSnapshot( pFrame );
+		bool bBroadcast = pClient->IsHLTV();
+#if defined( REPLAY_ENABLED )
+		bBroadcast = bBroadcast || pClient->IsReplay();
+#endif
+		if ( bBroadcast )
+		{
+			AUTO_LOCK( s_BroadcastSnapshotMutex );
+			pClient->SendSnapshot( pFrame );
+		}
+		else
+		{
+			pClient->SendSnapshot( pFrame );
+		}
 		pClient->UpdateSendState();
 	}
 	// Replace this parallel processing array entry with NULL so
@@ -1853,6 +1855,9 @@ static void SV_ParallelSendSnapshot( CGameClient *& pClient )
 void CGameServer::SendClientMessages ( bool bSendSnapshots )
 {
 	VPROF_BUDGET( "SendClientMessages", VPROF_BUDGETGROUP_OTHER_NETWORKING );
+
+	// everything sent to clients this frame goes out in as few socket calls as possible
+	NET_BeginSendBatch();
 	
 	// build individual updates
 	int receivingClientCount = 0;
@@ -1905,12 +1910,12 @@ void CGameServer::SendClientMessages ( bool bSendSnapshots )
 		// Compute the client packs
 		SV_ComputeClientPacks( receivingClientCount, pReceivingClients, pSnapshot );
 
-		if ( receivingClientCount > 1 && sv_parallel_sendsnapshot.GetBool() )
+		if ( receivingClientCount > 1 && sv_parallel_sendsnapshot.GetBool() && !g_pLocalNetworkBackdoor )
 		{
-			// SV_ParallelSendSnapshot will not process HLTV or Replay clients as they
-			// must be run on the main thread due to un-threadsafe global state access.
-			// It will replace anything that it does process with a NULL pointer.
+			// SV_ParallelSendSnapshot replaces everything it processes with a NULL pointer.
+			framesnapshotmanager->BeginDeferredDeletes();
 			ParallelProcess( "SV_ParallelSendSnapshot", pReceivingClients, receivingClientCount, &SV_ParallelSendSnapshot );
+			framesnapshotmanager->EndDeferredDeletes();
 		}
 		
 		for (int i = 0; i < receivingClientCount; ++i)
@@ -1924,9 +1929,15 @@ void CGameServer::SendClientMessages ( bool bSendSnapshots )
 			pClient->SendSnapshot( pFrame );
 			pClient->UpdateSendState();
 		}
+
+		// the shared entity deltas are only useful while this tick is sent,
+		// the snapshot itself lives on in the client frames
+		pSnapshot->m_DeltaMemo.Purge();
 	
 		pSnapshot->ReleaseReference();
 	}
+
+	NET_EndSendBatch();
 }
 
 void CGameServer::SetMaxClients( int number )
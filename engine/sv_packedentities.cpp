@@ -387,6 +387,7 @@ void PackEntities_NetworkBackDoor(
 }
 
 static ConVar sv_parallel_packentities( "sv_parallel_packentities", "1" );
+static ConVar sv_pack_dirty_entities_only( "sv_pack_dirty_entities_only", "1", 0, "Only pack entities the game reported as changed, all others reuse their previously sent packet." );
 
 struct PackWork_t
 {
@@ -410,6 +411,10 @@ void PackEntities_Normal(
 
 	CUtlVectorFixed< PackWork_t, MAX_EDICTS > workItems;
 
+	// Game DLLs older than ServerGameEnts002 don't keep the dirty edict list
+	bool bDirtyEdictsOnly = sv_pack_dirty_entities_only.GetBool() && !sv_debugmanualmode.GetInt() && g_iServerGameEntsVersion >= 2;
+	CBitVec<MAX_EDICTS> &dirtyEdicts = g_pSharedChangeInfo->m_DirtyEdicts;
+
 	// check for all active entities, if they are seen by at least on client, if
 	// so, bit pack them 
 	for ( int iValidEdict=0; iValidEdict < snapshot->m_nValidEntities; ++iValidEdict )
@@ -437,6 +442,19 @@ void PackEntities_Normal(
 
 			if( frame->transmit_entity.Get( index ) )
 			{	
+				if ( bDirtyEdictsOnly )
+				{
+					// unchanged entities take the last packet without looking at the edict
+					if ( !dirtyEdicts.IsBitSet( index ) &&
+						framesnapshotmanager->UsePreviouslySentPacket( snapshot, index, snapshot->m_pEntities[ index ].m_nSerialNumber ) )
+					{
+						break;
+					}
+
+					// SV_PackEntity clears the edict's changed flags
+					dirtyEdicts.Clear( index );
+				}
+
 				PackWork_t w;
 				w.nIdx = index;
 				w.pEdict = edict;
@@ -467,6 +485,19 @@ void PackEntities_Normal(
 }
 
 
+static ConVar sv_parallel_checktransmit( "sv_parallel_checktransmit", "0", 0, "Run CheckTransmit for all clients in parallel. Requires that the game's ShouldTransmit and SetTransmit are thread safe." );
+
+struct CheckTransmitWork_t
+{
+	CGameClient		*pClient;
+	CFrameSnapshot	*pSnapshot;
+
+	static void Process( CheckTransmitWork_t &item )
+	{
+		serverGameEnts->CheckTransmit( &item.pClient->m_PackInfo, item.pSnapshot->m_pValidEntities, item.pSnapshot->m_nValidEntities );
+	}
+};
+
 //-----------------------------------------------------------------------------
 // Writes the compressed packet of entities to all clients
 //-----------------------------------------------------------------------------
@@ -483,12 +514,41 @@ void SV_ComputeClientPacks(
 	{
 		VPROF_BUDGET_FLAGS( "SV_ComputeClientPacks", "CheckTransmit", BUDGETFLAG_SERVER );
 
-		for (int iClient = 0; iClient < clientCount; ++iClient)
+		bool bPrepared = ( g_iServerGameEntsVersion >= 2 );
+		if ( bPrepared )
+		{
+			serverGameEnts->PrepareCheckTransmit( snapshot->m_pValidEntities, snapshot->m_nValidEntities );
+		}
+
+		if ( bPrepared && sv_parallel_checktransmit.GetBool() && clientCount > 1 )
+		{
+			// visibility setup calls into the game, keep it on this thread
+			CUtlVectorFixed< CheckTransmitWork_t, ABSOLUTE_PLAYER_LIMIT > workItems;
+			for (int iClient = 0; iClient < clientCount; ++iClient)
+			{
+				clients[iClient]->SetupPackInfo( snapshot );
+
+				CheckTransmitWork_t &w = workItems[ workItems.AddToTail() ];
+				w.pClient = clients[iClient];
+				w.pSnapshot = snapshot;
+			}
+
+			ParallelProcess( "CheckTransmitWork_t::Process", workItems.Base(), workItems.Count(), &CheckTransmitWork_t::Process );
+
+			for (int iClient = 0; iClient < clientCount; ++iClient)
+			{
+				clients[iClient]->SetupPrevPackInfo();
+			}
+		}
+		else
 		{
-			CCheckTransmitInfo *pInfo = &clients[iClient]->m_PackInfo;
-			clients[iClient]->SetupPackInfo( snapshot );
-			serverGameEnts->CheckTransmit( pInfo, snapshot->m_pValidEntities, snapshot->m_nValidEntities );
-			clients[iClient]->SetupPrevPackInfo();
+			for (int iClient = 0; iClient < clientCount; ++iClient)
+			{
+				CCheckTransmitInfo *pInfo = &clients[iClient]->m_PackInfo;
+				clients[iClient]->SetupPackInfo( snapshot );
+				serverGameEnts->CheckTransmit( pInfo, snapshot->m_pValidEntities, snapshot->m_nValidEntities );
+				clients[iClient]->SetupPrevPackInfo();
+			}
 		}
 	}
 
@@ -31,6 +31,7 @@
 #include "gl_cvars.h"
 #include "filesystem_engine.h"
 #include "tier0/cpumonitoring.h"
+#include "sys_frame_scheduler.h"
 #ifndef SWDS
 #include "vgui_baseui_interface.h"
 #endif
@@ -198,6 +199,7 @@ CEngine::~CEngine( void )
 void CEngine::Unload( void )
 {
 	Sys_ShutdownGame();
+	g_pFrameScheduler->Shutdown();
 
 	m_nDLLState			= DLL_INACTIVE;
 	m_nNextDLLState		= DLL_INACTIVE;
@@ -342,6 +344,22 @@ void CEngine::Frame( void )
 			break;
 		}
 
+		if ( sv.IsDedicated() && host_timer_epoll.GetBool() )
+		{
+			// Block on the tick timer, and the server socket if we drain it here, nothing spins
+			int nWakeSocket = ( host_timer_epoll_drain.GetBool() && sv.IsActive() ) ? NS_SERVER : -1;
+			bool bPacketsArrived;
+			if ( g_pFrameScheduler->Wait( m_flMinFrameTime - m_flFrameTime, nWakeSocket, &bPacketsArrived ) )
+			{
+				if ( bPacketsArrived )
+				{
+					NET_SetTime( Plat_FloatTime() );
+					NET_ProcessSocket( NS_SERVER, &sv );
+				}
+				continue;
+			}
+		}
+
 		if ( IsPC() && ( !sv.IsDedicated() || host_timer_spin_ms.GetFloat() != 0 ) )
 		{
 			// ThreadSleep may be imprecise. On non-dedicated servers, we busy-sleep
@@ -0,0 +1,219 @@
+//========= Copyright Valve Corporation, All rights reserved. ============//
+//
+// Purpose: Waits for the next dedicated server tick on a timer and the game
+//			sockets instead of sleeping and spinning.  On Linux the wait is an
+//			epoll on a timerfd armed for the tick deadline, plus the server
+//			socket when its packets are processed between ticks, so nothing
+//			spins and a packet can end the wait early.
+//
+//=============================================================================
+
+#include "convar.h"
+#include "tier0/vprof.h"
+#include "net.h"
+#include "sys_frame_scheduler.h"
+
+#ifdef LINUX
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#include <unistd.h>
+#include <errno.h>
+#endif
+
+// memdbgon must be the last include file in a .cpp file!!!
+#include "tier0/memdbgon.h"
+
+ConVar host_timer_epoll( "host_timer_epoll", "0", FCVAR_NONE, "Wait for the next tick on a high resolution timer and the game sockets instead of sleeping and spinning (dedicated Linux only)" );
+ConVar host_timer_epoll_drain( "host_timer_epoll_drain", "0", FCVAR_NONE, "With host_timer_epoll, process server packets as they arrive between ticks instead of at the next tick" );
+
+#ifdef LINUX
+
+// epoll key of the timer, sockets use their index + 1
+#define TIMER_EPOLL_KEY		0
+
+class CEpollFrameScheduler : public IFrameScheduler
+{
+public:
+	CEpollFrameScheduler()
+	{
+		m_hEpoll = -1;
+		m_hTimer = -1;
+		m_bFailed = false;
+		Q_memset( m_hSockets, 0, sizeof( m_hSockets ) );
+	}
+
+	~CEpollFrameScheduler()
+	{
+		Shutdown();
+	}
+
+	virtual bool Wait( float flWaitSeconds, int nWakeSocket, bool *pbPacketsArrived );
+	virtual void Shutdown();
+
+private:
+	bool	Init();
+	void	UpdateSockets( int nWakeSocket );
+
+	int		m_hEpoll;
+	int		m_hTimer;
+	bool	m_bFailed;
+	int		m_hSockets[MAX_SOCKETS];	// registered with epoll, 0 if not
+};
+
+bool CEpollFrameScheduler::Init()
+{
+	if ( m_hEpoll >= 0 )
+		return true;
+
+	if ( m_bFailed )
+		return false;
+
+	m_hEpoll = epoll_create1( EPOLL_CLOEXEC );
+	m_hTimer = timerfd_create( CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC );
+
+	struct epoll_event event;
+	event.events = EPOLLIN;
+	event.data.u64 = TIMER_EPOLL_KEY;
+
+	if ( m_hEpoll < 0 || m_hTimer < 0 || epoll_ctl( m_hEpoll, EPOLL_CTL_ADD, m_hTimer, &event ) != 0 )
+	{
+		Warning( "host_timer_epoll: couldn't create the tick timer (%s), sleeping instead.\n", strerror( errno ) );
+		Shutdown();
+		m_bFailed = true;
+		return false;
+	}
+
+	return true;
+}
+
+void CEpollFrameScheduler::Shutdown()
+{
+	if ( m_hTimer >= 0 )
+	{
+		close( m_hTimer );
+		m_hTimer = -1;
+	}
+
+	if ( m_hEpoll >= 0 )
+	{
+		close( m_hEpoll );
+		m_hEpoll = -1;
+	}
+
+	Q_memset( m_hSockets, 0, sizeof( m_hSockets ) );
+}
+
+//-----------------------------------------------------------------------------
+// Sockets get opened, closed and handed to receive threads between frames,
+// follow them. Only the one the caller reads is in the set, the others are
+// level triggered and would end every wait until the tick.
+//-----------------------------------------------------------------------------
+void CEpollFrameScheduler::UpdateSockets( int nWakeSocket )
+{
+	for ( int i = 0; i < MAX_SOCKETS; i++ )
+	{
+		int hSocket = ( i == nWakeSocket ) ? NET_GetMainThreadSocket( i ) : 0;
+		if ( hSocket && hSocket == m_hSockets[i] )
+		{
+			// a socket that was closed and reopened can get the same descriptor back,
+			// closing it took the old one out of the set
+			struct epoll_event event;
+			event.events = EPOLLIN;
+			event.data.u64 = i + 1;
+			if ( epoll_ctl( m_hEpoll, EPOLL_CTL_MOD, hSocket, &event ) == 0 )
+				continue;
+
+			if ( errno != ENOENT || epoll_ctl( m_hEpoll, EPOLL_CTL_ADD, hSocket, &event ) != 0 )
+			{
+				m_hSockets[i] = 0;
+			}
+			continue;
+		}
+
+		if ( hSocket == m_hSockets[i] )
+			continue;
+
+		if ( m_hSockets[i] )
+		{
+			// fails if the socket was closed already, it's out of the set then anyway
+			epoll_ctl( m_hEpoll, EPOLL_CTL_DEL, m_hSockets[i], NULL );
+			m_hSockets[i] = 0;
+		}
+
+		if ( hSocket )
+		{
+			struct epoll_event event;
+			event.events = EPOLLIN;
+			event.data.u64 = i + 1;
+			if ( epoll_ctl( m_hEpoll, EPOLL_CTL_ADD, hSocket, &event ) == 0 )
+			{
+				m_hSockets[i] = hSocket;
+			}
+		}
+	}
+}
+
+bool CEpollFrameScheduler::Wait( float flWaitSeconds, int nWakeSocket, bool *pbPacketsArrived )
+{
+	*pbPacketsArrived = false;
+
+	if ( !Init() )
+		return false;
+
+	VPROF_BUDGET( "Sleep", VPROF_BUDGETGROUP_SLEEPING );
+
+	UpdateSockets( nWakeSocket );
+
+	// forget an expiry left over from a wait a packet ended
+	uint64 nExpirations;
+	while ( read( m_hTimer, &nExpirations, sizeof( nExpirations ) ) > 0 )
+		;
+
+	int64 nWaitNanoseconds = clamp( (int64)( flWaitSeconds * 1e9 ), (int64)1000, (int64)1000000000 );
+	struct itimerspec deadline;
+	Q_memset( &deadline, 0, sizeof( deadline ) );
+	deadline.it_value.tv_sec = nWaitNanoseconds / 1000000000;
+	deadline.it_value.tv_nsec = nWaitNanoseconds % 1000000000;
+	if ( timerfd_settime( m_hTimer, 0, &deadline, NULL ) != 0 )
+		return false;
+
+	// the timer ends the wait, the timeout is only there in case it doesn't
+	int nTimeoutMS = (int)( nWaitNanoseconds / 1000000 ) + 100;
+
+	struct epoll_event events[MAX_SOCKETS + 1];
+	int nEvents = epoll_wait( m_hEpoll, events, ARRAYSIZE( events ), nTimeoutMS );
+	for ( int i = 0; i < nEvents; i++ )
+	{
+		if ( events[i].data.u64 != TIMER_EPOLL_KEY )
+		{
+			*pbPacketsArrived = true;
+		}
+	}
+
+	// EINTR and the like just end the wait early, the caller checks the time again
+	return true;
+}
+
+static CEpollFrameScheduler g_FrameScheduler;
+
+#else
+
+class CNullFrameScheduler : public IFrameScheduler
+{
+public:
+	virtual bool Wait( float flWaitSeconds, int nWakeSocket, bool *pbPacketsArrived )
+	{
+		*pbPacketsArrived = false;
+		return false;
+	}
+
+	virtual void Shutdown()
+	{
+	}
+};
+
+static CNullFrameScheduler g_FrameScheduler;
+
+#endif // LINUX
+
+IFrameScheduler *g_pFrameScheduler = &g_FrameScheduler;
@@ -0,0 +1,28 @@
+//========= Copyright Valve Corporation, All rights reserved. ============//
+//
+// Purpose: Waits for the next dedicated server tick on a timer and the server
+//			socket instead of sleeping and spinning
+//
+//=============================================================================
+
+#ifndef SYS_FRAME_SCHEDULER_H
+#define SYS_FRAME_SCHEDULER_H
+#ifdef _WIN32
+#pragma once
+#endif
+
+class IFrameScheduler
+{
+public:
+	// Blocks for flWaitSeconds, or until a datagram arrives on nWakeSocket (NS_SERVER etc., -1 for
+	// none) if the main thread reads it. The caller has to read what arrived, or the next wait
+	// ends right away. Returns false without waiting if it isn't available here.
+	virtual bool Wait( float flWaitSeconds, int nWakeSocket, bool *pbPacketsArrived ) = 0;
+	virtual void Shutdown() = 0;
+};
+
+extern IFrameScheduler *g_pFrameScheduler;
+extern ConVar host_timer_epoll;
+extern ConVar host_timer_epoll_drain;
+
+#endif // SYS_FRAME_SCHEDULER_H
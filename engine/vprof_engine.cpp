@@ -12,6 +12,7 @@
 #include "basetypes.h"
 #include "convar.h"
 #include "cmd.h"
+#include "common.h"
 #include "tier1/strtools.h"
 #include "con_nprint.h"
 #include "tier0/vprof.h"
@@ -552,6 +553,7 @@ DEFERRED_CON_COMMAND( vprof_reset, "Reset the stats in VProf profiler" )
 {
 	Msg("VProf reset.\n");
 	g_VProfCurrentProfile.Reset();
+	g_VProfCurrentProfile.ResetThreadProfile();
 
 #ifndef SWDS
 	if ( GetVProfPanel() )
@@ -567,6 +569,59 @@ DEFERRED_CON_COMMAND(vprof_reset_peaks, "Reset just the peak time in VProf profi
 	g_VProfCurrentProfile.ResetPeaks();
 }
 
+CON_COMMAND( vprof_threads, "Record vprof scopes on all threads for vprof_threads_report and vprof_trace_export: vprof_threads <0|1>" )
+{
+	if ( args.ArgC() < 2 )
+	{
+		Msg( "Thread profiling is %s.\n", g_VProfCurrentProfile.IsThreadProfiling() ? "on" : "off" );
+		return;
+	}
+
+	g_VProfCurrentProfile.EnableThreadProfiling( atoi( args[1] ) != 0 );
+	Msg( "Thread profiling %s.\n", g_VProfCurrentProfile.IsThreadProfiling() ? "enabled" : "disabled" );
+}
+
+CON_COMMAND( vprof_threads_report, "Report time per budget group and scope on each thread since vprof_threads was turned on or vprof_reset." )
+{
+	ConsoleLogger consoleLog;
+	g_VProfCurrentProfile.OutputThreadReport();
+}
+
+CON_COMMAND( vprof_trace_export, "Write the last N seconds recorded by vprof_threads as a Chrome trace (chrome://tracing, Perfetto): vprof_trace_export <seconds> [filename]" )
+{
+	if ( args.ArgC() < 2 )
+	{
+		Msg( "Usage: vprof_trace_export <seconds> [filename]\n" );
+		return;
+	}
+
+	const char *pszFilename = ( args.ArgC() >= 3 ) ? args[2] : "vprof_trace.json";
+	if ( !COM_IsValidPath( pszFilename ) )
+	{
+		Warning( "vprof_trace_export: invalid filename '%s'\n", pszFilename );
+		return;
+	}
+
+	if ( !g_VProfCurrentProfile.IsThreadProfiling() )
+	{
+		Warning( "vprof_trace_export: thread profiling is off, turn it on with vprof_threads 1\n" );
+	}
+
+	char szFullPath[MAX_OSPATH];
+	Q_snprintf( szFullPath, sizeof( szFullPath ), "%s/%s", com_gamedir, pszFilename );
+	Q_FixSlashes( szFullPath );
+
+	float flSeconds = clamp( (float)atof( args[1] ), 0.0f, 60.0f );
+	if ( g_VProfCurrentProfile.WriteThreadTrace( szFullPath, flSeconds ) )
+	{
+		Msg( "Wrote %.1f seconds of vprof scopes to %s\n", flSeconds, szFullPath );
+	}
+	else
+	{
+		Warning( "vprof_trace_export: couldn't write %s\n", szFullPath );
+	}
+}
+
 DEFERRED_CON_COMMAND(vprof_generate_report, "Generate a report to the console.")
 {
 	g_VProfCurrentProfile.Pause();
@@ -53,6 +53,7 @@
 
 ConVar fs_report_sync_opens( "fs_report_sync_opens", "0", 0, "0:Off, 1:Blocking only, 2:All" );
 ConVar fs_warning_mode( "fs_warning_mode", "0", 0, "0:Off, 1:Warn main thread, 2:Warn other threads"  );
+ConVar fs_searchpath_cache( "fs_searchpath_cache", "5", 0, "Seconds to remember which search path files were found in, and which files aren't in any. 0:Off" );
 
 #define BSPOUTPUT	0	// bsp output flag -- determines type of fs_log output to generate
 
@@ -331,6 +332,8 @@ CBaseFileSystem::CBaseFileSystem()
 #endif
 
 	m_iMapLoad = 0;
+	m_nSearchPathCacheGeneration = 0;
+	m_flSearchPathCacheStartTime = 0.0;
 
 	Q_memset( m_PreloadData, 0, sizeof( m_PreloadData ) );
 
@@ -829,6 +832,10 @@ void CBaseFileSystem::AddVPKFile( char const *pPath, const char *pPathID, Search
 		}
 		pVPK->RegisterFileTracker( (IThreadedFileMD5Processor *)&m_FileTracker2 );
 
+		// read straight from mapped chunk files, skips the read cache and its chunk MD5 checks
+		if ( CommandLine()->FindParm( "-fs_mapvpkdata" ) )
+			pVPK->SetMapDataFiles( true );
+
 		pVPK->m_PackFileID = m_FileTracker2.NotePackFileOpened( pVPK->FullPathName(), pPathID, 0 );
 	}
 	else
@@ -845,6 +852,8 @@ void CBaseFileSystem::AddVPKFile( char const *pPath, const char *pPathID, Search
 
 	// Check if we're trusted or not
 	SetSearchPathIsTrustedSource( sp );
+
+	InvalidateSearchPathCache();
 #endif // SUPPORT_PACKED_STORE
 }
 
@@ -869,6 +878,7 @@ bool CBaseFileSystem::RemoveVPKFile( const char *pPath, const char *pPathID )
 			if ( m_SearchPaths[i].GetPath() == pathIDSym )
 			{
 				m_SearchPaths.Remove( i );
+				InvalidateSearchPathCache();
 				return true;
 			}
 		}
@@ -939,6 +949,7 @@ bool CBaseFileSystem::AddPackFileFromPath( const char *pPath, const char *pakfil
 	sp->m_pPathIDInfo->SetPathID( pathID );
 	sp->SetPackFile( pf );
 
+	InvalidateSearchPathCache();
 	return true;
 }
 
@@ -1106,6 +1117,8 @@ void CBaseFileSystem::RemoveAllMapSearchPaths( void )
 		
 		m_SearchPaths.Remove( i );
 	}
+
+	InvalidateSearchPathCache();
 }
 
 //-----------------------------------------------------------------------------
@@ -1181,6 +1194,7 @@ void CBaseFileSystem::AddMapPackFile( const char *pPath, const char *pPathID, Se
 				sp->m_bIsRemotePath = true;
 			}
 			SetSearchPathIsTrustedSource( sp );
+			InvalidateSearchPathCache();
 			return;
 		}
 	}
@@ -1259,6 +1273,7 @@ void CBaseFileSystem::AddMapPackFile( const char *pPath, const char *pPathID, Se
 			m_ZipFiles.AddToTail( pf );
 
 			SetSearchPathIsTrustedSource( sp );
+			InvalidateSearchPathCache();
 		}
 		else
 		{
@@ -1567,6 +1582,9 @@ void CBaseFileSystem::AddSearchPath( const char *pPath, const char *pathID, Sear
 		}
 	}
 
+	// also covers the pack files added along with the path and a path moved to the head
+	InvalidateSearchPathCache();
+
 	if ( currCount != m_SearchPaths.Count() )
 	{
 #if !defined( DEDICATED )
@@ -1683,6 +1701,11 @@ bool CBaseFileSystem::RemoveSearchPath( const char *pPath, const char *pathID )
 		m_SearchPaths.Remove( i );
 		bret = true;
 	}
+
+	if ( bret )
+	{
+		InvalidateSearchPathCache();
+	}
 	return bret;
 }
 
@@ -1703,6 +1726,8 @@ void CBaseFileSystem::RemoveSearchPaths( const char *pathID )
 			m_SearchPaths.FastRemove(i);
 		}
 	}
+
+	InvalidateSearchPathCache();
 }
 
 
@@ -2120,9 +2145,13 @@ bool CBaseFileSystem::UnzipFile( const char *pFileName, const char *pPath, const
 //-----------------------------------------------------------------------------
 void CBaseFileSystem::RemoveAllSearchPaths( void )
 {
-	AUTO_LOCK( m_SearchPathsMutex );
-	m_SearchPaths.Purge();
-	//m_PackFileHandles.Purge();
+	{
+		AUTO_LOCK( m_SearchPathsMutex );
+		m_SearchPaths.Purge();
+		//m_PackFileHandles.Purge();
+	}
+
+	InvalidateSearchPathCache();
 }
 
 
@@ -2179,6 +2208,7 @@ public:
 			*m_ppszResolvedFilename = NULL;
 		m_pPackFile = NULL;
 		m_pVPKFile = NULL;
+		m_nOpenError = 0;
 		m_AbsolutePath[0] = '\0';
 	}
 	
@@ -2258,6 +2288,7 @@ public:
 
 	CPackFile *m_pPackFile;
 	CPackedStore *m_pVPKFile;
+	int m_nOpenError;	// errno of the last loose file that failed to open, 0 for pack and VPK misses
 
 	const char *m_pFileName;
 	const CBaseFileSystem::CSearchPath *m_pSearchPath;
@@ -2276,6 +2307,7 @@ void CBaseFileSystem::HandleOpenRegularFile( CFileOpenInfo &openInfo, bool bIsAb
 
 	int64 size;
 	FILE *fp = Trace_FOpen( openInfo.m_AbsolutePath, openInfo.m_pOptions, openInfo.m_Flags, &size );
+	openInfo.m_nOpenError = fp ? 0 : errno;
 	if ( fp )
 	{
 		if ( m_pLogFile )
@@ -2321,6 +2353,7 @@ FileHandle_t CBaseFileSystem::FindFileInSearchPath( CFileOpenInfo &openInfo )
 	
 	Assert( openInfo.m_pSearchPath );
 	openInfo.m_pFileHandle = NULL;
+	openInfo.m_nOpenError = 0;
 
 	// Loading from pack file?
 	CPackFile *pPackFile = openInfo.m_pSearchPath->GetPackFile();
@@ -2374,6 +2407,82 @@ FileHandle_t CBaseFileSystem::FindFileInSearchPath( CFileOpenInfo &openInfo )
 }
 
 
+//-----------------------------------------------------------------------------
+// Search path cache
+//-----------------------------------------------------------------------------
+#define MAX_SEARCHPATH_CACHE_ENTRIES	65536
+
+bool CBaseFileSystem::GetSearchPathCacheKey( const char *pFileName, const char *pathID, PathTypeFilter_t pathFilter, char *pKey, int nKeySize )
+{
+	// "//PATHID/" names pick their own path ID, 360 exclude paths aren't tracked
+	if ( fs_searchpath_cache.GetFloat() <= 0.0f || IsX360() || ( pFileName[0] == '/' && pFileName[1] == '/' ) )
+		return false;
+
+	// path IDs are case insensitive, the name is used as is
+	int nLen = V_snprintf( pKey, nKeySize, "%s|%d|", pathID ? pathID : "", pathFilter );
+	if ( nLen < 0 || nLen + V_strlen( pFileName ) >= nKeySize )
+		return false;
+
+	V_strlower( pKey );
+	V_strncpy( pKey + nLen, pFileName, nKeySize - nLen );
+	return true;
+}
+
+bool CBaseFileSystem::FindInSearchPathCache( const char *pKey, SearchPathCacheEntry_t &entry, int &nGeneration )
+{
+	AUTO_LOCK( m_SearchPathCacheMutex );
+
+	// read before the caller copies the search paths, AddToSearchPathCache() drops results from older paths
+	nGeneration = m_nSearchPathCacheGeneration;
+
+	// files put in the search paths from outside the filesystem show up after a while
+	if ( m_SearchPathCache.Count() && Plat_FloatTime() - m_flSearchPathCacheStartTime > fs_searchpath_cache.GetFloat() )
+	{
+		m_SearchPathCache.RemoveAll();
+		return false;
+	}
+
+	UtlHashHandle_t h = m_SearchPathCache.Find( pKey );
+	if ( h == m_SearchPathCache.InvalidHandle() )
+		return false;
+
+	entry = m_SearchPathCache[h];
+	return true;
+}
+
+void CBaseFileSystem::AddToSearchPathCache( const char *pKey, const SearchPathCacheEntry_t &entry, int nGeneration )
+{
+	AUTO_LOCK( m_SearchPathCacheMutex );
+
+	if ( nGeneration != m_nSearchPathCacheGeneration )
+		return;
+
+	// looking for lots of different files that don't exist shouldn't grow it forever
+	if ( m_SearchPathCache.Count() >= MAX_SEARCHPATH_CACHE_ENTRIES )
+	{
+		m_SearchPathCache.RemoveAll();
+	}
+
+	if ( !m_SearchPathCache.Count() )
+	{
+		m_flSearchPathCacheStartTime = Plat_FloatTime();
+	}
+
+	m_SearchPathCache[ m_SearchPathCache.Insert( pKey ) ] = entry;
+}
+
+//-----------------------------------------------------------------------------
+// Call after changing the search paths or the files in them, not before,
+// so searches that copied the old paths can't put their results back in
+//-----------------------------------------------------------------------------
+void CBaseFileSystem::InvalidateSearchPathCache()
+{
+	AUTO_LOCK( m_SearchPathCacheMutex );
+	m_nSearchPathCacheGeneration++;
+	m_SearchPathCache.RemoveAll();
+}
+
+
 //-----------------------------------------------------------------------------
 // Purpose: 
 //-----------------------------------------------------------------------------
@@ -2519,10 +2628,60 @@ FileHandle_t CBaseFileSystem::OpenForRead( const char *pFileNameT, const char *p
 		}
 	}
 
+	// A previous search may know the file isn't in any of the paths, or which one it's in
+	char szCacheKey[MAX_PATH * 2];
+	SearchPathCacheEntry_t cached;
+	int nCacheGeneration = 0;
+	bool bUseCache = GetSearchPathCacheKey( pFileName, pathID, pathFilter, szCacheKey, sizeof( szCacheKey ) );
+	bool bCached = bUseCache && FindInSearchPathCache( szCacheKey, cached, nCacheGeneration );
+	if ( bCached && !cached.m_bFound )
+	{
+		LogFileOpen( "[Failed]", pFileName, "" );
+		return ( FileHandle_t )0;
+	}
+
+	SearchPathCacheEntry_t found;
+	found.m_bFound = false;
+	found.m_storeId = 0;
+
+	// Only remember a miss if every path said the file isn't there, not that it couldn't be opened
+	bool bMissing = true;
+
 	CSearchPathsIterator iter( this, &pFileName, pathID, pathFilter );
-	for ( openInfo.m_pSearchPath = iter.GetFirst(); openInfo.m_pSearchPath != NULL; openInfo.m_pSearchPath = iter.GetNext() )
+	openInfo.m_pSearchPath = iter.GetFirst();
+	if ( bCached )
+	{
+		// the paths in front of it don't have the file
+		while ( openInfo.m_pSearchPath && openInfo.m_pSearchPath->m_storeId != cached.m_storeId )
+		{
+			openInfo.m_pSearchPath = iter.GetNext();
+		}
+
+		if ( !openInfo.m_pSearchPath )
+		{
+			bCached = false;
+			openInfo.m_pSearchPath = iter.GetFirst();
+		}
+	}
+
+	for ( ; openInfo.m_pSearchPath != NULL; openInfo.m_pSearchPath = iter.GetNext() )
 	{
 		FileHandle_t filehandle = FindFileInSearchPath( openInfo );
+		if ( !filehandle && openInfo.m_nOpenError && openInfo.m_nOpenError != ENOENT && openInfo.m_nOpenError != ENOTDIR )
+		{
+			bMissing = false;
+		}
+
+		if ( filehandle && !found.m_bFound )
+		{
+			found.m_bFound = true;
+			found.m_storeId = openInfo.m_pSearchPath->m_storeId;
+			if ( bUseCache && !bCached )
+			{
+				AddToSearchPathCache( szCacheKey, found, nCacheGeneration );
+			}
+		}
+
 		if ( filehandle )
 		{
 			// Check if search path is excluded due to pure server white list,
@@ -2550,6 +2709,19 @@ FileHandle_t CBaseFileSystem::OpenForRead( const char *pFileNameT, const char *p
 		}
 	}
 
+	if ( bUseCache && !found.m_bFound )
+	{
+		if ( bCached )
+		{
+			// it went away behind our back, anything else might have too
+			InvalidateSearchPathCache();
+		}
+		else if ( bMissing )
+		{
+			AddToSearchPathCache( szCacheKey, found, nCacheGeneration );
+		}
+	}
+
 	LogFileOpen( "[Failed]", pFileName, "" );
 	return ( FileHandle_t )0;
 }
@@ -2584,6 +2756,10 @@ FileHandle_t CBaseFileSystem::OpenForWrite( const char *pFileName, const char *p
 
 	int64 size;
 	FILE *fp = Trace_FOpen( pTmpFileName, pOptions, 0, &size );
+
+	// the file may be new now
+	InvalidateSearchPathCache();
+
 	if ( !fp )
 	{
 		return ( FileHandle_t )0;
@@ -4659,6 +4835,7 @@ void CBaseFileSystem::RemoveFile( char const* pRelativePath, const char *pathID
 		ComputeFullWritePath( szScratchFileName, sizeof( szScratchFileName ), pRelativePath, pathID );
 	}
 	int fail = unlink( szScratchFileName );
+	InvalidateSearchPathCache();
 	if ( fail != 0 )
 	{
 		Warning( FILESYSTEM_WARNING, "Unable to remove %s!\n", szScratchFileName );
@@ -4718,6 +4895,7 @@ bool CBaseFileSystem::RenameFile( char const *pOldPath, char const *pNewPath, co
 
 	// Now copy the file over
 	int fail = rename( szScratchFileName, pNewFileName );
+	InvalidateSearchPathCache();
 	if (fail != 0)
 	{
 		Warning( FILESYSTEM_WARNING, "Unable to rename %s to %s!\n", szScratchFileName, pNewFileName );
@@ -5185,6 +5363,7 @@ CBaseFileSystem::CPathIDInfo* CBaseFileSystem::FindOrAddPathIDInfo( const CUtlSy
 void CBaseFileSystem::MarkPathIDByRequestOnly( const char *pPathID, bool bRequestOnly )
 {
 	FindOrAddPathIDInfo( g_PathIDTable.AddString( pPathID ), bRequestOnly );
+	InvalidateSearchPathCache();
 }
 
 #if defined( TRACK_BLOCKING_IO )
@@ -672,6 +672,26 @@ public:
 
 	CSearchPath *FindSearchPathByStoreId( int storeId );
 
+	// Which search path OpenForRead first found a relative filename in, so later opens go
+	// straight to it, and which filenames are in none of them. Thrown away whenever the
+	// search paths change or a file is written, renamed or removed through the filesystem,
+	// and after fs_searchpath_cache seconds for changes made by anything else.
+	struct SearchPathCacheEntry_t
+	{
+		bool	m_bFound;		// false if no search path has the file
+		int		m_storeId;		// CSearchPath::m_storeId of the first one that has it
+	};
+
+	bool GetSearchPathCacheKey( const char *pFileName, const char *pathID, PathTypeFilter_t pathFilter, char *pKey, int nKeySize );
+	bool FindInSearchPathCache( const char *pKey, SearchPathCacheEntry_t &entry, int &nGeneration );
+	void AddToSearchPathCache( const char *pKey, const SearchPathCacheEntry_t &entry, int nGeneration );
+	void InvalidateSearchPathCache();
+
+	CThreadFastMutex m_SearchPathCacheMutex;
+	CUtlHashtable< CUtlString, SearchPathCacheEntry_t > m_SearchPathCache;
+	int m_nSearchPathCacheGeneration;	// bumped after every change the cache depends on
+	double m_flSearchPathCacheStartTime;
+
 	int m_iMapLoad;
 
 	// Global list of pack file handles
@@ -858,6 +858,7 @@ CStdioFile *CStdioFile::FS_fopen( const char *filenameT, const char *options, in
 
 
 	pFile = fopen(filename, options);
+	int nOpenError = pFile ? 0 : errno;
 	if (pFile && size)
 	{
 		// todo: replace with filelength()? 
@@ -876,6 +877,10 @@ CStdioFile *CStdioFile::FS_fopen( const char *filenameT, const char *options, in
 		if ( found )
 		{	
 			pFile = fopen( caseFixedName, options );
+			if ( !pFile )
+			{
+				nOpenError = errno;
+			}
 
 			if (pFile && size)
 			{
@@ -938,6 +943,8 @@ CStdioFile *CStdioFile::FS_fopen( const char *filenameT, const char *options, in
 		return new CStdioFile( pFile, bWriteable );
 	}
 
+	// the case insensitive search may have changed it, callers look at why the open failed
+	errno = nOpenError;
 	return NULL;
 }
 
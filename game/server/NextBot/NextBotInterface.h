@@ -235,7 +235,7 @@ inline IVision *INextBot::GetVisionInterface( void ) const
 {
 	if ( m_baseVision == NULL )
 	{
-		m_baseVision = new IVision( const_cast< INextBot * >( this ) );
+		m_baseVision = new NextBotBaseVision( const_cast< INextBot * >( this ) );
 	}
 
 	return m_baseVision;
@@ -6,6 +6,10 @@
 
 #include "NextBotManager.h"
 #include "NextBotInterface.h"
+#include "NextBotVisionInterface.h"
+#include "NextBotBodyInterface.h"
+#include "functorutils.h"
+#include "vstdlib/jobthread.h"
 
 #ifdef TERROR
 #include "ZombieBot/Infected/Infected.h"
@@ -25,6 +29,10 @@ ConVar nb_update_frequency( "nb_update_frequency", ".1", FCVAR_CHEAT );
 ConVar nb_update_framelimit( "nb_update_framelimit", ( IsDebug() ) ? "30" : "15", FCVAR_CHEAT );
 ConVar nb_update_maxslide( "nb_update_maxslide", "2", FCVAR_CHEAT );
 ConVar nb_update_debug( "nb_update_debug", "0", FCVAR_CHEAT );
+ConVar nb_update_sense_parallel( "nb_update_sense_parallel", "1", FCVAR_CHEAT, "Do the vision queries of the bots about to update across the job pool before they update" );
+ConVar nb_update_sense_budget( "nb_update_sense_budget", "2000", FCVAR_CHEAT, "Microseconds per tick the parallel sensing may take, bots that don't fit sense when they update and go first next tick (0 = no limit)" );
+
+extern ConVar nb_blind;
 
 //---------------------------------------------------------------------------------------------
 //---------------------------------------------------------------------------------------------
@@ -304,6 +312,8 @@ inline bool IsDead( INextBot *pBot )
 static int g_nRun;
 static int g_nSlid;
 static int g_nBlockedSlides;
+static int g_nSensed;
+static int g_nSenseDeferred;
 
 void NextBotManager::Update( void )
 {
@@ -391,6 +401,8 @@ void NextBotManager::Update( void )
 			nScheduled = m_botList.Count();
 		}
 
+		SenseScheduledBots();
+
 		if ( nb_update_debug.GetBool() )
 		{
 			int nIntentionalSliders = 0;
@@ -405,10 +417,108 @@ void NextBotManager::Update( void )
 				}
 			}
 
-			Msg( "Frame %8d/tick %8d: %3d run of %3d, %3d sliders, %3d blocked slides, scheduled %3d for next tick, %3d intentional sliders, %d nonresponsive, %d dead\n", gpGlobals->framecount - 1, gpGlobals->tickcount - 1, g_nRun, m_botList.Count() - nDead, g_nSlid, g_nBlockedSlides, nScheduled, nIntentionalSliders, nNonResponsive, nDead );
+			Msg( "Frame %8d/tick %8d: %3d run of %3d, %3d sliders, %3d blocked slides, scheduled %3d for next tick, %3d intentional sliders, %d nonresponsive, %d dead, %d sensed, %d sensing deferred\n", gpGlobals->framecount - 1, gpGlobals->tickcount - 1, g_nRun, m_botList.Count() - nDead, g_nSlid, g_nBlockedSlides, nScheduled, nIntentionalSliders, nNonResponsive, nDead, g_nSensed, g_nSenseDeferred );
 			g_nRun = g_nSlid = g_nBlockedSlides = 0;
+			g_nSensed = g_nSenseDeferred = 0;
+		}
+
+	}
+}
+
+//---------------------------------------------------------------------------------------------
+static void SenseBotVision( IVision *&vision )
+{
+	vision->SenseVisibleEntities();
+}
+
+static int __cdecl CompareSensedFrame( IVision * const *a, IVision * const *b )
+{
+	return (*a)->GetSensedFrame() - (*b)->GetSensedFrame();
+}
+
+//---------------------------------------------------------------------------------------------
+/**
+ * Lazily computed transforms have to be up to date before other threads read them
+ */
+class SettleActorTransforms
+{
+public:
+	bool operator() ( CBaseEntity *actor )
+	{
+		actor->GetAbsOrigin();
+		actor->WorldSpaceCenter();
+		actor->EyePosition();
+		return true;
+	}
+};
+
+//---------------------------------------------------------------------------------------------
+/**
+ * Sensing phase. The vision traces of the bots scheduled this tick only read the world, so
+ * they run across the job pool here, before any bot thinks. Each bot's update (the decision
+ * phase, limited by nb_update_framelimit) then only does its bookkeeping.
+ * Bots that don't fit into nb_update_sense_budget sense inline when they update, and
+ * since we go in order of the last frame a bot sensed, they are first in line next tick.
+ */
+void NextBotManager::SenseScheduledBots( void )
+{
+	VPROF_BUDGET( "NextBotManager::SenseScheduledBots", "NextBot" );
+
+	if ( !nb_update_sense_parallel.GetBool() || nb_blind.GetBool() )
+		return;
+
+	m_senseList.RemoveAll();
+
+	for( int i = m_botList.Head(); i != m_botList.InvalidIndex(); i = m_botList.Next( i ) )
+	{
+		INextBot *bot = m_botList[i];
+
+		if ( m_iUpdateTickrate > 0 && !bot->IsFlaggedForUpdate() )
+			continue;
+
+		if ( IsDead( bot ) )
+			continue;
+
+		IVision *vision = bot->GetVisionInterface();
+		if ( vision && vision->IsSensingThreadSafe() )
+		{
+			m_senseList.AddToTail( vision );
 		}
+	}
+
+	if ( m_senseList.Count() == 0 )
+		return;
+
+	m_senseList.Sort( CompareSensedFrame );
 
+	SettleActorTransforms settle;
+	ForEachActor( settle );
+	FOR_EACH_VEC( m_senseList, it )
+	{
+		m_senseList[ it ]->GetBot()->GetBodyInterface()->GetEyePosition();
+	}
+
+	// small batches, so we can stop close to the budget
+	int nThreads = ( g_pThreadPool ) ? g_pThreadPool->NumThreads() : 0;
+	int nBatch = MAX( 4, 2 * ( nThreads + 1 ) );
+	double budget = nb_update_sense_budget.GetFloat() / 1000000.0;
+	double startTime = Plat_FloatTime();
+
+	int nSensed = 0;
+	while ( nSensed < m_senseList.Count() )
+	{
+		if ( budget > 0.0 && Plat_FloatTime() - startTime >= budget )
+			break;
+
+		int nItems = MIN( nBatch, m_senseList.Count() - nSensed );
+		ParallelProcess( "NextBotManager::SenseScheduledBots", m_senseList.Base() + nSensed, nItems, &SenseBotVision );
+		nSensed += nItems;
+	}
+
+	if ( nb_update_debug.GetBool() )
+	{
+		g_nSensed += nSensed;
+		g_nSenseDeferred += m_senseList.Count() - nSensed;
 	}
 }
 
@@ -145,12 +145,16 @@ protected:
 	int Register( INextBot *bot );
 	void UnRegister( INextBot *bot );
 
+	void SenseScheduledBots( void );				// run the vision queries of the bots about to update across the job pool
+
 	CUtlLinkedList< INextBot * > m_botList;				// list of all active NextBots
 
 	int m_iUpdateTickrate;
 	double m_CurUpdateStartTime;
 	double m_SumFrameTime;
 
+	CUtlVector< IVision * > m_senseList;			// visions SenseScheduledBots() runs this tick
+
 	unsigned int m_debugType;						// debug flags
 
 	struct DebugFilter
@@ -46,6 +46,9 @@ void IVision::Reset( void )
 	m_lastVisionUpdateTimestamp = 0.0f;
 	m_primaryThreat = NULL;
 
+	m_sensedVisible.RemoveAll();
+	m_sensedFrame = -1;
+
 	m_FOV = GetDefaultFieldOfView();
 	m_cosHalfFOV = cos( 0.5f * m_FOV * M_PI / 180.0f );
 	
@@ -364,23 +367,69 @@ public:
 
 
 //------------------------------------------------------------------------------------------
-void IVision::UpdateKnownEntities( void )
+/**
+ * Collect the entities we can see right now, to be used by the next Update() this frame.
+ * This may run on a job thread, it must not change anything but our sensed set.
+ */
+void IVision::SenseVisibleEntities( void )
 {
-	VPROF_BUDGET( "IVision::UpdateKnownEntities", "NextBot" );
+	VPROF_BUDGET( "IVision::SenseVisibleEntities", "NextBot" );
 
 	// construct set of potentially visible objects
 	CUtlVector< CBaseEntity * > potentiallyVisible;
 	CollectPotentiallyVisibleEntities( &potentiallyVisible );
 
-	// collect set of visible and recognized entities at this moment
 	CollectVisible visibleNow( this );
 	FOR_EACH_VEC( potentiallyVisible, pit )
 	{
-		VPROF_BUDGET( "IVision::UpdateKnownEntities( collect visible )", "NextBot" );
-
 		if ( visibleNow( potentiallyVisible[ pit ] ) == false )
 			break;
 	}
+
+	m_sensedVisible.RemoveAll();
+	FOR_EACH_VEC( visibleNow.m_recognized, it )
+	{
+		m_sensedVisible.AddToTail( visibleNow.m_recognized[ it ] );
+	}
+
+	m_sensedFrame = gpGlobals->framecount;
+}
+
+
+//------------------------------------------------------------------------------------------
+void IVision::UpdateKnownEntities( void )
+{
+	VPROF_BUDGET( "IVision::UpdateKnownEntities", "NextBot" );
+
+	// collect set of visible and recognized entities at this moment
+	CollectVisible visibleNow( this );
+
+	if ( m_sensedFrame == gpGlobals->framecount )
+	{
+		// the bot manager already looked around for us this frame
+		FOR_EACH_VEC( m_sensedVisible, sit )
+		{
+			CBaseEntity *entity = m_sensedVisible[ sit ];
+			if ( entity )
+			{
+				visibleNow.m_recognized.AddToTail( entity );
+			}
+		}
+	}
+	else
+	{
+		// construct set of potentially visible objects
+		CUtlVector< CBaseEntity * > potentiallyVisible;
+		CollectPotentiallyVisibleEntities( &potentiallyVisible );
+
+		FOR_EACH_VEC( potentiallyVisible, pit )
+		{
+			VPROF_BUDGET( "IVision::UpdateKnownEntities( collect visible )", "NextBot" );
+
+			if ( visibleNow( potentiallyVisible[ pit ] ) == false )
+				break;
+		}
+	}
 	
 	// update known set with new data
 	{	VPROF_BUDGET( "IVision::UpdateKnownEntities( update status )", "NextBot" );
@@ -26,6 +26,15 @@ public:
 	virtual void Reset( void );									// reset to initial state
 	virtual void Update( void );								// update internal state
 
+	/**
+	 * Collect the entities we can see right now, to be used by the next Update() this frame.
+	 * Only reads the world. If IsSensingThreadSafe(), NextBotManager runs it for many bots
+	 * at once on the job pool before they update.
+	 */
+	void SenseVisibleEntities( void );
+	virtual bool IsSensingThreadSafe( void ) const { return false; }	// return true if our vision queries only read, to sense on the job pool
+	int GetSensedFrame( void ) const;							// frame SenseVisibleEntities() last ran
+
 	//-- attention/short term memory interface follows ------------------------------------------
 
 	//
@@ -121,6 +130,28 @@ private:
 
 	float m_lastVisionUpdateTimestamp;
 	IntervalTimer m_notVisibleTimer[ MAX_TEAMS ];		// for tracking interval since last saw a member of the given team
+
+	CUtlVector< CHandle< CBaseEntity > > m_sensedVisible;	// what SenseVisibleEntities() found
+	int m_sensedFrame;
+};
+
+inline int IVision::GetSensedFrame( void ) const
+{
+	return m_sensedFrame;
+}
+
+
+//----------------------------------------------------------------------------------------------------------------
+/**
+ * The vision of bots that don't provide their own. IVision's queries only read, so it
+ * senses on the job pool. Derive from IVision instead of this.
+ */
+class NextBotBaseVision : public IVision
+{
+public:
+	NextBotBaseVision( INextBot *bot ) : IVision( bot ) { }
+
+	virtual bool IsSensingThreadSafe( void ) const { return true; }
 };
 
 inline void IVision::CollectKnownEntities( CUtlVector< CKnownEntity > *knownVector )
@@ -45,11 +45,14 @@ public:
 
 private:
 	void RefreshPath( INextBot *bot, CBaseEntity *subject, const IPathCost &cost, Vector *pPredictedSubjectPos );
+	void OnRefreshPathResult( INextBot *bot, CBaseEntity *subject, bool isPath, const Vector &pathTarget );
 
 	CountdownTimer m_failTimer;							// throttle re-pathing if last path attempt failed
 	CountdownTimer m_throttleTimer;						// require a minimum time between re-paths
 	CountdownTimer m_lifetimeTimer;
 	EHANDLE m_lastPathSubject;							// the subject used to compute the current/last path
+	EHANDLE m_asyncPathSubject;							// the subject of the path being computed on the job pool
+	Vector m_asyncPathTarget;
 	SubjectChaseType m_chaseHow;
 };
 
@@ -59,6 +62,8 @@ inline ChasePath::ChasePath( SubjectChaseType chaseHow )
 	m_throttleTimer.Invalidate();
 	m_lifetimeTimer.Invalidate();
 	m_lastPathSubject = NULL;
+	m_asyncPathSubject = NULL;
+	m_asyncPathTarget = vec3_origin;
 	m_chaseHow = chaseHow;
 }
 
@@ -85,6 +90,9 @@ inline void ChasePath::Invalidate( void )
 	m_throttleTimer.Invalidate();
 	m_lifetimeTimer.Invalidate();
 
+	// a search that is still running was started for the old situation
+	CancelComputeAsync();
+
 	// extend
 	PathFollower::Invalidate();	
 }
@@ -159,6 +167,22 @@ inline void ChasePath::RefreshPath( INextBot *bot, CBaseEntity *subject, const I
 		return;
 	}
 
+	if ( IsComputingAsync() )
+	{
+		if ( subject == m_asyncPathSubject )
+		{
+			// keep following the current path until the new one is done
+			bool isPath;
+			if ( UpdateComputeAsync( bot, &isPath ) )
+			{
+				OnRefreshPathResult( bot, subject, isPath, m_asyncPathTarget );
+			}
+			return;
+		}
+
+		CancelComputeAsync();
+	}
+
 	if ( !m_failTimer.IsElapsed() )
 	{
 // 		if ( bot->IsDebugging( NEXTBOT_PATH ) )
@@ -203,68 +227,95 @@ inline void ChasePath::RefreshPath( INextBot *bot, CBaseEntity *subject, const I
 		// the situation has changed - try a new path
 		bool isPath;
 		Vector pathTarget = subject->GetAbsOrigin();
+		CBaseCombatCharacter *combatSubject = NULL;
 
 		if ( m_chaseHow == LEAD_SUBJECT )
 		{
 			pathTarget = pPredictedSubjectPos ? *pPredictedSubjectPos : PredictSubjectPosition( bot, subject );
-			isPath = Compute( bot, pathTarget, cost, GetMaxPathLength() );
 		}
 		else if ( subject->MyCombatCharacterPointer() && subject->MyCombatCharacterPointer()->GetLastKnownArea() )
 		{
-			isPath = Compute( bot, subject->MyCombatCharacterPointer(), cost, GetMaxPathLength() );
+			combatSubject = subject->MyCombatCharacterPointer();
+		}
+
+		if ( NextBotPathComputeAsync.GetBool() )
+		{
+			// search on the job pool if the cost allows it, the current path is followed meanwhile
+			bool isStarted = combatSubject ? ComputeAsync( bot, combatSubject, cost, GetMaxPathLength() ) : ComputeAsync( bot, pathTarget, cost, GetMaxPathLength() );
+			if ( isStarted )
+			{
+				m_asyncPathSubject = subject;
+				m_asyncPathTarget = pathTarget;
+				return;
+			}
+		}
+
+		if ( combatSubject )
+		{
+			isPath = Compute( bot, combatSubject, cost, GetMaxPathLength() );
 		}
 		else
 		{
 			isPath = Compute( bot, pathTarget, cost, GetMaxPathLength() );
 		}
 
-		if ( isPath )
+		OnRefreshPathResult( bot, subject, isPath, pathTarget );
+	}
+}
+
+
+//----------------------------------------------------------------------------------------------
+/**
+ * Throttle the next repath, or react to the failure, once a new path is computed
+ */
+inline void ChasePath::OnRefreshPathResult( INextBot *bot, CBaseEntity *subject, bool isPath, const Vector &pathTarget )
+{
+	if ( isPath )
+	{
+		if ( bot->IsDebugging( NEXTBOT_PATH ) )
 		{
-			if ( bot->IsDebugging( NEXTBOT_PATH ) )
-			{
-				//const float size = 20.0f;			
-				//NDebugOverlay::VertArrow( bot->GetPosition() + Vector( 0, 0, size ), bot->GetPosition(), size, 255, RandomInt( 0, 200 ), 255, 255, true, 30.0f );
+			//const float size = 20.0f;			
+			//NDebugOverlay::VertArrow( bot->GetPosition() + Vector( 0, 0, size ), bot->GetPosition(), size, 255, RandomInt( 0, 200 ), 255, 255, true, 30.0f );
 
-				DevMsg( "%3.2f: bot(#%d) REPATH\n", gpGlobals->curtime, bot->GetEntity()->entindex() );
-			}
+			DevMsg( "%3.2f: bot(#%d) REPATH\n", gpGlobals->curtime, bot->GetEntity()->entindex() );
+		}
 
-			m_lastPathSubject = subject;
+		m_lastPathSubject = subject;
 
-			const float minRepathInterval = 0.5f;
-			m_throttleTimer.Start( minRepathInterval );
+		const float minRepathInterval = 0.5f;
+		m_throttleTimer.Start( minRepathInterval );
 
-			// track the lifetime of this new path
-			float lifetime = GetLifetime();
-			if ( lifetime > 0.0f )
-			{
-				m_lifetimeTimer.Start( lifetime );
-			}
-			else
-			{
-				m_lifetimeTimer.Invalidate();
-			}
+		// track the lifetime of this new path
+		float lifetime = GetLifetime();
+		if ( lifetime > 0.0f )
+		{
+			m_lifetimeTimer.Start( lifetime );
 		}
 		else
 		{
-			// can't reach subject - throttle retry based on range to subject
-			m_failTimer.Start( 0.005f * ( bot->GetRangeTo( subject ) ) );
-			
-			// allow bot to react to path failure
-			bot->OnMoveToFailure( this, FAIL_NO_PATH_EXISTS );
-
-			if ( bot->IsDebugging( NEXTBOT_PATH ) )
-			{
-				//const float size = 20.0f;	
-				const float dT = 90.0f;		
-				int c = RandomInt( 0, 100 );
-				//NDebugOverlay::VertArrow( bot->GetPosition() + Vector( 0, 0, size ), bot->GetPosition(), size, 255, c, c, 255, true, dT );
-				NDebugOverlay::HorzArrow( bot->GetPosition(), pathTarget, 5.0f, 255, c, c, 255, true, dT );
+			m_lifetimeTimer.Invalidate();
+		}
+	}
+	else
+	{
+		// can't reach subject - throttle retry based on range to subject
+		m_failTimer.Start( 0.005f * ( bot->GetRangeTo( subject ) ) );
+		
+		// allow bot to react to path failure
+		bot->OnMoveToFailure( this, FAIL_NO_PATH_EXISTS );
 
-				DevMsg( "%3.2f: bot(#%d) REPATH FAILED\n", gpGlobals->curtime, bot->GetEntity()->entindex() );
-			}
+		if ( bot->IsDebugging( NEXTBOT_PATH ) )
+		{
+			//const float size = 20.0f;	
+			const float dT = 90.0f;		
+			int c = RandomInt( 0, 100 );
+			//NDebugOverlay::VertArrow( bot->GetPosition() + Vector( 0, 0, size ), bot->GetPosition(), size, 255, c, c, 255, true, dT );
+			NDebugOverlay::HorzArrow( bot->GetPosition(), pathTarget, 5.0f, 255, c, c, 255, true, dT );
 
-			Invalidate();
+			DevMsg( "%3.2f: bot(#%d) REPATH FAILED\n", gpGlobals->curtime, bot->GetEntity()->entindex() );
 		}
+
+		Invalidate();
 	}
 }
 
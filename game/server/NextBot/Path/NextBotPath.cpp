@@ -6,6 +6,7 @@
 #include "cbase.h"
 
 #include "nav_mesh.h"
+#include "nav_pathfind.h"
 #include "fmtstr.h"
 
 #include "NextBotPath.h"
@@ -22,6 +23,67 @@
 ConVar NextBotPathDrawIncrement( "nb_path_draw_inc", "100", FCVAR_CHEAT );
 ConVar NextBotPathDrawSegmentCount( "nb_path_draw_segment_count", "100", FCVAR_CHEAT );
 ConVar NextBotPathSegmentInfluenceRadius( "nb_path_segment_influence_radius", "100", FCVAR_CHEAT );
+ConVar NextBotPathComputeAsync( "nb_path_compute_async", "1", FCVAR_CHEAT, "Compute repaths on the job pool when the path cost allows it" );
+
+
+//--------------------------------------------------------------------------------------------------------------
+/**
+ * Same cost as CSimpleBotPathCost, from values copied on the main thread
+ */
+float SnapshotPathCost::operator()( CNavArea *area, CNavArea *fromArea, const CNavLadder *ladder, const CFuncElevator *elevator, float length ) const
+{
+	if ( fromArea == NULL )
+	{
+		// first area in path, no cost
+		return 0.0f;
+	}
+
+	if ( area->IsBlocked( m_snapshot.teamID ) )
+	{
+		return -1.0f;
+	}
+
+	// compute distance traveled along path so far
+	float dist;
+
+	if ( ladder )
+	{
+		dist = ladder->m_length;
+	}
+	else if ( length > 0.0 )
+	{
+		// optimization to avoid recomputing length
+		dist = length;
+	}
+	else
+	{
+		dist = ( area->GetCenter() - fromArea->GetCenter() ).Length();
+	}
+
+	float cost = dist + fromArea->GetCostSoFar();
+
+	// check height change
+	float deltaZ = fromArea->ComputeAdjacentConnectionHeightChange( area );
+	if ( deltaZ >= m_snapshot.stepHeight )
+	{
+		if ( deltaZ >= m_snapshot.maxJumpHeight )
+		{
+			// too high to reach
+			return -1.0f;
+		}
+
+		// jumping is slower than flat ground
+		cost += m_snapshot.jumpPenalty * dist;
+	}
+	else if ( deltaZ < -m_snapshot.deathDropHeight )
+	{
+		// too far to drop
+		return -1.0f;
+	}
+
+	return cost;
+}
+
 
 //--------------------------------------------------------------------------------------------------------------
 Path::Path( void )
@@ -33,6 +95,208 @@ Path::Path( void )
 	m_cursorData.segmentPrior = NULL;
 	m_ageTimer.Invalidate();
 	m_subject = NULL;
+	m_pathRequest = NULL;
+}
+
+
+//--------------------------------------------------------------------------------------------------------------
+/**
+ * Start computing shortest path from bot to 'goal' on the job pool, see Compute()
+ */
+bool Path::ComputeAsync( INextBot *bot, const Vector &goal, const IPathCost &costFunc, float maxPathLength, bool includeGoalIfPathFails )
+{
+	VPROF_BUDGET( "Path::ComputeAsync(goal)", "NextBot" );
+
+	PathCostSnapshot snapshot;
+	if ( !costFunc.GetSnapshot( &snapshot ) )
+		return false;
+
+	CNavArea *startArea = bot->GetEntity()->GetLastKnownArea();
+	if ( !startArea )
+		return false;
+
+	// check line-of-sight to the goal position when finding it's nav area
+	const float maxDistanceToArea = 200.0f;
+	CNavArea *goalArea = TheNavMesh->GetNearestNavArea( goal, true, maxDistanceToArea, true );
+
+	// trivial paths are built right away by Compute()
+	if ( startArea == goalArea )
+		return false;
+
+	// make sure path end position is on the ground
+	Vector pathEndPosition = goal;
+	if ( goalArea )
+	{
+		pathEndPosition.z = goalArea->GetZ( pathEndPosition );
+	}
+	else
+	{
+		TheNavMesh->GetGroundHeight( pathEndPosition, &pathEndPosition.z );
+	}
+
+	m_asyncSubject = NULL;
+
+	return StartComputeAsync( bot, startArea, goalArea, goal, pathEndPosition, snapshot, maxPathLength, includeGoalIfPathFails );
+}
+
+
+//--------------------------------------------------------------------------------------------------------------
+/**
+ * Start computing shortest path from bot to 'subject' on the job pool, see Compute()
+ */
+bool Path::ComputeAsync( INextBot *bot, CBaseCombatCharacter *subject, const IPathCost &costFunc, float maxPathLength, bool includeGoalIfPathFails )
+{
+	VPROF_BUDGET( "Path::ComputeAsync(subject)", "NextBot" );
+
+	PathCostSnapshot snapshot;
+	if ( !costFunc.GetSnapshot( &snapshot ) )
+		return false;
+
+	CNavArea *startArea = bot->GetEntity()->GetLastKnownArea();
+	if ( !startArea )
+		return false;
+
+	CNavArea *subjectArea = subject->GetLastKnownArea();
+	if ( !subjectArea || startArea == subjectArea )
+		return false;
+
+	Vector subjectPos = subject->GetAbsOrigin();
+
+	m_asyncSubject = subject;
+
+	return StartComputeAsync( bot, startArea, subjectArea, subjectPos, subjectPos, snapshot, maxPathLength, includeGoalIfPathFails );
+}
+
+
+//--------------------------------------------------------------------------------------------------------------
+bool Path::StartComputeAsync( INextBot *bot, CNavArea *startArea, CNavArea *goalArea, const Vector &goal, const Vector &pathEndPosition, const PathCostSnapshot &snapshot, float maxPathLength, bool includeGoalIfPathFails )
+{
+	CancelComputeAsync();
+
+	m_asyncGoal = goal;
+	m_asyncPathEndPosition = pathEndPosition;
+	m_asyncIncludeGoalIfPathFails = includeGoalIfPathFails;
+
+	m_pathRequest = NavAreaBuildPathAsync( startArea, goalArea, &goal, SnapshotPathCost( snapshot ), maxPathLength, bot->GetEntity()->GetTeamNumber() );
+
+	return true;
+}
+
+
+//--------------------------------------------------------------------------------------------------------------
+/**
+ * Build the path once the search started by ComputeAsync() is done.
+ * Returns false while the search is still running.
+ */
+bool Path::UpdateComputeAsync( INextBot *bot, bool *pathResult )
+{
+	if ( pathResult )
+	{
+		*pathResult = false;
+	}
+
+	if ( !m_pathRequest )
+		return true;
+
+	if ( !m_pathRequest->IsFinished() )
+		return false;
+
+	VPROF_BUDGET( "Path::UpdateComputeAsync", "NextBot" );
+
+	CNavPathRequest *request = m_pathRequest;
+	m_pathRequest = NULL;
+
+	// paths to a subject follow it, like Compute() does
+	CBaseCombatCharacter *subject = m_asyncSubject;
+	m_asyncSubject = NULL;
+
+	Invalidate();
+	m_subject = subject;
+
+	// Failed?
+	CNavArea *closestArea = request->IsStale() ? NULL : request->GetClosestArea();
+	if ( closestArea == NULL )
+	{
+		request->Release();
+		OnPathChanged( bot, NO_PATH );
+		return true;
+	}
+
+	bool foundPath = request->FoundPath();
+	if ( pathResult )
+	{
+		*pathResult = foundPath;
+	}
+
+	// the search lists the areas from the start, keep the ones closest to the goal
+	int count = MIN( request->GetAreaCount(), MAX_PATH_SEGMENTS-1 );	// save room for endpoint
+	int first = request->GetAreaCount() - count;
+
+	if ( count == 1 )
+	{
+		request->Release();
+		BuildTrivialPath( bot, m_asyncGoal );
+		m_subject = subject;
+		return true;
+	}
+
+	// assemble path
+	m_segmentCount = count;
+	for( int i = 0; i < count; ++i )
+	{
+		m_path[ i ].area = request->GetArea( first + i );
+		m_path[ i ].how = request->GetHow( first + i );
+		m_path[ i ].type = ON_GROUND;
+	}
+
+	request->Release();
+
+	if ( foundPath || m_asyncIncludeGoalIfPathFails )
+	{
+		// append actual goal position
+		m_path[ m_segmentCount ].area = closestArea;
+		m_path[ m_segmentCount ].pos = m_asyncPathEndPosition;
+		m_path[ m_segmentCount ].ladder = NULL;
+		m_path[ m_segmentCount ].how = NUM_TRAVERSE_TYPES;
+		m_path[ m_segmentCount ].type = ON_GROUND;
+		++m_segmentCount;
+	}
+
+	// compute path positions
+	if ( ComputePathDetails( bot, bot->GetPosition() ) == false )
+	{
+		Invalidate();
+		OnPathChanged( bot, NO_PATH );
+		return true;
+	}
+
+	// remove redundant nodes and clean up path
+	Optimize( bot );
+
+	PostProcess();
+
+	OnPathChanged( bot, foundPath ? COMPLETE_PATH : PARTIAL_PATH );
+
+	return true;
+}
+
+
+//--------------------------------------------------------------------------------------------------------------
+/**
+ * Drop the search started by ComputeAsync(). A search that already runs is waited for,
+ * so no search outlives its path.
+ */
+void Path::CancelComputeAsync( void )
+{
+	if ( m_pathRequest )
+	{
+		m_pathRequest->Abort();
+		m_pathRequest->WaitForFinish();
+		m_pathRequest->Release();
+		m_pathRequest = NULL;
+	}
+
+	m_asyncSubject = NULL;
 }
 
 
@@ -16,6 +16,24 @@
 class INextBot;
 class CNavArea;
 class CNavLadder;
+class CNavPathRequest;
+
+extern ConVar NextBotPathComputeAsync;
+
+
+//---------------------------------------------------------------------------------------------------------------
+/**
+ * What a path cost depends on besides the nav mesh, copied on the main thread
+ * so the cost can be computed on a pool thread. See IPathCost::GetSnapshot().
+ */
+struct PathCostSnapshot
+{
+	int teamID;							// areas blocked for this team are not traversable
+	float stepHeight;					// climbing less than this costs nothing extra
+	float maxJumpHeight;				// climbing this much or more is not possible
+	float deathDropHeight;				// dropping more than this is not possible
+	float jumpPenalty;					// distance multiplier added for climbing more than a step
+};
 
 
 //---------------------------------------------------------------------------------------------------------------
@@ -27,6 +45,26 @@ class IPathCost
 {
 public:
 	virtual float operator()( CNavArea *area, CNavArea *fromArea, const CNavLadder *ladder, const CFuncElevator *elevator, float length ) const = 0;
+
+	// Fill in 'snapshot' if SnapshotPathCost computes the same cost as this one.
+	// Costs that read more than that can't be computed off the main thread and return false.
+	virtual bool GetSnapshot( PathCostSnapshot *snapshot ) const { return false; }
+};
+
+
+//---------------------------------------------------------------------------------------------------------------
+/**
+ * A path cost computed from a PathCostSnapshot and the nav mesh only, used by Path::ComputeAsync()
+ */
+class SnapshotPathCost
+{
+public:
+	SnapshotPathCost( const PathCostSnapshot &snapshot ) : m_snapshot( snapshot ) { }
+
+	float operator()( CNavArea *area, CNavArea *fromArea, const CNavLadder *ladder, const CFuncElevator *elevator, float length ) const;
+
+private:
+	PathCostSnapshot m_snapshot;
 };
 
 
@@ -52,7 +90,7 @@ class Path
 {
 public:
 	Path( void );
-	virtual ~Path() { }
+	virtual ~Path() { CancelComputeAsync(); }
 	
 	enum SegmentType
 	{
@@ -383,6 +421,21 @@ public:
 	}
 
 
+	//-----------------------------------------------------------------------------------------------------------------
+	/**
+	 * Start computing the same path as Compute() on the job pool, the current path is kept until then.
+	 * Call UpdateComputeAsync() until it returns true, the path is built then.
+	 * Returns false and starts nothing if the cost has no snapshot, or if there is nothing to search
+	 * for. Use Compute() then.
+	 */
+	bool ComputeAsync( INextBot *bot, const Vector &goal, const IPathCost &costFunc, float maxPathLength = 0.0f, bool includeGoalIfPathFails = true );
+	bool ComputeAsync( INextBot *bot, CBaseCombatCharacter *subject, const IPathCost &costFunc, float maxPathLength = 0.0f, bool includeGoalIfPathFails = true );
+
+	bool IsComputingAsync( void ) const	{ return m_pathRequest != NULL; }
+	bool UpdateComputeAsync( INextBot *bot, bool *pathResult = NULL );	// build the path once the search is done, returns false while it is still running. 'pathResult' is what Compute() would have returned.
+	void CancelComputeAsync( void );				// abort the search, or wait for it if it already runs
+
+
 	//-----------------------------------------------------------------------------------------------------------------
 	/**
 	 * Build a path from bot's current location to an undetermined goal area
@@ -603,6 +656,14 @@ private:
 	IntervalTimer m_ageTimer;					// how old is this path?
 	CHandle< CBaseCombatCharacter > m_subject;	// the subject this path leads to
 
+	CNavPathRequest *m_pathRequest;				// search started by ComputeAsync()
+	Vector m_asyncGoal;
+	Vector m_asyncPathEndPosition;
+	bool m_asyncIncludeGoalIfPathFails;
+	CHandle< CBaseCombatCharacter > m_asyncSubject;
+
+	bool StartComputeAsync( INextBot *bot, CNavArea *startArea, CNavArea *goalArea, const Vector &goal, const Vector &pathEndPosition, const PathCostSnapshot &snapshot, float maxPathLength, bool includeGoalIfPathFails );
+
 	/**
 	 * Build a vector of adjacent areas reachable from the given area
 	 */
@@ -109,6 +109,17 @@ public:
 		}
 	}
 
+	// the cost above only reads these, so the path can be computed on the job pool
+	virtual bool GetSnapshot( PathCostSnapshot *snapshot ) const
+	{
+		snapshot->teamID = m_me->GetTeamNumber();
+		snapshot->stepHeight = m_me->GetLocomotionInterface()->GetStepHeight();
+		snapshot->maxJumpHeight = m_me->GetLocomotionInterface()->GetMaxJumpHeight();
+		snapshot->deathDropHeight = m_me->GetLocomotionInterface()->GetDeathDropHeight();
+		snapshot->jumpPenalty = 5.0f;
+		return true;
+	}
+
 	CSimpleBot *m_me;
 };
 
@@ -213,13 +213,10 @@ bool CServerNetworkProperty::IsInPVS( const edict_t *pRecipient, const void *pvs
 
 
 //-----------------------------------------------------------------------------
-// PVS: this function is called a lot, so it avoids function calls
+// Is one of the entity's areas connected to an area the client sees?
 //-----------------------------------------------------------------------------
-bool CServerNetworkProperty::IsInPVS( const CCheckTransmitInfo *pInfo )
+bool CServerNetworkProperty::IsInNetworkedAreas( const CCheckTransmitInfo *pInfo )
 {
-	// PVS data must be up to date
-	Assert( !m_pPev || ( ( m_pPev->m_fStateFlags & FL_EDICT_DIRTY_PVS_INFORMATION ) == 0 ) );
-	
 	int i;
 
 	// Early out if the areas are connected
@@ -250,7 +247,22 @@ bool CServerNetworkProperty::IsInPVS( const CCheckTransmitInfo *pInfo )
 		}
 	}
 
-	if ( i == pInfo->m_AreasNetworked )
+	// false if the areas are not connected
+	return ( i != pInfo->m_AreasNetworked );
+}
+
+
+//-----------------------------------------------------------------------------
+// PVS: this function is called a lot, so it avoids function calls
+//-----------------------------------------------------------------------------
+bool CServerNetworkProperty::IsInPVS( const CCheckTransmitInfo *pInfo )
+{
+	// PVS data must be up to date
+	Assert( !m_pPev || ( ( m_pPev->m_fStateFlags & FL_EDICT_DIRTY_PVS_INFORMATION ) == 0 ) );
+	
+	int i;
+
+	if ( !IsInNetworkedAreas( pInfo ) )
 	{
 		// areas not connected
 		return false;
@@ -92,6 +92,9 @@ public:
 	// This version does a PVS check which also checks for connected areas
 	bool IsInPVS( const CCheckTransmitInfo *pInfo );
 
+	// Just the connected areas part of the check above
+	bool IsInNetworkedAreas( const CCheckTransmitInfo *pInfo );
+
 	// This version doesn't do the area check
 	bool IsInPVS( const edict_t *pRecipient, const void *pvs, int pvssize );
 
@@ -174,6 +174,7 @@ ISpatialPartition *partition = NULL;
 IVModelInfo *modelinfo = NULL;
 IEngineTrace *enginetrace = NULL;
 IGameEventManager2 *gameeventmanager = NULL;
+int g_iGameEventManagerVersion = 0;	// This matches the number at the end of the interface name (so for "GAMEEVENTSMANAGER003", this would be 3).
 IDataCache *datacache = NULL;
 IVDebugOverlay * debugoverlay = NULL;
 ISoundEmitterSystemBase *soundemitterbase = NULL;
@@ -603,8 +604,19 @@ bool CServerGameDLL::DLLInit( CreateInterfaceFn appSystemFactory,
 		return false;
 	if ( (filesystem = (IFileSystem *)fileSystemFactory(FILESYSTEM_INTERFACE_VERSION,NULL)) == NULL )
 		return false;
-	if ( (gameeventmanager = (IGameEventManager2 *)appSystemFactory(INTERFACEVERSION_GAMEEVENTSMANAGER2,NULL)) == NULL )
+	if ( (gameeventmanager = (IGameEventManager2 *)appSystemFactory(INTERFACEVERSION_GAMEEVENTSMANAGER2,NULL)) != NULL )
+	{
+		g_iGameEventManagerVersion = 3;
+	}
+	else if ( (gameeventmanager = (IGameEventManager2 *)appSystemFactory(INTERFACEVERSION_GAMEEVENTSMANAGER2_VERSION_2,NULL)) != NULL )
+	{
+		// older engine, its events can only be accessed by key name
+		g_iGameEventManagerVersion = 2;
+	}
+	else
+	{
 		return false;
+	}
 	if ( (datacache = (IDataCache*)appSystemFactory(DATACACHE_INTERFACE_VERSION, NULL )) == NULL )
 		return false;
 	if ( (soundemitterbase = (ISoundEmitterSystemBase *)appSystemFactory(SOUNDEMITTERSYSTEM_INTERFACE_VERSION, NULL)) == NULL )
@@ -2374,8 +2386,13 @@ public:
 	virtual edict_t*		BaseEntityToEdict( CBaseEntity *pEnt );
 	virtual CBaseEntity*	EdictToBaseEntity( edict_t *pEdict );
 	virtual void			CheckTransmit( CCheckTransmitInfo *pInfo, const unsigned short *pEdictIndices, int nEdicts );
+	virtual void			PrepareCheckTransmit( const unsigned short *pEdictIndices, int nEdicts );
 };
-EXPOSE_SINGLE_INTERFACE(CServerGameEnts, IServerGameEnts, INTERFACEVERSION_SERVERGAMEENTS);
+
+CServerGameEnts g_ServerGameEnts;
+// INTERFACEVERSION_SERVERGAMEENTS_VERSION_1 is compatible with the latest since we're only adding things to the end, so expose that as well.
+EXPOSE_SINGLE_INTERFACE_GLOBALVAR(CServerGameEnts, IServerGameEnts001, INTERFACEVERSION_SERVERGAMEENTS_VERSION_1, g_ServerGameEnts );
+EXPOSE_SINGLE_INTERFACE_GLOBALVAR(CServerGameEnts, IServerGameEnts, INTERFACEVERSION_SERVERGAMEENTS, g_ServerGameEnts );
 
 void CServerGameEnts::SetDebugEdictBase(edict_t *base)
 {
@@ -2439,6 +2456,161 @@ inline void CServerNetworkProperty::CheckTransmit( CCheckTransmitInfo *pInfo )
 	}
 } */
 
+//-----------------------------------------------------------------------------
+// PVS clusters of the edicts of one CheckTransmit batch. The clusters of an
+// entity are packed in groups of four PVS words and bit masks, so a client's
+// PVS is tested against four clusters at once.
+//-----------------------------------------------------------------------------
+class CTransmitClusterCache
+{
+public:
+	CTransmitClusterCache() : m_pEdictIndices( NULL ), m_nEdicts( 0 ), m_nTickCount( -1 ), m_nBuild( 0 )
+	{
+		memset( m_Entries, 0, sizeof( m_Entries ) );
+	}
+
+	void Build( const unsigned short *pEdictIndices, int nEdicts );
+	bool IsBuiltFor( const unsigned short *pEdictIndices, int nEdicts ) const;
+
+	// Same result as pNetProp->IsInPVS( pInfo ), uses the packed clusters if the edict has them
+	bool IsInPVS( CServerNetworkProperty *pNetProp, const CCheckTransmitInfo *pInfo ) const;
+
+private:
+	void AddEntity( CServerNetworkProperty *pNetProp );
+
+	struct ClusterGroup_t
+	{
+		uint32	m_nByteOffset[4];	// of the PVS word holding the cluster
+		uint32	m_nMask[4];			// cluster bit in that word
+	};
+
+	struct Entry_t
+	{
+		int		m_nBuild;			// entry is valid if this matches m_nBuild
+		int		m_iFirstGroup;
+		int		m_nGroups;			// -1 to test the headnode, the entity has too many clusters
+	};
+
+	CUtlVector< ClusterGroup_t, CUtlMemoryAligned< ClusterGroup_t, 16 > > m_Groups;
+	Entry_t					m_Entries[MAX_EDICTS];
+	const unsigned short	*m_pEdictIndices;
+	int						m_nEdicts;
+	int						m_nTickCount;
+	int						m_nBuild;
+};
+
+static CTransmitClusterCache s_TransmitClusterCache;
+
+void CTransmitClusterCache::Build( const unsigned short *pEdictIndices, int nEdicts )
+{
+	m_pEdictIndices = pEdictIndices;
+	m_nEdicts = nEdicts;
+	m_nTickCount = gpGlobals->tickcount;
+	m_nBuild++;
+	m_Groups.RemoveAll();
+
+	edict_t *pBaseEdict = engine->PEntityOfEntIndex( 0 );
+	for ( int i=0; i < nEdicts; i++ )
+	{
+		edict_t *pEdict = &pBaseEdict[pEdictIndices[i]];
+		if ( pEdict->m_fStateFlags & FL_EDICT_DONTSEND )
+			continue;
+
+		// CheckTransmit walks up the hierarchy, the parents need their clusters too
+		CServerNetworkProperty *pNetProp = static_cast<CServerNetworkProperty*>( pEdict->GetNetworkable() );
+		while ( pNetProp && m_Entries[pNetProp->entindex()].m_nBuild != m_nBuild )
+		{
+			AddEntity( pNetProp );
+			pNetProp = pNetProp->GetNetworkParent();
+		}
+	}
+}
+
+void CTransmitClusterCache::AddEntity( CServerNetworkProperty *pNetProp )
+{
+	// nothing may recompute PVS information while clients are checked in parallel
+	pNetProp->RecomputePVSInformation();
+
+	const PVSInfo_t *pPVSInfo = pNetProp->GetPVSInfo();
+	Entry_t &entry = m_Entries[pNetProp->entindex()];
+	entry.m_nBuild = m_nBuild;
+	entry.m_iFirstGroup = m_Groups.Count();
+
+	if ( pPVSInfo->m_nClusterCount < 0 )
+	{
+		entry.m_nGroups = -1;
+		return;
+	}
+
+	entry.m_nGroups = ( pPVSInfo->m_nClusterCount + 3 ) / 4;
+	for ( int i=0; i < entry.m_nGroups; i++ )
+	{
+		ClusterGroup_t &group = m_Groups[m_Groups.AddToTail()];
+		for ( int j=0; j < 4; j++ )
+		{
+			int iCluster = i * 4 + j;
+			if ( iCluster >= pPVSInfo->m_nClusterCount )
+			{
+				// padding, tests no bit
+				group.m_nByteOffset[j] = 0;
+				group.m_nMask[j] = 0;
+				continue;
+			}
+
+			// the mask is built in memory order so it matches the PVS bytes on any endianness
+			int nCluster = pPVSInfo->m_pClusters[iCluster];
+			unsigned char pMask[4] = { 0, 0, 0, 0 };
+			pMask[( nCluster >> 3 ) & 3] = BitVec_BitInByte( nCluster );
+			group.m_nByteOffset[j] = ( nCluster >> 5 ) << 2;
+			memcpy( &group.m_nMask[j], pMask, sizeof( pMask ) );
+		}
+	}
+}
+
+bool CTransmitClusterCache::IsBuiltFor( const unsigned short *pEdictIndices, int nEdicts ) const
+{
+	return m_pEdictIndices == pEdictIndices && m_nEdicts == nEdicts && m_nTickCount == gpGlobals->tickcount;
+}
+
+bool CTransmitClusterCache::IsInPVS( CServerNetworkProperty *pNetProp, const CCheckTransmitInfo *pInfo ) const
+{
+	const Entry_t &entry = m_Entries[pNetProp->entindex()];
+	if ( entry.m_nBuild != m_nBuild )
+		return pNetProp->IsInPVS( pInfo );
+
+	if ( !pNetProp->IsInNetworkedAreas( pInfo ) )
+		return false;
+
+	const unsigned char *pPVS = pInfo->m_PVS;
+	if ( entry.m_nGroups < 0 )
+	{
+		// too many clusters, use headnode
+		return ( engine->CheckHeadnodeVisible( pNetProp->GetPVSInfo()->m_nHeadNode, pPVS, pInfo->m_nPVSSize ) != 0 );
+	}
+
+	ALIGN16 uint32 pWords[4] ALIGN16_POST;
+	fltx4 hits = Four_Zeros;
+	const ClusterGroup_t *pGroup = &m_Groups[entry.m_iFirstGroup];
+	for ( int i=0; i < entry.m_nGroups; i++, pGroup++ )
+	{
+		memcpy( &pWords[0], pPVS + pGroup->m_nByteOffset[0], sizeof( uint32 ) );
+		memcpy( &pWords[1], pPVS + pGroup->m_nByteOffset[1], sizeof( uint32 ) );
+		memcpy( &pWords[2], pPVS + pGroup->m_nByteOffset[2], sizeof( uint32 ) );
+		memcpy( &pWords[3], pPVS + pGroup->m_nByteOffset[3], sizeof( uint32 ) );
+		hits = OrSIMD( hits, AndSIMD( LoadAlignedSIMD( pWords ), LoadAlignedSIMD( pGroup->m_nMask ) ) );
+	}
+
+	// the hits are bit patterns, not floats, so test them as ints
+	StoreAlignedSIMD( (float*)pWords, hits );
+	return ( pWords[0] | pWords[1] | pWords[2] | pWords[3] ) != 0;
+}
+
+
+void CServerGameEnts::PrepareCheckTransmit( const unsigned short *pEdictIndices, int nEdicts )
+{
+	s_TransmitClusterCache.Build( pEdictIndices, nEdicts );
+}
+
 void CServerGameEnts::CheckTransmit( CCheckTransmitInfo *pInfo, const unsigned short *pEdictIndices, int nEdicts )
 {
 	// NOTE: for speed's sake, this assumes that all networkables are CBaseEntities and that the edict list
@@ -2467,6 +2639,9 @@ void CServerGameEnts::CheckTransmit( CCheckTransmitInfo *pInfo, const unsigned s
 		    bIsReplay == ( pInfo->m_pTransmitAlways != NULL) );
 #endif
 
+	// without PrepareCheckTransmit for this edict list every entity takes the slow path
+	const bool bUseClusterCache = s_TransmitClusterCache.IsBuiltFor( pEdictIndices, nEdicts );
+
 	for ( int i=0; i < nEdicts; i++ )
 	{
 		int iEdict = pEdictIndices[i];
@@ -2561,7 +2736,7 @@ void CServerGameEnts::CheckTransmit( CCheckTransmitInfo *pInfo, const unsigned s
 			continue;
 		}
 
-		bool bInPVS = netProp->IsInPVS( pInfo );
+		bool bInPVS = bUseClusterCache ? s_TransmitClusterCache.IsInPVS( netProp, pInfo ) : netProp->IsInPVS( pInfo );
 		if ( bInPVS || sv_force_transmit_ents.GetBool() )
 		{
 			// only send if entity is in PVS
@@ -2616,7 +2791,7 @@ void CServerGameEnts::CheckTransmit( CCheckTransmitInfo *pInfo, const unsigned s
 			{
 				// Check pvs
 				check->RecomputePVSInformation();
-				bool bMoveParentInPVS = check->IsInPVS( pInfo );
+				bool bMoveParentInPVS = bUseClusterCache ? s_TransmitClusterCache.IsInPVS( check, pInfo ) : check->IsInPVS( pInfo );
 				if ( bMoveParentInPVS )
 				{
 					orig->SetTransmit( pInfo, true );
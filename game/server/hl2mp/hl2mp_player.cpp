@@ -585,8 +585,10 @@ void CHL2MP_Player::PlayerDeathThink()
 
 void CHL2MP_Player::FireBullets ( const FireBulletsInfo_t &info )
 {
-	// Move other players back to history positions based on local player's lag
-	lagcompensation->StartLagCompensation( this, this->GetCurrentCommand() );
+	// Move other players back to history positions based on local player's lag. Pellets
+	// stay within the spread cone, every other shotgun pellet is a 3 unit hull trace.
+	lagcompensation->StartLagCompensationAlongRay( this, this->GetCurrentCommand(), info.m_vecSrc, info.m_vecDirShooting,
+		info.m_flDistance, info.m_vecSpread.Length(), ( info.m_iShots > 1 ) ? 6.0f : 0.0f );
 
 	FireBulletsInfo_t modinfo = info;
 
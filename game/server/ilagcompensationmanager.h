@@ -13,6 +13,7 @@
 
 class CBasePlayer;
 class CUserCmd;
+class Vector;
 
 //-----------------------------------------------------------------------------
 // Purpose: This is also an IServerSystem
@@ -22,6 +23,9 @@ abstract_class ILagCompensationManager
 public:
 	// Called during player movement to set up/restore after lag compensation
 	virtual void	StartLagCompensation( CBasePlayer *player, CUserCmd *cmd ) = 0;
+	// Same, but players the shots can't reach are left where they are. vecDir is normalized, flSpread
+	// is how far shots stray sideways per unit of distance and flRadius the size of hull traces.
+	virtual void	StartLagCompensationAlongRay( CBasePlayer *player, CUserCmd *cmd, const Vector &vecSrc, const Vector &vecDir, float flDistance, float flSpread, float flRadius ) = 0;
 	virtual void	FinishLagCompensation( CBasePlayer *player ) = 0;
 };
 
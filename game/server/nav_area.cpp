@@ -527,6 +527,8 @@ public:
  */
 CNavArea::~CNavArea()
 {
+	NavWaitForPathRequests();
+
 	// spot encounters aren't owned by anything else, so free them up here
 	m_spotEncounters.PurgeAndDeleteElements();
 
@@ -554,6 +556,8 @@ CNavArea::~CNavArea()
  */
 void CNavArea::ConnectElevators( void )
 {
+	NavWaitForPathRequests();
+
 	m_elevator = NULL;
 	m_attributeFlags &= ~NAV_MESH_HAS_ELEVATOR;
 	m_elevatorAreas.RemoveAll();
@@ -786,6 +790,8 @@ void CNavArea::OnDestroyNotify( CNavLadder *dead )
  */
 void CNavArea::ConnectTo( CNavArea *area, NavDirType dir )
 {
+	NavWaitForPathRequests();
+
 	// don't allow self-referential connections
 	if ( area == this )
 		return;
@@ -821,6 +827,8 @@ void CNavArea::ConnectTo( CNavArea *area, NavDirType dir )
  */
 void CNavArea::ConnectTo( CNavLadder *ladder )
 {
+	NavWaitForPathRequests();
+
 	float center = (ladder->m_top.z + ladder->m_bottom.z) * 0.5f;
 
 	Disconnect( ladder ); // just in case
@@ -841,6 +849,8 @@ void CNavArea::ConnectTo( CNavLadder *ladder )
  */
 void CNavArea::Disconnect( CNavArea *area )
 {
+	NavWaitForPathRequests();
+
 	NavConnect connect;
 	connect.area = area;
 
@@ -872,6 +882,8 @@ void CNavArea::Disconnect( CNavArea *area )
  */
 void CNavArea::Disconnect( CNavLadder *ladder )
 {
+	NavWaitForPathRequests();
+
 	NavLadderConnect con;
 	con.ladder = ladder;
 
@@ -885,6 +897,8 @@ void CNavArea::Disconnect( CNavLadder *ladder )
 //--------------------------------------------------------------------------------------------------------------
 void CNavArea::AddLadderUp( CNavLadder *ladder )
 {
+	NavWaitForPathRequests();
+
 	Disconnect( ladder ); // just in case
 
 	NavLadderConnect tmp;
@@ -896,6 +910,8 @@ void CNavArea::AddLadderUp( CNavLadder *ladder )
 //--------------------------------------------------------------------------------------------------------------
 void CNavArea::AddLadderDown( CNavLadder *ladder )
 {
+	NavWaitForPathRequests();
+
 	Disconnect( ladder ); // just in case
 
 	NavLadderConnect tmp;
@@ -911,6 +927,8 @@ void CNavArea::AddLadderDown( CNavLadder *ladder )
  */
 void CNavArea::FinishMerge( CNavArea *adjArea )
 {
+	NavWaitForPathRequests();
+
 	// update extent
 	m_nwCorner = *m_node[ NORTH_WEST ]->GetPosition();
 	m_seCorner = *m_node[ SOUTH_EAST ]->GetPosition();
@@ -1358,6 +1376,8 @@ float CNavArea::ComputeGroundHeightChange( const CNavArea *area )
  */
 void CNavArea::AddIncomingConnection( CNavArea *source, NavDirType incomingEdgeDir )
 {
+	NavWaitForPathRequests();
+
 	NavConnect con;
 	con.area = source;
 	if ( m_incomingConnect[ incomingEdgeDir ].Find( con ) == m_incomingConnect[ incomingEdgeDir ].InvalidIndex() )
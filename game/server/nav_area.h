@@ -22,6 +22,37 @@ enum { MAX_NAV_TEAMS = 2 };
 class CFuncElevator;
 class CFuncNavPrerequisite;
 class CFuncNavCost;
+class CNavArea;
+class CNavPathSearch;
+
+
+//-------------------------------------------------------------------------------------------------------------------
+/**
+ * A* state of one area in a CNavPathSearch. While a search runs, the area's
+ * parent and cost accessors return this instead of the area's own state.
+ */
+struct NavSearchNode_t
+{
+	CNavArea *m_area;
+	CNavArea *m_parent;
+	NavTraverseType m_parentHow;
+	float m_totalCost;
+	float m_costSoFar;
+	float m_pathLengthSoFar;
+	int m_heapIndex;											// index in the open list heap, or NAV_NODE_UNVISITED/NAV_NODE_CLOSED
+	unsigned int m_openOrder;									// areas with the same cost come off the open list in the order they went on
+};
+
+enum { NAV_NODE_UNVISITED = -1, NAV_NODE_CLOSED = -2 };
+
+extern CTHREADLOCALPTR( CNavPathSearch ) g_pActiveNavPathSearch;	// path search running on this thread, if any
+extern const NavSearchNode_t *NavFindSearchNode( const CNavPathSearch *search, const CNavArea *area );
+
+inline const NavSearchNode_t *NavGetActiveSearchNode( const CNavArea *area )
+{
+	CNavPathSearch *search = g_pActiveNavPathSearch;
+	return ( search ) ? NavFindSearchNode( search, area ) : NULL;
+}
 
 class CNavVectorNoEditAllocator
 {
@@ -428,8 +459,8 @@ public:
 	BOOL IsMarked( void ) const			{ return (m_marker == m_masterMarker) ? true : false; }
 	
 	void SetParent( CNavArea *parent, NavTraverseType how = NUM_TRAVERSE_TYPES )	{ m_parent = parent; m_parentHow = how; }
-	CNavArea *GetParent( void ) const	{ return m_parent; }
-	NavTraverseType GetParentHow( void ) const	{ return m_parentHow; }
+	CNavArea *GetParent( void ) const;
+	NavTraverseType GetParentHow( void ) const;
 
 	bool IsOpen( void ) const;									// true if on "open list"
 	void AddToOpenList( void );									// add to open list in decreasing value order
@@ -446,13 +477,13 @@ public:
 	static void ClearSearchLists( void );						// clears the open and closed lists for a new search
 
 	void SetTotalCost( float value )	{ Assert( value >= 0.0 && !IS_NAN(value) ); m_totalCost = value; }
-	float GetTotalCost( void ) const	{ return m_totalCost; }
+	float GetTotalCost( void ) const;
 
 	void SetCostSoFar( float value )	{ Assert( value >= 0.0 && !IS_NAN(value) ); m_costSoFar = value; }
-	float GetCostSoFar( void ) const	{ return m_costSoFar; }
+	float GetCostSoFar( void ) const;
 
 	void SetPathLengthSoFar( float value )	{ Assert( value >= 0.0 && !IS_NAN(value) ); m_pathLengthSoFar = value; }
-	float GetPathLengthSoFar( void ) const	{ return m_pathLengthSoFar; }
+	float GetPathLengthSoFar( void ) const;
 
 	//- editing -----------------------------------------------------------------------------------------
 	virtual void Draw( void ) const;							// draw area for debugging & editing
@@ -824,6 +855,41 @@ inline CNavArea *CNavArea::GetAdjacentArea( NavDirType dir, int i ) const
 	return NULL;
 }
 
+//--------------------------------------------------------------------------------------------------------------
+inline CNavArea *CNavArea::GetParent( void ) const
+{
+	const NavSearchNode_t *node = NavGetActiveSearchNode( this );
+	return ( node ) ? node->m_parent : m_parent;
+}
+
+//--------------------------------------------------------------------------------------------------------------
+inline NavTraverseType CNavArea::GetParentHow( void ) const
+{
+	const NavSearchNode_t *node = NavGetActiveSearchNode( this );
+	return ( node ) ? node->m_parentHow : m_parentHow;
+}
+
+//--------------------------------------------------------------------------------------------------------------
+inline float CNavArea::GetTotalCost( void ) const
+{
+	const NavSearchNode_t *node = NavGetActiveSearchNode( this );
+	return ( node ) ? node->m_totalCost : m_totalCost;
+}
+
+//--------------------------------------------------------------------------------------------------------------
+inline float CNavArea::GetCostSoFar( void ) const
+{
+	const NavSearchNode_t *node = NavGetActiveSearchNode( this );
+	return ( node ) ? node->m_costSoFar : m_costSoFar;
+}
+
+//--------------------------------------------------------------------------------------------------------------
+inline float CNavArea::GetPathLengthSoFar( void ) const
+{
+	const NavSearchNode_t *node = NavGetActiveSearchNode( this );
+	return ( node ) ? node->m_pathLengthSoFar : m_pathLengthSoFar;
+}
+
 //--------------------------------------------------------------------------------------------------------------
 inline bool CNavArea::IsOpen( void ) const
 {
@@ -3712,6 +3712,7 @@ void CNavMesh::CommandNavLadderFlip( void )
 		m_selectedLadder->SetDir( OppositeDirection( m_selectedLadder->GetDir() ) );
 
 		// and reverse ladder's area pointers
+		NavWaitForPathRequests();
 		area = m_selectedLadder->m_topBehindArea;
 		m_selectedLadder->m_topBehindArea = m_selectedLadder->m_topForwardArea;
 		m_selectedLadder->m_topForwardArea = area;
@@ -17,6 +17,8 @@
 #include "viewport_panel_names.h"
 //#include "terror/TerrorShared.h"
 #include "fmtstr.h"
+#include "tier1/utlhashtable.h"
+#include "vstdlib/jobthread.h"
 
 #ifdef TERROR
 #include "func_simpleladder.h"
@@ -42,6 +44,7 @@ ConVar nav_generate_fixup_jump_areas( "nav_generate_fixup_jump_areas", "1", FCVA
 ConVar nav_generate_incremental_range( "nav_generate_incremental_range", "2000", FCVAR_CHEAT );
 ConVar nav_generate_incremental_tolerance( "nav_generate_incremental_tolerance", "0", FCVAR_CHEAT, "Z tolerance for adding new nav areas." );
 ConVar nav_area_max_size( "nav_area_max_size", "50", FCVAR_CHEAT, "Max area size created in nav generation" );
+ConVar nav_generate_parallel( "nav_generate_parallel", "1", FCVAR_CHEAT, "Do the traces of nav generation on the job pool. The generated mesh is the same either way." );
 
 // Common bounding box for traces
 Vector NavTraceMins( -0.45, -0.45, 0 );
@@ -51,6 +54,278 @@ bool FindGroundForNode( Vector *pos, Vector *normal );	// find a ground Z for po
 const float MaxTraversableHeight = StepHeight;		// max internal obstacle height that can occur between nav nodes and safely disregarded
 const float MinObstacleAreaWidth = 10.0f;			// min width of a nav area we will generate on top of an obstacle
 
+//--------------------------------------------------------------------------------------------------------------
+/**
+ * The result of trying to step from a node to an adjacent grid position while sampling.
+ * It only depends on the world and on where the node is.
+ */
+struct NavSampleStep_t
+{
+	enum { QUEUED, RUNNING, DONE };
+
+	Vector m_from;									// position of the node we step from
+	Vector m_pos;									// grid position we step to
+	CInterlockedInt m_state;
+
+	bool m_canStep;
+	Vector m_to;									// ground position reached
+	Vector m_toNormal;
+	bool m_isOnDisplacement;
+	float m_obstacleHeight;
+	float m_obstacleStartDist;
+	float m_obstacleEndDist;
+};
+
+
+//--------------------------------------------------------------------------------------------------------------
+/**
+ * Return the grid position adjacent to 'from' in the given direction
+ */
+static Vector GetSampleStepPos( const Vector &from, NavDirType dir )
+{
+	Vector pos = from;
+
+	// snap to grid
+	int cx = TheNavMesh->SnapToGrid( pos.x );
+	int cy = TheNavMesh->SnapToGrid( pos.y );
+
+	switch( dir )
+	{
+		case NORTH:		cy -= GenerationStepSize; break;
+		case SOUTH:		cy += GenerationStepSize; break;
+		case EAST:		cx += GenerationStepSize; break;
+		case WEST:		cx -= GenerationStepSize; break;
+	}
+
+	pos.x = cx;
+	pos.y = cy;
+
+	return pos;
+}
+
+
+//--------------------------------------------------------------------------------------------------------------
+/**
+ * Tries the steps of newly added nodes ahead of time on the job pool.
+ * SampleStep() still takes the steps one at a time and in the same order,
+ * so the nodes come out exactly as they do when sampling serially.
+ */
+class CNavSampleStepper
+{
+public:
+	CNavSampleStepper( void )
+	{
+		m_stop = false;
+	}
+
+	void Start( void );										// start pool jobs trying queued steps
+	void Stop( void );										// stop the pool jobs, queued steps are kept
+	void Reset( void );										// stop, and forget every step
+
+	bool IsRunning( void ) const	{ return m_jobs.Count() > 0; }
+
+	void QueueSteps( CNavNode *node );						// try the unvisited directions of this node ahead of time
+	const NavSampleStep_t *TakeStep( CNavNode *node, NavDirType dir );	// return the result for this step, or NULL if it wasn't queued
+
+private:
+	void Work( void );
+	NavSampleStep_t *PopQueued( void );
+
+	struct NodeSteps
+	{
+		NavSampleStep_t *step[ NUM_DIRECTIONS ];
+	};
+	CUtlHashtable< const CNavNode *, NodeSteps, PointerHashFunctor, PointerEqualFunctor > m_nodeSteps;	// main thread only
+
+	CThreadFastMutex m_queueMutex;
+	CUtlVector< NavSampleStep_t * > m_queue;				// newest last, those are needed first
+	CThreadEvent m_queueEvent;
+
+	CUtlVector< NavSampleStep_t * > m_taken;				// deleted once no pool job can see them
+	CUtlVector< CJob * > m_jobs;
+	volatile bool m_stop;
+};
+
+static CNavSampleStepper s_sampleStepper;
+
+
+//--------------------------------------------------------------------------------------------------------------
+void CNavSampleStepper::Start( void )
+{
+	if ( IsRunning() || !g_pThreadPool || !nav_generate_parallel.GetBool() )
+		return;
+
+	m_stop = false;
+	for( int i=0; i<g_pThreadPool->NumThreads(); ++i )
+	{
+		m_jobs.AddToTail( g_pThreadPool->QueueCall( this, &CNavSampleStepper::Work ) );
+	}
+}
+
+
+//--------------------------------------------------------------------------------------------------------------
+void CNavSampleStepper::Stop( void )
+{
+	m_stop = true;
+	m_queueEvent.Set();
+
+	FOR_EACH_VEC( m_jobs, it )
+	{
+		m_jobs[ it ]->WaitForFinish();
+		m_jobs[ it ]->Release();
+	}
+	m_jobs.RemoveAll();
+
+	// the jobs are gone, only keep the steps that haven't been tried
+	int queued = 0;
+	FOR_EACH_VEC( m_queue, qit )
+	{
+		if ( m_queue[ qit ]->m_state == NavSampleStep_t::QUEUED )
+		{
+			m_queue[ queued++ ] = m_queue[ qit ];
+		}
+	}
+	m_queue.RemoveMultipleFromTail( m_queue.Count() - queued );
+
+	m_taken.PurgeAndDeleteElements();
+	m_stop = false;
+}
+
+
+//--------------------------------------------------------------------------------------------------------------
+void CNavSampleStepper::Reset( void )
+{
+	Stop();
+
+	// steps whose direction was visited from the other side are never taken
+	FOR_EACH_HASHTABLE( m_nodeSteps, it )
+	{
+		NodeSteps &steps = m_nodeSteps.Element( it );
+		for( int d=0; d<NUM_DIRECTIONS; ++d )
+		{
+			delete steps.step[d];
+		}
+	}
+	m_nodeSteps.Purge();
+	m_queue.Purge();
+}
+
+
+//--------------------------------------------------------------------------------------------------------------
+void CNavSampleStepper::QueueSteps( CNavNode *node )
+{
+	if ( !IsRunning() )
+		return;
+
+	NodeSteps steps;
+	int count = 0;
+	for( int d=0; d<NUM_DIRECTIONS; ++d )
+	{
+		steps.step[d] = NULL;
+
+		if ( node->HasVisited( (NavDirType)d ) )
+			continue;
+
+		NavSampleStep_t *step = new NavSampleStep_t;
+		step->m_from = *node->GetPosition();
+		step->m_pos = GetSampleStepPos( step->m_from, (NavDirType)d );
+		step->m_state = NavSampleStep_t::QUEUED;
+		steps.step[d] = step;
+		++count;
+	}
+
+	if ( count == 0 )
+		return;
+
+	m_nodeSteps.Insert( node, steps );
+
+	{
+		AUTO_LOCK( m_queueMutex );
+
+		// the search goes north first, so have it on top
+		for( int d=NUM_DIRECTIONS-1; d>=0; --d )
+		{
+			if ( steps.step[d] )
+			{
+				m_queue.AddToTail( steps.step[d] );
+			}
+		}
+	}
+
+	m_queueEvent.Set();
+}
+
+
+//--------------------------------------------------------------------------------------------------------------
+const NavSampleStep_t *CNavSampleStepper::TakeStep( CNavNode *node, NavDirType dir )
+{
+	UtlHashHandle_t h = m_nodeSteps.Find( node );
+	if ( h == m_nodeSteps.InvalidHandle() )
+		return NULL;
+
+	NavSampleStep_t *step = m_nodeSteps.Element( h ).step[ dir ];
+	if ( step == NULL )
+		return NULL;
+
+	m_nodeSteps.Element( h ).step[ dir ] = NULL;
+	m_taken.AddToTail( step );
+
+	if ( step->m_state.AssignIf( NavSampleStep_t::QUEUED, NavSampleStep_t::RUNNING ) )
+	{
+		// no job got to it yet
+		TheNavMesh->TestSampleStep( step );
+		step->m_state = NavSampleStep_t::DONE;
+	}
+	else
+	{
+		while ( step->m_state != NavSampleStep_t::DONE )
+		{
+			ThreadPause();
+		}
+	}
+
+	return step;
+}
+
+
+//--------------------------------------------------------------------------------------------------------------
+NavSampleStep_t *CNavSampleStepper::PopQueued( void )
+{
+	AUTO_LOCK( m_queueMutex );
+
+	while ( m_queue.Count() )
+	{
+		NavSampleStep_t *step = m_queue.Tail();
+		m_queue.RemoveMultipleFromTail( 1 );
+
+		if ( step->m_state == NavSampleStep_t::QUEUED )
+			return step;
+	}
+
+	return NULL;
+}
+
+
+//--------------------------------------------------------------------------------------------------------------
+void CNavSampleStepper::Work( void )
+{
+	while ( !m_stop )
+	{
+		NavSampleStep_t *step = PopQueued();
+		if ( step == NULL )
+		{
+			m_queueEvent.Wait( 1 );
+			continue;
+		}
+
+		if ( step->m_state.AssignIf( NavSampleStep_t::QUEUED, NavSampleStep_t::RUNNING ) )
+		{
+			TheNavMesh->TestSampleStep( step );
+			step->m_state = NavSampleStep_t::DONE;
+		}
+	}
+}
+
 //--------------------------------------------------------------------------------------------------------------
 /**
  * Shortest path cost, paying attention to "blocked" areas
@@ -368,6 +643,8 @@ void CNavMesh::CreateLadder( const Vector &top, const Vector &bottom, float widt
 //--------------------------------------------------------------------------------------------------------------
 void CNavLadder::ConnectGeneratedLadder( float maxHeightAboveTopArea )
 {
+	NavWaitForPathRequests();
+
 	const float nearLadderRange = 75.0f;		// 50
 
 	//
@@ -3100,7 +3377,7 @@ bool CNavMesh::TestArea( CNavNode *node, int width, int height )
 
 			// Now that we've done the quick checks, test for a valid crouch area.
 			// This finds pillars etc in the middle of 4 nodes, that weren't found initially.
-			if ( nodeCrouch && !TestForValidCrouchArea( horizNode ) )
+			if ( nodeCrouch && !IsValidCrouchArea( horizNode ) )
 			{
 				return false;
 			}
@@ -3262,6 +3539,41 @@ int CNavMesh::BuildArea( CNavNode *node, int width, int height )
 }
 
 
+//--------------------------------------------------------------------------------------------------------------
+/**
+ * Do the traces of a node that building areas needs. They only depend on where the node is,
+ * so this runs on the job pool for all nodes at once.
+ * Only nodes AddNode() reached are checked for crouching, like a serial run does.
+ */
+void CNavMesh::CheckNodeForAreas( CNavNode *&node )
+{
+	if ( node->m_isCrouchCheckPending )
+	{
+		node->m_isCrouchCheckPending = false;
+		node->CheckCrouch();
+	}
+
+	node->m_isValidCrouchArea = TestForValidCrouchArea( node );
+	node->m_isValidCrouchAreaKnown = true;
+}
+
+
+//--------------------------------------------------------------------------------------------------------------
+/**
+ * Return the TestForValidCrouchArea() result of the node, tracing only the first time
+ */
+bool CNavMesh::IsValidCrouchArea( CNavNode *node )
+{
+	if ( !node->m_isValidCrouchAreaKnown )
+	{
+		node->m_isValidCrouchArea = TestForValidCrouchArea( node );
+		node->m_isValidCrouchAreaKnown = true;
+	}
+
+	return node->m_isValidCrouchArea;
+}
+
+
 //--------------------------------------------------------------------------------------------------------------
 /**
  * This function uses the CNavNodes that have been sampled from the map to
@@ -3274,6 +3586,18 @@ int CNavMesh::BuildArea( CNavNode *node, int width, int height )
  */
 void CNavMesh::CreateNavAreasFromNodes( void )
 {
+	if ( nav_generate_parallel.GetBool() )
+	{
+		CUtlVector< CNavNode * > nodes;
+		nodes.EnsureCapacity( CNavNode::GetListLength() );
+		for( CNavNode *node = CNavNode::GetFirst(); node; node = node->GetNext() )
+		{
+			nodes.AddToTail( node );
+		}
+
+		ParallelProcess( "CNavMesh::CheckNodeForAreas", nodes.Base(), nodes.Count(), &CNavMesh::CheckNodeForAreas );
+	}
+
 	// haven't yet seen a map use larger than 30...
 	int tryWidth = nav_area_max_size.GetInt();
 	int tryHeight = tryWidth;
@@ -3425,6 +3749,8 @@ void CNavMesh::BeginGeneration( bool incremental )
 		nav_quicksave.SetValue( 1 );
 	}
 
+	s_sampleStepper.Reset();
+
 	m_generationState = SAMPLE_WALKABLE_SPACE;
 	m_sampleTick = 0;
 	m_generationMode = (incremental) ? GENERATE_INCREMENTAL : GENERATE_FULL;
@@ -3466,6 +3792,34 @@ void CNavMesh::BeginGeneration( bool incremental )
 }
 
 
+//--------------------------------------------------------------------------------------------------------------
+/**
+ * Generate and save a Navigation Mesh in one go, instead of a little every frame.
+ * Finding light intensity needs frames, if it runs the rest of the generation happens in Update().
+ */
+void CNavMesh::GenerateNow( bool quitWhenFinished )
+{
+	BeginGeneration();
+	m_bQuitWhenFinished = quitWhenFinished;
+
+	if ( !IsGenerating() )
+	{
+		if ( quitWhenFinished )
+		{
+			engine->ServerCommand( "quit\n" );
+		}
+		return;
+	}
+
+	// long slices, the sampler frees the steps it took between them
+	while ( UpdateGeneration( 1.0f ) )
+	{
+		if ( m_generationState == FIND_LIGHT_INTENSITY )
+			return;
+	}
+}
+
+
 //--------------------------------------------------------------------------------------------------------------
 /**
  * Re-analyze an existing Mesh.  Determine Hiding Spots, Encounter Spots, etc.
@@ -3631,14 +3985,19 @@ bool CNavMesh::UpdateGeneration( float maxTime )
 			AnalysisProgress( "Sampling walkable space...", 100, m_sampleTick / 10, false );
 			m_sampleTick = ( m_sampleTick + 1 ) % 1000;
 
+			s_sampleStepper.Start();
+
 			while ( SampleStep() )
 			{
 				if ( Plat_FloatTime() - startTime > maxTime )
 				{
+					s_sampleStepper.Stop();
 					return true;
 				}
 			}
 
+			s_sampleStepper.Reset();
+
 			// sampling is complete, now build nav areas
 			m_generationState = CREATE_AREAS_FROM_SAMPLES;
 
@@ -4106,9 +4465,20 @@ CNavNode *CNavMesh::AddNode( const Vector &destPos, const Vector &normal, NavDir
 	{
 		// new node becomes current node
 		m_currentNode = node;
+
+		// start on its neighbors while we search elsewhere
+		s_sampleStepper.QueueSteps( node );
 	}
 
-	node->CheckCrouch();
+	if ( nav_generate_parallel.GetBool() )
+	{
+		// CreateNavAreasFromNodes() does the crouch traces of all these nodes at once
+		node->m_isCrouchCheckPending = true;
+	}
+	else
+	{
+		node->CheckCrouch();
+	}
 
 	// determine if there's a cliff nearby and set an attribute on this node
 	for ( int i = 0; i < NUM_DIRECTIONS; i++ )
@@ -4331,6 +4701,187 @@ static bool IsNodeOverlapped( const Vector& pos, const Vector& offset )
 }
 
 
+//--------------------------------------------------------------------------------------------------------------
+/**
+ * Try to step from step->m_from to the adjacent grid position step->m_pos.
+ * This only reads the world, so it is safe to run on the job pool while sampling.
+ */
+void CNavMesh::TestSampleStep( NavSampleStep_t *step ) const
+{
+	const Vector &pos = step->m_pos;
+	step->m_canStep = false;
+
+	trace_t result;
+	Vector from( step->m_from );
+	CTraceFilterWalkableEntities filter( NULL, COLLISION_GROUP_NONE, WALK_THRU_EVERYTHING );
+	Vector to, toNormal;
+	float obstacleHeight = 0, obstacleStartDist = 0, obstacleEndDist = GenerationStepSize;
+	if ( TraceAdjacentNode( 0, from, pos, &result ) )
+	{
+		to = result.endpos;
+		toNormal = result.plane.normal;
+	}
+	else
+	{
+		// test going up ClimbUpHeight
+		bool success = false;
+		for ( float height = StepHeight; height <= ClimbUpHeight; height += 1.0f )
+		{						
+			trace_t tr;
+			Vector start( from );
+			Vector end( pos );
+			start.z += height;
+			end.z += height;
+			UTIL_TraceHull( start, end, NavTraceMins, NavTraceMaxs, GetGenerationTraceMask(), &filter, &tr );
+			if ( !tr.startsolid && tr.fraction == 1.0f )
+			{
+				if ( !StayOnFloor( &tr ) )
+				{
+					break;
+				}
+
+				to = tr.endpos;
+				toNormal = tr.plane.normal;
+
+				start = end = from;
+				end.z += height;
+				UTIL_TraceHull( start, end, NavTraceMins, NavTraceMaxs, GetGenerationTraceMask(), &filter, &tr );
+				if ( tr.fraction < 1.0f )
+				{
+					break;
+				}
+
+				// keep track of far up we had to go to find a path to the next node
+				obstacleHeight = height;
+				success = true;
+				break;
+			}
+			else
+			{
+				// Could not trace from node to node at this height, something is in the way.
+				// Trace in the other direction to see if we hit something
+				Vector vecToObstacleStart = tr.endpos - start;
+				Assert( vecToObstacleStart.LengthSqr() <= Square( GenerationStepSize ) );
+				if ( vecToObstacleStart.LengthSqr() <= Square( GenerationStepSize ) )
+				{
+					UTIL_TraceHull( end, start, NavTraceMins, NavTraceMaxs, GetGenerationTraceMask(), &filter, &tr );
+					if ( !tr.startsolid && tr.fraction < 1.0 )
+					{
+						// We hit something going the other direction.  There is some obstacle between the two nodes.
+						Vector vecToObstacleEnd = tr.endpos - start;
+						Assert( vecToObstacleEnd.LengthSqr() <= Square( GenerationStepSize ) );
+						if ( vecToObstacleEnd.LengthSqr() <= Square( GenerationStepSize )  )
+						{
+							// Remember the distances to start and end of the obstacle (with respect to the "from" node).
+							// Keep track of the last distances to obstacle as we keep increasing the height we do a trace for.
+							// If we do eventually clear the obstacle, these values will be the start and end distance to the
+							// very tip of the obstacle.
+							obstacleStartDist = vecToObstacleStart.Length();
+							obstacleEndDist = vecToObstacleEnd.Length();
+							if ( obstacleEndDist == 0 )
+							{
+								obstacleEndDist = GenerationStepSize;
+							}
+						}								
+					}
+				}
+			}
+		}
+
+		if ( !success )
+		{
+			return;
+		}
+	}
+
+	// Don't generate nodes if we spill off the end of the world onto skybox
+	if ( result.surface.flags & ( SURF_SKY|SURF_SKY2D ) )
+	{
+		return;
+	}
+
+	// If we're incrementally generating, don't overlap existing nav areas.
+	Vector testPos( to );
+	bool overlapSE = IsNodeOverlapped( testPos, Vector(  1,  1, HalfHumanHeight ) );
+	bool overlapSW = IsNodeOverlapped( testPos, Vector( -1,  1, HalfHumanHeight ) );
+	bool overlapNE = IsNodeOverlapped( testPos, Vector(  1, -1, HalfHumanHeight ) );
+	bool overlapNW = IsNodeOverlapped( testPos, Vector( -1, -1, HalfHumanHeight ) );
+	if ( overlapSE && overlapSW && overlapNE && overlapNW && m_generationMode != GENERATE_SIMPLIFY )
+	{
+		return;
+	}
+
+	int nTolerance = nav_generate_incremental_tolerance.GetInt();
+	if ( nTolerance > 0 && m_generationMode == GENERATE_INCREMENTAL )
+	{
+		bool bValid = false;
+		int zPos = to.z;
+		for ( int i=0; i<m_walkableSeeds.Count(); ++i )
+		{
+			const Vector &seedPos = m_walkableSeeds[i].pos;
+			int zMin = seedPos.z - nTolerance;
+			int zMax = seedPos.z + nTolerance;
+
+			if ( zPos >= zMin && zPos <= zMax )
+			{
+				bValid = true;
+				break;
+			}
+		}
+
+		if ( !bValid )
+			return;
+	}
+
+
+	bool isOnDisplacement = result.IsDispSurface();
+
+	if ( nav_displacement_test.GetInt() > 0 )
+	{
+		// Test for nodes under displacement surfaces.
+		// This happens during development, and is a pain because the space underneath a displacement
+		// is not 'solid'.
+		Vector start = to + Vector( 0, 0, 0 );
+		Vector end = start + Vector( 0, 0, nav_displacement_test.GetInt() );
+		UTIL_TraceHull( start, end, NavTraceMins, NavTraceMaxs, GetGenerationTraceMask(), &filter, &result );
+
+		if ( result.fraction > 0 )
+		{
+			end = start;
+			start = result.endpos;
+			UTIL_TraceHull( start, end, NavTraceMins, NavTraceMaxs, GetGenerationTraceMask(), &filter, &result );
+			if ( result.fraction < 1 )
+			{
+				// if we made it down to within StepHeight, maybe we're on a static prop
+				if ( result.endpos.z > to.z + StepHeight )
+				{
+					return;
+				}
+			}
+		}
+	}
+
+	float deltaZ = to.z - step->m_from.z;
+	// If there's an obstacle in the way and it's traversable, or the obstacle is not higher than the destination node itself minus a small epsilon
+	// (meaning the obstacle was just the height change to get to the destination node, no extra obstacle between the two), clear obstacle height
+	// and distances
+	if ( ( obstacleHeight < MaxTraversableHeight ) || ( deltaZ > ( obstacleHeight - 2.0f ) ) )
+	{
+		obstacleHeight = 0;
+		obstacleStartDist = 0;
+		obstacleEndDist = GenerationStepSize;
+	}
+
+	step->m_canStep = true;
+	step->m_to = to;
+	step->m_toNormal = toNormal;
+	step->m_isOnDisplacement = isOnDisplacement;
+	step->m_obstacleHeight = obstacleHeight;
+	step->m_obstacleStartDist = obstacleStartDist;
+	step->m_obstacleEndDist = obstacleEndDist;
+}
+
+
 //--------------------------------------------------------------------------------------------------------------
 /**
  * Search the world and build a map of possible movements.
@@ -4389,24 +4940,8 @@ bool CNavMesh::SampleStep( void )
 			{
 				// have not searched in this direction yet
 
-				// start at current node position
-				Vector pos = *m_currentNode->GetPosition();
-
-				// snap to grid
-				int cx = SnapToGrid( pos.x );
-				int cy = SnapToGrid( pos.y );
-
 				// attempt to move to adjacent node
-				switch( dir )
-				{
-					case NORTH:		cy -= GenerationStepSize; break;
-					case SOUTH:		cy += GenerationStepSize; break;
-					case EAST:		cx += GenerationStepSize; break;
-					case WEST:		cx -= GenerationStepSize; break;
-				}
-
-				pos.x = cx;
-				pos.y = cy;
+				Vector pos = GetSampleStepPos( *m_currentNode->GetPosition(), (NavDirType)dir );
 
 				m_generationDir = (NavDirType)dir;
 
@@ -4443,170 +4978,25 @@ bool CNavMesh::SampleStep( void )
 				}
 
 				// test if we can move to new position
-				trace_t result;
-				Vector from( *m_currentNode->GetPosition() );
-				CTraceFilterWalkableEntities filter( NULL, COLLISION_GROUP_NONE, WALK_THRU_EVERYTHING );
-				Vector to, toNormal;
-				float obstacleHeight = 0, obstacleStartDist = 0, obstacleEndDist = GenerationStepSize;
-				if ( TraceAdjacentNode( 0, from, pos, &result ) )
+				NavSampleStep_t inlineStep;
+				const NavSampleStep_t *step = s_sampleStepper.TakeStep( m_currentNode, m_generationDir );
+				if ( step == NULL )
 				{
-					to = result.endpos;
-					toNormal = result.plane.normal;
+					inlineStep.m_from = *m_currentNode->GetPosition();
+					inlineStep.m_pos = pos;
+					TestSampleStep( &inlineStep );
+					step = &inlineStep;
 				}
-				else
-				{
-					// test going up ClimbUpHeight
-					bool success = false;
-					for ( float height = StepHeight; height <= ClimbUpHeight; height += 1.0f )
-					{						
-						trace_t tr;
-						Vector start( from );
-						Vector end( pos );
-						start.z += height;
-						end.z += height;
-						UTIL_TraceHull( start, end, NavTraceMins, NavTraceMaxs, GetGenerationTraceMask(), &filter, &tr );
-						if ( !tr.startsolid && tr.fraction == 1.0f )
-						{
-							if ( !StayOnFloor( &tr ) )
-							{
-								break;
-							}
-
-							to = tr.endpos;
-							toNormal = tr.plane.normal;
-
-							start = end = from;
-							end.z += height;
-							UTIL_TraceHull( start, end, NavTraceMins, NavTraceMaxs, GetGenerationTraceMask(), &filter, &tr );
-							if ( tr.fraction < 1.0f )
-							{
-								break;
-							}
 
-							// keep track of far up we had to go to find a path to the next node
-							obstacleHeight = height;
-							success = true;
-							break;
-						}
-						else
-						{
-							// Could not trace from node to node at this height, something is in the way.
-							// Trace in the other direction to see if we hit something
-							Vector vecToObstacleStart = tr.endpos - start;
-							Assert( vecToObstacleStart.LengthSqr() <= Square( GenerationStepSize ) );
-							if ( vecToObstacleStart.LengthSqr() <= Square( GenerationStepSize ) )
-							{
-								UTIL_TraceHull( end, start, NavTraceMins, NavTraceMaxs, GetGenerationTraceMask(), &filter, &tr );
-								if ( !tr.startsolid && tr.fraction < 1.0 )
-								{
-									// We hit something going the other direction.  There is some obstacle between the two nodes.
-									Vector vecToObstacleEnd = tr.endpos - start;
-									Assert( vecToObstacleEnd.LengthSqr() <= Square( GenerationStepSize ) );
-									if ( vecToObstacleEnd.LengthSqr() <= Square( GenerationStepSize )  )
-									{
-										// Remember the distances to start and end of the obstacle (with respect to the "from" node).
-										// Keep track of the last distances to obstacle as we keep increasing the height we do a trace for.
-										// If we do eventually clear the obstacle, these values will be the start and end distance to the
-										// very tip of the obstacle.
-										obstacleStartDist = vecToObstacleStart.Length();
-										obstacleEndDist = vecToObstacleEnd.Length();
-										if ( obstacleEndDist == 0 )
-										{
-											obstacleEndDist = GenerationStepSize;
-										}
-									}								
-								}
-							}
-						}
-					}
-
-					if ( !success )
-					{
-						return true;
-					}
-				}
-
-				// Don't generate nodes if we spill off the end of the world onto skybox
-				if ( result.surface.flags & ( SURF_SKY|SURF_SKY2D ) )
-				{
-					return true;
-				}
-
-				// If we're incrementally generating, don't overlap existing nav areas.
-				Vector testPos( to );
-				bool overlapSE = IsNodeOverlapped( testPos, Vector(  1,  1, HalfHumanHeight ) );
-				bool overlapSW = IsNodeOverlapped( testPos, Vector( -1,  1, HalfHumanHeight ) );
-				bool overlapNE = IsNodeOverlapped( testPos, Vector(  1, -1, HalfHumanHeight ) );
-				bool overlapNW = IsNodeOverlapped( testPos, Vector( -1, -1, HalfHumanHeight ) );
-				if ( overlapSE && overlapSW && overlapNE && overlapNW && m_generationMode != GENERATE_SIMPLIFY )
+				Assert( step->m_pos == pos );
+				if ( !step->m_canStep )
 				{
 					return true;
 				}
 
-				int nTolerance = nav_generate_incremental_tolerance.GetInt();
-				if ( nTolerance > 0 && m_generationMode == GENERATE_INCREMENTAL )
-				{
-					bool bValid = false;
-					int zPos = to.z;
-					for ( int i=0; i<m_walkableSeeds.Count(); ++i )
-					{
-						const Vector &seedPos = m_walkableSeeds[i].pos;
-						int zMin = seedPos.z - nTolerance;
-						int zMax = seedPos.z + nTolerance;
-
-						if ( zPos >= zMin && zPos <= zMax )
-						{
-							bValid = true;
-							break;
-						}
-					}
-
-					if ( !bValid )
-						return true;
-				}
-
-
-				bool isOnDisplacement = result.IsDispSurface();
-
-				if ( nav_displacement_test.GetInt() > 0 )
-				{
-					// Test for nodes under displacement surfaces.
-					// This happens during development, and is a pain because the space underneath a displacement
-					// is not 'solid'.
-					Vector start = to + Vector( 0, 0, 0 );
-					Vector end = start + Vector( 0, 0, nav_displacement_test.GetInt() );
-					UTIL_TraceHull( start, end, NavTraceMins, NavTraceMaxs, GetGenerationTraceMask(), &filter, &result );
-
-					if ( result.fraction > 0 )
-					{
-						end = start;
-						start = result.endpos;
-						UTIL_TraceHull( start, end, NavTraceMins, NavTraceMaxs, GetGenerationTraceMask(), &filter, &result );
-						if ( result.fraction < 1 )
-						{
-							// if we made it down to within StepHeight, maybe we're on a static prop
-							if ( result.endpos.z > to.z + StepHeight )
-							{
-								return true;
-							}
-						}
-					}
-				}
-
-				float deltaZ = to.z - m_currentNode->GetPosition()->z;
-				// If there's an obstacle in the way and it's traversable, or the obstacle is not higher than the destination node itself minus a small epsilon
-				// (meaning the obstacle was just the height change to get to the destination node, no extra obstacle between the two), clear obstacle height
-				// and distances
-				if ( ( obstacleHeight < MaxTraversableHeight ) || ( deltaZ > ( obstacleHeight - 2.0f ) ) )
-				{
-					obstacleHeight = 0;
-					obstacleStartDist = 0;
-					obstacleEndDist = GenerationStepSize;
-				}
-
 				// we can move here
 				// create a new navigation node, and update current node pointer
-				AddNode( to, toNormal, m_generationDir, m_currentNode, isOnDisplacement, obstacleHeight, obstacleStartDist, obstacleEndDist );
+				AddNode( step->m_to, step->m_toNormal, m_generationDir, m_currentNode, step->m_isOnDisplacement, step->m_obstacleHeight, step->m_obstacleStartDist, step->m_obstacleEndDist );
 
 				return true;
 			}
@@ -76,6 +76,8 @@ CNavArea ** CNavLadder::GetConnection( LadderConnectionType dir )
 //--------------------------------------------------------------------------------------------------------------
 void CNavLadder::OnSplit( CNavArea *original, CNavArea *alpha, CNavArea *beta )
 {
+	NavWaitForPathRequests();
+
 	for ( int con=0; con<NUM_LADDER_CONNECTIONS; ++con )
 	{
 		CNavArea ** areaConnection = GetConnection( (LadderConnectionType)con );
@@ -104,6 +106,8 @@ void CNavLadder::OnSplit( CNavArea *original, CNavArea *alpha, CNavArea *beta )
  */
 void CNavLadder::ConnectTo( CNavArea *area )
 {
+	NavWaitForPathRequests();
+
 	float center = (m_top.z + m_bottom.z) * 0.5f;
 
 	if (area->GetCenter().z > center)
@@ -166,6 +170,8 @@ void CNavLadder::ConnectTo( CNavArea *area )
  */
 CNavLadder::~CNavLadder()
 {
+	NavWaitForPathRequests();
+
 	// tell the other areas we are going away
 	FOR_EACH_VEC( TheNavAreas, it )
 	{
@@ -192,6 +198,8 @@ void CNavLadder::OnDestroyNotify( CNavArea *dead )
  */
 void CNavLadder::Disconnect( CNavArea *area )
 {
+	NavWaitForPathRequests();
+
 	if ( m_topForwardArea == area )
 	{
 		m_topForwardArea = NULL;
@@ -13,6 +13,7 @@
 #include "filesystem.h"
 #include "nav_mesh.h"
 #include "nav_node.h"
+#include "nav_pathfind.h"
 #include "fmtstr.h"
 #include "utlbuffer.h"
 #include "tier0/vprof.h"
@@ -156,6 +157,9 @@ CNavArea *CNavMesh::GetMarkedArea( void ) const
  */
 void CNavMesh::DestroyNavigationMesh( bool incremental )
 {
+	// path searches on the job pool may still be reading the mesh
+	NavWaitForPathRequests();
+
 	m_blockedAreas.RemoveAll();
 	m_avoidanceObstacleAreas.RemoveAll();
 	m_transientAreas.RemoveAll();
@@ -2605,6 +2609,17 @@ void CommandNavGenerateIncremental( void )
 static ConCommand nav_generate_incremental( "nav_generate_incremental", CommandNavGenerateIncremental, "Generate a Navigation Mesh for the current map and save it to disk.", FCVAR_GAMEDLL | FCVAR_CHEAT );
 
 
+//--------------------------------------------------------------------------------------------------------------
+void CommandNavGenerateScripted( void )
+{
+	if ( !UTIL_IsCommandIssuedByServerAdmin() )
+		return;
+
+	TheNavMesh->GenerateNow( true );
+}
+static ConCommand nav_generate_scripted( "nav_generate_scripted", CommandNavGenerateScripted, "commandline hook to generate a Navigation Mesh without stepping it over frames, save it and then quit.", FCVAR_GAMEDLL | FCVAR_CHEAT );
+
+
 //--------------------------------------------------------------------------------------------------------------
 void CommandNavAnalyze( void )
 {
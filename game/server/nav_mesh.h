@@ -355,6 +355,7 @@ public:
 	#define INCREMENTAL_GENERATION true
 	void BeginGeneration( bool incremental = false );					// initiate the generation process
 	void BeginAnalysis( bool quitWhenFinished = false );						// re-analyze an existing Mesh.  Determine Hiding Spots, Encounter Spots, etc.
+	void GenerateNow( bool quitWhenFinished );					// generate and save a Navigation Mesh right away, without spreading it over frames
 
 	bool IsGenerating( void ) const		{ return m_generationMode != GENERATE_NONE; }	// return true while a Navigation Mesh is being generated
 	const char *GetPlayerSpawnName( void ) const;						// return name of player spawn entity
@@ -1069,6 +1070,7 @@ private:
 	friend class CNavArea;
 	friend class CNavNode;
 	friend class CNavUIBasePanel;
+	friend class CNavSampleStepper;
 
 	mutable CUtlVector<NavAreaVector> m_grid;
 	float m_gridCellSize;										// the width/height of a grid cell for spatially partitioning nav areas for fast access
@@ -1169,10 +1171,13 @@ private:
 	void DestroyLadders( void );
 
 	bool SampleStep( void );									// sample the walkable areas of the map
+	void TestSampleStep( struct NavSampleStep_t *step ) const;	// try a single step of the sampling, only reads the world
 	void CreateNavAreasFromNodes( void );						// cover all of the sampled nodes with nav areas
 
 	bool TestArea( CNavNode *node, int width, int height );		// check if an area of size (width, height) can fit, starting from node as upper left corner
 	int BuildArea( CNavNode *node, int width, int height );		// create a CNavArea of size (width, height) starting fom node at upper left corner
+	static void CheckNodeForAreas( CNavNode *&node );			// do the traces of a node that building areas needs, safe on the job pool
+	static bool IsValidCrouchArea( CNavNode *node );			// cached TestForValidCrouchArea()
 	bool CheckObstacles( CNavNode *node, int width, int height, int x, int y );
 
 	void MarkPlayerClipAreas( void );
@@ -90,6 +90,9 @@ CNavNode::CNavNode( const Vector &pos, const Vector &normal, CNavNode *parent, b
 	m_attributeFlags = 0;
 
 	m_isOnDisplacement = isOnDisplacement;
+	m_isCrouchCheckPending = false;
+	m_isValidCrouchAreaKnown = false;
+	m_isValidCrouchArea = true;
 
 	if ( !g_pNavNodeHash )
 	{
@@ -380,7 +383,7 @@ void CNavNode::CheckCrouch( void )
 
 		if ( !TestForCrouchArea( corner, mins, maxs, &m_groundHeightAboveNode[i] ) )
 		{
-			SetAttributes( NAV_MESH_CROUCH );
+			SetAttributes( GetAttributes() | NAV_MESH_CROUCH );
 			m_crouch[corner] = true;
 		}
 	}
@@ -97,6 +97,9 @@ private:
 	bool m_crouch[ NUM_CORNERS ];
 	float m_groundHeightAboveNode[ NUM_CORNERS ];
 	bool m_isOnDisplacement;
+	bool m_isCrouchCheckPending;									///< AddNode() reached this node, its crouch corners get tested before building areas
+	bool m_isValidCrouchAreaKnown;									///< m_isValidCrouchArea has been tested
+	bool m_isValidCrouchArea;										///< a crouch area with this node at its NW corner isn't bogus
 };
 
 //--------------------------------------------------------------------------------------------------------------
@@ -0,0 +1,348 @@
+//========= Copyright Valve Corporation, All rights reserved. ============//
+//
+// Purpose:
+//
+// $NoKeywords: $
+//
+//=============================================================================//
+// nav_pathfind.cpp
+// Path search state and asynchronous path requests
+
+#include "cbase.h"
+
+#include "nav_mesh.h"
+#include "nav_pathfind.h"
+
+// NOTE: This has to be the last file included!
+#include "tier0/memdbgon.h"
+
+
+CTHREADLOCALPTR( CNavPathSearch ) g_pActiveNavPathSearch;
+
+static CUtlVector< CNavPathSearch * > s_freeSearches;
+static CThreadFastMutex s_freeSearchesMutex;
+
+static CUtlVector< CNavPathRequest * > s_pendingRequests;	// main thread only
+static int s_pathRequestEpoch = 0;							// changes when the areas and connections requests read change
+
+
+//--------------------------------------------------------------------------------------------------------------
+const NavSearchNode_t *NavFindSearchNode( const CNavPathSearch *search, const CNavArea *area )
+{
+	return search->FindNode( area );
+}
+
+
+//--------------------------------------------------------------------------------------------------------------
+CNavPathSearch *NavAllocPathSearch( void )
+{
+	{
+		AUTO_LOCK( s_freeSearchesMutex );
+
+		if ( s_freeSearches.Count() )
+		{
+			CNavPathSearch *search = s_freeSearches.Tail();
+			s_freeSearches.RemoveMultipleFromTail( 1 );
+			return search;
+		}
+	}
+
+	return new CNavPathSearch;
+}
+
+
+//--------------------------------------------------------------------------------------------------------------
+void NavFreePathSearch( CNavPathSearch *search )
+{
+	AUTO_LOCK( s_freeSearchesMutex );
+	s_freeSearches.AddToTail( search );
+}
+
+
+//--------------------------------------------------------------------------------------------------------------
+/**
+ * Forget the last search, keeping the memory
+ */
+void CNavPathSearch::Reset( void )
+{
+	m_nodes.RemoveAll();
+	m_nodeIndex.RemoveAll();
+	m_openHeap.RemoveAll();
+	m_nextOpenOrder = 0;
+}
+
+
+//--------------------------------------------------------------------------------------------------------------
+const NavSearchNode_t *CNavPathSearch::FindNode( const CNavArea *area ) const
+{
+	UtlHashHandle_t h = m_nodeIndex.Find( area );
+	return ( h != m_nodeIndex.InvalidHandle() ) ? &m_nodes[ m_nodeIndex[ h ] ] : NULL;
+}
+
+
+//--------------------------------------------------------------------------------------------------------------
+CNavArea *CNavPathSearch::GetParent( const CNavArea *area ) const
+{
+	const NavSearchNode_t *node = FindNode( area );
+	return ( node ) ? node->m_parent : NULL;
+}
+
+
+//--------------------------------------------------------------------------------------------------------------
+NavTraverseType CNavPathSearch::GetParentHow( const CNavArea *area ) const
+{
+	const NavSearchNode_t *node = FindNode( area );
+	return ( node ) ? node->m_parentHow : NUM_TRAVERSE_TYPES;
+}
+
+
+//--------------------------------------------------------------------------------------------------------------
+int CNavPathSearch::FindOrAddNode( CNavArea *area )
+{
+	UtlHashHandle_t h = m_nodeIndex.Find( area );
+	if ( h != m_nodeIndex.InvalidHandle() )
+	{
+		return m_nodeIndex[ h ];
+	}
+
+	int node = m_nodes.AddToTail();
+	NavSearchNode_t &newNode = m_nodes[ node ];
+	newNode.m_area = area;
+	newNode.m_parent = NULL;
+	newNode.m_parentHow = NUM_TRAVERSE_TYPES;
+	newNode.m_totalCost = 0.0f;
+	newNode.m_costSoFar = 0.0f;
+	newNode.m_pathLengthSoFar = 0.0f;
+	newNode.m_heapIndex = NAV_NODE_UNVISITED;
+	newNode.m_openOrder = 0;
+
+	m_nodeIndex.Insert( area, node );
+	return node;
+}
+
+
+//--------------------------------------------------------------------------------------------------------------
+/**
+ * Store the search state of every area the last search opened in the area itself
+ */
+void CNavPathSearch::CopyToAreas( void ) const
+{
+	Assert( ThreadInMainThread() );
+
+	FOR_EACH_VEC( m_nodes, it )
+	{
+		const NavSearchNode_t &node = m_nodes[ it ];
+		if ( node.m_openOrder == 0 )
+			continue;
+
+		node.m_area->SetParent( node.m_parent, node.m_parentHow );
+		node.m_area->SetTotalCost( node.m_totalCost );
+		node.m_area->SetCostSoFar( node.m_costSoFar );
+		node.m_area->SetPathLengthSoFar( node.m_pathLengthSoFar );
+	}
+}
+
+
+//--------------------------------------------------------------------------------------------------------------
+/**
+ * Lower total cost first, areas with the same cost in the order they were opened
+ */
+bool CNavPathSearch::IsHeapLess( int heapA, int heapB ) const
+{
+	const NavSearchNode_t &a = m_nodes[ m_openHeap[ heapA ] ];
+	const NavSearchNode_t &b = m_nodes[ m_openHeap[ heapB ] ];
+
+	if ( a.m_totalCost != b.m_totalCost )
+		return a.m_totalCost < b.m_totalCost;
+
+	return a.m_openOrder < b.m_openOrder;
+}
+
+
+//--------------------------------------------------------------------------------------------------------------
+void CNavPathSearch::HeapSwap( int heapA, int heapB )
+{
+	V_swap( m_openHeap[ heapA ], m_openHeap[ heapB ] );
+	m_nodes[ m_openHeap[ heapA ] ].m_heapIndex = heapA;
+	m_nodes[ m_openHeap[ heapB ] ].m_heapIndex = heapB;
+}
+
+
+//--------------------------------------------------------------------------------------------------------------
+void CNavPathSearch::HeapUp( int heap )
+{
+	while ( heap > 0 )
+	{
+		int parent = ( heap - 1 ) / 2;
+		if ( !IsHeapLess( heap, parent ) )
+			break;
+
+		HeapSwap( heap, parent );
+		heap = parent;
+	}
+}
+
+
+//--------------------------------------------------------------------------------------------------------------
+void CNavPathSearch::HeapDown( int heap )
+{
+	int count = m_openHeap.Count();
+	while ( true )
+	{
+		int smallest = heap;
+		int left = 2 * heap + 1;
+		int right = left + 1;
+
+		if ( left < count && IsHeapLess( left, smallest ) )
+			smallest = left;
+		if ( right < count && IsHeapLess( right, smallest ) )
+			smallest = right;
+
+		if ( smallest == heap )
+			break;
+
+		HeapSwap( heap, smallest );
+		heap = smallest;
+	}
+}
+
+
+//--------------------------------------------------------------------------------------------------------------
+void CNavPathSearch::AddToOpenList( int node )
+{
+	Assert( m_nodes[ node ].m_heapIndex < 0 );
+
+	m_nodes[ node ].m_openOrder = ++m_nextOpenOrder;
+	m_nodes[ node ].m_heapIndex = m_openHeap.AddToTail( node );
+	HeapUp( m_nodes[ node ].m_heapIndex );
+}
+
+
+//--------------------------------------------------------------------------------------------------------------
+/**
+ * A smaller cost has been found, move the area up the heap. It keeps its place among areas of equal cost.
+ */
+void CNavPathSearch::UpdateOnOpenList( int node )
+{
+	Assert( m_nodes[ node ].m_heapIndex >= 0 );
+	HeapUp( m_nodes[ node ].m_heapIndex );
+}
+
+
+//--------------------------------------------------------------------------------------------------------------
+/**
+ * Remove and return the area with the lowest total cost. It is neither open nor closed until
+ * it has been searched.
+ */
+int CNavPathSearch::PopOpenList( void )
+{
+	Assert( !IsOpenListEmpty() );
+
+	int node = m_openHeap[0];
+
+	int last = m_openHeap.Count() - 1;
+	if ( last > 0 )
+	{
+		HeapSwap( 0, last );
+	}
+	m_openHeap.RemoveMultipleFromTail( 1 );
+
+	if ( m_openHeap.Count() )
+	{
+		HeapDown( 0 );
+	}
+
+	m_nodes[ node ].m_heapIndex = NAV_NODE_UNVISITED;
+	return node;
+}
+
+
+//--------------------------------------------------------------------------------------------------------------
+CNavPathRequest::CNavPathRequest( void )
+{
+	m_foundPath = false;
+	m_closestArea = NULL;
+	m_epoch = s_pathRequestEpoch;
+}
+
+
+//--------------------------------------------------------------------------------------------------------------
+/**
+ * True if the mesh changed since the request was made, the result must not be used then
+ */
+bool CNavPathRequest::IsStale( void ) const
+{
+	return m_epoch != s_pathRequestEpoch;
+}
+
+
+//--------------------------------------------------------------------------------------------------------------
+void CNavPathRequest::StorePath( const CNavPathSearch &search, CNavArea *startArea, bool foundPath, CNavArea *closestArea )
+{
+	m_foundPath = foundPath;
+	m_closestArea = closestArea;
+	m_areas.RemoveAll();
+
+	// follow the parents back to the start, the start area can end up with a parent too
+	for( CNavArea *area = closestArea; area; area = search.GetParent( area ) )
+	{
+		int i = m_areas.AddToTail();
+		m_areas[i].area = area;
+		m_areas[i].how = search.GetParentHow( area );
+
+		if ( area == startArea )
+			break;
+	}
+
+	// start area first
+	for( int i = 0, j = m_areas.Count() - 1; i < j; ++i, --j )
+	{
+		V_swap( m_areas[i], m_areas[j] );
+	}
+}
+
+
+//--------------------------------------------------------------------------------------------------------------
+/**
+ * Run the request on the job pool and keep it around until it finishes, so
+ * NavWaitForPathRequests() can wait for it
+ */
+void NavQueuePathRequest( CNavPathRequest *request )
+{
+	Assert( ThreadInMainThread() );
+
+	// forget about the ones that are done
+	FOR_EACH_VEC_BACK( s_pendingRequests, it )
+	{
+		if ( s_pendingRequests[ it ]->IsFinished() )
+		{
+			s_pendingRequests[ it ]->Release();
+			s_pendingRequests.FastRemove( it );
+		}
+	}
+
+	request->AddRef();
+	s_pendingRequests.AddToTail( request );
+
+	request->SetFlags( JF_QUEUE );
+	g_pThreadPool->AddJob( request );
+}
+
+
+//--------------------------------------------------------------------------------------------------------------
+/**
+ * Path requests read the mesh, finish them before it changes
+ */
+void NavWaitForPathRequests( void )
+{
+	Assert( ThreadInMainThread() );
+
+	FOR_EACH_VEC( s_pendingRequests, it )
+	{
+		s_pendingRequests[ it ]->WaitForFinish();
+		s_pendingRequests[ it ]->Release();
+	}
+	s_pendingRequests.RemoveAll();
+
+	++s_pathRequestEpoch;
+}
@@ -14,6 +14,8 @@
 
 #include "tier0/vprof.h"
 #include "mathlib/ssemath.h"
+#include "tier1/utlhashtable.h"
+#include "vstdlib/jobthread.h"
 #include "nav_area.h"
 
 extern int g_DebugPathfindCounter;
@@ -87,34 +89,94 @@ public:
 
 //--------------------------------------------------------------------------------------------------------------
 /**
- * Find path from startArea to goalArea via an A* search, using supplied cost heuristic.
- * If cost functor returns -1 for an area, that area is considered a dead end.
- * This doesn't actually build a path, but the path is defined by following parent
- * pointers back from goalArea to startArea.
- * If 'closestArea' is non-NULL, the closest area to the goal is returned (useful if the path fails).
- * If 'goalArea' is NULL, will compute a path as close as possible to 'goalPos'.
- * If 'goalPos' is NULL, will use the center of 'goalArea' as the goal position.
- * If 'maxPathLength' is nonzero, path building will stop when this length is reached.
- * Returns true if a path exists.
+ * State of one A* search, so searches can run at the same time on different threads.
+ * Areas are looked up through a hash of their address, the open list is a binary heap.
+ * The areas' own search state is left alone, but while Search() runs their parent and
+ * cost accessors return this search's state, so existing cost functors work unchanged.
  */
-#define IGNORE_NAV_BLOCKERS true
-template< typename CostFunctor >
-bool NavAreaBuildPath( CNavArea *startArea, CNavArea *goalArea, const Vector *goalPos, CostFunctor &costFunc, CNavArea **closestArea = NULL, float maxPathLength = 0.0f, int teamID = TEAM_ANY, bool ignoreNavBlockers = false )
+class CNavPathSearch
 {
-	VPROF_BUDGET( "NavAreaBuildPath", "NextBotSpiky" );
+public:
+	CNavPathSearch( void ) : m_nextOpenOrder( 0 ) { }
+
+	/**
+	 * Same as NavAreaBuildPath(), the path is defined by following GetParent() back from the goal
+	 * area. Can be called from any thread if the cost functor only reads the mesh.
+	 */
+	template< typename CostFunctor >
+	bool Search( CNavArea *startArea, CNavArea *goalArea, const Vector *goalPos, CostFunctor &costFunc, CNavArea **closestArea = NULL, float maxPathLength = 0.0f, int teamID = TEAM_ANY, bool ignoreNavBlockers = false );
+
+	const NavSearchNode_t *FindNode( const CNavArea *area ) const;	// NULL if the last search didn't reach the area
+	CNavArea *GetParent( const CNavArea *area ) const;
+	NavTraverseType GetParentHow( const CNavArea *area ) const;
+
+	void CopyToAreas( void ) const;									// store the last search's state in the areas themselves, main thread only
+
+private:
+	void Reset( void );
+	int FindOrAddNode( CNavArea *area );
+
+	bool IsOpenListEmpty( void ) const	{ return m_openHeap.Count() == 0; }
+	void AddToOpenList( int node );
+	void UpdateOnOpenList( int node );
+	int PopOpenList( void );
+	bool IsHeapLess( int heapA, int heapB ) const;
+	void HeapSwap( int heapA, int heapB );
+	void HeapUp( int heap );
+	void HeapDown( int heap );
+
+	CUtlVector< NavSearchNode_t > m_nodes;
+	CUtlHashtable< const CNavArea *, int, PointerHashFunctor, PointerEqualFunctor > m_nodeIndex;
+	CUtlVector< int > m_openHeap;
+	unsigned int m_nextOpenOrder;
+};
+
+
+//--------------------------------------------------------------------------------------------------------------
+/**
+ * Makes a search the active one on this thread while in scope
+ */
+class CNavPathSearchScope
+{
+public:
+	CNavPathSearchScope( CNavPathSearch *search )
+	{
+		m_prevSearch = g_pActiveNavPathSearch;
+		g_pActiveNavPathSearch = search;
+	}
+
+	~CNavPathSearchScope()
+	{
+		g_pActiveNavPathSearch = m_prevSearch;
+	}
+
+private:
+	CNavPathSearch *m_prevSearch;
+};
+
+
+// searches are recycled to keep their memory, thread safe
+extern CNavPathSearch *NavAllocPathSearch( void );
+extern void NavFreePathSearch( CNavPathSearch *search );
+
 
+//--------------------------------------------------------------------------------------------------------------
+template< typename CostFunctor >
+bool CNavPathSearch::Search( CNavArea *startArea, CNavArea *goalArea, const Vector *goalPos, CostFunctor &costFunc, CNavArea **closestArea, float maxPathLength, int teamID, bool ignoreNavBlockers )
+{
 	if ( closestArea )
 	{
 		*closestArea = startArea;
 	}
 
-	bool isDebug = ( g_DebugPathfindCounter-- > 0 );
+	Reset();
+
+	// the debug counter and overlays are main thread only
+	bool isDebug = ThreadInMainThread() && ( g_DebugPathfindCounter-- > 0 );
 
 	if (startArea == NULL)
 		return false;
 
-	startArea->SetParent( NULL );
-
 	if (goalArea != NULL && goalArea->IsBlocked( teamID, ignoreNavBlockers ))
 		goalArea = NULL;
 
@@ -130,29 +192,32 @@ bool NavAreaBuildPath( CNavArea *startArea, CNavArea *goalArea, const Vector *go
 	// determine actual goal position
 	Vector actualGoalPos = (goalPos) ? *goalPos : goalArea->GetCenter();
 
-	// start search
-	CNavArea::ClearSearchLists();
+	// area accessors read this search's state from here on
+	CNavPathSearchScope scope( this );
+
+	int start = FindOrAddNode( startArea );
 
 	// compute estimate of path length
 	/// @todo Cost might work as "manhattan distance"
-	startArea->SetTotalCost( (startArea->GetCenter() - actualGoalPos).Length() );
+	m_nodes[ start ].m_totalCost = (startArea->GetCenter() - actualGoalPos).Length();
 
 	float initCost = costFunc( startArea, NULL, NULL, NULL, -1.0f );	
 	if (initCost < 0.0f)
 		return false;
-	startArea->SetCostSoFar( initCost );
-	startArea->SetPathLengthSoFar( 0.0 );
+	m_nodes[ start ].m_costSoFar = initCost;
+	m_nodes[ start ].m_pathLengthSoFar = 0.0f;
 
-	startArea->AddToOpenList();
+	AddToOpenList( start );
 
 	// keep track of the area we visit that is closest to the goal
-	float closestAreaDist = startArea->GetTotalCost();
+	float closestAreaDist = m_nodes[ start ].m_totalCost;
 
 	// do A* search
-	while( !CNavArea::IsOpenListEmpty() )
+	while( !IsOpenListEmpty() )
 	{
 		// get next area to check
-		CNavArea *area = CNavArea::PopOpenList();
+		int current = PopOpenList();
+		CNavArea *area = m_nodes[ current ].m_area;
 
 		if ( isDebug )
 		{
@@ -329,7 +394,7 @@ bool NavAreaBuildPath( CNavArea *startArea, CNavArea *goalArea, const Vector *go
 
 			// don't backtrack
 			Assert( newArea );
-			if ( newArea == area->GetParent() )
+			if ( newArea == m_nodes[ current ].m_parent )
 				continue;
 			if ( newArea == area ) // self neighbor?
 				continue;
@@ -344,30 +409,35 @@ bool NavAreaBuildPath( CNavArea *startArea, CNavArea *goalArea, const Vector *go
 			if ( newCostSoFar < 0.0f )
 				continue;
 
+			float costSoFar = m_nodes[ current ].m_costSoFar;
+
 			// Safety check against a bogus functor.  The cost of the path
 			// A...B, C should always be at least as big as the path A...B.
-			Assert( newCostSoFar >= area->GetCostSoFar() );
+			Assert( newCostSoFar >= costSoFar );
 
 			// And now that we've asserted, let's be a bit more defensive.
 			// Make sure that any jump to a new area incurs some pathfinsing
 			// cost, to avoid us spinning our wheels over insignificant cost
 			// benefit, floating point precision bug, or busted cost functor.
-			float minNewCostSoFar = area->GetCostSoFar() * 1.00001 + 0.00001;
+			float minNewCostSoFar = costSoFar * 1.00001 + 0.00001;
 			newCostSoFar = Max( newCostSoFar, minNewCostSoFar );
+
+			int next = FindOrAddNode( newArea );
+			NavSearchNode_t &newNode = m_nodes[ next ];
 				
 			// stop if path length limit reached
 			if ( bHaveMaxPathLength )
 			{
 				// keep track of path length so far
 				float deltaLength = ( newArea->GetCenter() - area->GetCenter() ).Length();
-				float newLengthSoFar = area->GetPathLengthSoFar() + deltaLength;
+				float newLengthSoFar = m_nodes[ current ].m_pathLengthSoFar + deltaLength;
 				if ( newLengthSoFar > maxPathLength )
 					continue;
 				
-				newArea->SetPathLengthSoFar( newLengthSoFar );
+				newNode.m_pathLengthSoFar = newLengthSoFar;
 			}
 
-			if ( ( newArea->IsOpen() || newArea->IsClosed() ) && newArea->GetCostSoFar() <= newCostSoFar )
+			if ( newNode.m_heapIndex != NAV_NODE_UNVISITED && newNode.m_costSoFar <= newCostSoFar )
 			{
 				// this is a worse path - skip it
 				continue;
@@ -385,36 +455,166 @@ bool NavAreaBuildPath( CNavArea *startArea, CNavArea *goalArea, const Vector *go
 					closestAreaDist = newCostRemaining;
 				}
 				
-				newArea->SetCostSoFar( newCostSoFar );
-				newArea->SetTotalCost( newCostSoFar + newCostRemaining );
-
-				if ( newArea->IsClosed() )
-				{
-					newArea->RemoveFromClosedList();
-				}
+				newNode.m_costSoFar = newCostSoFar;
+				newNode.m_totalCost = newCostSoFar + newCostRemaining;
+				newNode.m_parent = area;
+				newNode.m_parentHow = how;
 
-				if ( newArea->IsOpen() )
+				if ( newNode.m_heapIndex >= 0 )
 				{
-					// area already on open list, update the list order to keep costs sorted
-					newArea->UpdateOnOpenList();
+					// area already on open list, update the heap to keep costs sorted
+					UpdateOnOpenList( next );
 				}
 				else
 				{
-					newArea->AddToOpenList();
+					// closed areas go back on the open list
+					AddToOpenList( next );
 				}
-
-				newArea->SetParent( area, how );
 			}
 		}
 
 		// we have searched this area
-		area->AddToClosedList();
+		m_nodes[ current ].m_heapIndex = NAV_NODE_CLOSED;
 	}
 
 	return false;
 }
 
 
+//--------------------------------------------------------------------------------------------------------------
+/**
+ * Find path from startArea to goalArea via an A* search, using supplied cost heuristic.
+ * If cost functor returns -1 for an area, that area is considered a dead end.
+ * This doesn't actually build a path, but the path is defined by following parent
+ * pointers back from goalArea to startArea.
+ * If 'closestArea' is non-NULL, the closest area to the goal is returned (useful if the path fails).
+ * If 'goalArea' is NULL, will compute a path as close as possible to 'goalPos'.
+ * If 'goalPos' is NULL, will use the center of 'goalArea' as the goal position.
+ * If 'maxPathLength' is nonzero, path building will stop when this length is reached.
+ * Returns true if a path exists.
+ * Main thread only, use CNavPathSearch or NavAreaBuildPathAsync() elsewhere.
+ */
+#define IGNORE_NAV_BLOCKERS true
+template< typename CostFunctor >
+bool NavAreaBuildPath( CNavArea *startArea, CNavArea *goalArea, const Vector *goalPos, CostFunctor &costFunc, CNavArea **closestArea = NULL, float maxPathLength = 0.0f, int teamID = TEAM_ANY, bool ignoreNavBlockers = false )
+{
+	VPROF_BUDGET( "NavAreaBuildPath", "NextBotSpiky" );
+	Assert( ThreadInMainThread() );
+
+	if ( startArea )
+	{
+		startArea->SetParent( NULL );
+	}
+
+	CNavPathSearch *search = NavAllocPathSearch();
+
+	bool result = search->Search( startArea, goalArea, goalPos, costFunc, closestArea, maxPathLength, teamID, ignoreNavBlockers );
+
+	// callers follow the parent pointers of the areas
+	search->CopyToAreas();
+
+	NavFreePathSearch( search );
+
+	return result;
+}
+
+
+//--------------------------------------------------------------------------------------------------------------
+/**
+ * A path search running on the job pool, see NavAreaBuildPathAsync().
+ * The results are valid once IsFinished() returns true.
+ */
+class CNavPathRequest : public CJob
+{
+public:
+	CNavPathRequest( void );
+
+	bool IsStale( void ) const;					// true if the mesh changed since the request was made
+
+	bool FoundPath( void ) const				{ Assert( IsFinished() ); return m_foundPath; }		// true if the path reaches the goal
+	CNavArea *GetClosestArea( void ) const		{ Assert( IsFinished() ); return m_closestArea; }		// where the path ends, NULL if there is none
+
+	// areas along the path, from the start area to the closest area
+	int GetAreaCount( void ) const				{ Assert( IsFinished() ); return m_areas.Count(); }
+	CNavArea *GetArea( int i ) const			{ Assert( IsFinished() ); return m_areas[i].area; }
+	NavTraverseType GetHow( int i ) const		{ Assert( IsFinished() ); return m_areas[i].how; }		// how to enter area i from area i-1
+
+protected:
+	void StorePath( const CNavPathSearch &search, CNavArea *startArea, bool foundPath, CNavArea *closestArea );
+
+private:
+	struct PathArea
+	{
+		CNavArea *area;
+		NavTraverseType how;
+	};
+
+	bool m_foundPath;
+	CNavArea *m_closestArea;
+	CUtlVector< PathArea > m_areas;
+	int m_epoch;
+};
+
+template< typename CostFunctor >
+class CNavPathJob : public CNavPathRequest
+{
+public:
+	CNavPathJob( CNavArea *startArea, CNavArea *goalArea, const Vector *goalPos, const CostFunctor &costFunc, float maxPathLength, int teamID, bool ignoreNavBlockers )
+		: m_costFunc( costFunc )
+	{
+		m_startArea = startArea;
+		m_goalArea = goalArea;
+		m_hasGoalPos = ( goalPos != NULL );
+		m_goalPos = ( goalPos ) ? *goalPos : vec3_origin;
+		m_maxPathLength = maxPathLength;
+		m_teamID = teamID;
+		m_ignoreNavBlockers = ignoreNavBlockers;
+	}
+
+	virtual JobStatus_t DoExecute( void )
+	{
+		VPROF_BUDGET( "NavAreaBuildPathAsync", "NextBotSpiky" );
+
+		CNavPathSearch *search = NavAllocPathSearch();
+
+		CNavArea *closestArea = NULL;
+		bool foundPath = search->Search( m_startArea, m_goalArea, ( m_hasGoalPos ) ? &m_goalPos : NULL, m_costFunc, &closestArea, m_maxPathLength, m_teamID, m_ignoreNavBlockers );
+		StorePath( *search, m_startArea, foundPath, closestArea );
+
+		NavFreePathSearch( search );
+		return JOB_OK;
+	}
+
+private:
+	CostFunctor m_costFunc;
+	CNavArea *m_startArea;
+	CNavArea *m_goalArea;
+	Vector m_goalPos;
+	bool m_hasGoalPos;
+	float m_maxPathLength;
+	int m_teamID;
+	bool m_ignoreNavBlockers;
+};
+
+extern void NavQueuePathRequest( CNavPathRequest *request );
+extern void NavWaitForPathRequests( void );		// finish all path requests, before areas, ladders or their connections change
+
+//--------------------------------------------------------------------------------------------------------------
+/**
+ * Same as NavAreaBuildPath(), but searches on the job pool and returns right away.
+ * A copy of the cost functor is called from a pool thread, so it must be a concrete type that only
+ * reads the mesh and values copied into it, such as SnapshotPathCost.
+ * Poll IsFinished() on the returned request and Release() it when done with it.
+ */
+template< typename CostFunctor >
+CNavPathRequest *NavAreaBuildPathAsync( CNavArea *startArea, CNavArea *goalArea, const Vector *goalPos, const CostFunctor &costFunc, float maxPathLength = 0.0f, int teamID = TEAM_ANY, bool ignoreNavBlockers = false )
+{
+	CNavPathRequest *request = new CNavPathJob< CostFunctor >( startArea, goalArea, goalPos, costFunc, maxPathLength, teamID, ignoreNavBlockers );
+	NavQueuePathRequest( request );
+	return request;
+}
+
+
 //--------------------------------------------------------------------------------------------------------------
 /**
  * Compute distance between two areas. Return -1 if can't reach 'endArea' from 'startArea'.
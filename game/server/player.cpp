@@ -1620,18 +1620,22 @@ int CBasePlayer::OnTakeDamage_Alive( const CTakeDamageInfo &info )
 	IGameEvent * event = gameeventmanager->CreateEvent( "player_hurt" );
 	if ( event )
 	{
-		event->SetInt("userid", GetUserID() );
-		event->SetInt("health", MAX(0, m_iHealth) );
+		static CGameEventKey s_userid( "userid" );
+		static CGameEventKey s_health( "health" );
+		static CGameEventKey s_attacker( "attacker" );
+
+		s_userid.SetInt( event, GetUserID() );
+		s_health.SetInt( event, MAX(0, m_iHealth) );
 		event->SetInt("priority", 5 );	// HLTV event priority, not transmitted
 
 		if ( attacker->IsPlayer() )
 		{
 			CBasePlayer *player = ToBasePlayer( attacker );
-			event->SetInt("attacker", player->GetUserID() ); // hurt by other player
+			s_attacker.SetInt( event, player->GetUserID() ); // hurt by other player
 		}
 		else
 		{
-			event->SetInt("attacker", 0 ); // hurt by "world"
+			s_attacker.SetInt( event, 0 ); // hurt by "world"
 		}
 
         gameeventmanager->FireEvent( event );
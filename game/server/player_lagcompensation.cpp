@@ -10,9 +10,9 @@
 #include "igamesystem.h"
 #include "ilagcompensationmanager.h"
 #include "inetchannelinfo.h"
-#include "utllinkedlist.h"
 #include "BaseAnimatingOverlay.h"
 #include "tier0/vprof.h"
+#include "mathlib/ssemath.h"
 
 // memdbgon must be the last include file in a .cpp file!!!
 #include "tier0/memdbgon.h"
@@ -35,6 +35,9 @@ ConVar sv_maxunlag( "sv_maxunlag", "1.0", FCVAR_DEVELOPMENTONLY, "Maximum lag co
 ConVar sv_lagflushbonecache( "sv_lagflushbonecache", "1", FCVAR_DEVELOPMENTONLY, "Flushes entity bone cache on lag compensation" );
 ConVar sv_showlagcompensation( "sv_showlagcompensation", "0", FCVAR_CHEAT, "Show lag compensated hitboxes whenever a player is lag compensated." );
 
+static ConVar sv_lagcompensation_cull_ray( "sv_lagcompensation_cull_ray", "1", FCVAR_DEVELOPMENTONLY, "Only move back players whose history comes near the shots, for weapons that say where they fire" );
+static ConVar sv_lagcompensation_cull_bloat( "sv_lagcompensation_cull_bloat", "24", FCVAR_DEVELOPMENTONLY, "How far hitboxes may reach past a player's collision bounds when culling players against shots" );
+
 ConVar sv_unlag_fixstuck( "sv_unlag_fixstuck", "0", FCVAR_DEVELOPMENTONLY, "Disallow backtracking a player for lag compensation if it will cause them to become stuck" );
 
 //-----------------------------------------------------------------------------
@@ -115,6 +118,103 @@ public:
 };
 
 
+// Records kept per player, a power of two. Enough for sv_maxunlag at 255 ticks per second,
+// the oldest record is dropped before that on faster servers.
+#define MAX_PLAYER_LAG_RECORDS	256
+
+//-----------------------------------------------------------------------------
+// Purpose: A player's lag records in a fixed size ring, newest first. The
+//  simulation times, flags and origins BacktrackPlayer validates and searches
+//  are also kept in arrays of their own, the full records are only read for
+//  the one or two it ends up moving the player to.
+//-----------------------------------------------------------------------------
+class CLagRecordTrack
+{
+public:
+	CLagRecordTrack() : m_pRecords( NULL ), m_iHead( 0 ), m_nCount( 0 ) {}
+	~CLagRecordTrack() { Purge(); }
+
+	int Count() const { return m_nCount; }
+	void RemoveAll() { m_nCount = 0; }
+
+	void Purge()
+	{
+		delete [] m_pRecords;
+		m_pRecords = NULL;
+		m_nCount = 0;
+	}
+
+	// i = 0 is the newest record
+	float SimulationTime( int i ) const { return m_flSimulationTime[ Slot( i ) ]; }
+	int Flags( int i ) const { return m_fFlags[ Slot( i ) ]; }
+	const Vector &Origin( int i ) const { return m_vecOrigin[ Slot( i ) ]; }
+	LagRecord &Record( int i ) { return m_pRecords[ Slot( i ) ]; }
+
+	// Records are added with increasing simulation times, drops the oldest one if the ring is full
+	LagRecord &AddToHead( float flSimulationTime, int fFlags, const Vector &vecOrigin )
+	{
+		if ( !m_pRecords )
+		{
+			m_pRecords = new LagRecord[ MAX_PLAYER_LAG_RECORDS ];
+		}
+
+		Assert( !m_nCount || SimulationTime( 0 ) < flSimulationTime );
+		m_iHead = ( m_iHead + 1 ) & ( MAX_PLAYER_LAG_RECORDS - 1 );
+		m_nCount = MIN( m_nCount + 1, MAX_PLAYER_LAG_RECORDS );
+
+		m_flSimulationTime[ m_iHead ] = flSimulationTime;
+		m_fFlags[ m_iHead ] = fFlags;
+		m_vecOrigin[ m_iHead ] = vecOrigin;
+		return m_pRecords[ m_iHead ];
+	}
+
+	void RemoveOlderThan( float flDeadtime )
+	{
+		while ( m_nCount > 0 && SimulationTime( m_nCount - 1 ) < flDeadtime )
+		{
+			--m_nCount;
+		}
+	}
+
+	// Newest record at or before flTargetTime, the oldest record if they are all newer
+	int FindRecord( float flTargetTime ) const
+	{
+		Assert( m_nCount > 0 );
+
+		// simulation times decrease with the index
+		int nLow = 0;
+		int nHigh = m_nCount - 1;
+		while ( nLow < nHigh )
+		{
+			int nMid = ( nLow + nHigh ) >> 1;
+			if ( SimulationTime( nMid ) <= flTargetTime )
+			{
+				nHigh = nMid;
+			}
+			else
+			{
+				nLow = nMid + 1;
+			}
+		}
+		return nLow;
+	}
+
+private:
+	int Slot( int i ) const
+	{
+		Assert( i >= 0 && i < m_nCount );
+		return ( m_iHead - i ) & ( MAX_PLAYER_LAG_RECORDS - 1 );
+	}
+
+	float		m_flSimulationTime[ MAX_PLAYER_LAG_RECORDS ];
+	int			m_fFlags[ MAX_PLAYER_LAG_RECORDS ];
+	Vector		m_vecOrigin[ MAX_PLAYER_LAG_RECORDS ];
+	LagRecord	*m_pRecords;	// allocated when the player gets a first record
+	int			m_iHead;
+	int			m_nCount;
+};
+
+
 //
 // Try to take the player from his current origin to vWantedPos.
 // If it can't get there, leave the player where he is.
@@ -192,9 +292,23 @@ public:
 
 	// Called during player movement to set up/restore after lag compensation
 	void			StartLagCompensation( CBasePlayer *player, CUserCmd *cmd );
+	void			StartLagCompensationAlongRay( CBasePlayer *player, CUserCmd *cmd, const Vector &vecSrc, const Vector &vecDir, float flDistance, float flSpread, float flRadius );
 	void			FinishLagCompensation( CBasePlayer *player );
 
 private:
+	struct LagCompensationRay_t
+	{
+		Vector	m_vecSrc;
+		Vector	m_vecDir;
+		float	m_flDistance;
+		float	m_flSpread;
+		float	m_flRadius;
+	};
+
+	void			StartLagCompensation( CBasePlayer *player, CUserCmd *cmd, const LagCompensationRay_t *pRay );
+	float			GetTargetTime( CBasePlayer *player, CUserCmd *cmd );
+	int				CullPlayersAgainstRay( CBasePlayer **ppPlayers, int nPlayers, float flTargetTime, const LagCompensationRay_t &ray );
+	bool			GetBacktrackSphere( CBasePlayer *player, float flTargetTime, Vector &vecCenter, float &flRadius );
 	void			BacktrackPlayer( CBasePlayer *player, float flTargetTime );
 
 	void ClearHistory()
@@ -204,7 +318,7 @@ private:
 	}
 
 	// keep a list of lag records for each player
-	CUtlFixedLinkedList< LagRecord >	m_PlayerTrack[ MAX_PLAYERS ];
+	CLagRecordTrack			m_PlayerTrack[ MAX_PLAYERS ];
 
 	// Scratchpad for determining what needs to be restored
 	CBitVec<MAX_PLAYERS>	m_RestorePlayer;
@@ -245,7 +359,7 @@ void CLagCompensationManager::FrameUpdatePostEntityThink()
 	{
 		CBasePlayer *pPlayer = UTIL_PlayerByIndex( i );
 
-		CUtlFixedLinkedList< LagRecord > *track = &m_PlayerTrack[i-1];
+		CLagRecordTrack *track = &m_PlayerTrack[i-1];
 
 		if ( !pPlayer )
 		{
@@ -257,42 +371,28 @@ void CLagCompensationManager::FrameUpdatePostEntityThink()
 			continue;
 		}
 
-		Assert( track->Count() < 1000 ); // insanity check
-
 		// remove tail records that are too old
-		intp tailIndex = track->Tail();
-		while ( track->IsValidIndex( tailIndex ) )
-		{
-			LagRecord &tail = track->Element( tailIndex );
-
-			// if tail is within limits, stop
-			if ( tail.m_flSimulationTime >= flDeadtime )
-				break;
-			
-			// remove tail, get new tail
-			track->Remove( tailIndex );
-			tailIndex = track->Tail();
-		}
+		track->RemoveOlderThan( flDeadtime );
 
 		// check if head has same simulation time
 		if ( track->Count() > 0 )
 		{
-			LagRecord &head = track->Element( track->Head() );
-
 			// check if player changed simulation time since last time updated
-			if ( head.m_flSimulationTime >= pPlayer->GetSimulationTime() )
+			if ( track->SimulationTime( 0 ) >= pPlayer->GetSimulationTime() )
 				continue; // don't add new entry for same or older time
 		}
 
 		// add new record to player track
-		LagRecord &record = track->Element( track->AddToHead() );
-
-		record.m_fFlags = 0;
+		int fFlags = 0;
 		if ( pPlayer->IsAlive() )
 		{
-			record.m_fFlags |= LC_ALIVE;
+			fFlags |= LC_ALIVE;
 		}
 
+		LagRecord &record = track->AddToHead( pPlayer->GetSimulationTime(), fFlags, pPlayer->GetLocalOrigin() );
+
+		record.m_fFlags = fFlags;
+
 		record.m_flSimulationTime	= pPlayer->GetSimulationTime();
 		record.m_vecAngles			= pPlayer->GetLocalAngles();
 		record.m_vecOrigin			= pPlayer->GetLocalOrigin();
@@ -321,6 +421,25 @@ void CLagCompensationManager::FrameUpdatePostEntityThink()
 
 // Called during player movement to set up/restore after lag compensation
 void CLagCompensationManager::StartLagCompensation( CBasePlayer *player, CUserCmd *cmd )
+{
+	StartLagCompensation( player, cmd, NULL );
+}
+
+// Same, but only moves back players whose history comes near the shots. vecDir is normalized,
+// flSpread is how far the shots stray sideways per unit of distance, flRadius how wide they are.
+void CLagCompensationManager::StartLagCompensationAlongRay( CBasePlayer *player, CUserCmd *cmd, const Vector &vecSrc, const Vector &vecDir, float flDistance, float flSpread, float flRadius )
+{
+	LagCompensationRay_t ray;
+	ray.m_vecSrc = vecSrc;
+	ray.m_vecDir = vecDir;
+	ray.m_flDistance = flDistance;
+	ray.m_flSpread = flSpread;
+	ray.m_flRadius = flRadius;
+
+	StartLagCompensation( player, cmd, sv_lagcompensation_cull_ray.GetBool() ? &ray : NULL );
+}
+
+void CLagCompensationManager::StartLagCompensation( CBasePlayer *player, CUserCmd *cmd, const LagCompensationRay_t *pRay )
 {
 	//DONT LAG COMP AGAIN THIS FRAME IF THERES ALREADY ONE IN PROGRESS
 	//IF YOU'RE HITTING THIS THEN IT MEANS THERES A CODE BUG
@@ -350,6 +469,52 @@ void CLagCompensationManager::StartLagCompensation( CBasePlayer *player, CUserCm
 	Q_memset( m_RestoreData, 0, sizeof( m_RestoreData ) );
 	Q_memset( m_ChangeData, 0, sizeof( m_ChangeData ) );
 
+	float flTargetTime = GetTargetTime( player, cmd );
+	
+	// Collect all active players that should be moved back
+	CBasePlayer *pPlayers[ MAX_PLAYERS ];
+	int nPlayers = 0;
+
+	const CBitVec<MAX_EDICTS> *pEntityTransmitBits = engine->GetEntityTransmitBitsForClient( player->entindex() - 1 );
+	for ( int i = 1; i <= gpGlobals->maxClients; i++ )
+	{
+		CBasePlayer *pPlayer = UTIL_PlayerByIndex( i );
+
+		if ( !pPlayer )
+		{
+			continue;
+		}
+
+		// Don't lag compensate yourself you loser...
+		if ( player == pPlayer )
+		{
+			continue;
+		}
+
+		// Custom checks for if things should lag compensate (based on things like what team the player is on).
+		if ( !player->WantsLagCompensationOnEntity( pPlayer, cmd, pEntityTransmitBits ) )
+			continue;
+
+		pPlayers[ nPlayers++ ] = pPlayer;
+	}
+
+	if ( pRay )
+	{
+		nPlayers = CullPlayersAgainstRay( pPlayers, nPlayers, flTargetTime, *pRay );
+	}
+
+	// Move other players back in time
+	for ( int i = 0; i < nPlayers; i++ )
+	{
+		BacktrackPlayer( pPlayers[i], flTargetTime );
+	}
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Time the player saw the world at when sending cmd
+//-----------------------------------------------------------------------------
+float CLagCompensationManager::GetTargetTime( CBasePlayer *player, CUserCmd *cmd )
+{
 	// Get true latency
 
 	// correct is the amout of time we have to correct game time
@@ -384,31 +549,140 @@ void CLagCompensationManager::StartLagCompensation( CBasePlayer *player, CUserCm
 		// DevMsg("StartLagCompensation: delta too big (%.3f)\n", deltaTime );
 		targettick = gpGlobals->tickcount - TIME_TO_TICKS( correct );
 	}
-	
-	// Iterate all active players
-	const CBitVec<MAX_EDICTS> *pEntityTransmitBits = engine->GetEntityTransmitBitsForClient( player->entindex() - 1 );
-	for ( int i = 1; i <= gpGlobals->maxClients; i++ )
+
+	return TICKS_TO_TIME( targettick );
+}
+
+// Grows vecExtents to reach both corners of a box around the origin
+static void ExpandExtents( Vector &vecExtents, const Vector &vecMins, const Vector &vecMaxs )
+{
+	for ( int i = 0; i < 3; i++ )
 	{
-		CBasePlayer *pPlayer = UTIL_PlayerByIndex( i );
+		vecExtents[i] = MAX( vecExtents[i], MAX( fabs( vecMins[i] ), fabs( vecMaxs[i] ) ) );
+	}
+}
 
-		if ( !pPlayer )
-		{
-			continue;
-		}
+//-----------------------------------------------------------------------------
+// Purpose: Sphere around every position BacktrackPlayer can leave the player's
+//  hitboxes at for flTargetTime. Returns false if it wouldn't move the player.
+//-----------------------------------------------------------------------------
+bool CLagCompensationManager::GetBacktrackSphere( CBasePlayer *pPlayer, float flTargetTime, Vector &vecCenter, float &flRadius )
+{
+	CLagRecordTrack *track = &m_PlayerTrack[ pPlayer->entindex() - 1 ];
+	if ( track->Count() <= 0 )
+		return false;
 
-		// Don't lag compensate yourself you loser...
-		if ( player == pPlayer )
-		{
-			continue;
-		}
+	// the player ends up between the two records around the target time, or
+	// between there and where he is now if sv_unlag_fixstuck pulls him forward
+	int iRecord = track->FindRecord( flTargetTime );
 
-		// Custom checks for if things should lag compensate (based on things like what team the player is on).
-		if ( !player->WantsLagCompensationOnEntity( pPlayer, cmd, pEntityTransmitBits ) )
+	Vector vecOrigin = pPlayer->GetLocalOrigin();
+	Vector vecMins = vecOrigin;
+	Vector vecMaxs = vecOrigin;
+	VectorMin( vecMins, track->Origin( iRecord ), vecMins );
+	VectorMax( vecMaxs, track->Origin( iRecord ), vecMaxs );
+
+	// largest extent of the hitboxes around the origin
+	Vector vecSurroundMins, vecSurroundMaxs;
+	pPlayer->CollisionProp()->WorldSpaceSurroundingBounds( &vecSurroundMins, &vecSurroundMaxs );
+	vecSurroundMins -= pPlayer->GetAbsOrigin();
+	vecSurroundMaxs -= pPlayer->GetAbsOrigin();
+
+	Vector vecExtents( 0, 0, 0 );
+	ExpandExtents( vecExtents, vecSurroundMins, vecSurroundMaxs );
+	ExpandExtents( vecExtents, track->Record( iRecord ).m_vecMinsPreScaled, track->Record( iRecord ).m_vecMaxsPreScaled );
+
+	if ( iRecord > 0 )
+	{
+		VectorMin( vecMins, track->Origin( iRecord - 1 ), vecMins );
+		VectorMax( vecMaxs, track->Origin( iRecord - 1 ), vecMaxs );
+		ExpandExtents( vecExtents, track->Record( iRecord - 1 ).m_vecMinsPreScaled, track->Record( iRecord - 1 ).m_vecMaxsPreScaled );
+	}
+
+	vecCenter = ( vecMins + vecMaxs ) * 0.5f;
+	flRadius = ( vecMaxs - vecCenter ).Length() + vecExtents.Length() + sv_lagcompensation_cull_bloat.GetFloat();
+	return true;
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Removes the players the shots can't reach wherever they get moved
+//  back to, four players at a time. Returns the number of players left.
+//-----------------------------------------------------------------------------
+int CLagCompensationManager::CullPlayersAgainstRay( CBasePlayer **ppPlayers, int nPlayers, float flTargetTime, const LagCompensationRay_t &ray )
+{
+	VPROF_BUDGET( "CullPlayersAgainstRay", "CLagCompensationManager" );
+
+	ALIGN16 float flCenterX[ MAX_PLAYERS + 3 ] ALIGN16_POST;
+	ALIGN16 float flCenterY[ MAX_PLAYERS + 3 ] ALIGN16_POST;
+	ALIGN16 float flCenterZ[ MAX_PLAYERS + 3 ] ALIGN16_POST;
+	ALIGN16 float flRadius[ MAX_PLAYERS + 3 ] ALIGN16_POST;
+
+	// players without history aren't moved at all
+	int nSpheres = 0;
+	for ( int i = 0; i < nPlayers; i++ )
+	{
+		Vector vecCenter;
+		if ( !GetBacktrackSphere( ppPlayers[i], flTargetTime, vecCenter, flRadius[ nSpheres ] ) )
 			continue;
 
-		// Move other player back in time
-		BacktrackPlayer( pPlayer, TICKS_TO_TIME( targettick ) );
+		flCenterX[ nSpheres ] = vecCenter.x;
+		flCenterY[ nSpheres ] = vecCenter.y;
+		flCenterZ[ nSpheres ] = vecCenter.z;
+		ppPlayers[ nSpheres++ ] = ppPlayers[i];
+	}
+
+	// pad to a multiple of four with spheres nothing reaches
+	for ( int i = nSpheres; i < ( ( nSpheres + 3 ) & ~3 ); i++ )
+	{
+		flCenterX[i] = ray.m_vecSrc.x;
+		flCenterY[i] = ray.m_vecSrc.y;
+		flCenterZ[i] = ray.m_vecSrc.z;
+		flRadius[i] = -FLT_MAX;
+	}
+
+	fltx4 f4SrcX = ReplicateX4( ray.m_vecSrc.x );
+	fltx4 f4SrcY = ReplicateX4( ray.m_vecSrc.y );
+	fltx4 f4SrcZ = ReplicateX4( ray.m_vecSrc.z );
+	fltx4 f4DirX = ReplicateX4( ray.m_vecDir.x );
+	fltx4 f4DirY = ReplicateX4( ray.m_vecDir.y );
+	fltx4 f4DirZ = ReplicateX4( ray.m_vecDir.z );
+	fltx4 f4Distance = ReplicateX4( ray.m_flDistance );
+	fltx4 f4Spread = ReplicateX4( ray.m_flSpread );
+	fltx4 f4RayRadius = ReplicateX4( ray.m_flRadius );
+
+	int nHit = 0;
+	for ( int i = 0; i < nSpheres; i += 4 )
+	{
+		fltx4 f4DeltaX = SubSIMD( LoadAlignedSIMD( &flCenterX[i] ), f4SrcX );
+		fltx4 f4DeltaY = SubSIMD( LoadAlignedSIMD( &flCenterY[i] ), f4SrcY );
+		fltx4 f4DeltaZ = SubSIMD( LoadAlignedSIMD( &flCenterZ[i] ), f4SrcZ );
+		fltx4 f4Radius = LoadAlignedSIMD( &flRadius[i] );
+
+		// distance along the ray to the sphere center, and the closest point of the segment
+		fltx4 f4Along = MaddSIMD( f4DeltaX, f4DirX, MaddSIMD( f4DeltaY, f4DirY, MulSIMD( f4DeltaZ, f4DirZ ) ) );
+		fltx4 f4Closest = MinSIMD( MaxSIMD( f4Along, Four_Zeros ), f4Distance );
+
+		fltx4 f4OffsetX = SubSIMD( f4DeltaX, MulSIMD( f4DirX, f4Closest ) );
+		fltx4 f4OffsetY = SubSIMD( f4DeltaY, MulSIMD( f4DirY, f4Closest ) );
+		fltx4 f4OffsetZ = SubSIMD( f4DeltaZ, MulSIMD( f4DirZ, f4Closest ) );
+		fltx4 f4DistSqr = MaddSIMD( f4OffsetX, f4OffsetX, MaddSIMD( f4OffsetY, f4OffsetY, MulSIMD( f4OffsetZ, f4OffsetZ ) ) );
+
+		// the spread cone is no wider than at the far side of the sphere
+		fltx4 f4Far = MinSIMD( MaxSIMD( AddSIMD( f4Along, f4Radius ), Four_Zeros ), f4Distance );
+		fltx4 f4Reach = AddSIMD( AddSIMD( f4Radius, f4RayRadius ), MulSIMD( f4Spread, f4Far ) );
+		fltx4 f4Hit = AndSIMD( CmpLeSIMD( f4DistSqr, MulSIMD( f4Reach, f4Reach ) ), CmpGeSIMD( f4Reach, Four_Zeros ) );
+
+		int nMask = TestSignSIMD( f4Hit );
+		for ( int j = i; nMask; j++, nMask >>= 1 )
+		{
+			if ( nMask & 1 )
+			{
+				ppPlayers[ nHit++ ] = ppPlayers[j];
+			}
+		}
 	}
+
+	return nHit;
 }
 
 void CLagCompensationManager::BacktrackPlayer( CBasePlayer *pPlayer, float flTargetTime )
@@ -422,62 +696,38 @@ void CLagCompensationManager::BacktrackPlayer( CBasePlayer *pPlayer, float flTar
 	int pl_index = pPlayer->entindex() - 1;
 
 	// get track history of this player
-	CUtlFixedLinkedList< LagRecord > *track = &m_PlayerTrack[ pl_index ];
+	CLagRecordTrack *track = &m_PlayerTrack[ pl_index ];
 
 	// check if we have at leat one entry
 	if ( track->Count() <= 0 )
 		return;
 
-    intp curr = track->Head();
-
-	LagRecord *prevRecord = NULL;
-	LagRecord *record = NULL;
+	// find the first context smaller than target time
+	int iRecord = track->FindRecord( flTargetTime );
 
 	Vector prevOrg = pPlayer->GetLocalOrigin();
 	
-	// Walk context looking for any invalidating event
-	while( track->IsValidIndex(curr) )
+	// Walk context up to there looking for any invalidating event
+	for ( int i = 0; i <= iRecord; i++ )
 	{
-		// remember last record
-		prevRecord = record;
-
-		// get next record
-		record = &track->Element( curr );
-
-		if ( !(record->m_fFlags & LC_ALIVE) )
+		if ( !(track->Flags( i ) & LC_ALIVE) )
 		{
 			// player most be alive, lost track
 			return;
 		}
 
-		Vector delta = record->m_vecOrigin - prevOrg;
+		Vector delta = track->Origin( i ) - prevOrg;
 		if ( delta.Length2DSqr() > m_flTeleportDistanceSqr )
 		{
 			// lost track, too much difference
 			return; 
 		}
 
-		// did we find a context smaller than target time ?
-		if ( record->m_flSimulationTime <= flTargetTime )
-			break; // hurra, stop
-
-		prevOrg = record->m_vecOrigin;
-
-		// go one step back
-		curr = track->Next( curr );
+		prevOrg = track->Origin( i );
 	}
 
-	Assert( record );
-
-	if ( !record )
-	{
-		if ( sv_unlag_debug.GetBool() )
-		{
-			DevMsg( "No valid positions in history for BacktrackPlayer client ( %s )\n", pPlayer->GetPlayerName() );
-		}
-
-		return; // that should never happen
-	}
+	LagRecord *record = &track->Record( iRecord );
+	LagRecord *prevRecord = ( iRecord > 0 ) ? &track->Record( iRecord - 1 ) : NULL;
 
 	float frac = 0.0f;
 	if ( prevRecord && 
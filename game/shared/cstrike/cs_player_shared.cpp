@@ -452,10 +452,15 @@ void CCSPlayer::FireBullet(
 		IGameEvent * event = gameeventmanager->CreateEvent( "bullet_impact" );
 		if ( event )
 		{
-			event->SetInt( "userid", GetUserID() );
-			event->SetFloat( "x", tr.endpos.x );
-			event->SetFloat( "y", tr.endpos.y );
-			event->SetFloat( "z", tr.endpos.z );
+			static CGameEventKey s_userid( "userid" );
+			static CGameEventKey s_x( "x" );
+			static CGameEventKey s_y( "y" );
+			static CGameEventKey s_z( "z" );
+
+			s_userid.SetInt( event, GetUserID() );
+			s_x.SetFloat( event, tr.endpos.x );
+			s_y.SetFloat( event, tr.endpos.y );
+			s_z.SetFloat( event, tr.endpos.z );
 			gameeventmanager->FireEvent( event );
 		}
 #endif
@@ -494,6 +494,137 @@ inline void CalcBoneQuaternion( int frame, float s,
 	}
 }
 
+
+//-----------------------------------------------------------------------------
+// Purpose: CalcBoneQuaternion for all the bones of an animation.  Euler
+//			animated bones are queued and converted and blended four at a
+//			time, the rest are done as they're added.  Results are only
+//			written once Flush() is called.
+//-----------------------------------------------------------------------------
+class ALIGN16 CBoneQuaternionBatch
+{
+public:
+	CBoneQuaternionBatch( int frame, float s ) : m_nFrame( frame ), m_s( s ), m_nCount( 0 ) {}
+
+	void Add( const mstudiobone_t *pBone, const mstudiolinearbone_t *pLinearBones, const mstudioanim_t *panim, Quaternion &q );
+	void Flush();
+
+private:
+	fltx4				m_angle1[3];
+	fltx4				m_angle2[3];
+	int					m_nFrame;
+	float				m_s;
+	int					m_nCount;
+	Quaternion			*m_pOut[4];
+	const Quaternion	*m_pAlignment[4];	// NULL unless the bone is aligned to it afterwards
+};
+
+void CBoneQuaternionBatch::Add( const mstudiobone_t *pBone, const mstudiolinearbone_t *pLinearBones, const mstudioanim_t *panim, Quaternion &q )
+{
+	// a queued result would overwrite this one
+	for ( int i = 0; i < m_nCount; i++ )
+	{
+		if ( m_pOut[i] == &q )
+		{
+			Flush();
+			break;
+		}
+	}
+
+	if ( !( panim->flags & STUDIO_ANIM_ANIMROT ) || ( panim->flags & ( STUDIO_ANIM_RAWROT | STUDIO_ANIM_RAWROT2 ) ) )
+	{
+		CalcBoneQuaternion( m_nFrame, m_s, pBone, pLinearBones, panim, q );
+		return;
+	}
+
+	const RadianEuler &baseRot = ( pLinearBones ) ? pLinearBones->rot( panim->bone ) : pBone->rot;
+	const Vector &baseRotScale = ( pLinearBones ) ? pLinearBones->rotscale( panim->bone ) : pBone->rotscale;
+	int iBaseFlags = ( pLinearBones ) ? pLinearBones->flags( panim->bone ) : pBone->flags;
+
+	mstudioanim_valueptr_t *pValuesPtr = panim->pRotV();
+	int n = m_nCount;
+	for ( int i = 0; i < 3; i++ )
+	{
+		float &angle1 = SubFloat( m_angle1[i], n );
+		float &angle2 = SubFloat( m_angle2[i], n );
+		if ( m_s > 0.001f )
+		{
+			ExtractAnimValue( m_nFrame, pValuesPtr->pAnimvalue( i ), baseRotScale[i], angle1, angle2 );
+		}
+		else
+		{
+			ExtractAnimValue( m_nFrame, pValuesPtr->pAnimvalue( i ), baseRotScale[i], angle1 );
+			angle2 = angle1;
+		}
+
+		if ( !( panim->flags & STUDIO_ANIM_DELTA ) )
+		{
+			angle1 = angle1 + baseRot[i];
+			angle2 = angle2 + baseRot[i];
+		}
+	}
+
+	m_pOut[n] = &q;
+	m_pAlignment[n] = NULL;
+	if ( !( panim->flags & STUDIO_ANIM_DELTA ) && ( iBaseFlags & BONE_FIXED_ALIGNMENT ) )
+	{
+		m_pAlignment[n] = ( pLinearBones ) ? &pLinearBones->qalignment( panim->bone ) : &pBone->qAlignment;
+	}
+
+	if ( ++m_nCount == 4 )
+	{
+		Flush();
+	}
+}
+
+void CBoneQuaternionBatch::Flush()
+{
+	if ( !m_nCount )
+		return;
+
+	// unused lanes get a copy of the first one
+	for ( int n = m_nCount; n < 4; n++ )
+	{
+		for ( int i = 0; i < 3; i++ )
+		{
+			SubFloat( m_angle1[i], n ) = SubFloat( m_angle1[i], 0 );
+			SubFloat( m_angle2[i], n ) = SubFloat( m_angle2[i], 0 );
+		}
+	}
+
+	FourQuaternions q1;
+	q1.FromRadianEulers( m_angle1[0], m_angle1[1], m_angle1[2] );
+
+	// blend only the bones whose angles change between the frames
+	fltx4 same = AndSIMD( AndSIMD( CmpEqSIMD( m_angle1[0], m_angle2[0] ), CmpEqSIMD( m_angle1[1], m_angle2[1] ) ), CmpEqSIMD( m_angle1[2], m_angle2[2] ) );
+	if ( TestSignSIMD( same ) != 0xf )
+	{
+		FourQuaternions q2;
+		q2.FromRadianEulers( m_angle2[0], m_angle2[1], m_angle2[2] );
+		FourQuaternions blended = FourQuaternions::Blend( q1, q2, ReplicateX4( m_s ) );
+		blended.MaskedAssign( same, q1 );
+		q1 = blended;
+	}
+
+	QuaternionAligned result[4];
+	q1.SwizzleAndStore( result[0], result[1], result[2], result[3] );
+
+	for ( int n = 0; n < m_nCount; n++ )
+	{
+		Quaternion &q = *m_pOut[n];
+		q = result[n];
+		Assert( q.IsValid() );
+
+		// align to unified bone
+		if ( m_pAlignment[n] )
+		{
+			QuaternionAlign( *m_pAlignment[n], q, q );
+		}
+	}
+
+	m_nCount = 0;
+}
+
 						
 
 
@@ -971,6 +1102,8 @@ static void CalcVirtualAnimation( virtualmodel_t *pVModel, const CStudioHdr *pSt
 		return;
 	}
 
+	CBoneQuaternionBatch boneQuaternions( iLocalFrame, s );
+
 	// FIXME: change encoding so that bone -1 is never the case
 	while (panim && panim->bone < 255)
 	{
@@ -981,7 +1114,7 @@ static void CalcVirtualAnimation( virtualmodel_t *pVModel, const CStudioHdr *pSt
 
 			if (k >= 0 && pweight[k] > 0.0f)
 			{
-				CalcBoneQuaternion( iLocalFrame, s, &pAnimbone[panim->bone], pAnimLinearBones, panim, q[j] );
+				boneQuaternions.Add( &pAnimbone[panim->bone], pAnimLinearBones, panim, q[j] );
 				CalcBonePosition  ( iLocalFrame, s, &pAnimbone[panim->bone], pAnimLinearBones, panim, pos[j] );
 #ifdef STUDIO_ENABLE_PERF_COUNTERS
 				pStudioHdr->m_nPerfAnimatedBones++;
@@ -990,6 +1123,7 @@ static void CalcVirtualAnimation( virtualmodel_t *pVModel, const CStudioHdr *pSt
 		}
 		panim = panim->pNext();
 	}
+	boneQuaternions.Flush();
 
 	// cross fade in previous zeroframe data
 	if (flStall > 0.0f)
@@ -1102,6 +1236,8 @@ static void CalcAnimation( const CStudioHdr *pStudioHdr,	Vector *pos, Quaternion
 		return;
 	}
 
+	CBoneQuaternionBatch boneQuaternions( iLocalFrame, s );
+
 	// BUGBUG: the sequence, the anim, and the model can have all different bone mappings.
 	for (int i = 0; i < pStudioHdr->numbones(); i++, pbone++, pweight++)
 	{
@@ -1109,7 +1245,7 @@ static void CalcAnimation( const CStudioHdr *pStudioHdr,	Vector *pos, Quaternion
 		{
 			if (*pweight > 0 && (pStudioHdr->boneFlags(i) & boneMask))
 			{
-				CalcBoneQuaternion( iLocalFrame, s, pbone, pLinearBones, panim, q[i] );
+				boneQuaternions.Add( pbone, pLinearBones, panim, q[i] );
 				CalcBonePosition  ( iLocalFrame, s, pbone, pLinearBones, panim, pos[i] );
 #ifdef STUDIO_ENABLE_PERF_COUNTERS
 				pStudioHdr->m_nPerfAnimatedBones++;
@@ -1135,6 +1271,7 @@ static void CalcAnimation( const CStudioHdr *pStudioHdr,	Vector *pos, Quaternion
 #endif
 		}
 	}
+	boneQuaternions.Flush();
 
 	// cross fade in previous zeroframe data
 	if (flStall > 0.0f)
@@ -1378,6 +1515,49 @@ void WorldSpaceSlerp(
 
 
 
+//-----------------------------------------------------------------------------
+// Purpose: q1 = QuaternionSlerp( q2, q1, s1 ) or QuaternionBlend( q2, q1, s1 )
+//			of a list of bones, four at a time.  BONE_FIXED_ALIGNMENT bones
+//			don't get aligned.
+//-----------------------------------------------------------------------------
+template< class QUATERNION >
+static void SlerpBoneQuaternions( const CStudioHdr *pStudioHdr, bool bBlend, const int *pBones, const float *pS1, int nBones, Quaternion *q1, const QUATERNION *q2 )
+{
+	for ( int i = 0; i < nBones; i += 4 )
+	{
+		// a partial group repeats its last bone
+		int nCount = MIN( nBones - i, 4 );
+		int bones[4];
+		for ( int n = 0; n < 4; n++ )
+		{
+			bones[n] = pBones[ i + MIN( n, nCount - 1 ) ];
+		}
+
+		FourQuaternions p, q;
+		p.LoadAndSwizzle( q2[bones[0]], q2[bones[1]], q2[bones[2]], q2[bones[3]] );
+		q.LoadAndSwizzle( q1[bones[0]], q1[bones[1]], q1[bones[2]], q1[bones[3]] );
+
+		fltx4 t, align;
+		for ( int n = 0; n < 4; n++ )
+		{
+			SubFloat( t, n ) = pS1[ bones[n] ];
+			SubInt( align, n ) = ( pStudioHdr->boneFlags( bones[n] ) & BONE_FIXED_ALIGNMENT ) ? 0 : ~0;
+		}
+
+		q.MaskedAssign( align, FourQuaternions::Align( p, q ) );
+		FourQuaternions result = ( bBlend ) ? FourQuaternions::BlendNoAlign( p, q, t ) : FourQuaternions::SlerpNoAlign( p, q, t );
+
+		QuaternionAligned results[4];
+		result.SwizzleAndStore( results[0], results[1], results[2], results[3] );
+		for ( int n = 0; n < nCount; n++ )
+		{
+			q1[bones[n]] = results[n];
+		}
+	}
+}
+
+
+
 //-----------------------------------------------------------------------------
 // Purpose: blend together q1,pos1 with q2,pos2.  Return result in q1,pos1.  
 //			0 returns q1, pos1.  1 returns q2, pos2
@@ -1487,45 +1667,25 @@ void SlerpBones(
 		return;
 	}
 
-	QuaternionAligned q3;
+	// the rotations of every blended bone are slerped together
+	int *pBones = (int*)stackalloc( nBoneCount * sizeof(int) );
+	float *pS1 = (float*)stackalloc( nBoneCount * sizeof(float) );
+	int nBones = 0;
 	for (i = 0; i < nBoneCount; i++)
 	{
-		s2 = pS2[i];
-		if ( s2 <= 0.0f )
-			continue;
-
-		s1 = 1.0 - s2;
-
-#ifdef _X360
-		fltx4  q1simd, q2simd, result;
-		q1simd = LoadUnalignedSIMD( q1[i].Base() );
-		q2simd = LoadAlignedSIMD( q2[i] );
-#endif
-		if ( pStudioHdr->boneFlags(i) & BONE_FIXED_ALIGNMENT )
-		{
-#ifndef _X360
-			QuaternionSlerpNoAlign( q2[i], q1[i], s1, q3 );
-#else
-			result = QuaternionSlerpNoAlignSIMD( q2simd, q1simd, s1 );
-#endif
-		}
-		else
+		if ( pS2[i] > 0.0f )
 		{
-#ifndef _X360
-			QuaternionSlerp( q2[i], q1[i], s1, q3 );
-#else
-			result = QuaternionSlerpSIMD( q2simd, q1simd, s1 );
-#endif
+			pBones[nBones++] = i;
+			pS1[i] = 1.0 - pS2[i];
 		}
+	}
+	SlerpBoneQuaternions( pStudioHdr, false, pBones, pS1, nBones, q1, q2 );
 
-#ifndef _X360
-		q1[i][0] = q3[0];
-		q1[i][1] = q3[1];
-		q1[i][2] = q3[2];
-		q1[i][3] = q3[3];
-#else
-		StoreUnalignedSIMD( q1[i].Base(), result );
-#endif
+	for (j = 0; j < nBones; j++)
+	{
+		i = pBones[j];
+		s2 = pS2[i];
+		s1 = pS1[i];
 
 		pos1[i][0] = pos1[i][0] * s1 + pos2[i][0] * s2;
 		pos1[i][1] = pos1[i][1] * s1 + pos2[i][1] * s2;
@@ -1552,7 +1712,6 @@ void BlendBones(
 	int boneMask )
 {
 	int			i, j;
-	Quaternion		q3;
 
 	virtualmodel_t *pVModel = pStudioHdr->GetVirtualModel();
 	const virtualgroup_t *pSeqGroup = NULL;
@@ -1598,7 +1757,12 @@ void BlendBones(
 	float s2 = s;
 	float s1 = 1.0 - s2;
 
-	for (i = 0; i < pStudioHdr->numbones(); i++)
+	int nBoneCount = pStudioHdr->numbones();
+	int *pBones = (int*)stackalloc( nBoneCount * sizeof(int) );
+	float *pS1 = (float*)stackalloc( nBoneCount * sizeof(float) );
+	int nBones = 0;
+
+	for (i = 0; i < nBoneCount; i++)
 	{
 		// skip unused bones
 		if (!(pStudioHdr->boneFlags(i) & boneMask))
@@ -1617,23 +1781,15 @@ void BlendBones(
 
 		if (j >= 0 && seqdesc.weight( j ) > 0.0)
 		{
-			if (pStudioHdr->boneFlags(i) & BONE_FIXED_ALIGNMENT)
-			{
-				QuaternionBlendNoAlign( q2[i], q1[i], s1, q3 );
-			}
-			else
-			{
-				QuaternionBlend( q2[i], q1[i], s1, q3 );
-			}
-			q1[i][0] = q3[0];
-			q1[i][1] = q3[1];
-			q1[i][2] = q3[2];
-			q1[i][3] = q3[3];
+			pBones[nBones++] = i;
+			pS1[i] = s1;
 			pos1[i][0] = pos1[i][0] * s1 + pos2[i][0] * s2;
 			pos1[i][1] = pos1[i][1] * s1 + pos2[i][1] * s2;
 			pos1[i][2] = pos1[i][2] * s1 + pos2[i][2] * s2;
 		}
 	}
+
+	SlerpBoneQuaternions( pStudioHdr, true, pBones, pS1, nBones, q1, q2 );
 }
 
 
@@ -70,6 +70,29 @@ inline void ByteSwap_demoheader_t( demoheader_t &swap )
 	swap.signonlength = LittleDWord( swap.signonlength );
 }
 
+// Seek index, appended after dem_stop so readers that stop there never see it:
+//
+//	keyframes		string tables and a full entity packet, each as int length + data
+//	index			demoindexentry_t for every keyframe, in tick order
+//	footer			demoindexfooter_t at the very end of the file
+//
+#define DEMO_INDEX_ID		"HL2DIDX"
+
+struct demoindexentry_t
+{
+	int		tick;			// recording tick of the keyframe
+	int		keyframepos;	// file position of the keyframe data
+	int		streampos;		// file position of the first command after the keyframe tick's dem_packet
+	int		sequence;		// sequence number of that dem_packet
+};
+
+struct demoindexfooter_t
+{
+	int		numkeyframes;
+	int		indexpos;		// file position of the first demoindexentry_t
+	char	indexfilestamp[8];	// Should be HL2DIDX
+};
+
 #define FDEMO_NORMAL		0
 #define FDEMO_USE_ORIGIN2	(1<<0)
 #define FDEMO_USE_ANGLES2	(1<<1)
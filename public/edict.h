@@ -127,6 +127,10 @@ public:
 	
 	CEdictChangeInfo m_ChangeInfos[MAX_EDICT_CHANGE_INFOS];
 	unsigned short m_nChangeInfos;	// How many are in use this frame.
+
+	// Edicts that called StateChanged since the engine last packed them. The engine
+	// reuses the previously sent packet of every edict that isn't in here.
+	CBitVec<MAX_EDICTS> m_DirtyEdicts;
 };
 extern CSharedEdictChangeInfo *g_pSharedChangeInfo;
 
@@ -281,6 +285,7 @@ inline void	CBaseEdict::StateChanged()
 	// kind of pointer dereference. If the data is directly offsetable 
 	m_fStateFlags |= (FL_EDICT_CHANGED | FL_FULL_EDICT_CHANGED);
 	SetChangeInfoSerialNumber( 0 );
+	g_pSharedChangeInfo->m_DirtyEdicts.Set( m_EdictIndex );
 }
 
 inline void	CBaseEdict::StateChanged( unsigned short offset )
@@ -289,6 +294,7 @@ inline void	CBaseEdict::StateChanged( unsigned short offset )
 		return;
 
 	m_fStateFlags |= FL_EDICT_CHANGED;
+	g_pSharedChangeInfo->m_DirtyEdicts.Set( m_EdictIndex );
 
 	IChangeInfoAccessor *accessor = GetChangeAccessor();
 	
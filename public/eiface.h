@@ -642,7 +642,8 @@ typedef IServerGameDLL IServerGameDLL008;
 //-----------------------------------------------------------------------------
 #define VENGINE_SERVER_RANDOM_INTERFACE_VERSION	"VEngineRandom001"
 
-#define INTERFACEVERSION_SERVERGAMEENTS			"ServerGameEnts001"
+#define INTERFACEVERSION_SERVERGAMEENTS_VERSION_1	"ServerGameEnts001"
+#define INTERFACEVERSION_SERVERGAMEENTS			"ServerGameEnts002"
 //-----------------------------------------------------------------------------
 // Purpose: Interface to get at server entities
 //-----------------------------------------------------------------------------
@@ -670,8 +671,15 @@ public:
 	// This is also where an entity can force other entities to be transmitted if it refers to them
 	// with ehandles.
 	virtual void			CheckTransmit( CCheckTransmitInfo *pInfo, const unsigned short *pEdictIndices, int nEdicts ) = 0;
+
+	// Called before CheckTransmit is run for the clients of a snapshot with the same edict list. Brings
+	// the PVS information of those edicts up to date, after it CheckTransmit may be called for several
+	// clients at once from different threads.
+	virtual void			PrepareCheckTransmit( const unsigned short *pEdictIndices, int nEdicts ) = 0;
 };
 
+typedef IServerGameEnts IServerGameEnts001;
+
 #define INTERFACEVERSION_SERVERGAMECLIENTS_VERSION_3	"ServerGameClients003"
 #define INTERFACEVERSION_SERVERGAMECLIENTS				"ServerGameClients004"
 
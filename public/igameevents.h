@@ -19,7 +19,12 @@
 #include "tier1/interface.h"
 
 #define INTERFACEVERSION_GAMEEVENTSMANAGER	"GAMEEVENTSMANAGER001"	// old game event manager, don't use it!
-#define INTERFACEVERSION_GAMEEVENTSMANAGER2	"GAMEEVENTSMANAGER002"	// new game event manager,
+#define INTERFACEVERSION_GAMEEVENTSMANAGER2_VERSION_2	"GAMEEVENTSMANAGER002"	// events without the ...ByIndex methods
+#define INTERFACEVERSION_GAMEEVENTSMANAGER2	"GAMEEVENTSMANAGER003"	// new game event manager,
+
+// The game sets this to the number at the end of the interface name it got (so for "GAMEEVENTSMANAGER003",
+// this would be 3). Events of a version 2 engine don't have the ...ByIndex methods, CGameEventKey uses names then.
+extern int g_iGameEventManagerVersion;
 
 #include "tier1/bitbuf.h"
 //-----------------------------------------------------------------------------
@@ -82,6 +87,83 @@ public:
 	virtual void SetInt( const char *keyName, int value ) = 0;
 	virtual void SetFloat( const char *keyName, float value ) = 0;
 	virtual void SetString( const char *keyName, const char *value ) = 0;
+
+	// Fast data access by the index of a key in the event description, see CGameEventKey.
+	// Events with the same key layout id share key indices, -1 is not a declared key.
+	// Only there with INTERFACEVERSION_GAMEEVENTSMANAGER2, not _VERSION_2.
+	virtual int   GetKeyLayout() const = 0;
+	virtual int   FindKeyIndex( const char *keyName ) const = 0;
+
+	virtual bool  GetBoolByIndex( int keyIndex, bool defaultValue = false ) = 0;
+	virtual int   GetIntByIndex( int keyIndex, int defaultValue = 0 ) = 0;
+	virtual float GetFloatByIndex( int keyIndex, float defaultValue = 0.0f ) = 0;
+	virtual const char *GetStringByIndex( int keyIndex, const char *defaultValue = "" ) = 0;
+
+	virtual void SetBoolByIndex( int keyIndex, bool value ) = 0;
+	virtual void SetIntByIndex( int keyIndex, int value ) = 0;
+	virtual void SetFloatByIndex( int keyIndex, float value ) = 0;
+	virtual void SetStringByIndex( int keyIndex, const char *value ) = 0;
+};
+
+//-----------------------------------------------------------------------------
+// Caches the index of a key for the last key layout it was used with, so
+// frequently fired events don't look their keys up by name:
+//
+//	static CGameEventKey s_userid( "userid" );
+//	s_userid.SetInt( event, GetUserID() );
+//
+// Keys that aren't in the event description, and all keys on engines that only
+// expose INTERFACEVERSION_GAMEEVENTSMANAGER2_VERSION_2, are set by name.
+//-----------------------------------------------------------------------------
+class CGameEventKey
+{
+public:
+	CGameEventKey( const char *keyName ) : m_pszName( keyName ), m_nLayout( -1 ), m_nIndex( -1 ) {}
+
+	int GetIndex( const IGameEvent *event )
+	{
+		if ( g_iGameEventManagerVersion < 3 )
+			return -1;
+
+		int nLayout = event->GetKeyLayout();
+		if ( nLayout != m_nLayout )
+		{
+			m_nIndex = event->FindKeyIndex( m_pszName );
+			m_nLayout = nLayout;
+		}
+		return m_nIndex;
+	}
+
+	const char *GetName() const { return m_pszName; }
+
+	void SetBool( IGameEvent *event, bool value )
+	{
+		int nIndex = GetIndex( event );
+		if ( nIndex >= 0 ) event->SetBoolByIndex( nIndex, value ); else event->SetBool( m_pszName, value );
+	}
+
+	void SetInt( IGameEvent *event, int value )
+	{
+		int nIndex = GetIndex( event );
+		if ( nIndex >= 0 ) event->SetIntByIndex( nIndex, value ); else event->SetInt( m_pszName, value );
+	}
+
+	void SetFloat( IGameEvent *event, float value )
+	{
+		int nIndex = GetIndex( event );
+		if ( nIndex >= 0 ) event->SetFloatByIndex( nIndex, value ); else event->SetFloat( m_pszName, value );
+	}
+
+	void SetString( IGameEvent *event, const char *value )
+	{
+		int nIndex = GetIndex( event );
+		if ( nIndex >= 0 ) event->SetStringByIndex( nIndex, value ); else event->SetString( m_pszName, value );
+	}
+
+private:
+	const char	*m_pszName;
+	int			m_nLayout;
+	int			m_nIndex;
 };
 
 
@@ -136,6 +218,9 @@ public:
 	virtual IGameEvent *UnserializeEvent( bf_read *buf ) = 0; // create new KeyValues, must be deleted
 };
 
+// The manager is the same for INTERFACEVERSION_GAMEEVENTSMANAGER2_VERSION_2, only its events differ
+typedef IGameEventManager2 IGameEventManager002;
+
 // the old game event manager interface, don't use it. Rest is legacy support:
 
 abstract_class IGameEventListener
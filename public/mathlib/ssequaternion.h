@@ -363,5 +363,177 @@ FORCEINLINE fltx4 QuaternionSlerpSIMD( const fltx4 &p, const fltx4 &q, float t )
 
 #endif // ALLOW_SIMD_QUATERNION_MATH
 
+
+//---------------------------------------------------------------------
+// FourQuaternions stores 4 independent quaternions "structure of arrays"
+// style. Unlike the functions above it needs no horizontal operations, so
+// it's fine on PC too. Every lane gets the same math, in the same order, as
+// the scalar Quaternion function it's named after.
+//---------------------------------------------------------------------
+class ALIGN16 FourQuaternions
+{
+public:
+	fltx4 x;
+	fltx4 y;
+	fltx4 z;
+	fltx4 w;
+
+	/// load 4 quaternions, performing transpose op
+	FORCEINLINE void LoadAndSwizzle( const Quaternion &a, const Quaternion &b, const Quaternion &c, const Quaternion &d )
+	{
+		x = LoadUnalignedSIMD( a.Base() );
+		y = LoadUnalignedSIMD( b.Base() );
+		z = LoadUnalignedSIMD( c.Base() );
+		w = LoadUnalignedSIMD( d.Base() );
+		TransposeSIMD( x, y, z, w );
+	}
+
+	/// transpose and store 4 quaternions
+	FORCEINLINE void SwizzleAndStore( Quaternion &a, Quaternion &b, Quaternion &c, Quaternion &d ) const
+	{
+		fltx4 ta = x, tb = y, tc = z, td = w;
+		TransposeSIMD( ta, tb, tc, td );
+		StoreUnalignedSIMD( a.Base(), ta );
+		StoreUnalignedSIMD( b.Base(), tb );
+		StoreUnalignedSIMD( c.Base(), tc );
+		StoreUnalignedSIMD( d.Base(), td );
+	}
+
+	/// 4 dot products
+	FORCEINLINE fltx4 Dot( const FourQuaternions &q ) const
+	{
+		fltx4 dot = MulSIMD( x, q.x );
+		dot = AddSIMD( dot, MulSIMD( y, q.y ) );
+		dot = AddSIMD( dot, MulSIMD( z, q.z ) );
+		dot = AddSIMD( dot, MulSIMD( w, q.w ) );
+		return dot;
+	}
+
+	/// keep the lanes of q where mask is set, this one elsewhere
+	FORCEINLINE void MaskedAssign( const fltx4 &mask, const FourQuaternions &q )
+	{
+		x = ::MaskedAssign( mask, q.x, x );
+		y = ::MaskedAssign( mask, q.y, y );
+		z = ::MaskedAssign( mask, q.z, z );
+		w = ::MaskedAssign( mask, q.w, w );
+	}
+
+	/// QuaternionNormalize, lanes of length 0 are left alone
+	FORCEINLINE void Normalize( void )
+	{
+		fltx4 radius = Dot( *this );
+		fltx4 nonZero = CmpGtSIMD( radius, Four_Zeros );
+		fltx4 iradius = DivSIMD( Four_Ones, SqrtSIMD( radius ) );
+		x = ::MaskedAssign( nonZero, MulSIMD( x, iradius ), x );
+		y = ::MaskedAssign( nonZero, MulSIMD( y, iradius ), y );
+		z = ::MaskedAssign( nonZero, MulSIMD( z, iradius ), z );
+		w = ::MaskedAssign( nonZero, MulSIMD( w, iradius ), w );
+	}
+
+	/// AngleQuaternion( RadianEuler ) of 4 sets of angles
+	FORCEINLINE void FromRadianEulers( const fltx4 &anglesX, const fltx4 &anglesY, const fltx4 &anglesZ )
+	{
+		fltx4 sr, sp, sy, cr, cp, cy;
+		SinCosSIMD( sy, cy, MulSIMD( anglesZ, Four_PointFives ) );
+		SinCosSIMD( sp, cp, MulSIMD( anglesY, Four_PointFives ) );
+		SinCosSIMD( sr, cr, MulSIMD( anglesX, Four_PointFives ) );
+
+		fltx4 srXcp = MulSIMD( sr, cp ), crXsp = MulSIMD( cr, sp );
+		x = SubSIMD( MulSIMD( srXcp, cy ), MulSIMD( crXsp, sy ) );
+		y = AddSIMD( MulSIMD( crXsp, cy ), MulSIMD( srXcp, sy ) );
+
+		fltx4 crXcp = MulSIMD( cr, cp ), srXsp = MulSIMD( sr, sp );
+		z = SubSIMD( MulSIMD( crXcp, sy ), MulSIMD( srXsp, cy ) );
+		w = AddSIMD( MulSIMD( crXcp, cy ), MulSIMD( srXsp, sy ) );
+	}
+
+	/// QuaternionAlign, q flipped where it is further from p than -q is
+	static FORCEINLINE FourQuaternions Align( const FourQuaternions &p, const FourQuaternions &q )
+	{
+		fltx4 dx = SubSIMD( p.x, q.x ), dy = SubSIMD( p.y, q.y ), dz = SubSIMD( p.z, q.z ), dw = SubSIMD( p.w, q.w );
+		fltx4 sx = AddSIMD( p.x, q.x ), sy = AddSIMD( p.y, q.y ), sz = AddSIMD( p.z, q.z ), sw = AddSIMD( p.w, q.w );
+		fltx4 a = MulSIMD( dx, dx );
+		a = AddSIMD( a, MulSIMD( dy, dy ) );
+		a = AddSIMD( a, MulSIMD( dz, dz ) );
+		a = AddSIMD( a, MulSIMD( dw, dw ) );
+		fltx4 b = MulSIMD( sx, sx );
+		b = AddSIMD( b, MulSIMD( sy, sy ) );
+		b = AddSIMD( b, MulSIMD( sz, sz ) );
+		b = AddSIMD( b, MulSIMD( sw, sw ) );
+		fltx4 flip = CmpGtSIMD( a, b );
+
+		FourQuaternions result;
+		result.x = ::MaskedAssign( flip, NegSIMD( q.x ), q.x );
+		result.y = ::MaskedAssign( flip, NegSIMD( q.y ), q.y );
+		result.z = ::MaskedAssign( flip, NegSIMD( q.z ), q.z );
+		result.w = ::MaskedAssign( flip, NegSIMD( q.w ), q.w );
+		return result;
+	}
+
+	/// QuaternionBlendNoAlign, 0.0 returns p, 1.0 returns q
+	static FORCEINLINE FourQuaternions BlendNoAlign( const FourQuaternions &p, const FourQuaternions &q, const fltx4 &t )
+	{
+		fltx4 sclp = SubSIMD( Four_Ones, t );
+		FourQuaternions result;
+		result.x = AddSIMD( MulSIMD( sclp, p.x ), MulSIMD( t, q.x ) );
+		result.y = AddSIMD( MulSIMD( sclp, p.y ), MulSIMD( t, q.y ) );
+		result.z = AddSIMD( MulSIMD( sclp, p.z ), MulSIMD( t, q.z ) );
+		result.w = AddSIMD( MulSIMD( sclp, p.w ), MulSIMD( t, q.w ) );
+		result.Normalize();
+		return result;
+	}
+
+	/// QuaternionBlend
+	static FORCEINLINE FourQuaternions Blend( const FourQuaternions &p, const FourQuaternions &q, const fltx4 &t )
+	{
+		return BlendNoAlign( p, Align( p, q ), t );
+	}
+
+	/// QuaternionSlerpNoAlign, 0.0 returns p, 1.0 returns q
+	static FORCEINLINE FourQuaternions SlerpNoAlign( const FourQuaternions &p, const FourQuaternions &q, const fltx4 &t )
+	{
+		fltx4 epsilons = ReplicateX4( 0.000001f );
+
+		fltx4 cosom = p.Dot( q );
+		fltx4 oneMinusT = SubSIMD( Four_Ones, t );
+		fltx4 notOpposite = CmpGtSIMD( AddSIMD( Four_Ones, cosom ), epsilons );
+		fltx4 notSame = CmpGtSIMD( SubSIMD( Four_Ones, cosom ), epsilons );
+
+		// lanes that are neither take acos( 0 ) instead of going out of range
+		fltx4 omega = ArcCosSIMD( AndSIMD( AndSIMD( notOpposite, notSame ), cosom ) );
+		fltx4 sinom = SinSIMD( omega );
+		fltx4 sclp = ::MaskedAssign( notSame, DivSIMD( SinSIMD( MulSIMD( oneMinusT, omega ) ), sinom ), oneMinusT );
+		fltx4 sclq = ::MaskedAssign( notSame, DivSIMD( SinSIMD( MulSIMD( t, omega ) ), sinom ), t );
+
+		FourQuaternions result;
+		result.x = AddSIMD( MulSIMD( sclp, p.x ), MulSIMD( sclq, q.x ) );
+		result.y = AddSIMD( MulSIMD( sclp, p.y ), MulSIMD( sclq, q.y ) );
+		result.z = AddSIMD( MulSIMD( sclp, p.z ), MulSIMD( sclq, q.z ) );
+		result.w = AddSIMD( MulSIMD( sclp, p.w ), MulSIMD( sclq, q.w ) );
+
+		// opposite quaternions go through a perpendicular one
+		if ( TestSignSIMD( notOpposite ) != 0xf )
+		{
+			fltx4 halfPis = ReplicateX4( 0.5f * M_PI_F );
+			fltx4 sclpPerp = SinSIMD( MulSIMD( oneMinusT, halfPis ) );
+			fltx4 sclqPerp = SinSIMD( MulSIMD( t, halfPis ) );
+			FourQuaternions perp;
+			perp.x = AddSIMD( MulSIMD( sclpPerp, p.x ), MulSIMD( sclqPerp, NegSIMD( q.y ) ) );
+			perp.y = AddSIMD( MulSIMD( sclpPerp, p.y ), MulSIMD( sclqPerp, q.x ) );
+			perp.z = AddSIMD( MulSIMD( sclpPerp, p.z ), MulSIMD( sclqPerp, NegSIMD( q.w ) ) );
+			perp.w = q.z;
+			perp.MaskedAssign( notOpposite, result );
+			result = perp;
+		}
+		return result;
+	}
+
+	/// QuaternionSlerp
+	static FORCEINLINE FourQuaternions Slerp( const FourQuaternions &p, const FourQuaternions &q, const fltx4 &t )
+	{
+		return SlerpNoAlign( p, Align( p, q ), t );
+	}
+};
+
 #endif // SSEQUATMATH_H
 
@@ -450,8 +450,8 @@ public:
 	void Start();
 	void Stop();
 
-	void SetTargetThreadId( unsigned id ) { m_TargetThreadId = id; }
-	unsigned GetTargetThreadId() { return m_TargetThreadId; }
+	void SetTargetThreadId( ThreadId_t id ) { m_TargetThreadId = id; }
+	ThreadId_t GetTargetThreadId() { return m_TargetThreadId; }
 	bool InTargetThread() { return ( m_TargetThreadId == ThreadGetCurrentId() ); }
 
 #ifdef _X360
@@ -519,6 +519,23 @@ public:
 
 	void MarkFrame();
 	void ResetPeaks();
+
+	//
+	// Thread profiling: while it's on, scopes on every thread (the target thread
+	// included) go into a scope tree and a timeline of that thread. Threads only
+	// ever write their own, so recording takes no locks.
+	//
+	void EnableThreadProfiling( bool bEnable );
+	bool IsThreadProfiling() const	{ return m_bThreadProfiling; }
+	void ResetThreadProfile();
+	void OutputThreadReport();
+
+	// Write the last flSeconds of the thread timelines as Chrome trace event JSON,
+	// which chrome://tracing and Perfetto open
+	bool WriteThreadTrace( const char *pszFilename, float flSeconds );
+
+	void EnterThreadScope( const tchar *pszName, const tchar *pBudgetGroupName );
+	void ExitThreadScope();
 	
 	void Pause();
 	void Resume();
@@ -673,7 +690,9 @@ protected:
 	bool					m_bTraceCompleteEvent;
 #endif
 
-	unsigned m_TargetThreadId;
+	ThreadId_t m_TargetThreadId;
+
+	volatile bool			m_bThreadProfiling;
 
 	StreamOut_t				m_pOutputStream;
 };
@@ -1077,6 +1096,11 @@ inline void CVProfile::EnterScope( const tchar *pszName, int detailLevel, const
 		m_pCurNode->EnterScope();
 		m_fAtRoot = false;
 	}
+
+	if ( m_bThreadProfiling )
+	{
+		EnterThreadScope( pszName, pBudgetGroupName );
+	}
 #if defined(_X360) && defined(VPROF_PIX)
 	if ( m_pCurNode->GetBudgetGroupID() != VPROF_BUDGET_GROUP_ID_UNACCOUNTED )
 		PIXBeginNamedEvent( 0, pszName );
@@ -1113,6 +1137,11 @@ inline void CVProfile::ExitScope()
 		}
 		m_fAtRoot = ( m_pCurNode == &m_Root );
 	}
+
+	if ( m_bThreadProfiling )
+	{
+		ExitThreadScope();
+	}
 }
 
 //-------------------------------------
@@ -1282,7 +1311,7 @@ inline unsigned int CVProfile::GetMultiTraceIndex()
 //-----------------------------------------------------------------------------
 
 inline CVProfScope::CVProfScope( const tchar * pszName, int detailLevel, const tchar *pBudgetGroupName, bool bAssertAccounted, int budgetFlags )
-	: m_bEnabled( g_VProfCurrentProfile.IsEnabled() )
+	: m_bEnabled( g_VProfCurrentProfile.IsEnabled() || g_VProfCurrentProfile.IsThreadProfiling() )
 { 
 	if ( m_bEnabled )
 	{
@@ -31,6 +31,9 @@ const int k_nVPKDefaultChunkSize = 200 * 1024 * 1024;
 class CPackedStore;
 
 
+class IThreadPool;
+class CJob;
+
 struct ChunkHashFraction_t
 {
 	int m_nPackFileNumber;
@@ -124,6 +127,29 @@ typedef HANDLE PackDataFileHandle_t;
 typedef FileHandle_t PackDataFileHandle_t;
 #endif
 
+// Read-only view of a whole file, shared with every other process mapping it
+class CPackedStoreFileMapping
+{
+public:
+	CPackedStoreFileMapping( void );
+	~CPackedStoreFileMapping( void );
+
+	bool Map( char const *pszFileName );
+	void Unmap( void );
+
+	bool IsMapped( void ) const { return m_pBase != NULL; }
+	uint8 const *Base( void ) const { return m_pBase; }
+	int64 Size( void ) const { return m_nSize; }
+
+private:
+	uint8 const *m_pBase;
+	int64 m_nSize;
+#ifdef _WIN32
+	HANDLE m_hFile;
+	HANDLE m_hMapping;
+#endif
+};
+
 struct FileHandleTracker_t
 {
 	int m_nFileNumber;
@@ -297,9 +323,23 @@ public:
 
 	FORCEINLINE void *DirectoryData( void )
 	{
-		return m_DirectoryData.Base();
+		return m_pMappedDirectory ? ( void * )m_pMappedDirectory : m_DirectoryData.Base();
 	}
 
+	FORCEINLINE int DirectoryDataSize( void ) const
+	{
+		return m_pMappedDirectory ? m_nDirectoryDataSize : m_DirectoryData.Count();
+	}
+
+	// Read file data straight out of mapped chunk files instead of through the
+	// read cache. Chunk reads aren't MD5 checked by the file tracker then.
+	void SetMapDataFiles( bool bMapDataFiles );
+	bool IsDirectoryMapped( void ) const { return m_pMappedDirectory != NULL; }
+	bool HasDirectoryIndex( void ) const { return m_pDirIndex != NULL; }
+
+	// Pool that chunk files are hashed and the lookup index is built on, g_pThreadPool if NULL
+	void SetThreadPool( IThreadPool *pThreadPool ) { m_pThreadPool = pThreadPool; }
+
 	// Get a list of all the files in the zip You are responsible for freeing the contents of
 	// outFilenames (call outFilenames.PurgeAndDeleteElements).
 	int GetFileList( CUtlStringList &outFilenames, bool bFormattedOutput, bool bSortedOutput );
@@ -393,6 +433,22 @@ private:
 	IBaseFileSystem *m_pFileSystem;
 	IThreadedFileMD5Processor *m_pFileTracker;
 	CThreadFastMutex m_Mutex;
+	IThreadPool *m_pThreadPool;
+
+	// chunk file AddFile() is appending to, kept open between files
+	FileHandle_t m_hWriteHandle;
+	int m_nWriteHandleChunk;
+	uint32 m_nWriteHandleSize;
+
+	// chunk AddFile() moved on from, hashed on the pool while the next one is written
+	struct PendingChunkHash_t
+	{
+		int m_nChunkFileIndex;
+		int64 m_nFileSize;
+		CUtlVector<ChunkHashFraction_t> m_Fractions;
+		CJob *m_pJob;
+	};
+	CUtlVector<PendingChunkHash_t *> m_PendingChunkHashes;
 	
 	CPackedStoreReadCache m_PackedStoreReadCache;
 
@@ -401,6 +457,16 @@ private:
 	CUtlVector<uint8> m_DirectoryData;
 	CUtlBlockVector<uint8> m_EmbeddedChunkData;
 
+	// read-only opens map the dir file, the directory and its index point into it
+	CPackedStoreFileMapping m_DirFileMapping;
+	uint8 const *m_pMappedDirectory;
+	struct VPKDirIndexHeader_t const *m_pDirIndex;
+	uint32 const *m_pDirIndexDisplacements;
+	struct VPKDirIndexSlot_t const *m_pDirIndexSlots;
+
+	bool m_bMapDataFiles;
+	CUtlVector<CPackedStoreFileMapping *> m_DataFileMappings;	// by chunk file number
+
 	CUtlSortVector<ChunkHashFraction_t, ChunkHashFractionLess_t > m_vecChunkHashFraction;
 	bool BFileContainedHashes() { return m_vecChunkHashFraction.Count() > 0; }
 	// these are valid if BFileContainedHashes() is true
@@ -432,12 +498,26 @@ private:
 		char const *pDirname, char const *pBaseName, char const *pExtension,
 		uint8 **pExtBaseOut = NULL, uint8 **pNameBaseOut = NULL );
 
+	struct CFileHeaderFixedData *FindFileEntryInIndex( 
+		char const *pDirname, char const *pBaseName, char const *pExtension, uint8 **pNameBaseOut );
+
 	void BuildHashTables( void );
+	void LoadDirectoryIndex( uint32 nIndexOffset );
+	void UnmapDirectory( void );
+	uint8 const *GetMappedDataFile( int nFileNumber, int64 &nSizeOut );
 
 	FileHandleTracker_t &GetFileHandle( int nFileNumber );
 
 	void CloseWriteHandle( void );
 
+	void HashChunkFractions( const CUtlVector<int> &chunkFileIndices );
+	void HashChunkFraction( ChunkHashFraction_t &fraction );
+
+	void QueueChunkHash( int iChunkFileIndex, int64 nFileSize );
+	void HashPendingChunk( PendingChunkHash_t *pPending );
+	bool TakePendingChunkHash( int iChunkFileIndex );
+	void DiscardPendingChunkHashes( void );
+
 	// For cache-ing directory and contents data
 	CUtlStringList m_directoryList; // The index of this list of directories...
 	CUtlMap<int, CUtlStringList*> m_dirContents; // ...is the key to this map of filenames
@@ -102,6 +102,7 @@ struct ThreadPoolStartParams_t
 		: bIOThreads( bIOThreads ), nThreads( nThreads ), fDistribute( fDistribute ), nStackSize( nStackSize ), iThreadPriority( iThreadPriority ), nThreadsMax( -1 )
 	{
 		bExecOnThreadPoolThreadsOnly = false;
+		bWorkStealing = false;
 
 		bUseAffinityTable = ( pAffinities != NULL ) && ( fDistribute == TRS_TRUE ) && ( nThreads != -1 );
 		if ( bUseAffinityTable )
@@ -125,6 +126,7 @@ struct ThreadPoolStartParams_t
 	bool			bIOThreads : 1;
 	bool			bUseAffinityTable : 1;
 	bool			bExecOnThreadPoolThreadsOnly : 1;
+	bool			bWorkStealing : 1;		// per thread job deques instead of one shared queue
 };
 
 //-----------------------------------------------------------------------------
@@ -103,6 +103,10 @@ static volatile bool s_bThreadIDAllocated[MAX_THREAD_IDS];
 
 static CThreadFastMutex s_ThreadIDMutex;
 
+#ifdef VPROF_ENABLED
+extern void ReleaseVProfThread();
+#endif
+
 PLATFORM_INTERFACE void AllocateThreadID( void )
 {
 	AUTO_LOCK( s_ThreadIDMutex );
@@ -120,6 +124,11 @@ PLATFORM_INTERFACE void AllocateThreadID( void )
 
 PLATFORM_INTERFACE void FreeThreadID( void )
 {
+#ifdef VPROF_ENABLED
+	// hand the thread's profiling record back to the pool
+	ReleaseVProfThread();
+#endif
+
 	AUTO_LOCK( s_ThreadIDMutex );
 	int nThread = g_nThreadID;
 	if ( nThread )
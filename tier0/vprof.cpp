@@ -1284,7 +1284,7 @@ static void DumpPMC( CVProfNode *pNode, bool &bPrintHeader, uint64 L2thresh = 1,
 
 //-------------------------------------
 
-void CVProfile::SetOutputStream( StreamOut_t outputStream )
+void CVProfile::SetOutputStream( CVProfile::StreamOut_t outputStream )
 {
 	if ( outputStream != NULL )
 		m_pOutputStream = outputStream;
@@ -1413,6 +1413,7 @@ CVProfile::CVProfile()
  	m_enabled( 0 ),
  	m_pausedEnabledDepth( 0 ),
 	m_fAtRoot( true ),
+	m_bThreadProfiling( false ),
 	m_pOutputStream( Msg )
 {
 #ifdef VPROF_VTUNE_GROUP
@@ -1736,6 +1737,519 @@ void CVProfile::SpewWorstMultiFrame()
 }
 #endif
 
+//=============================================================================
+//
+// Thread profiling
+//
+// Every thread that enters a scope while thread profiling is on gets a
+// CVProfThread that only it writes to: a tree of the scopes it entered with
+// call counts and times, and a ring of the last scopes it finished for the
+// timeline. Readers copy a ring, then look at how far the thread wrote in the
+// meantime and drop whatever was overwritten under them.
+//
+// The records are pooled: a thread hands its record back when it exits and the
+// next new thread takes it over. At most VPROF_THREAD_MAX_THREADS records are
+// made, threads that come after that aren't profiled.
+//
+
+#define VPROF_THREAD_MAX_DEPTH		64
+#define VPROF_THREAD_TRACE_SCOPES	( 1 << 16 )		// per thread, power of two
+#define VPROF_THREAD_NODE_BLOCK		256
+#define VPROF_THREAD_MAX_THREADS	32
+
+struct VProfThreadNode_t
+{
+	const tchar					*m_pszName;
+	const tchar					*m_pBudgetGroupName;
+	VProfThreadNode_t			*m_pParent;
+	VProfThreadNode_t * volatile m_pChild;
+	VProfThreadNode_t			*m_pSibling;
+	int							m_nCalls;
+	int64						m_nCycles;
+};
+
+struct VProfThreadScope_t
+{
+	VProfThreadNode_t			*m_pNode;
+	int64						m_nStart;
+	int64						m_nEnd;
+};
+
+class CVProfThread
+{
+public:
+	CVProfThread( ThreadId_t threadId );
+
+	// Takes over a record another thread released
+	bool Claim( ThreadId_t threadId );
+	void Release();
+
+	void EnterScope( const tchar *pszName, const tchar *pBudgetGroupName );
+	void ExitScope();
+
+	// Appends the scopes that ended at or after nSince, oldest first
+	void CopyScopes( int64 nSince, vector<VProfThreadScope_t> &scopes ) const;
+
+	ThreadId_t					m_ThreadId;
+	CVProfThread				*m_pNext;
+	VProfThreadNode_t			m_Root;
+	volatile int32				m_nInUse;
+
+private:
+	void Sync();
+	VProfThreadNode_t *GetSubNode( const tchar *pszName, const tchar *pBudgetGroupName );
+	void ResetNodes_R( VProfThreadNode_t *pNode );
+
+	VProfThreadNode_t			*m_pCurNode;
+	int							m_nDepth;
+	int							m_nSkippedDepth;	// scopes entered past VPROF_THREAD_MAX_DEPTH
+	int64						m_nEnterCycles[VPROF_THREAD_MAX_DEPTH];
+	int							m_nGeneration;
+	int							m_nResetCount;
+
+	VProfThreadNode_t			*m_pFreeNodes;
+	int							m_nFreeNodes;
+
+	VProfThreadScope_t			*m_pScopes;
+	volatile uint32				m_nScopesWritten;
+	volatile uint32				m_nFirstScope;		// the first one the current thread wrote
+};
+
+static CTHREADLOCALPTR( CVProfThread ) g_pVProfThread;
+static CTHREADLOCALINT g_bVProfThreadDenied;
+static CVProfThread * volatile g_pVProfThreads;
+static volatile int32 g_nVProfThreads;
+
+// Bumped when thread profiling is turned on, threads drop the scopes they had open before
+static volatile int32 g_nVProfThreadGeneration;
+// Bumped to have threads zero their trees the next time they enter or leave a scope
+static volatile int32 g_nVProfThreadResetCount;
+
+CVProfThread::CVProfThread( ThreadId_t threadId )
+{
+	m_ThreadId = threadId;
+	m_pNext = NULL;
+	m_nInUse = 1;
+
+	memset( &m_Root, 0, sizeof( m_Root ) );
+	m_Root.m_pszName = _T("Root");
+	m_Root.m_pBudgetGroupName = VPROF_BUDGETGROUP_OTHER_UNACCOUNTED;
+
+	m_pCurNode = &m_Root;
+	m_nDepth = 0;
+	m_nSkippedDepth = 0;
+	m_nGeneration = g_nVProfThreadGeneration;
+	m_nResetCount = g_nVProfThreadResetCount;
+
+	m_pFreeNodes = NULL;
+	m_nFreeNodes = 0;
+
+	MEM_ALLOC_CREDIT();
+	m_pScopes = new VProfThreadScope_t[VPROF_THREAD_TRACE_SCOPES];
+	memset( m_pScopes, 0, VPROF_THREAD_TRACE_SCOPES * sizeof( VProfThreadScope_t ) );
+	m_nScopesWritten = 0;
+	m_nFirstScope = 0;
+}
+
+bool CVProfThread::Claim( ThreadId_t threadId )
+{
+	if ( !ThreadInterlockedAssignIf( &m_nInUse, 1, 0 ) )
+		return false;
+
+	// The tree and the ring are kept, the scopes the last thread wrote are left out
+	m_ThreadId = threadId;
+	ResetNodes_R( &m_Root );
+	m_pCurNode = &m_Root;
+	m_nDepth = 0;
+	m_nSkippedDepth = 0;
+	m_nGeneration = g_nVProfThreadGeneration;
+	m_nResetCount = g_nVProfThreadResetCount;
+	m_nFirstScope = m_nScopesWritten;
+	return true;
+}
+
+void CVProfThread::Release()
+{
+	ThreadMemoryBarrier();
+	m_nInUse = 0;
+}
+
+void CVProfThread::ResetNodes_R( VProfThreadNode_t *pNode )
+{
+	pNode->m_nCalls = 0;
+	pNode->m_nCycles = 0;
+	for ( VProfThreadNode_t *pChild = pNode->m_pChild; pChild; pChild = pChild->m_pSibling )
+	{
+		ResetNodes_R( pChild );
+	}
+}
+
+void CVProfThread::Sync()
+{
+	if ( m_nResetCount != g_nVProfThreadResetCount )
+	{
+		m_nResetCount = g_nVProfThreadResetCount;
+		ResetNodes_R( &m_Root );
+	}
+
+	if ( m_nGeneration != g_nVProfThreadGeneration )
+	{
+		m_nGeneration = g_nVProfThreadGeneration;
+		m_pCurNode = &m_Root;
+		m_nDepth = 0;
+		m_nSkippedDepth = 0;
+	}
+}
+
+VProfThreadNode_t *CVProfThread::GetSubNode( const tchar *pszName, const tchar *pBudgetGroupName )
+{
+	for ( VProfThreadNode_t *pChild = m_pCurNode->m_pChild; pChild; pChild = pChild->m_pSibling )
+	{
+		if ( pChild->m_pszName == pszName )
+		{
+			return pChild;
+		}
+	}
+
+	// Nodes are never freed, so readers can walk the tree while it grows
+	if ( !m_nFreeNodes )
+	{
+		MEM_ALLOC_CREDIT();
+		m_pFreeNodes = new VProfThreadNode_t[VPROF_THREAD_NODE_BLOCK];
+		m_nFreeNodes = VPROF_THREAD_NODE_BLOCK;
+	}
+
+	VProfThreadNode_t *pNode = m_pFreeNodes++;
+	m_nFreeNodes--;
+
+	pNode->m_pszName = pszName;
+	pNode->m_pBudgetGroupName = pBudgetGroupName;
+	pNode->m_pParent = m_pCurNode;
+	pNode->m_pChild = NULL;
+	pNode->m_pSibling = m_pCurNode->m_pChild;
+	pNode->m_nCalls = 0;
+	pNode->m_nCycles = 0;
+
+	ThreadMemoryBarrier();
+	m_pCurNode->m_pChild = pNode;
+	return pNode;
+}
+
+void CVProfThread::EnterScope( const tchar *pszName, const tchar *pBudgetGroupName )
+{
+	Sync();
+
+	if ( m_nDepth == VPROF_THREAD_MAX_DEPTH )
+	{
+		m_nSkippedDepth++;
+		return;
+	}
+
+	m_pCurNode = GetSubNode( pszName, pBudgetGroupName );
+	m_nEnterCycles[m_nDepth++] = CCycleCount::GetTimestamp();
+}
+
+void CVProfThread::ExitScope()
+{
+	Sync();
+
+	if ( m_nSkippedDepth )
+	{
+		m_nSkippedDepth--;
+		return;
+	}
+
+	// Entered before thread profiling was turned on
+	if ( !m_nDepth )
+		return;
+
+	int64 nEnd = CCycleCount::GetTimestamp();
+	int64 nStart = m_nEnterCycles[--m_nDepth];
+
+	VProfThreadNode_t *pNode = m_pCurNode;
+	pNode->m_nCalls++;
+	pNode->m_nCycles += nEnd - nStart;
+	m_pCurNode = pNode->m_pParent;
+
+	VProfThreadScope_t &scope = m_pScopes[m_nScopesWritten & ( VPROF_THREAD_TRACE_SCOPES - 1 )];
+	scope.m_pNode = pNode;
+	scope.m_nStart = nStart;
+	scope.m_nEnd = nEnd;
+
+	ThreadMemoryBarrier();
+	m_nScopesWritten = m_nScopesWritten + 1;
+}
+
+void CVProfThread::CopyScopes( int64 nSince, vector<VProfThreadScope_t> &scopes ) const
+{
+	uint32 nWritten = m_nScopesWritten;
+	ThreadMemoryBarrier();
+
+	// oldest first
+	vector<VProfThreadScope_t> ring( VPROF_THREAD_TRACE_SCOPES );
+	for ( uint32 i = 0; i < VPROF_THREAD_TRACE_SCOPES; i++ )
+	{
+		ring[i] = m_pScopes[( nWritten + i ) & ( VPROF_THREAD_TRACE_SCOPES - 1 )];
+	}
+
+	// Whatever the thread wrote while we were copying overwrote the oldest ones,
+	// and the ones before m_nFirstScope were written by the thread that had the
+	// record before
+	ThreadMemoryBarrier();
+	uint32 nTorn = min( m_nScopesWritten - nWritten, (uint32)VPROF_THREAD_TRACE_SCOPES );
+	uint32 nOwned = min( nWritten - m_nFirstScope, (uint32)VPROF_THREAD_TRACE_SCOPES );
+
+	for ( uint32 i = max( nTorn, VPROF_THREAD_TRACE_SCOPES - nOwned ); i < VPROF_THREAD_TRACE_SCOPES; i++ )
+	{
+		if ( ring[i].m_pNode && ring[i].m_nEnd >= nSince )
+		{
+			scopes.push_back( ring[i] );
+		}
+	}
+}
+
+static CVProfThread *GetVProfThread()
+{
+	CVProfThread *pThread = g_pVProfThread;
+	if ( pThread || g_bVProfThreadDenied )
+		return pThread;
+
+	ThreadId_t threadId = ThreadGetCurrentId();
+	for ( pThread = g_pVProfThreads; pThread; pThread = pThread->m_pNext )
+	{
+		if ( pThread->Claim( threadId ) )
+			break;
+	}
+
+	if ( !pThread )
+	{
+		if ( ThreadInterlockedIncrement( &g_nVProfThreads ) > VPROF_THREAD_MAX_THREADS )
+		{
+			ThreadInterlockedDecrement( &g_nVProfThreads );
+			g_bVProfThreadDenied = true;
+			return NULL;
+		}
+
+		pThread = new CVProfThread( threadId );
+		do
+		{
+			pThread->m_pNext = g_pVProfThreads;
+		} while ( ThreadInterlockedCompareExchangePointer( (void * volatile *)&g_pVProfThreads, pThread, pThread->m_pNext ) != pThread->m_pNext );
+	}
+
+	g_pVProfThread = pThread;
+	return pThread;
+}
+
+// Called by tier0 threads on their way out
+void ReleaseVProfThread()
+{
+	CVProfThread *pThread = g_pVProfThread;
+	if ( pThread )
+	{
+		g_pVProfThread = NULL;
+		pThread->Release();
+	}
+}
+
+void CVProfile::EnterThreadScope( const tchar *pszName, const tchar *pBudgetGroupName )
+{
+	CVProfThread *pThread = GetVProfThread();
+	if ( pThread )
+	{
+		pThread->EnterScope( pszName, pBudgetGroupName );
+	}
+}
+
+void CVProfile::ExitThreadScope()
+{
+	CVProfThread *pThread = g_pVProfThread;
+	if ( pThread )
+	{
+		pThread->ExitScope();
+	}
+}
+
+void CVProfile::EnableThreadProfiling( bool bEnable )
+{
+	if ( bEnable && !m_bThreadProfiling )
+	{
+		ThreadInterlockedIncrement( &g_nVProfThreadGeneration );
+	}
+	m_bThreadProfiling = bEnable;
+}
+
+void CVProfile::ResetThreadProfile()
+{
+	ThreadInterlockedIncrement( &g_nVProfThreadResetCount );
+}
+
+//-------------------------------------
+
+// Adds up time less children per budget group. Call on the target thread, it
+// may add budget groups.
+static void SumThreadBudgetGroups_R( CVProfile *pProfile, const VProfThreadNode_t *pNode, vector<double> &times, vector<int> &calls )
+{
+	int64 nChildCycles = 0;
+	for ( const VProfThreadNode_t *pChild = pNode->m_pChild; pChild; pChild = pChild->m_pSibling )
+	{
+		nChildCycles += pChild->m_nCycles;
+		SumThreadBudgetGroups_R( pProfile, pChild, times, calls );
+	}
+
+	if ( pNode->m_pParent && pNode->m_nCalls )
+	{
+		int budgetGroupID = pProfile->BudgetGroupNameToBudgetGroupID( pNode->m_pBudgetGroupName );
+		if ( budgetGroupID >= (int)times.size() )
+		{
+			times.resize( budgetGroupID + 1, 0.0 );
+			calls.resize( budgetGroupID + 1, 0 );
+		}
+
+		CCycleCount cycles( max( pNode->m_nCycles - nChildCycles, (int64)0 ) );
+		times[budgetGroupID] += cycles.GetMillisecondsF();
+		calls[budgetGroupID] += pNode->m_nCalls;
+	}
+}
+
+static void OutputThreadNode_R( CVProfile::StreamOut_t outputStream, const VProfThreadNode_t *pNode, int depth )
+{
+	for ( const VProfThreadNode_t *pChild = pNode->m_pChild; pChild; pChild = pChild->m_pSibling )
+	{
+		if ( !pChild->m_nCalls )
+			continue;
+
+		CCycleCount cycles( pChild->m_nCycles );
+		outputStream( _T("  %10.3f %8d  %*s%s\n"), cycles.GetMillisecondsF(), pChild->m_nCalls, depth * 2, _T(""), pChild->m_pszName );
+		OutputThreadNode_R( outputStream, pChild, depth + 1 );
+	}
+}
+
+static void OutputThreadBudgetGroups( CVProfile *pProfile, CVProfile::StreamOut_t outputStream, const vector<double> &times, const vector<int> &calls )
+{
+	outputStream( _T("          ms    calls  budget group\n") );
+	for ( int i = 0; i < (int)times.size(); i++ )
+	{
+		if ( calls[i] )
+		{
+			outputStream( _T("  %10.3f %8d  %s\n"), times[i], calls[i], pProfile->GetBudgetGroupName( i ) );
+		}
+	}
+}
+
+void CVProfile::OutputThreadReport()
+{
+	m_pOutputStream( _T("******** BEGIN VPROF THREAD REPORT ********\n") );
+
+	if ( !g_pVProfThreads )
+	{
+		m_pOutputStream( _T("No samples, turn on thread profiling first\n") );
+	}
+
+	vector<double> allTimes;
+	vector<int> allCalls;
+	for ( CVProfThread *pThread = g_pVProfThreads; pThread; pThread = pThread->m_pNext )
+	{
+		vector<double> times;
+		vector<int> calls;
+		SumThreadBudgetGroups_R( this, &pThread->m_Root, times, calls );
+		if ( times.empty() )
+			continue;
+
+		m_pOutputStream( _T("-- Thread %u%s --\n"), (unsigned)pThread->m_ThreadId, ( pThread->m_ThreadId == m_TargetThreadId ) ? _T(" (main)") : _T("") );
+		OutputThreadBudgetGroups( this, m_pOutputStream, times, calls );
+		m_pOutputStream( _T("\n          ms    calls  scope\n") );
+		OutputThreadNode_R( m_pOutputStream, &pThread->m_Root, 0 );
+		m_pOutputStream( _T("\n") );
+
+		if ( times.size() > allTimes.size() )
+		{
+			allTimes.resize( times.size(), 0.0 );
+			allCalls.resize( times.size(), 0 );
+		}
+		for ( int i = 0; i < (int)times.size(); i++ )
+		{
+			allTimes[i] += times[i];
+			allCalls[i] += calls[i];
+		}
+	}
+
+	if ( !allTimes.empty() )
+	{
+		m_pOutputStream( _T("-- All threads --\n") );
+		OutputThreadBudgetGroups( this, m_pOutputStream, allTimes, allCalls );
+	}
+
+	m_pOutputStream( _T("******** END VPROF THREAD REPORT ********\n") );
+}
+
+//-------------------------------------
+
+static void WriteJSONString( FILE *fp, const tchar *pszString )
+{
+	fputc( '"', fp );
+	for ( const tchar *p = pszString; *p; p++ )
+	{
+		if ( *p == '"' || *p == '\\' )
+		{
+			fputc( '\\', fp );
+			fputc( *p, fp );
+		}
+		else if ( (unsigned)*p < ' ' )
+		{
+			fprintf( fp, "\\u%04x", (unsigned)*p );
+		}
+		else
+		{
+			fputc( *p, fp );
+		}
+	}
+	fputc( '"', fp );
+}
+
+bool CVProfile::WriteThreadTrace( const char *pszFilename, float flSeconds )
+{
+	FILE *fp = fopen( pszFilename, "wt" );
+	if ( !fp )
+		return false;
+
+	int64 nSince = CCycleCount::GetTimestamp() - (int64)( flSeconds * g_ClockSpeed );
+
+	fprintf( fp, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n" );
+	fprintf( fp, "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":1,\"args\":{\"name\":\"vprof\"}}" );
+
+	vector<VProfThreadScope_t> scopes;
+	for ( CVProfThread *pThread = g_pVProfThreads; pThread; pThread = pThread->m_pNext )
+	{
+		unsigned threadId = (unsigned)pThread->m_ThreadId;
+		bool bMain = ( pThread->m_ThreadId == m_TargetThreadId );
+		fprintf( fp, ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%u,\"args\":{\"name\":\"%s %u\"}}", threadId, bMain ? "Main" : "Thread", threadId );
+		fprintf( fp, ",\n{\"name\":\"thread_sort_index\",\"ph\":\"M\",\"pid\":1,\"tid\":%u,\"args\":{\"sort_index\":%d}}", threadId, bMain ? 0 : 1 );
+
+		scopes.clear();
+		pThread->CopyScopes( nSince, scopes );
+		for ( int i = 0; i < (int)scopes.size(); i++ )
+		{
+			// Scopes that began before the window are cut off at its start
+			const VProfThreadScope_t &scope = scopes[i];
+			int64 nStart = max( scope.m_nStart, nSince );
+			CCycleCount start( nStart - nSince );
+			CCycleCount duration( scope.m_nEnd - nStart );
+
+			fprintf( fp, ",\n{\"name\":" );
+			WriteJSONString( fp, scope.m_pNode->m_pszName );
+			fprintf( fp, ",\"cat\":" );
+			WriteJSONString( fp, scope.m_pNode->m_pBudgetGroupName );
+			fprintf( fp, ",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,\"pid\":1,\"tid\":%u}", start.GetMicrosecondsF(), duration.GetMicrosecondsF(), threadId );
+		}
+	}
+
+	fprintf( fp, "\n]}\n" );
+	bool bOK = !ferror( fp );
+	fclose( fp );
+	return bOK;
+}
+
 #ifdef DBGFLAG_VALIDATE
 
 #ifdef _WIN64
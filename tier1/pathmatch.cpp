@@ -51,10 +51,15 @@
 #include <sys/stat.h>
 #include <sys/time.h>
 #include <sys/mount.h>
+#include <sys/inotify.h>
+#include <sys/vfs.h>
 #include <fcntl.h>
 #include <utime.h>
+#include <pthread.h>
 #include <map>
 #include <string>
+#include <unordered_map>
+#include <vector>
 #include <time.h>
 
 
@@ -492,6 +497,380 @@ static bool Descend( char *pPath, size_t nStartIdx, bool bAllowBasenameMismatch,
 	return false;
 }
 
+// Directory index for absolute paths. Instead of reading every directory along
+// a path each time a lookup misses, each directory is read once and kept in a
+// hash table keyed by the case-folded name, and an inotify watch on it keeps it
+// current. Lookups then don't touch the file system past draining the inotify
+// queue. Directories that can't be watched (out of inotify watches, gone, not
+// a directory) fall back to Descend(), and so do directories on network and
+// FUSE file systems, where inotify doesn't see changes made by anyone else.
+struct DirIndex_t
+{
+	int m_nWatch;
+	std::vector<std::string> m_Paths;	// paths it was looked up by, symlinks can add more than one
+	std::unordered_map<std::string, std::vector<std::string> > m_Names;	// folded name -> names in the directory
+};
+
+typedef std::unordered_map<std::string, DirIndex_t *> dirIndexByPath_t;
+typedef std::unordered_map<int, DirIndex_t *> dirIndexByWatch_t;
+
+static pthread_mutex_t s_DirIndexMutex = PTHREAD_MUTEX_INITIALIZER;
+static int s_hDirWatch = -1;
+static dirIndexByPath_t s_DirIndexByPath;
+static dirIndexByWatch_t s_DirIndexByWatch;
+
+static const uint32_t k_DirWatchMask = IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO | IN_DELETE_SELF | IN_MOVE_SELF | IN_ONLYDIR;
+
+// statfs f_type of the file systems inotify can't be trusted on
+static const unsigned long k_NFSMagic = 0x6969;
+static const unsigned long k_SMBMagic = 0x517B;
+static const unsigned long k_CIFSMagic = 0xFF534D42;
+static const unsigned long k_SMB2Magic = 0xFE534D42;
+static const unsigned long k_FUSEMagic = 0x65735546;
+
+static bool IsDirWatchable( const char *pszDir )
+{
+	struct statfs buf;
+	if ( statfs( pszDir, &buf ) != 0 )
+		return false;
+
+	switch ( (unsigned long)buf.f_type & 0xFFFFFFFF )
+	{
+	case k_NFSMagic:
+	case k_SMBMagic:
+	case k_CIFSMagic:
+	case k_SMB2Magic:
+	case k_FUSEMagic:
+		DEBUG_MSG( "pathmatch: not indexing '%s', it's on a network or FUSE file system\n", pszDir );
+		return false;
+	}
+	return true;
+}
+
+// Same folding the strcasecmp in Descend() does
+static std::string FoldName( const char *pszName, size_t cbName )
+{
+	std::string folded;
+#ifdef UTF8_PATHMATCH
+	std::string name( pszName, cbName );
+	uint32_t *pFolded = fold_utf8( name.c_str() );
+	for ( uint32_t *p = pFolded; *p; p++ )
+	{
+		folded.append( (const char *)p, sizeof( *p ) );
+	}
+	delete[] pFolded;
+#else
+	folded.resize( cbName );
+	for ( size_t i = 0; i < cbName; i++ )
+	{
+		folded[i] = tolower( (unsigned char)pszName[i] );
+	}
+#endif
+	return folded;
+}
+
+static void AddDirIndexName( DirIndex_t *pIndex, const char *pszName )
+{
+	std::vector<std::string> &names = pIndex->m_Names[ FoldName( pszName, strlen( pszName ) ) ];
+	for ( size_t i = 0; i < names.size(); i++ )
+	{
+		if ( names[i] == pszName )
+			return;
+	}
+	names.push_back( pszName );
+}
+
+static void RemoveDirIndexName( DirIndex_t *pIndex, const char *pszName )
+{
+	std::unordered_map<std::string, std::vector<std::string> >::iterator it = pIndex->m_Names.find( FoldName( pszName, strlen( pszName ) ) );
+	if ( it == pIndex->m_Names.end() )
+		return;
+
+	std::vector<std::string> &names = it->second;
+	for ( size_t i = 0; i < names.size(); i++ )
+	{
+		if ( names[i] == pszName )
+		{
+			names.erase( names.begin() + i );
+			break;
+		}
+	}
+
+	if ( names.empty() )
+	{
+		pIndex->m_Names.erase( it );
+	}
+}
+
+static void FreeDirIndex( DirIndex_t *pIndex, bool bRemoveWatch )
+{
+	s_DirIndexByWatch.erase( pIndex->m_nWatch );
+	if ( bRemoveWatch )
+	{
+		inotify_rm_watch( s_hDirWatch, pIndex->m_nWatch );
+	}
+	delete pIndex;
+}
+
+static bool IsPathUnder( const std::string &path, const std::string &dir )
+{
+	if ( path.compare( 0, dir.size(), dir ) != 0 )
+		return false;
+	return path.size() == dir.size() || dir[dir.size() - 1] == '/' || path[dir.size()] == '/';
+}
+
+// Forget dir and everything looked up below it, it was removed or renamed
+static void DropDirIndexPaths( const std::string &dir )
+{
+	dirIndexByPath_t::iterator it = s_DirIndexByPath.begin();
+	while ( it != s_DirIndexByPath.end() )
+	{
+		if ( !IsPathUnder( it->first, dir ) )
+		{
+			++it;
+			continue;
+		}
+
+		DirIndex_t *pIndex = it->second;
+		std::vector<std::string> &paths = pIndex->m_Paths;
+		for ( size_t i = 0; i < paths.size(); i++ )
+		{
+			if ( paths[i] == it->first )
+			{
+				paths.erase( paths.begin() + i );
+				break;
+			}
+		}
+
+		if ( paths.empty() )
+		{
+			FreeDirIndex( pIndex, true );
+		}
+
+		it = s_DirIndexByPath.erase( it );
+	}
+}
+
+static void DropDirIndex( DirIndex_t *pIndex, bool bRemoveWatch )
+{
+	// keep the watch on the index until its last path is gone
+	std::vector<std::string> paths = pIndex->m_Paths;
+	pIndex->m_Paths.push_back( std::string() );
+	for ( size_t i = 0; i < paths.size(); i++ )
+	{
+		DropDirIndexPaths( paths[i] );
+	}
+	FreeDirIndex( pIndex, bRemoveWatch );
+}
+
+static void ResetDirIndex()
+{
+	for ( dirIndexByWatch_t::iterator it = s_DirIndexByWatch.begin(); it != s_DirIndexByWatch.end(); ++it )
+	{
+		delete it->second;
+	}
+	s_DirIndexByWatch.clear();
+	s_DirIndexByPath.clear();
+
+	// closing drops the watches along with anything still queued
+	if ( s_hDirWatch >= 0 )
+	{
+		close( s_hDirWatch );
+		s_hDirWatch = -1;
+	}
+}
+
+static void ProcessDirIndexEvents()
+{
+	if ( s_hDirWatch < 0 )
+		return;
+
+	char buf[ 4096 ] __attribute__ ((aligned(__alignof__(struct inotify_event))));
+	ssize_t cbRead;
+	while ( ( cbRead = read( s_hDirWatch, buf, sizeof( buf ) ) ) > 0 )
+	{
+		for ( char *p = buf; p < buf + cbRead; )
+		{
+			const struct inotify_event *pEvent = (const struct inotify_event *)p;
+			p += sizeof( struct inotify_event ) + pEvent->len;
+
+			if ( pEvent->mask & IN_Q_OVERFLOW )
+			{
+				DEBUG_MSG( "pathmatch: inotify queue overflowed, dropping the directory index\n" );
+				ResetDirIndex();
+				return;
+			}
+
+			dirIndexByWatch_t::iterator it = s_DirIndexByWatch.find( pEvent->wd );
+			if ( it == s_DirIndexByWatch.end() )
+				continue;
+
+			DirIndex_t *pIndex = it->second;
+			if ( pEvent->mask & ( IN_DELETE_SELF | IN_MOVE_SELF | IN_IGNORED | IN_UNMOUNT ) )
+			{
+				DropDirIndex( pIndex, !( pEvent->mask & IN_IGNORED ) );
+				continue;
+			}
+
+			if ( !pEvent->len )
+				continue;
+
+			if ( pEvent->mask & ( IN_CREATE | IN_MOVED_TO ) )
+			{
+				AddDirIndexName( pIndex, pEvent->name );
+			}
+
+			if ( pEvent->mask & ( IN_DELETE | IN_MOVED_FROM ) )
+			{
+				RemoveDirIndexName( pIndex, pEvent->name );
+
+				// directories looked up below it aren't there anymore
+				std::vector<std::string> paths = pIndex->m_Paths;
+				for ( size_t i = 0; i < paths.size(); i++ )
+				{
+					DropDirIndexPaths( paths[i] == "/" ? paths[i] + pEvent->name : paths[i] + "/" + pEvent->name );
+				}
+			}
+		}
+	}
+}
+
+static DirIndex_t *GetDirIndex( const char *pszDir )
+{
+	std::string dir( pszDir );
+	dirIndexByPath_t::iterator it = s_DirIndexByPath.find( dir );
+	if ( it != s_DirIndexByPath.end() )
+		return it->second;
+
+	if ( !IsDirWatchable( pszDir ) )
+		return NULL;
+
+	if ( s_hDirWatch < 0 )
+	{
+		s_hDirWatch = inotify_init1( IN_NONBLOCK | IN_CLOEXEC );
+		if ( s_hDirWatch < 0 )
+			return NULL;
+	}
+
+	// watch before reading so nothing that changes in between is missed
+	int nWatch = inotify_add_watch( s_hDirWatch, pszDir, k_DirWatchMask );
+	if ( nWatch < 0 )
+	{
+		DEBUG_MSG( "pathmatch: can't watch '%s' (%s)\n", pszDir, strerror( errno ) );
+		return NULL;
+	}
+
+	// another path to a directory that's indexed already
+	dirIndexByWatch_t::iterator itWatch = s_DirIndexByWatch.find( nWatch );
+	if ( itWatch != s_DirIndexByWatch.end() )
+	{
+		DirIndex_t *pIndex = itWatch->second;
+		pIndex->m_Paths.push_back( dir );
+		s_DirIndexByPath[ dir ] = pIndex;
+		return pIndex;
+	}
+
+	CDirPtr spDir( __real_opendir( pszDir ) );
+	if ( !spDir )
+	{
+		inotify_rm_watch( s_hDirWatch, nWatch );
+		return NULL;
+	}
+
+	DirIndex_t *pIndex = new DirIndex_t;
+	pIndex->m_nWatch = nWatch;
+	pIndex->m_Paths.push_back( dir );
+	for ( struct dirent *pEntry = readdir( spDir ); pEntry; pEntry = readdir( spDir ) )
+	{
+		AddDirIndexName( pIndex, pEntry->d_name );
+	}
+
+	s_DirIndexByWatch[ nWatch ] = pIndex;
+	s_DirIndexByPath[ dir ] = pIndex;
+	return pIndex;
+}
+
+// Descend() through the index, pPath must be absolute
+static bool DescendIndexed_R( char *pPath, size_t nStartIdx, bool bAllowBasenameMismatch, size_t nLevel )
+{
+	DEBUG_MSG( "(%zu) DescendIndexed: %s, (%s), %s\n", nLevel, pPath, pPath+nStartIdx, bAllowBasenameMismatch ? "true" : "false " );
+	size_t nNextSlash = nStartIdx+1;
+
+	// path might be a dir
+	if ( pPath[nNextSlash] == '\0' )
+	{
+		return true;
+	}
+
+	while ( pPath[nNextSlash] != '\0' && pPath[nNextSlash] != '/' )
+	{
+		nNextSlash++;
+	}
+	bool bIsDir = ( pPath[nNextSlash] == '/' );
+
+	DirIndex_t *pIndex = GetDirIndex( nStartIdx ? (const char *)CDirTrimmer( pPath, nStartIdx ) : "/" );
+	if ( !pIndex )
+		return Descend( pPath, nStartIdx, bAllowBasenameMismatch, nLevel );
+
+	char *pszComponent = pPath + nStartIdx + 1;
+	size_t cbComponent = nNextSlash - nStartIdx - 1;
+
+	// empty components and "." stay in this directory
+	if ( cbComponent == 0 || ( cbComponent == 1 && *pszComponent == '.' ) )
+	{
+		return !bIsDir || DescendIndexed_R( pPath, nNextSlash, bAllowBasenameMismatch, nLevel+1 );
+	}
+
+	std::unordered_map<std::string, std::vector<std::string> >::iterator it = pIndex->m_Names.find( FoldName( pszComponent, cbComponent ) );
+	if ( it != pIndex->m_Names.end() )
+	{
+		// The name as given first, then the other casings of it
+		std::vector<std::string> names = it->second;
+		std::string component( pszComponent, cbComponent );
+		for ( size_t i = 0; i < names.size(); i++ )
+		{
+			if ( names[i] == component )
+			{
+				names.erase( names.begin() + i );
+				names.insert( names.begin(), component );
+				break;
+			}
+		}
+
+		for ( size_t i = 0; i < names.size(); i++ )
+		{
+			if ( names[i].size() != cbComponent )
+				continue;
+
+			memcpy( pszComponent, names[i].data(), cbComponent );
+
+			if ( !bIsDir )
+				return true;
+
+			if ( DescendIndexed_R( pPath, nNextSlash, bAllowBasenameMismatch, nLevel+1 ) )
+				return true;
+		}
+	}
+	else if ( bIsDir )
+	{
+		DEBUG_MSG( "(%zu) index has no '%s' in '%s'\n", nLevel, (const char *)CDirTrimmer(pszComponent, cbComponent), nStartIdx ? (const char *)CDirTrimmer( pPath, nStartIdx ) : "/" );
+	}
+
+	if ( !bIsDir && bAllowBasenameMismatch )
+		return true;
+
+	return false;
+}
+
+static bool DescendIndexed( char *pPath, bool bAllowBasenameMismatch )
+{
+	pthread_mutex_lock( &s_DirIndexMutex );
+	ProcessDirIndexEvents();
+	bool bRet = DescendIndexed_R( pPath, 0, bAllowBasenameMismatch, 0 );
+	pthread_mutex_unlock( &s_DirIndexMutex );
+	return bRet;
+}
+
 #ifdef DO_PATHMATCH_CACHE
 typedef std::map<std::string, std::pair<std::string, time_t> > resultCache_t;
 typedef std::map<std::string, std::pair<std::string, time_t> >::iterator resultCacheItr_t;
@@ -510,6 +889,7 @@ PathMod_t pathmatch( const char *pszIn, char **ppszOut, bool bAllowBasenameMisma
 		return kPathUnchanged;
 
 	static const char *s_pszDbgPathMatch = getenv("DBG_PATHMATCH");
+	static const char *s_pszNoPathMatchIndex = getenv("PATHMATCH_NO_INDEX");
 
 	s_bShowDiag = ( s_pszDbgPathMatch != NULL );
 
@@ -623,7 +1003,11 @@ PathMod_t pathmatch( const char *pszIn, char **ppszOut, bool bAllowBasenameMisma
 			DEBUG_BREAK();
 		}
 
-		bool bSuccess = Descend( pPath, 0, bAllowBasenameMismatch );
+		bool bSuccess;
+		if ( *pPath == '/' && !s_pszNoPathMatchIndex )
+			bSuccess = DescendIndexed( pPath, bAllowBasenameMismatch );
+		else
+			bSuccess = Descend( pPath, 0, bAllowBasenameMismatch );
 		if ( bSuccess )
 		{
 			*ppszOut = pPath;
@@ -0,0 +1,307 @@
+//========= Copyright Valve Corporation, All rights reserved. ============//
+//
+// Purpose: Unit test and benchmark for the engine's IChangeFrameList
+//
+// $NoKeywords: $
+//=============================================================================//
+
+#include "unitlib/unitlib.h"
+#include "changeframelist.h"
+#include "dt_common.h"
+#include "tier0/fasttimer.h"
+#include "tier1/utlvector.h"
+
+
+//-----------------------------------------------------------------------------
+// The original implementation, one tick per property and a linear scan
+//-----------------------------------------------------------------------------
+class CChangeFrameListReference : public IChangeFrameList
+{
+public:
+	CChangeFrameListReference( int nProperties, int iCurTick )
+	{
+		m_ChangeTicks.SetSize( nProperties );
+		for ( int i=0; i < nProperties; i++ )
+			m_ChangeTicks[i] = iCurTick;
+	}
+
+	virtual void	Release()		{ delete this; }
+	virtual int		GetNumProps()	{ return m_ChangeTicks.Count(); }
+
+	virtual IChangeFrameList* Copy()
+	{
+		CChangeFrameListReference *pRet = new CChangeFrameListReference( 0, 0 );
+		pRet->m_ChangeTicks = m_ChangeTicks;
+		return pRet;
+	}
+
+	virtual void	SetChangeTick( const int *pPropIndices, int nPropIndices, const int iTick )
+	{
+		for ( int i=0; i < nPropIndices; i++ )
+		{
+			m_ChangeTicks[ pPropIndices[i] ] = iTick;
+		}
+	}
+
+	virtual int		GetPropsChangedAfterTick( int iTick, int *iOutProps, int nMaxOutProps )
+	{
+		int nOutProps = 0;
+		int c = m_ChangeTicks.Count();
+		for ( int i=0; i < c; i++ )
+		{
+			if ( m_ChangeTicks[i] > iTick )
+			{
+				iOutProps[nOutProps] = i;
+				++nOutProps;
+			}
+		}
+		return nOutProps;
+	}
+
+private:
+	CUtlVector<int>		m_ChangeTicks;
+};
+
+
+//-----------------------------------------------------------------------------
+// Entity workload of a full 64 player server. It is generated from a fixed
+// seed so every run (and both implementations) replays the same changes.
+//-----------------------------------------------------------------------------
+#define WORKLOAD_PLAYERS	64
+#define WORKLOAD_START_TICK	1000
+
+struct WorkloadClass_t
+{
+	int		m_nCount;			// entities of this class
+	int		m_nProps;			// flat props
+	int		m_nChangePercent;	// chance to change in a tick, in 1/10 percent
+	int		m_nChangedProps;	// props changed when it does
+};
+
+static const WorkloadClass_t s_WorkloadClasses[] =
+{
+	{ WORKLOAD_PLAYERS,		900,	1000,	40 },	// players
+	{ WORKLOAD_PLAYERS * 2,	200,	500,	6 },	// weapons and wearables
+	{ 600,					150,	200,	3 },	// physics props, projectiles
+	{ 1400,					80,		2,		1 },	// static but networked
+};
+
+class CWorkloadRandom
+{
+public:
+	CWorkloadRandom( unsigned int nSeed ) : m_nState( nSeed ) {}
+	int RandomInt( int nMin, int nMax )
+	{
+		m_nState = m_nState * 1664525u + 1013904223u;
+		return nMin + (int)( ( m_nState >> 8 ) % (unsigned int)( nMax - nMin + 1 ) );
+	}
+private:
+	unsigned int m_nState;
+};
+
+class CChangeFrameWorkload
+{
+public:
+	CChangeFrameWorkload( bool bReference ) : m_Random( 0x5eed ), m_bReference( bReference )
+	{
+		for ( int i=0; i < ARRAYSIZE( s_WorkloadClasses ); i++ )
+		{
+			for ( int j=0; j < s_WorkloadClasses[i].m_nCount; j++ )
+			{
+				m_EntityClass.AddToTail( i );
+				m_Lists.AddToTail( Alloc( s_WorkloadClasses[i].m_nProps, WORKLOAD_START_TICK ) );
+			}
+		}
+	}
+
+	~CChangeFrameWorkload()
+	{
+		FOR_EACH_VEC( m_Lists, i )
+		{
+			m_Lists[i]->Release();
+		}
+	}
+
+	IChangeFrameList *Alloc( int nProps, int iTick )
+	{
+		if ( m_bReference )
+			return new CChangeFrameListReference( nProps, iTick );
+
+		return AllocChangeFrameList( nProps, iTick );
+	}
+
+	// apply one server tick of changes
+	void SimulateTick( int iTick )
+	{
+		int props[MAX_DATATABLE_PROPS];
+
+		FOR_EACH_VEC( m_Lists, i )
+		{
+			const WorkloadClass_t &wc = s_WorkloadClasses[ m_EntityClass[i] ];
+			if ( m_Random.RandomInt( 0, 999 ) >= wc.m_nChangePercent )
+				continue;
+
+			// changes cluster around a few hot props
+			int nChanged = m_Random.RandomInt( 1, wc.m_nChangedProps );
+			int iBase = m_Random.RandomInt( 0, wc.m_nProps - 1 );
+			for ( int j=0; j < nChanged; j++ )
+			{
+				props[j] = ( iBase + m_Random.RandomInt( 0, 31 ) * j ) % wc.m_nProps;
+			}
+
+			m_Lists[i]->SetChangeTick( props, nChanged, iTick );
+		}
+	}
+
+	// ack tick of one client, mostly recent with a long tail for lossy clients
+	int GetClientAckTick( int iTick )
+	{
+		int nRoll = m_Random.RandomInt( 0, 99 );
+		if ( nRoll < 80 )
+			return iTick - 1;
+		if ( nRoll < 95 )
+			return iTick - m_Random.RandomInt( 2, 8 );
+		return iTick - m_Random.RandomInt( 9, 64 );
+	}
+
+	CWorkloadRandom				m_Random;
+	bool						m_bReference;
+	CUtlVector<int>				m_EntityClass;
+	CUtlVector<IChangeFrameList*>	m_Lists;
+};
+
+// every client sees a quarter of the entities
+static inline bool ClientSeesEntity( int iClient, int iEntity )
+{
+	return ( ( iEntity + iClient ) & 3 ) == 0 || iEntity < WORKLOAD_PLAYERS;
+}
+
+static float RunChangeFrameWorkload( bool bReference, int nTicks, int *pChecksum )
+{
+	CChangeFrameWorkload workload( bReference );
+	int props[MAX_DATATABLE_PROPS];
+	int nChecksum = 0;
+
+	CFastTimer timer;
+	timer.Start();
+
+	for ( int iTick = WORKLOAD_START_TICK + 1; iTick <= WORKLOAD_START_TICK + nTicks; iTick++ )
+	{
+		workload.SimulateTick( iTick );
+
+		for ( int iClient = 0; iClient < WORKLOAD_PLAYERS; iClient++ )
+		{
+			int iAckTick = workload.GetClientAckTick( iTick );
+
+			FOR_EACH_VEC( workload.m_Lists, i )
+			{
+				if ( !ClientSeesEntity( iClient, i ) )
+					continue;
+
+				int nProps = workload.m_Lists[i]->GetPropsChangedAfterTick( iAckTick, props, ARRAYSIZE( props ) );
+				for ( int j=0; j < nProps; j++ )
+				{
+					nChecksum = nChecksum * 31 + props[j];
+				}
+				nChecksum += nProps;
+			}
+		}
+	}
+
+	timer.End();
+
+	*pChecksum = nChecksum;
+	return timer.GetDuration().GetMillisecondsF();
+}
+
+
+DEFINE_TESTSUITE( ChangeFrameListTestSuite )
+
+DEFINE_TESTCASE( ChangeFrameListTest, ChangeFrameListTestSuite )
+{
+	Msg( "Running IChangeFrameList tests\n" );
+
+	int props[MAX_DATATABLE_PROPS];
+	int refProps[MAX_DATATABLE_PROPS];
+
+	// randomized changes against the reference implementation, including
+	// queries older than the mask history and copies that diverge
+	CWorkloadRandom random( 1234 );
+	for ( int nTest = 0; nTest < 64; nTest++ )
+	{
+		int nProps = random.RandomInt( 1, 700 );
+		int iTick = random.RandomInt( 0, 100 );
+
+		IChangeFrameList *pList = AllocChangeFrameList( nProps, iTick );
+		IChangeFrameList *pRef = new CChangeFrameListReference( nProps, iTick );
+		IChangeFrameList *pCopy = NULL;
+		IChangeFrameList *pRefCopy = NULL;
+
+		for ( int nStep = 0; nStep < 200; nStep++ )
+		{
+			// mostly increasing ticks, sometimes repeated or going back
+			int nRoll = random.RandomInt( 0, 99 );
+			if ( nRoll < 85 )
+				iTick += random.RandomInt( 1, 3 );
+			else if ( nRoll < 98 )
+				iTick += 0;
+			else
+				iTick -= random.RandomInt( 1, 5 );
+
+			int nChanged = random.RandomInt( 0, MIN( nProps, 20 ) );
+			for ( int i=0; i < nChanged; i++ )
+			{
+				props[i] = random.RandomInt( 0, nProps - 1 );
+			}
+
+			pList->SetChangeTick( props, nChanged, iTick );
+			pRef->SetChangeTick( props, nChanged, iTick );
+
+			if ( nStep == 50 )
+			{
+				pCopy = pList->Copy();
+				pRefCopy = pRef->Copy();
+			}
+
+			for ( int iQuery = iTick - 70; iQuery <= iTick + 1; iQuery += random.RandomInt( 1, 4 ) )
+			{
+				int nOut = pList->GetPropsChangedAfterTick( iQuery, props, ARRAYSIZE( props ) );
+				int nRefOut = pRef->GetPropsChangedAfterTick( iQuery, refProps, ARRAYSIZE( refProps ) );
+				Shipping_Assert( nOut == nRefOut );
+				Shipping_Assert( !memcmp( props, refProps, nOut * sizeof( int ) ) );
+
+				if ( pCopy )
+				{
+					nOut = pCopy->GetPropsChangedAfterTick( iQuery, props, ARRAYSIZE( props ) );
+					nRefOut = pRefCopy->GetPropsChangedAfterTick( iQuery, refProps, ARRAYSIZE( refProps ) );
+					Shipping_Assert( nOut == nRefOut );
+					Shipping_Assert( !memcmp( props, refProps, nOut * sizeof( int ) ) );
+				}
+			}
+		}
+
+		pList->Release();
+		pRef->Release();
+		if ( pCopy )
+		{
+			pCopy->Release();
+			pRefCopy->Release();
+		}
+	}
+}
+
+DEFINE_TESTCASE( ChangeFrameListBenchmark, ChangeFrameListTestSuite )
+{
+	Msg( "Running IChangeFrameList 64 player workload benchmark\n" );
+
+	const int nTicks = 200;
+	int nRefChecksum, nChecksum;
+
+	float flRefMS = RunChangeFrameWorkload( true, nTicks, &nRefChecksum );
+	float flMS = RunChangeFrameWorkload( false, nTicks, &nChecksum );
+
+	Msg( "  tick array scan:   %8.2f ms\n", flRefMS );
+	Msg( "  change masks:      %8.2f ms\n", flMS );
+
+	Shipping_Assert( nChecksum == nRefChecksum );
+}
@@ -0,0 +1,39 @@
+//========= Copyright Valve Corporation, All rights reserved. ============//
+//
+// Purpose: Unit test program for testing of engine components
+//
+// $NoKeywords: $
+//=============================================================================//
+
+#include "unitlib/unitlib.h"
+#include "appframework/IAppSystem.h"
+#include "mathlib/mathlib.h"
+
+//-----------------------------------------------------------------------------
+// Used to connect/disconnect the DLL
+//-----------------------------------------------------------------------------
+class CEngineTestAppSystem : public CTier0AppSystem< IAppSystem >
+{
+	typedef CTier0AppSystem< IAppSystem > BaseClass;
+
+public:
+	virtual bool Connect( CreateInterfaceFn factory ) 
+	{
+		if ( !BaseClass::Connect( factory ) )
+			return false;
+		return true;
+	}
+
+	virtual InitReturnVal_t Init()
+	{
+		MathLib_Init( 2.2f, 2.2f, 0.0f, 2.0f );
+		return INIT_OK;
+	}
+
+	virtual void Shutdown()
+	{
+		BaseClass::Shutdown();
+	}
+};
+
+USE_UNITTEST_APPSYSTEM( CEngineTestAppSystem )
@@ -0,0 +1,252 @@
+//========= Copyright Valve Corporation, All rights reserved. ============//
+//
+// Purpose: Unit test for changing the spatial partition from its enumerators
+//
+// $NoKeywords: $
+//=============================================================================//
+
+#include "unitlib/unitlib.h"
+#include "ispatialpartitioninternal.h"
+#include "ispatialpartition.h"
+#include "ihandleentity.h"
+#include "basehandle.h"
+#include "mathlib/vector.h"
+#include "worldsize.h"
+#include "cmodel.h"
+#include "debugoverlay.h"
+#include "host.h"
+#include "datacache/imdlcache.h"
+#include "tier2/renderutils.h"
+#include "appframework/IAppSystem.h"
+#include "tier1/utlvector.h"
+
+
+//-----------------------------------------------------------------------------
+// The partition's queries take the model cache lock, nothing else is used
+//-----------------------------------------------------------------------------
+class CNullMDLCache : public CBaseAppSystem< IMDLCache >
+{
+public:
+	virtual void SetCacheNotify( IMDLCacheNotify *pNotify ) {}
+	virtual MDLHandle_t FindMDL( const char *pMDLRelativePath ) { return MDLHANDLE_INVALID; }
+	virtual int AddRef( MDLHandle_t handle ) { return 0; }
+	virtual int Release( MDLHandle_t handle ) { return 0; }
+	virtual int GetRef( MDLHandle_t handle ) { return 0; }
+	virtual studiohdr_t *GetStudioHdr( MDLHandle_t handle ) { return NULL; }
+	virtual studiohwdata_t *GetHardwareData( MDLHandle_t handle ) { return NULL; }
+	virtual vcollide_t *GetVCollide( MDLHandle_t handle ) { return NULL; }
+	virtual unsigned char *GetAnimBlock( MDLHandle_t handle, int nBlock ) { return NULL; }
+	virtual virtualmodel_t *GetVirtualModel( MDLHandle_t handle ) { return NULL; }
+	virtual int GetAutoplayList( MDLHandle_t handle, unsigned short **pOut ) { return 0; }
+	virtual vertexFileHeader_t *GetVertexData( MDLHandle_t handle ) { return NULL; }
+	virtual void TouchAllData( MDLHandle_t handle ) {}
+	virtual void SetUserData( MDLHandle_t handle, void* pData ) {}
+	virtual void *GetUserData( MDLHandle_t handle ) { return NULL; }
+	virtual bool IsErrorModel( MDLHandle_t handle ) { return false; }
+	virtual void Flush( MDLCacheFlush_t nFlushFlags ) {}
+	virtual void Flush( MDLHandle_t handle, int nFlushFlags ) {}
+	virtual const char *GetModelName( MDLHandle_t handle ) { return ""; }
+	virtual virtualmodel_t *GetVirtualModelFast( const studiohdr_t *pStudioHdr, MDLHandle_t handle ) { return NULL; }
+	virtual void BeginLock() {}
+	virtual void EndLock() {}
+	virtual int *GetFrameUnlockCounterPtrOLD() { return NULL; }
+	virtual void FinishPendingLoads() {}
+	virtual vcollide_t *GetVCollideEx( MDLHandle_t handle, bool synchronousLoad ) { return NULL; }
+	virtual bool GetVCollideSize( MDLHandle_t handle, int *pVCollideSize ) { return false; }
+	virtual bool GetAsyncLoad( MDLCacheDataType_t type ) { return false; }
+	virtual bool SetAsyncLoad( MDLCacheDataType_t type, bool bAsync ) { return false; }
+	virtual void BeginMapLoad() {}
+	virtual void EndMapLoad() {}
+	virtual void MarkAsLoaded( MDLHandle_t handle ) {}
+	virtual void InitPreloadData( bool rebuild ) {}
+	virtual void ShutdownPreloadData() {}
+	virtual bool IsDataLoaded( MDLHandle_t handle, MDLCacheDataType_t type ) { return false; }
+	virtual int *GetFrameUnlockCounterPtr( MDLCacheDataType_t type ) { return NULL; }
+	virtual studiohdr_t *LockStudioHdr( MDLHandle_t handle ) { return NULL; }
+	virtual void UnlockStudioHdr( MDLHandle_t handle ) {}
+	virtual bool PreloadModel( MDLHandle_t handle ) { return false; }
+	virtual void ResetErrorModelStatus( MDLHandle_t handle ) {}
+	virtual void MarkFrame() {}
+};
+
+static CNullMDLCache s_NullMDLCache;
+
+//-----------------------------------------------------------------------------
+// Engine symbols spatialpartition.cpp links against, the tests never draw
+//-----------------------------------------------------------------------------
+IMDLCache *g_pMDLCache = &s_NullMDLCache;
+EUniverse GetSteamUniverse() { return k_EUniverseInvalid; }
+void RenderLine( const Vector& v1, const Vector& v2, Color c, bool bZBuffer ) {}
+void CDebugOverlay::AddBoxOverlay( const Vector& origin, const Vector& mins, const Vector& max, QAngle const& orientation, int r, int g, int b, int a, float duration ) {}
+void CDebugOverlay::AddLineOverlay( const Vector& origin, const Vector& dest, int r, int g, int b, int a, bool noDepthTest, float duration ) {}
+
+#define TEST_ELEMENT_COUNT	48
+
+class CTestHandleEntity : public IHandleEntity
+{
+public:
+	virtual void SetRefEHandle( const CBaseHandle &handle )	{ m_RefEHandle = handle; }
+	virtual const CBaseHandle& GetRefEHandle() const		{ return m_RefEHandle; }
+
+	CBaseHandle					m_RefEHandle;
+	SpatialPartitionHandle_t	m_hPartition;
+	int							m_nVisits;
+	bool						m_bInQuery;
+	bool						m_bGone;	// destroyed, moved away or taken out of the list
+	bool						m_bVisitedWhileGone;
+};
+
+// Elements inside the queries that stay, the last ones are moved into the slots
+// of removed elements
+static bool IsKept( int i )
+{
+	return ( i & 1 ) && ( ( i % 3 ) == 0 || i >= TEST_ELEMENT_COUNT - 8 );
+}
+
+//-----------------------------------------------------------------------------
+// Takes other elements of the same voxel out of the partition on the first callback,
+// the way entity touch and trigger callbacks do. Removing elements outside the
+// query moves elements that are still to be visited into their slots.
+//-----------------------------------------------------------------------------
+class CRemovingEnumerator : public IPartitionEnumerator
+{
+public:
+	CRemovingEnumerator( ISpatialPartition *pPartition, CTestHandleEntity *pEntities ) : m_pPartition( pPartition ), m_pEntities( pEntities ), m_bRemoved( false )
+	{
+	}
+
+	virtual IterationRetval_t EnumElement( IHandleEntity *pHandleEntity )
+	{
+		CTestHandleEntity *pEntity = static_cast< CTestHandleEntity * >( pHandleEntity );
+		++pEntity->m_nVisits;
+		if ( pEntity->m_bGone )
+		{
+			pEntity->m_bVisitedWhileGone = true;
+		}
+
+		if ( !m_bRemoved )
+		{
+			m_bRemoved = true;
+			for ( int i = 0; i < TEST_ELEMENT_COUNT; ++i )
+			{
+				CTestHandleEntity &other = m_pEntities[i];
+				if ( &other == pEntity || IsKept( i ) )
+					continue;
+
+				other.m_bGone = true;
+				if ( !other.m_bInQuery )
+				{
+					if ( i & 2 )
+					{
+						m_pPartition->ElementMoved( other.m_hPartition, Vector( 3000, 3000, 3000 ), Vector( 3004, 3004, 3004 ) );
+					}
+					else
+					{
+						m_pPartition->DestroyHandle( other.m_hPartition );
+						other.m_hPartition = PARTITION_INVALID_HANDLE;
+					}
+				}
+				else if ( ( i % 3 ) == 1 )
+				{
+					m_pPartition->DestroyHandle( other.m_hPartition );
+					other.m_hPartition = PARTITION_INVALID_HANDLE;
+				}
+				else
+				{
+					m_pPartition->Remove( other.m_hPartition );
+				}
+			}
+		}
+
+		return ITERATION_CONTINUE;
+	}
+
+private:
+	ISpatialPartition	*m_pPartition;
+	CTestHandleEntity	*m_pEntities;
+	bool				m_bRemoved;
+};
+
+static void CreateTestElements( ISpatialPartition *pPartition, CTestHandleEntity *pEntities )
+{
+	// all in the same voxel, so removals reorder the element arrays the query walks.
+	// Every other element is outside the queries, the last one is inside.
+	for ( int i = 0; i < TEST_ELEMENT_COUNT; ++i )
+	{
+		int j = i / 2;
+		Vector vecMins( 16 + ( j % 8 ) * 4, 16 + ( j / 8 ) * 4, 16 );
+		if ( !( i & 1 ) )
+		{
+			vecMins.x += 128;
+		}
+		Vector vecMaxs = vecMins + Vector( 2, 2, 2 );
+
+		pEntities[i].m_nVisits = 0;
+		pEntities[i].m_bInQuery = ( i & 1 ) != 0;
+		pEntities[i].m_bGone = false;
+		pEntities[i].m_bVisitedWhileGone = false;
+		pEntities[i].m_hPartition = pPartition->CreateHandle( &pEntities[i], PARTITION_ENGINE_SOLID_EDICTS, vecMins, vecMaxs );
+	}
+}
+
+static void CheckTestElements( ISpatialPartition *pPartition, CTestHandleEntity *pEntities )
+{
+	int nVisited = 0;
+	for ( int i = 0; i < TEST_ELEMENT_COUNT; ++i )
+	{
+		CTestHandleEntity &entity = pEntities[i];
+		Shipping_Assert( !entity.m_bVisitedWhileGone );
+		Shipping_Assert( entity.m_nVisits <= ( entity.m_bInQuery ? 1 : 0 ) );
+		if ( entity.m_bInQuery && !entity.m_bGone )
+		{
+			Shipping_Assert( entity.m_nVisits == 1 );
+		}
+		nVisited += entity.m_nVisits;
+
+		if ( entity.m_hPartition != PARTITION_INVALID_HANDLE )
+		{
+			pPartition->DestroyHandle( entity.m_hPartition );
+		}
+	}
+
+	// the first element is visited before anything is removed
+	Shipping_Assert( nVisited >= 1 );
+}
+
+DEFINE_TESTSUITE( SpatialPartitionTestSuite )
+
+DEFINE_TESTCASE( SpatialPartitionRemoveDuringBoxEnumeration, SpatialPartitionTestSuite )
+{
+	Msg( "Running spatial partition removal during box enumeration test\n" );
+
+	ISpatialPartition *pPartition = CreateSpatialPartition( Vector( MIN_COORD_FLOAT, MIN_COORD_FLOAT, MIN_COORD_FLOAT ), Vector( MAX_COORD_FLOAT, MAX_COORD_FLOAT, MAX_COORD_FLOAT ) );
+
+	CTestHandleEntity entities[TEST_ELEMENT_COUNT];
+	CreateTestElements( pPartition, entities );
+
+	CRemovingEnumerator enumerator( pPartition, entities );
+	pPartition->EnumerateElementsInBox( PARTITION_ENGINE_SOLID_EDICTS, Vector( 0, 0, 0 ), Vector( 64, 64, 64 ), false, &enumerator );
+
+	CheckTestElements( pPartition, entities );
+	DestroySpatialPartition( pPartition );
+}
+
+DEFINE_TESTCASE( SpatialPartitionRemoveDuringRayEnumeration, SpatialPartitionTestSuite )
+{
+	Msg( "Running spatial partition removal during ray enumeration test\n" );
+
+	ISpatialPartition *pPartition = CreateSpatialPartition( Vector( MIN_COORD_FLOAT, MIN_COORD_FLOAT, MIN_COORD_FLOAT ), Vector( MAX_COORD_FLOAT, MAX_COORD_FLOAT, MAX_COORD_FLOAT ) );
+
+	CTestHandleEntity entities[TEST_ELEMENT_COUNT];
+	CreateTestElements( pPartition, entities );
+
+	// a swept box along the rows, it misses the elements further out on x
+	Ray_t ray;
+	ray.Init( Vector( 0, 20, 17 ), Vector( 64, 20, 17 ), Vector( -2, -12, -2 ), Vector( 2, 12, 2 ) );
+
+	CRemovingEnumerator enumerator( pPartition, entities );
+	pPartition->EnumerateElementsAlongRay( PARTITION_ENGINE_SOLID_EDICTS, ray, false, &enumerator );
+
+	CheckTestElements( pPartition, entities );
+	DestroySpatialPartition( pPartition );
+}
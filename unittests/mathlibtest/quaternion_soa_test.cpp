@@ -0,0 +1,215 @@
+//========= Copyright Valve Corporation, All rights reserved. ============//
+//
+// Purpose: Unit test and benchmark for the 4-wide FourQuaternions kernels
+//			bone setup uses, against the scalar quaternion functions
+//
+// $NoKeywords: $
+//=============================================================================//
+
+#include "unitlib/unitlib.h"
+#include "mathlib/mathlib.h"
+#include "mathlib/ssemath.h"
+#include "mathlib/ssequaternion.h"
+#include "tier0/platform.h"
+#include "tier0/fasttimer.h"
+#include "tier1/utlvector.h"
+
+
+// about the bone count of a player model, times a room full of them
+static const int s_nQuaternions = 128 * 64;
+
+static float RandomUnitFloat( unsigned int &nSeed )
+{
+	nSeed = nSeed * 1664525u + 1013904223u;
+	return ( nSeed >> 8 ) * ( 1.0f / 16777216.0f );
+}
+
+static void RandomQuaternion( unsigned int &nSeed, Quaternion &q )
+{
+	RadianEuler angles( RandomUnitFloat( nSeed ) * 2.0f * M_PI_F - M_PI_F,
+		RandomUnitFloat( nSeed ) * 2.0f * M_PI_F - M_PI_F,
+		RandomUnitFloat( nSeed ) * 2.0f * M_PI_F - M_PI_F );
+	AngleQuaternion( angles, q );
+}
+
+struct QuaternionTestData_t
+{
+	QuaternionTestData_t()
+	{
+		p.SetCount( s_nQuaternions );
+		q.SetCount( s_nQuaternions );
+		angles.SetCount( s_nQuaternions );
+		t.SetCount( s_nQuaternions );
+		scalar.SetCount( s_nQuaternions );
+		simd.SetCount( s_nQuaternions );
+
+		unsigned int nSeed = 12345;
+		for ( int i = 0; i < s_nQuaternions; i++ )
+		{
+			RandomQuaternion( nSeed, p[i] );
+			switch ( i % 16 )
+			{
+			case 0:		q[i] = p[i]; break;												// same
+			case 1:		q[i].Init( -p[i].x, -p[i].y, -p[i].z, -p[i].w ); break;			// same rotation, other side
+			default:	RandomQuaternion( nSeed, q[i] ); break;
+			}
+
+			angles[i].Init( RandomUnitFloat( nSeed ) * 4.0f * M_PI_F - 2.0f * M_PI_F,
+				RandomUnitFloat( nSeed ) * 4.0f * M_PI_F - 2.0f * M_PI_F,
+				RandomUnitFloat( nSeed ) * 4.0f * M_PI_F - 2.0f * M_PI_F );
+			t[i] = ( i % 7 == 0 ) ? 0.0f : ( ( i % 7 == 1 ) ? 1.0f : RandomUnitFloat( nSeed ) );
+		}
+	}
+
+	float MaxError() const
+	{
+		float flMaxError = 0.0f;
+		for ( int i = 0; i < s_nQuaternions; i++ )
+		{
+			for ( int j = 0; j < 4; j++ )
+			{
+				flMaxError = MAX( flMaxError, fabsf( scalar[i][j] - simd[i][j] ) );
+			}
+		}
+		return flMaxError;
+	}
+
+	CUtlVector<Quaternion>	p;
+	CUtlVector<Quaternion>	q;
+	CUtlVector<RadianEuler>	angles;
+	CUtlVector<float>		t;
+	CUtlVector<Quaternion>	scalar;
+	CUtlVector<Quaternion>	simd;
+};
+
+enum QuaternionKernel_t
+{
+	KERNEL_SLERP = 0,
+	KERNEL_SLERP_NOALIGN,
+	KERNEL_BLEND,
+	KERNEL_ANGLES,
+
+	NUM_KERNELS
+};
+
+static const char *s_pKernelNames[NUM_KERNELS] =
+{
+	"slerp",
+	"slerp noalign",
+	"blend",
+	"angles",
+};
+
+static void RunScalarKernel( QuaternionKernel_t kernel, QuaternionTestData_t &data )
+{
+	for ( int i = 0; i < s_nQuaternions; i++ )
+	{
+		switch ( kernel )
+		{
+		case KERNEL_SLERP:			QuaternionSlerp( data.p[i], data.q[i], data.t[i], data.scalar[i] ); break;
+		case KERNEL_SLERP_NOALIGN:	QuaternionSlerpNoAlign( data.p[i], data.q[i], data.t[i], data.scalar[i] ); break;
+		case KERNEL_BLEND:			QuaternionBlend( data.p[i], data.q[i], data.t[i], data.scalar[i] ); break;
+		case KERNEL_ANGLES:			AngleQuaternion( data.angles[i], data.scalar[i] ); break;
+		default:					break;
+		}
+	}
+}
+
+static void RunSIMDKernel( QuaternionKernel_t kernel, QuaternionTestData_t &data )
+{
+	for ( int i = 0; i < s_nQuaternions; i += 4 )
+	{
+		FourQuaternions p, q, result;
+		fltx4 t = LoadUnalignedSIMD( &data.t[i] );
+
+		switch ( kernel )
+		{
+		case KERNEL_SLERP:
+			p.LoadAndSwizzle( data.p[i], data.p[i+1], data.p[i+2], data.p[i+3] );
+			q.LoadAndSwizzle( data.q[i], data.q[i+1], data.q[i+2], data.q[i+3] );
+			result = FourQuaternions::Slerp( p, q, t );
+			break;
+
+		case KERNEL_SLERP_NOALIGN:
+			p.LoadAndSwizzle( data.p[i], data.p[i+1], data.p[i+2], data.p[i+3] );
+			q.LoadAndSwizzle( data.q[i], data.q[i+1], data.q[i+2], data.q[i+3] );
+			result = FourQuaternions::SlerpNoAlign( p, q, t );
+			break;
+
+		case KERNEL_BLEND:
+			p.LoadAndSwizzle( data.p[i], data.p[i+1], data.p[i+2], data.p[i+3] );
+			q.LoadAndSwizzle( data.q[i], data.q[i+1], data.q[i+2], data.q[i+3] );
+			result = FourQuaternions::Blend( p, q, t );
+			break;
+
+		case KERNEL_ANGLES:
+			{
+				fltx4 x, y, z;
+				for ( int j = 0; j < 4; j++ )
+				{
+					SubFloat( x, j ) = data.angles[i+j].x;
+					SubFloat( y, j ) = data.angles[i+j].y;
+					SubFloat( z, j ) = data.angles[i+j].z;
+				}
+				result.FromRadianEulers( x, y, z );
+			}
+			break;
+
+		default:
+			break;
+		}
+
+		result.SwizzleAndStore( data.simd[i], data.simd[i+1], data.simd[i+2], data.simd[i+3] );
+	}
+}
+
+
+DEFINE_TESTSUITE( QuaternionSoATestSuite )
+
+DEFINE_TESTCASE( QuaternionSoATest, QuaternionSoATestSuite )
+{
+	Msg( "Running FourQuaternions tests\n" );
+
+	QuaternionTestData_t data;
+
+	for ( int kernel = 0; kernel < NUM_KERNELS; kernel++ )
+	{
+		RunScalarKernel( (QuaternionKernel_t)kernel, data );
+		RunSIMDKernel( (QuaternionKernel_t)kernel, data );
+
+		float flMaxError = data.MaxError();
+		Msg( "  %-14s max error %g\n", s_pKernelNames[kernel], flMaxError );
+		Shipping_Assert( flMaxError < 1e-5f );
+	}
+}
+
+DEFINE_TESTCASE( QuaternionSoABenchmark, QuaternionSoATestSuite )
+{
+	Msg( "Running FourQuaternions benchmark, %d quaternions\n", s_nQuaternions );
+	Msg( "    kernel          scalar us    simd us   speedup\n" );
+
+	QuaternionTestData_t data;
+	const int nPasses = 20;
+
+	for ( int kernel = 0; kernel < NUM_KERNELS; kernel++ )
+	{
+		CFastTimer timer;
+		timer.Start();
+		for ( int i = 0; i < nPasses; i++ )
+		{
+			RunScalarKernel( (QuaternionKernel_t)kernel, data );
+		}
+		timer.End();
+		float flScalarUS = timer.GetDuration().GetMicrosecondsF() / nPasses;
+
+		timer.Start();
+		for ( int i = 0; i < nPasses; i++ )
+		{
+			RunSIMDKernel( (QuaternionKernel_t)kernel, data );
+		}
+		timer.End();
+		float flSIMDUS = timer.GetDuration().GetMicrosecondsF() / nPasses;
+
+		Msg( "    %-14s %10.1f %10.1f %9.2f\n", s_pKernelNames[kernel], flScalarUS, flSIMDUS, flScalarUS / MAX( flSIMDUS, 0.001f ) );
+	}
+}
@@ -0,0 +1,81 @@
+//========= Copyright Valve Corporation, All rights reserved. ============//
+//
+// Purpose: Unit test for the case-insensitive path lookups of pathmatch
+//
+// $NoKeywords: $
+//=============================================================================//
+
+#include "tier0/dbg.h"
+#include "unitlib/unitlib.h"
+#include "tier1/strtools.h"
+
+#ifdef LINUX
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <limits.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+
+// This library is linked with the pathmatch wrappers, turn them on before the
+// first wrapped call reads the setting
+static class CEnablePathMatch
+{
+public:
+	CEnablePathMatch()
+	{
+		setenv( "ENABLE_PATHMATCH", "1", 0 );
+	}
+} s_EnablePathMatch;
+
+static bool ResolvesTo( const char *pszPath, const char *pszExpected )
+{
+	char szResolved[PATH_MAX];
+	return realpath( pszPath, szResolved ) && !strcmp( szResolved, pszExpected );
+}
+
+DEFINE_TESTSUITE( PathMatchTestSuite )
+
+DEFINE_TESTCASE( PathMatchIndexUpdates, PathMatchTestSuite )
+{
+	Msg( "Running pathmatch directory index update test\n" );
+
+	char szBase[64], szDir[96], szFile[128], szNew[128], szRenamed[128], szLookup[128];
+	V_snprintf( szBase, sizeof( szBase ), "/tmp/pathmatchtest_%d", (int)getpid() );
+	V_snprintf( szDir, sizeof( szDir ), "%s/Dir", szBase );
+	V_snprintf( szFile, sizeof( szFile ), "%s/File.txt", szDir );
+	V_snprintf( szNew, sizeof( szNew ), "%s/NewFile.txt", szDir );
+	V_snprintf( szRenamed, sizeof( szRenamed ), "%s/Renamed.txt", szDir );
+
+	Shipping_Assert( mkdir( szBase, 0755 ) == 0 );
+	Shipping_Assert( mkdir( szDir, 0755 ) == 0 );
+	int fd = open( szFile, O_CREAT | O_WRONLY, 0644 );
+	Shipping_Assert( fd >= 0 );
+	close( fd );
+
+	// the first lookup reads the directory into the index
+	V_snprintf( szLookup, sizeof( szLookup ), "%s/DIR/file.TXT", szBase );
+	Shipping_Assert( ResolvesTo( szLookup, szFile ) );
+
+	// a file created afterwards is found without the directory being read again
+	V_snprintf( szLookup, sizeof( szLookup ), "%s/DIR/newfile.txt", szBase );
+	Shipping_Assert( access( szLookup, F_OK ) != 0 );
+	fd = open( szNew, O_CREAT | O_WRONLY, 0644 );
+	Shipping_Assert( fd >= 0 );
+	close( fd );
+	Shipping_Assert( ResolvesTo( szLookup, szNew ) );
+
+	// a rename drops the old name and adds the new one
+	Shipping_Assert( rename( szNew, szRenamed ) == 0 );
+	Shipping_Assert( access( szLookup, F_OK ) != 0 );
+	V_snprintf( szLookup, sizeof( szLookup ), "%s/DIR/RENAMED.txt", szBase );
+	Shipping_Assert( ResolvesTo( szLookup, szRenamed ) );
+
+	unlink( szRenamed );
+	unlink( szFile );
+	rmdir( szDir );
+	rmdir( szBase );
+}
+
+#endif // LINUX
@@ -0,0 +1,314 @@
+//========= Copyright Valve Corporation, All rights reserved. ============//
+//
+// Purpose: Unit test and benchmark for building and hashing vpks on the
+//			thread pool
+//
+// $NoKeywords: $
+//=============================================================================//
+
+#include "unitlib/unitlib.h"
+#include "vpklib/packedstore.h"
+#include "vstdlib/jobthread.h"
+#include "filesystem.h"
+#include "tier2/tier2.h"
+#include "tier1/utlbuffer.h"
+#include "tier0/platform.h"
+#include "tier0/fasttimer.h"
+#include "tier1/strtools.h"
+
+
+static const int k_nFileFractionSize = 0x00100000;
+
+//-----------------------------------------------------------------------------
+// The unittest app doesn't load a filesystem, vpklib needs one
+//-----------------------------------------------------------------------------
+static IFileSystem *ConnectFileSystem()
+{
+	static IFileSystem *s_pFileSystem = NULL;
+	if ( s_pFileSystem )
+		return s_pFileSystem;
+
+	CSysModule *hModule = Sys_LoadModule( "filesystem_stdio" );
+	if ( !hModule )
+		return NULL;
+
+	CreateInterfaceFn factory = Sys_GetFactory( hModule );
+	IFileSystem *pFileSystem = factory ? (IFileSystem *)factory( FILESYSTEM_INTERFACE_VERSION, NULL ) : NULL;
+	if ( !pFileSystem || !pFileSystem->Connect( factory ) || pFileSystem->Init() != INIT_OK )
+		return NULL;
+
+	s_pFileSystem = pFileSystem;
+	g_pFullFileSystem = pFileSystem;
+	return s_pFileSystem;
+}
+
+static void GetTestPackBaseName( const char *pName, char *pBaseName, int nBaseNameSize )
+{
+	// relative to the working directory
+	V_MakeAbsolutePath( pBaseName, nBaseNameSize, pName );
+}
+
+static void RemoveTestPack( const char *pBaseName )
+{
+	char szFileName[MAX_PATH];
+	V_snprintf( szFileName, sizeof( szFileName ), "%s_dir.vpk", pBaseName );
+	if ( g_pFullFileSystem->FileExists( szFileName ) )
+	{
+		g_pFullFileSystem->RemoveFile( szFileName );
+	}
+
+	for ( int i = 0; ; i++ )
+	{
+		V_snprintf( szFileName, sizeof( szFileName ), "%s_%03d.vpk", pBaseName, i );
+		if ( !g_pFullFileSystem->FileExists( szFileName ) )
+			break;
+		g_pFullFileSystem->RemoveFile( szFileName );
+	}
+}
+
+static void GetTestFileName( int nFile, char *pName, int nNameSize )
+{
+	V_snprintf( pName, nNameSize, "dir%d/sub%d/file%d.%s", nFile % 7, nFile % 13, nFile, ( nFile & 1 ) ? "txt" : "mdl" );
+}
+
+// Same contents every time for the same file
+static int FillTestFile( int nFile, uint8 *pData, int nMaxSize )
+{
+	unsigned int nSeed = 2166136261u ^ ( nFile * 16777619u );
+	nSeed = nSeed * 1664525u + 1013904223u;
+	int nSize = 1 + ( nSeed >> 8 ) % nMaxSize;
+	for ( int i = 0; i < nSize; i++ )
+	{
+		nSeed = nSeed * 1664525u + 1013904223u;
+		pData[i] = (uint8)( nSeed >> 24 );
+	}
+	return nSize;
+}
+
+// nFiles files of up to nMaxFileSize bytes, a few of them preloaded, the rest in chunks.
+// Finished chunks are hashed on pThreadPool while the files are added.
+static void BuildTestPack( const char *pBaseName, int nFiles, int nMaxFileSize, int nChunkSize, IThreadPool *pThreadPool = NULL )
+{
+	RemoveTestPack( pBaseName );
+
+	uint8 *pData = new uint8[nMaxFileSize];
+	char szDirFileName[MAX_PATH];
+	CPackedStore store( pBaseName, szDirFileName, g_pFullFileSystem, true );
+	store.SetThreadPool( pThreadPool );
+	store.SetWriteChunkSize( nChunkSize );
+	for ( int i = 0; i < nFiles; i++ )
+	{
+		char szName[MAX_PATH];
+		GetTestFileName( i, szName, sizeof( szName ) );
+		int nSize = FillTestFile( i, pData, nMaxFileSize );
+		store.AddFile( szName, ( i % 5 == 0 ) ? 16 : 0, pData, nSize, ( i % 11 ) != 0 );
+	}
+	store.HashEverything();
+	store.Write();
+	delete [] pData;
+}
+
+// One fraction at a time through the handle the pack file is read with, the way
+// chunks were hashed before the pool did it
+static void HashChunkFilesSerially( CPackedStore &store, CUtlVector<ChunkHashFraction_t> &fractions )
+{
+	fractions.RemoveAll();
+	for ( int iChunkFileIndex = 0; iChunkFileIndex <= store.GetHighestChunkFileIndex(); iChunkFileIndex++ )
+	{
+		CPackedStoreFileHandle handle = store.GetHandleForHashingFiles();
+		handle.m_nFileNumber = iChunkFileIndex;
+
+		for ( int nFileFraction = 0; ; nFileFraction += k_nFileFractionSize )
+		{
+			FileHash_t fileHash;
+			int64 nFileSize = 0;
+			store.HashEntirePackFile( handle, nFileSize, nFileFraction, k_nFileFractionSize, fileHash );
+
+			ChunkHashFraction_t &fraction = fractions[ fractions.AddToTail() ];
+			fraction.m_nPackFileNumber = iChunkFileIndex;
+			fraction.m_nFileFraction = nFileFraction;
+			fraction.m_cbChunkLen = fileHash.m_cbFileLen;
+			V_memcpy( fraction.m_md5contents.bits, fileHash.m_md5contents.bits, sizeof( fraction.m_md5contents ) );
+
+			if ( nFileFraction + k_nFileFractionSize > nFileSize )
+				break;
+		}
+	}
+}
+
+static bool SameFractions( CPackedStore &store, const CUtlVector<ChunkHashFraction_t> &fractions )
+{
+	const CUtlSortVector<ChunkHashFraction_t, ChunkHashFractionLess_t> &hashes = store.AccessPackFileHashes();
+	if ( hashes.Count() != fractions.Count() )
+		return false;
+	return V_memcmp( hashes.Base(), fractions.Base(), fractions.Count() * sizeof( ChunkHashFraction_t ) ) == 0;
+}
+
+static bool LoadDirFile( const char *pBaseName, CUtlBuffer &buf )
+{
+	char szFileName[MAX_PATH];
+	V_snprintf( szFileName, sizeof( szFileName ), "%s_dir.vpk", pBaseName );
+	buf.Purge();
+	return g_pFullFileSystem->ReadFile( szFileName, NULL, buf );
+}
+
+static IThreadPool *StartHashPool( int nThreads )
+{
+	IThreadPool *pPool = CreateThreadPool();
+	ThreadPoolStartParams_t params;
+	params.nThreads = nThreads;
+	params.fDistribute = TRS_FALSE;
+	pPool->Start( params, "VPKTst" );
+	return pPool;
+}
+
+static void StopHashPool( IThreadPool *pPool )
+{
+	pPool->Stop();
+	DestroyThreadPool( pPool );
+}
+
+
+DEFINE_TESTSUITE( PackedStoreTestSuite )
+
+DEFINE_TESTCASE( PackedStoreParallelHashTest, PackedStoreTestSuite )
+{
+	Msg( "Running vpk parallel hashing tests\n" );
+
+	if ( !ConnectFileSystem() )
+	{
+		Warning( "Couldn't load filesystem_stdio, skipping vpk tests\n" );
+		return;
+	}
+
+	char szBaseName[MAX_PATH];
+	GetTestPackBaseName( "vpklibtest_hash", szBaseName, sizeof( szBaseName ) );
+	BuildTestPack( szBaseName, 600, 64 * 1024, 2 * k_nFileFractionSize + 4096 );
+
+	CUtlBuffer serialDirFile;
+	CUtlVector<ChunkHashFraction_t> serialFractions;
+	{
+		char szDirFileName[MAX_PATH];
+		CPackedStore store( szBaseName, szDirFileName, g_pFullFileSystem, true );
+		Shipping_Assert( store.GetHighestChunkFileIndex() > 0 );
+
+		HashChunkFilesSerially( store, serialFractions );
+		Shipping_Assert( SameFractions( store, serialFractions ) );
+		Shipping_Assert( LoadDirFile( szBaseName, serialDirFile ) );
+	}
+
+	// Rehash and rewrite on a pool, the dir file has to come out the same
+	for ( int nThreads = 1; nThreads <= 4; nThreads++ )
+	{
+		IThreadPool *pPool = StartHashPool( nThreads );
+		{
+			char szDirFileName[MAX_PATH];
+			CPackedStore store( szBaseName, szDirFileName, g_pFullFileSystem, true );
+			store.SetThreadPool( pPool );
+			store.HashEverything();
+			Shipping_Assert( SameFractions( store, serialFractions ) );
+
+			store.HashChunkFile( 1 );
+			Shipping_Assert( SameFractions( store, serialFractions ) );
+
+			store.Write();
+		}
+
+		CUtlBuffer dirFile;
+		Shipping_Assert( LoadDirFile( szBaseName, dirFile ) );
+		Shipping_Assert( dirFile.TellPut() == serialDirFile.TellPut() && !V_memcmp( dirFile.Base(), serialDirFile.Base(), dirFile.TellPut() ) );
+
+		// Build it again, hashing the chunks on the pool while the next ones are written
+		BuildTestPack( szBaseName, 600, 64 * 1024, 2 * k_nFileFractionSize + 4096, pPool );
+		StopHashPool( pPool );
+
+		Shipping_Assert( LoadDirFile( szBaseName, dirFile ) );
+		Shipping_Assert( dirFile.TellPut() == serialDirFile.TellPut() && !V_memcmp( dirFile.Base(), serialDirFile.Base(), dirFile.TellPut() ) );
+		{
+			char szDirFileName[MAX_PATH];
+			CPackedStore store( szBaseName, szDirFileName, g_pFullFileSystem, true );
+			Shipping_Assert( SameFractions( store, serialFractions ) );
+		}
+	}
+
+	// and still reads back
+	{
+		char szDirFileName[MAX_PATH];
+		CPackedStore store( szBaseName, szDirFileName, g_pFullFileSystem, false );
+		Shipping_Assert( store.HasDirectoryIndex() );
+
+		uint8 *pExpected = new uint8[64 * 1024];
+		uint8 *pData = new uint8[64 * 1024];
+		for ( int i = 0; i < 600; i += 7 )
+		{
+			char szName[MAX_PATH];
+			GetTestFileName( i, szName, sizeof( szName ) );
+			int nSize = FillTestFile( i, pExpected, 64 * 1024 );
+
+			CPackedStoreFileHandle handle = store.OpenFile( szName );
+			Shipping_Assert( handle );
+			Shipping_Assert( handle && handle.Read( pData, 64 * 1024 ) == nSize && !V_memcmp( pData, pExpected, nSize ) );
+		}
+		delete [] pExpected;
+		delete [] pData;
+	}
+
+	RemoveTestPack( szBaseName );
+}
+
+DEFINE_TESTCASE( PackedStoreParallelHashBenchmark, PackedStoreTestSuite )
+{
+	Msg( "Running vpk chunk hashing benchmark\n" );
+
+	if ( !ConnectFileSystem() )
+	{
+		Warning( "Couldn't load filesystem_stdio, skipping vpk benchmark\n" );
+		return;
+	}
+
+	char szBaseName[MAX_PATH];
+	GetTestPackBaseName( "vpklibtest_bench", szBaseName, sizeof( szBaseName ) );
+
+	// about 128MB in 8 chunks
+	CFastTimer timer;
+	timer.Start();
+	BuildTestPack( szBaseName, 1024, 256 * 1024, 16 * k_nFileFractionSize );
+	timer.End();
+	Msg( "  build and write %.2f ms\n", timer.GetDuration().GetMillisecondsF() );
+
+	char szDirFileName[MAX_PATH];
+	CPackedStore store( szBaseName, szDirFileName, g_pFullFileSystem, true );
+
+	// the first pass brings the chunks into the page cache for everyone
+	CUtlVector<ChunkHashFraction_t> serialFractions;
+	HashChunkFilesSerially( store, serialFractions );
+
+	timer.Start();
+	HashChunkFilesSerially( store, serialFractions );
+	timer.End();
+	float flSerialMS = timer.GetDuration().GetMillisecondsF();
+
+	Msg( "    threads        ms   speedup\n" );
+	Msg( "     serial  %8.2f      1.00\n", flSerialMS );
+
+	static const int s_nThreadCounts[] = { 1, 2, 4, 8 };
+	for ( int i = 0; i < ARRAYSIZE( s_nThreadCounts ); i++ )
+	{
+		IThreadPool *pPool = StartHashPool( s_nThreadCounts[i] );
+		store.SetThreadPool( pPool );
+
+		timer.Start();
+		store.HashAllChunkFiles();
+		timer.End();
+
+		store.SetThreadPool( NULL );
+		StopHashPool( pPool );
+
+		Shipping_Assert( SameFractions( store, serialFractions ) );
+
+		float flMS = timer.GetDuration().GetMillisecondsF();
+		Msg( "    %7d  %8.2f  %8.2f\n", s_nThreadCounts[i], flMS, flSerialMS / MAX( flMS, 0.001f ) );
+	}
+
+	RemoveTestPack( szBaseName );
+}
@@ -0,0 +1,242 @@
+//========= Copyright Valve Corporation, All rights reserved. ============//
+//
+// Purpose: Unit test and benchmark for the thread pool's shared queue and
+//			work stealing modes
+//
+// $NoKeywords: $
+//=============================================================================//
+
+#include "unitlib/unitlib.h"
+#include "vstdlib/jobthread.h"
+#include "tier0/platform.h"
+#include "tier0/fasttimer.h"
+#include "tier1/utlvector.h"
+
+#include <stdlib.h>
+
+
+//-----------------------------------------------------------------------------
+// A few hundred nanoseconds of work, about the size of one ParallelProcess item
+//-----------------------------------------------------------------------------
+class CFineGrainedJob : public CJob
+{
+public:
+	CFineGrainedJob() : m_pPool( NULL ), m_pDone( NULL ), m_pRemaining( NULL ), m_pChildren( NULL ), m_nChildren( 0 ), m_flQueued( 0.0 ), m_flFinished( 0.0 ), m_nResult( 0 ) {}
+
+	virtual JobStatus_t DoExecute()
+	{
+		unsigned int nHash = (unsigned int)(uintp)this;
+		for ( int i = 0; i < 256; i++ )
+		{
+			nHash = nHash * 1664525u + 1013904223u;
+		}
+		m_nResult = nHash;
+
+		// nested jobs are queued from the pool thread, they go to its own deque
+		for ( int i = 0; i < m_nChildren; i++ )
+		{
+			m_pChildren[i].m_flQueued = Plat_FloatTime();
+			m_pPool->AddJob( &m_pChildren[i] );
+		}
+
+		m_flFinished = Plat_FloatTime();
+		if ( --(*m_pRemaining) == 0 )
+		{
+			m_pDone->Set();
+		}
+		return JOB_OK;
+	}
+
+	IThreadPool		*m_pPool;
+	CThreadEvent	*m_pDone;
+	CInterlockedInt	*m_pRemaining;
+	CFineGrainedJob	*m_pChildren;
+	int				m_nChildren;
+	double			m_flQueued;
+	double			m_flFinished;
+	unsigned int	m_nResult;
+};
+
+static int __cdecl CompareLatencies( const float *a, const float *b )
+{
+	return ( *a < *b ) ? -1 : ( *a > *b );
+}
+
+struct JobPoolResult_t
+{
+	float	m_flMS;
+	float	m_flJobsPerMS;
+	float	m_flMedianLatencyUS;
+	float	m_flTailLatencyUS;	// 99th percentile
+};
+
+static void StartJobPool( IThreadPool *pPool, int nThreads, bool bWorkStealing )
+{
+	ThreadPoolStartParams_t params;
+	params.nThreads = nThreads;
+	params.fDistribute = TRS_FALSE;
+	params.bWorkStealing = bWorkStealing;
+	pPool->Start( params, "JobTst" );
+}
+
+// nRoots jobs are queued by this thread, each of them queues nChildren more
+static JobPoolResult_t RunJobPool( int nThreads, bool bWorkStealing, int nRoots, int nChildren )
+{
+	IThreadPool *pPool = CreateThreadPool();
+	StartJobPool( pPool, nThreads, bWorkStealing );
+
+	int nJobs = nRoots * ( 1 + nChildren );
+	CFineGrainedJob *pJobs = new CFineGrainedJob[nJobs];
+	CThreadEvent done;
+	CInterlockedInt nRemaining( nJobs );
+
+	for ( int i = 0; i < nRoots; i++ )
+	{
+		CFineGrainedJob *pRoot = &pJobs[i * ( 1 + nChildren )];
+		for ( int j = 0; j <= nChildren; j++ )
+		{
+			pRoot[j].m_pPool = pPool;
+			pRoot[j].m_pDone = &done;
+			pRoot[j].m_pRemaining = &nRemaining;
+			pRoot[j].SetFlags( JF_QUEUE );
+		}
+		pRoot->m_pChildren = pRoot + 1;
+		pRoot->m_nChildren = nChildren;
+	}
+
+	CFastTimer timer;
+	timer.Start();
+
+	for ( int i = 0; i < nRoots; i++ )
+	{
+		CFineGrainedJob *pRoot = &pJobs[i * ( 1 + nChildren )];
+		pRoot->m_flQueued = Plat_FloatTime();
+		pPool->AddJob( pRoot );
+	}
+	done.Wait();
+
+	timer.End();
+
+	pPool->Stop();
+	DestroyThreadPool( pPool );
+
+	CUtlVector<float> latencies;
+	latencies.EnsureCapacity( nJobs );
+	for ( int i = 0; i < nJobs; i++ )
+	{
+		Shipping_Assert( pJobs[i].IsFinished() );
+		latencies.AddToTail( (float)( ( pJobs[i].m_flFinished - pJobs[i].m_flQueued ) * 1000000.0 ) );
+	}
+	latencies.Sort( CompareLatencies );
+	delete [] pJobs;
+
+	JobPoolResult_t result;
+	result.m_flMS = timer.GetDuration().GetMillisecondsF();
+	result.m_flJobsPerMS = nJobs / MAX( result.m_flMS, 0.001f );
+	result.m_flMedianLatencyUS = latencies[nJobs / 2];
+	result.m_flTailLatencyUS = latencies[( nJobs * 99 ) / 100];
+	return result;
+}
+
+
+//-----------------------------------------------------------------------------
+// Records the order jobs ran in
+//-----------------------------------------------------------------------------
+class COrderJob : public CJob
+{
+public:
+	virtual JobStatus_t DoExecute()
+	{
+		m_nOrder = (*m_pSequence)++;
+		return JOB_OK;
+	}
+
+	CInterlockedInt	*m_pSequence;
+	int				m_nOrder;
+};
+
+// With one thread, every high priority job has to run before any low priority one
+static void TestJobPriorities( bool bWorkStealing )
+{
+	IThreadPool *pPool = CreateThreadPool();
+	StartJobPool( pPool, 1, bWorkStealing );
+
+	const int nJobs = 200;
+	COrderJob jobs[nJobs];
+	CInterlockedInt nSequence( 0 );
+
+	pPool->SuspendExecution();
+	for ( int i = 0; i < nJobs; i++ )
+	{
+		jobs[i].m_pSequence = &nSequence;
+		jobs[i].SetFlags( JF_QUEUE );
+		jobs[i].SetPriority( ( i & 1 ) ? JP_HIGH : JP_LOW );
+		pPool->AddJob( &jobs[i] );
+	}
+	pPool->ResumeExecution();
+
+	// not WaitForFinish(), this thread would run jobs itself
+	for ( int i = 0; i < nJobs; i++ )
+	{
+		jobs[i].AccessEvent()->Wait();
+	}
+
+	for ( int i = 0; i < nJobs; i++ )
+	{
+		if ( jobs[i].GetPriority() == JP_HIGH )
+		{
+			Shipping_Assert( jobs[i].m_nOrder < nJobs / 2 );
+		}
+		else
+		{
+			Shipping_Assert( jobs[i].m_nOrder >= nJobs / 2 );
+		}
+	}
+
+	pPool->Stop();
+	DestroyThreadPool( pPool );
+}
+
+
+DEFINE_TESTSUITE( JobThreadTestSuite )
+
+DEFINE_TESTCASE( JobThreadTest, JobThreadTestSuite )
+{
+	Msg( "Running thread pool tests\n" );
+
+	TestJobPriorities( false );
+	TestJobPriorities( true );
+
+	// every job runs exactly once, whichever thread ends up with it
+	for ( int nThreads = 1; nThreads <= 4; nThreads++ )
+	{
+		RunJobPool( nThreads, false, 16, 64 );
+		RunJobPool( nThreads, true, 16, 64 );
+	}
+}
+
+DEFINE_TESTCASE( JobThreadBenchmark, JobThreadTestSuite )
+{
+	Msg( "Running thread pool fine grained job benchmark\n" );
+
+	static const int s_nThreadCounts[] = { 2, 4, 8, 16, 32 };
+
+	for ( int nNested = 0; nNested < 2; nNested++ )
+	{
+		// flat: this thread queues every job, nested: pool threads queue most of them
+		int nRoots = ( nNested ) ? 64 : 16384;
+		int nChildren = ( nNested ) ? 255 : 0;
+		Msg( "  %s, %d jobs\n", ( nNested ) ? "nested" : "flat", nRoots * ( 1 + nChildren ) );
+		Msg( "    threads  mode            ms     jobs/ms   p50 us   p99 us\n" );
+
+		for ( int i = 0; i < ARRAYSIZE( s_nThreadCounts ); i++ )
+		{
+			for ( int bWorkStealing = 0; bWorkStealing < 2; bWorkStealing++ )
+			{
+				JobPoolResult_t result = RunJobPool( s_nThreadCounts[i], bWorkStealing != 0, nRoots, nChildren );
+				Msg( "    %7d  %-9s %8.2f %11.1f %8.1f %8.1f\n", s_nThreadCounts[i], ( bWorkStealing ) ? "stealing" : "shared",
+					result.m_flMS, result.m_flJobsPerMS, result.m_flMedianLatencyUS, result.m_flTailLatencyUS );
+			}
+		}
+	}
+}
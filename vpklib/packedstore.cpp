@@ -13,6 +13,7 @@
 #include "tier1/utldict.h"
 #include "tier2/fileutils.h"
 #include "tier1/utlbuffer.h"
+#include "vstdlib/jobthread.h"
 
 #ifdef VPK_ENABLE_SIGNING
 	#include "crypto.h"
@@ -23,6 +24,13 @@
 #include <windows.h>
 #endif
 
+#ifdef POSIX
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
 // memdbgon must be the last include file in a .cpp file!!!
 #include "tier0/memdbgon.h"
 
@@ -153,6 +161,67 @@ static inline int SkipAllFilesInDir( char const * & pData )
 }
 
 
+// FNV-1a over "ext\0dir\0name\0", then the murmur3 finalizer so both halves are usable
+static uint64 VPKIndexHash( char const *pExtension, char const *pDirname, char const *pBaseName, uint32 nSeed )
+{
+	uint64 nHash = 14695981039346656037ull ^ nSeed;
+	char const *pStrings[3] = { pExtension, pDirname, pBaseName };
+	for ( int i = 0; i < ARRAYSIZE( pStrings ); i++ )
+	{
+		for ( uint8 const *p = ( uint8 const * )pStrings[i]; *p; p++ )
+		{
+			nHash = ( nHash ^ *p ) * 1099511628211ull;
+		}
+		nHash *= 1099511628211ull;								// the terminator
+	}
+
+	nHash ^= nHash >> 33;
+	nHash *= 0xff51afd7ed558ccdull;
+	nHash ^= nHash >> 33;
+	nHash *= 0xc4ceb9fe1a85ec53ull;
+	nHash ^= nHash >> 33;
+	return nHash;
+}
+
+static FORCEINLINE uint32 VPKIndexBucket( uint64 nHash, uint32 nNumBuckets )
+{
+	return ( uint32 )nHash % nNumBuckets;
+}
+
+static FORCEINLINE uint32 VPKIndexSlot( uint64 nHash, uint32 nDisplacement, uint32 nNumSlots )
+{
+	uint32 x = ( uint32 )( nHash >> 32 ) ^ ( nDisplacement * 0x9e3779b9 );
+	x ^= x >> 16;
+	x *= 0x85ebca6b;
+	x ^= x >> 13;
+	x *= 0xc2b2ae35;
+	x ^= x >> 16;
+	return x % nNumSlots;
+}
+
+CFileHeaderFixedData *CPackedStore::FindFileEntryInIndex( char const *pDirname, char const *pBaseName, char const *pExtension, uint8 **pNameBaseOut )
+{
+	uint64 nHash = VPKIndexHash( pExtension, pDirname, pBaseName, m_pDirIndex->m_nSeed );
+	uint32 nDisplacement = m_pDirIndexDisplacements[VPKIndexBucket( nHash, m_pDirIndex->m_nNumBuckets )];
+	VPKDirIndexSlot_t const &slot = m_pDirIndexSlots[VPKIndexSlot( nHash, nDisplacement, m_pDirIndex->m_nNumSlots )];
+
+	// every file has a slot of its own, anything else that hashes here isn't in the pack
+	if ( slot.m_nNameOffset >= ( uint32 )m_nDirectoryDataSize ||
+		 slot.m_nDirOffset >= ( uint32 )m_nDirectoryDataSize ||
+		 slot.m_nExtOffset >= ( uint32 )m_nDirectoryDataSize )
+		return NULL;
+
+	char const *pName = ( char const * )m_pMappedDirectory + slot.m_nNameOffset;
+	if ( V_strcmp( pName, pBaseName ) ||
+		 V_strcmp( ( char const * )m_pMappedDirectory + slot.m_nDirOffset, pDirname ) ||
+		 V_strcmp( ( char const * )m_pMappedDirectory + slot.m_nExtOffset, pExtension ) )
+		return NULL;
+
+	if ( pNameBaseOut )
+		*pNameBaseOut = ( uint8 * )pName;
+	return ( CFileHeaderFixedData * )( pName + 1 + V_strlen( pName ) );
+}
+
 CFileHeaderFixedData *CPackedStore::FindFileEntry( char const *pDirname, char const *pBaseName, char const *pExtension, uint8 **pExtBaseOut , uint8 **pNameBaseOut )
 {
 	if ( pExtBaseOut )
@@ -160,6 +229,9 @@ CFileHeaderFixedData *CPackedStore::FindFileEntry( char const *pDirname, char co
 	if ( pNameBaseOut )
 		*pNameBaseOut = NULL;
 
+	if ( m_pDirIndex )
+		return FindFileEntryInIndex( pDirname, pBaseName, pExtension, pNameBaseOut );
+
 	int nExtensionHash = HashString( pExtension ) % PACKEDFILE_EXT_HASH_SIZE;
 	CFileExtensionData const *pExt = m_pExtensionData[nExtensionHash].FindNamedNodeCaseSensitive( pExtension );
 	if ( pExt )
@@ -222,6 +294,17 @@ void CPackedStore::Init( void )
 	m_Signature.Purge();
 	m_SignaturePrivateKey.Purge();
 	m_SignaturePublicKey.Purge();
+
+	m_pMappedDirectory = NULL;
+	m_pDirIndex = NULL;
+	m_pDirIndexDisplacements = NULL;
+	m_pDirIndexSlots = NULL;
+	m_bMapDataFiles = false;
+
+	m_pThreadPool = NULL;
+	m_hWriteHandle = FILESYSTEM_INVALID_HANDLE;
+	m_nWriteHandleChunk = -1;
+	m_nWriteHandleSize = 0;
 }
    
 void CPackedStore::BuildHashTables( void )
@@ -256,9 +339,183 @@ void CPackedStore::BuildHashTables( void )
 }
 
 
+//-----------------------------------------------------------------------------
+// Use the index written after the directory if it was built for this directory
+//-----------------------------------------------------------------------------
+void CPackedStore::LoadDirectoryIndex( uint32 nIndexOffset )
+{
+	Assert( m_pMappedDirectory );
+
+	if ( nIndexOffset + sizeof( VPKDirIndexHeader_t ) > ( uint64 )m_DirFileMapping.Size() )
+		return;
+
+	VPKDirIndexHeader_t const *pIndex = ( VPKDirIndexHeader_t const * )( m_DirFileMapping.Base() + nIndexOffset );
+	if ( pIndex->m_nIndexMarker != VPK_INDEX_MARKER ||
+		 pIndex->m_nVersion != VPK_INDEX_VERSION ||
+		 pIndex->m_nDirectorySize != m_nDirectoryDataSize ||
+		 V_memcmp( pIndex->m_DirectoryMD5, m_DirectoryMD5.bits, sizeof( m_DirectoryMD5.bits ) ) ||
+		 pIndex->m_nNumBuckets <= 0 || pIndex->m_nNumSlots <= 0 )
+		return;
+
+	uint64 nIndexSize = sizeof( VPKDirIndexHeader_t ) + 
+		( uint64 )pIndex->m_nNumBuckets * sizeof( uint32 ) +
+		( uint64 )pIndex->m_nNumSlots * sizeof( VPKDirIndexSlot_t );
+	if ( nIndexOffset + nIndexSize > ( uint64 )m_DirFileMapping.Size() )
+		return;
+
+	m_pDirIndex = pIndex;
+	m_pDirIndexDisplacements = ( uint32 const * )( pIndex + 1 );
+	m_pDirIndexSlots = ( VPKDirIndexSlot_t const * )( m_pDirIndexDisplacements + pIndex->m_nNumBuckets );
+	m_nHighestChunkFileIndex = pIndex->m_nHighestChunkFileIndex;
+}
+
+//-----------------------------------------------------------------------------
+// Copy the directory out of the mapping before it gets modified
+//-----------------------------------------------------------------------------
+void CPackedStore::UnmapDirectory( void )
+{
+	if ( !m_pMappedDirectory )
+		return;
+
+	m_DirectoryData.SetCount( m_nDirectoryDataSize );
+	V_memcpy( m_DirectoryData.Base(), m_pMappedDirectory, m_nDirectoryDataSize );
+
+	m_pMappedDirectory = NULL;
+	m_pDirIndex = NULL;
+	m_pDirIndexDisplacements = NULL;
+	m_pDirIndexSlots = NULL;
+
+	BuildHashTables();
+}
+
+void CPackedStore::SetMapDataFiles( bool bMapDataFiles )
+{
+#ifdef PLATFORM_64BITS
+	m_bMapDataFiles = bMapDataFiles;
+#else
+	// all the chunk files of a game don't fit a 32 bit address space
+	m_bMapDataFiles = false;
+#endif
+}
+
+uint8 const *CPackedStore::GetMappedDataFile( int nFileNumber, int64 &nSizeOut )
+{
+	AUTO_LOCK( m_Mutex );
+
+	if ( nFileNumber == VPKFILENUMBER_EMBEDDED_IN_DIR_FILE )
+	{
+		nSizeOut = m_DirFileMapping.Size();
+		return m_DirFileMapping.Base();
+	}
+
+	if ( nFileNumber < 0 )
+		return NULL;
+
+	while ( m_DataFileMappings.Count() <= nFileNumber )
+	{
+		m_DataFileMappings.AddToTail( NULL );
+	}
+
+	if ( !m_DataFileMappings[nFileNumber] )
+	{
+		// keep failed ones too, they'll be read through file handles
+		char szDataFileName[MAX_PATH];
+		GetDataFileName( szDataFileName, sizeof( szDataFileName ), nFileNumber );
+		m_DataFileMappings[nFileNumber] = new CPackedStoreFileMapping;
+		m_DataFileMappings[nFileNumber]->Map( szDataFileName );
+	}
+
+	nSizeOut = m_DataFileMappings[nFileNumber]->Size();
+	return m_DataFileMappings[nFileNumber]->Base();
+}
+
+
+CPackedStoreFileMapping::CPackedStoreFileMapping( void )
+{
+	m_pBase = NULL;
+	m_nSize = 0;
+#ifdef _WIN32
+	m_hFile = INVALID_HANDLE_VALUE;
+	m_hMapping = NULL;
+#endif
+}
+
+CPackedStoreFileMapping::~CPackedStoreFileMapping( void )
+{
+	Unmap();
+}
+
+bool CPackedStoreFileMapping::Map( char const *pszFileName )
+{
+	Unmap();
+
+#ifdef _WIN32
+	m_hFile = CreateFile( pszFileName, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL );
+	if ( m_hFile == INVALID_HANDLE_VALUE )
+		return false;
+
+	LARGE_INTEGER nSize;
+	if ( !GetFileSizeEx( m_hFile, &nSize ) || nSize.QuadPart <= 0 )
+	{
+		Unmap();
+		return false;
+	}
+
+	m_hMapping = CreateFileMapping( m_hFile, NULL, PAGE_READONLY, 0, 0, NULL );
+	void *pBase = m_hMapping ? MapViewOfFile( m_hMapping, FILE_MAP_READ, 0, 0, 0 ) : NULL;
+	if ( !pBase )
+	{
+		Unmap();
+		return false;
+	}
+
+	m_pBase = ( uint8 const * )pBase;
+	m_nSize = nSize.QuadPart;
+#else
+	int fd = open( pszFileName, O_RDONLY );
+	if ( fd < 0 )
+		return false;
+
+	struct stat st;
+	void *pBase = MAP_FAILED;
+	if ( fstat( fd, &st ) == 0 && st.st_size > 0 )
+	{
+		pBase = mmap( NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0 );
+	}
+	close( fd );
+
+	if ( pBase == MAP_FAILED )
+		return false;
+
+	m_pBase = ( uint8 const * )pBase;
+	m_nSize = st.st_size;
+#endif
+	return true;
+}
+
+void CPackedStoreFileMapping::Unmap( void )
+{
+#ifdef _WIN32
+	if ( m_pBase )
+		UnmapViewOfFile( m_pBase );
+	if ( m_hMapping )
+		CloseHandle( m_hMapping );
+	if ( m_hFile != INVALID_HANDLE_VALUE )
+		CloseHandle( m_hFile );
+	m_hMapping = NULL;
+	m_hFile = INVALID_HANDLE_VALUE;
+#else
+	if ( m_pBase )
+		munmap( ( void * )m_pBase, m_nSize );
+#endif
+	m_pBase = NULL;
+	m_nSize = 0;
+}
+
+
 bool CPackedStore::IsEmpty( void ) const
 {
-	return ( m_DirectoryData.Count() <= 1 );
+	return ( DirectoryDataSize() <= 1 );
 }
 
 static void StripTrailingString( char *pszBuf, const char *pszStrip )
@@ -341,8 +598,18 @@ CPackedStore::CPackedStore( char const *pFileBasename, char *pszFName, IBaseFile
 			uint32 nSizeOfHeader = dirFile.Tell();
 			int nSize = dirHeader.m_nDirectorySize;
 			m_nDirectoryDataSize = dirHeader.m_nDirectorySize;
-			m_DirectoryData.SetCount( nSize );
-			dirFile.MustRead( DirectoryData(), nSize );
+			if ( !bOpenForWrite && m_DirFileMapping.Map( pszFName ) && m_DirFileMapping.Size() >= nSizeOfHeader + nSize )
+			{
+				// no private copy, every process mounting this vpk shares the pages
+				m_pMappedDirectory = m_DirFileMapping.Base() + nSizeOfHeader;
+				dirFile.Seek( nSizeOfHeader + nSize );
+			}
+			else
+			{
+				m_DirFileMapping.Unmap();
+				m_DirectoryData.SetCount( nSize );
+				dirFile.MustRead( DirectoryData(), nSize );
+			}
 			// now, if we are opening for write, read the entire contents of the embedded data chunk in the dir into ram
 			if ( bOpenForWrite && bNewFileFormat )
 			{
@@ -371,6 +638,11 @@ CPackedStore::CPackedStore( char const *pFileBasename, char *pszFName, IBaseFile
 					}
 				}
 			}
+			else if ( bNewFileFormat )
+			{
+				// the hashes come after the embedded data
+				dirFile.Seek( nSizeOfHeader + nSize + dirHeader.m_nEmbeddedChunkSize );
+			}
 			int cbVecHashes = dirHeader.m_nChunkHashesSize;
 			int ctHashes = cbVecHashes/sizeof(m_vecChunkHashFraction[0]);
 			m_vecChunkHashFraction.EnsureCount( ctHashes );
@@ -422,13 +694,23 @@ CPackedStore::CPackedStore( char const *pFileBasename, char *pszFName, IBaseFile
 				m_Signature.SetCount( cubSignature );
 				dirFile.MustRead( m_Signature.Base(), cubSignature );
 			}
+
+			if ( m_pMappedDirectory && bNewFileFormat && dirHeader.m_nVersion == VPK_CURRENT_VERSION )
+			{
+				LoadDirectoryIndex( AlignValue( dirFile.Tell(), 4 ) );
+			}
 		}
 		Q_MakeAbsolutePath( m_pszFullPathName, sizeof( m_pszFullPathName ), m_pszFileBaseName );
 		V_strcat_safe( m_pszFullPathName, ".vpk" );
 		//Q_strlower( m_pszFullPathName ); // NO!  this screws up linux.
 		Q_FixSlashes( m_pszFullPathName );
 	}
-	BuildHashTables();
+
+	// the index replaces the lookup tables
+	if ( !m_pDirIndex )
+	{
+		BuildHashTables();
+	}
 }
 
 
@@ -454,6 +736,10 @@ void CPackedStore::GetDataFileName( char *pchFileNameOut, int cchFileNameOut, in
 
 CPackedStore::~CPackedStore( void )
 {
+	DiscardPendingChunkHashes();
+	CloseWriteHandle();
+	m_DataFileMappings.PurgeAndDeleteElements();
+
 	for( int i = 0; i < ARRAYSIZE( m_pExtensionData ) ; i++ )
 	{
 		m_pExtensionData[i].Purge();
@@ -618,15 +904,191 @@ CPackedStoreFileHandle CPackedStore::GetHandleForHashingFiles()
 	return ret;
 }
 
+//-----------------------------------------------------------------------------
+// Builds a minimal perfect hash over all files in the directory, see
+// packedstore_internal.h. Buckets are placed largest first, each gets the
+// first displacement that moves all of its files into free slots.
+//-----------------------------------------------------------------------------
+struct VPKIndexKey_t
+{
+	VPKDirIndexSlot_t m_Slot;
+	uint64 m_nHash;
+};
+
+static void WriteDirectoryIndex( CUtlBuffer &buf, char const *pDirectory, int nDirectorySize, MD5Value_t const &md5Directory, int nHighestChunkFileIndex )
+{
+	CUtlVector<VPKIndexKey_t> keys;
+	char const *pData = pDirectory;
+	while( *pData )
+	{
+		uint32 nExtOffset = pData - pDirectory;
+		pData += 1 + strlen( pData );
+		while( *pData )
+		{
+			uint32 nDirOffset = pData - pDirectory;
+			pData += 1 + strlen( pData );
+			while( *pData )
+			{
+				VPKIndexKey_t &key = keys[keys.AddToTail()];
+				key.m_Slot.m_nExtOffset = nExtOffset;
+				key.m_Slot.m_nDirOffset = nDirOffset;
+				key.m_Slot.m_nNameOffset = pData - pDirectory;
+				SkipFile( pData );
+			}
+			pData++;
+		}
+		pData++;
+	}
+
+	if ( !keys.Count() )
+		return;
+
+	int nNumBuckets = ( keys.Count() + 3 ) / 4;
+	int nNumSlots = keys.Count() + keys.Count() / 4 + 1;
+
+	CUtlVector<uint32> displacements;
+	CUtlVector<VPKDirIndexSlot_t> slots;
+	CUtlVector<int> bucketStart, bucketKeys, bucketOrder;
+	displacements.SetCount( nNumBuckets );
+	slots.SetCount( nNumSlots );
+	bucketStart.SetCount( nNumBuckets + 1 );
+	bucketKeys.SetCount( keys.Count() );
+
+	for ( uint32 nSeed = 0; nSeed < 64; nSeed++ )
+	{
+		FOR_EACH_VEC( keys, i )
+		{
+			VPKDirIndexSlot_t const &s = keys[i].m_Slot;
+			keys[i].m_nHash = VPKIndexHash( pDirectory + s.m_nExtOffset, pDirectory + s.m_nDirOffset, pDirectory + s.m_nNameOffset, nSeed );
+		}
+
+		// files by bucket
+		V_memset( bucketStart.Base(), 0, bucketStart.Count() * sizeof( int ) );
+		FOR_EACH_VEC( keys, i )
+		{
+			bucketStart[VPKIndexBucket( keys[i].m_nHash, nNumBuckets ) + 1]++;
+		}
+		int nLargestBucket = 0;
+		for ( int i = 0; i < nNumBuckets; i++ )
+		{
+			nLargestBucket = MAX( nLargestBucket, bucketStart[i + 1] );
+			bucketStart[i + 1] += bucketStart[i];
+		}
+		CUtlVector<int> fill;
+		fill.CopyArray( bucketStart.Base(), nNumBuckets );
+		FOR_EACH_VEC( keys, i )
+		{
+			bucketKeys[fill[VPKIndexBucket( keys[i].m_nHash, nNumBuckets )]++] = i;
+		}
+
+		// largest buckets first
+		bucketOrder.RemoveAll();
+		for ( int nSize = nLargestBucket; nSize > 0; nSize-- )
+		{
+			for ( int i = 0; i < nNumBuckets; i++ )
+			{
+				if ( bucketStart[i + 1] - bucketStart[i] == nSize )
+					bucketOrder.AddToTail( i );
+			}
+		}
+
+		for ( int i = 0; i < nNumSlots; i++ )
+		{
+			slots[i].m_nExtOffset = slots[i].m_nDirOffset = slots[i].m_nNameOffset = VPK_INDEX_INVALID_OFFSET;
+		}
+		V_memset( displacements.Base(), 0, displacements.Count() * sizeof( uint32 ) );
+
+		bool bPlacedAll = true;
+		FOR_EACH_VEC( bucketOrder, b )
+		{
+			int nBucket = bucketOrder[b];
+			bool bPlaced = false;
+			for ( uint32 nDisplacement = 0; nDisplacement < 0x10000 && !bPlaced; nDisplacement++ )
+			{
+				// claim slots until one is taken, release them again if it is
+				int k;
+				for ( k = bucketStart[nBucket]; k < bucketStart[nBucket + 1]; k++ )
+				{
+					VPKIndexKey_t const &key = keys[bucketKeys[k]];
+					VPKDirIndexSlot_t &slot = slots[VPKIndexSlot( key.m_nHash, nDisplacement, nNumSlots )];
+					if ( slot.m_nNameOffset != VPK_INDEX_INVALID_OFFSET )
+						break;
+					slot = key.m_Slot;
+				}
+
+				if ( k == bucketStart[nBucket + 1] )
+				{
+					displacements[nBucket] = nDisplacement;
+					bPlaced = true;
+				}
+				else
+				{
+					while ( --k >= bucketStart[nBucket] )
+					{
+						slots[VPKIndexSlot( keys[bucketKeys[k]].m_nHash, nDisplacement, nNumSlots )].m_nNameOffset = VPK_INDEX_INVALID_OFFSET;
+					}
+				}
+			}
+
+			if ( !bPlaced )
+			{
+				bPlacedAll = false;
+				break;
+			}
+		}
+
+		if ( !bPlacedAll )
+			continue;
+
+		VPKDirIndexHeader_t header;
+		header.m_nIndexMarker = VPK_INDEX_MARKER;
+		header.m_nVersion = VPK_INDEX_VERSION;
+		header.m_nDirectorySize = nDirectorySize;
+		V_memcpy( header.m_DirectoryMD5, md5Directory.bits, sizeof( header.m_DirectoryMD5 ) );
+		header.m_nSeed = nSeed;
+		header.m_nNumBuckets = nNumBuckets;
+		header.m_nNumSlots = nNumSlots;
+		header.m_nHighestChunkFileIndex = nHighestChunkFileIndex;
+
+		buf.Put( &header, sizeof( header ) );
+		buf.Put( displacements.Base(), displacements.Count() * sizeof( uint32 ) );
+		buf.Put( slots.Base(), slots.Count() * sizeof( VPKDirIndexSlot_t ) );
+		return;
+	}
+
+	Warning( "Couldn't build a lookup index for %d files, the vpk will be written without one\n", keys.Count() );
+}
+
+static void WriteDirectoryIndexJob( CUtlBuffer *pBuf, char const *pDirectory, int nDirectorySize, MD5Value_t md5Directory, int nHighestChunkFileIndex )
+{
+	WriteDirectoryIndex( *pBuf, pDirectory, nDirectorySize, md5Directory, nHighestChunkFileIndex );
+}
+
 void CPackedStore::Write( void )
 {
+	CloseWriteHandle();
+
+	// The lookup index only depends on the directory, build it on the pool
+	// while the file is put together, hashed and signed
+	CUtlBuffer bufIndex;
+	CJob *pIndexJob = NULL;
+	IThreadPool *pThreadPool = m_pThreadPool ? m_pThreadPool : g_pThreadPool;
+	if ( pThreadPool )
+	{
+		pIndexJob = pThreadPool->QueueCall( &WriteDirectoryIndexJob, &bufIndex, ( char const * )DirectoryData(), DirectoryDataSize(), m_DirectoryMD5, m_nHighestChunkFileIndex );
+	}
+	else
+	{
+		WriteDirectoryIndex( bufIndex, ( char const * )DirectoryData(), DirectoryDataSize(), m_DirectoryMD5, m_nHighestChunkFileIndex );
+	}
+
 	// !KLUDGE!
 	// Write the whole header into a buffer in memory.
 	// We do this so we can easily sign it.
 	CUtlBuffer bufDirFile;
 
 	VPKDirHeader_t headerOut;
-	headerOut.m_nDirectorySize = m_DirectoryData.Count();
+	headerOut.m_nDirectorySize = DirectoryDataSize();
 	headerOut.m_nEmbeddedChunkSize = m_EmbeddedChunkData.Count();
 	headerOut.m_nChunkHashesSize = m_vecChunkHashFraction.Count()*sizeof(m_vecChunkHashFraction[0]);
 	headerOut.m_nSelfHashesSize = 3*sizeof(m_DirectoryMD5.bits);
@@ -645,7 +1107,7 @@ void CPackedStore::Write( void )
 	}
 
 	bufDirFile.Put( &headerOut, sizeof( headerOut ) );
-	bufDirFile.Put( DirectoryData(), m_DirectoryData.Count() );
+	bufDirFile.Put( DirectoryData(), DirectoryDataSize() );
 
 	if ( m_EmbeddedChunkData.Count() )
 	{
@@ -736,6 +1198,18 @@ void CPackedStore::Write( void )
 		}
 	#endif
 
+	// lookup index for read-only opens, after everything older readers know about
+	while ( bufDirFile.TellPut() & 3 )
+	{
+		bufDirFile.PutUnsignedChar( 0 );
+	}
+	if ( pIndexJob )
+	{
+		pIndexJob->WaitForFinish();
+		pIndexJob->Release();
+	}
+	bufDirFile.Put( bufIndex.Base(), bufIndex.TellPut() );
+
 	char szOutFileName[MAX_PATH];
 
 	// Delete any existing header file, either the standalone kind,
@@ -1174,17 +1648,27 @@ int CPackedStore::ReadData( CPackedStoreFileHandle &handle, void *pOutData, int
 			nNumBytes -= nNumMetaDataBytes;
 		}
 		// satisfy remaining bytes from file
-		if ( nNumBytes > 0 )
+		int nDesiredPos = handle.m_nFileOffset + handle.m_nCurrentFileOffset - handle.m_nMetaDataSize;
+		if ( handle.m_nFileNumber == VPKFILENUMBER_EMBEDDED_IN_DIR_FILE )
+		{
+			// for file data in the directory header, all offsets are relative to the size of the dir header.
+			nDesiredPos += m_nDirectoryDataSize + sizeof( VPKDirHeader_t );
+		}
+
+		int64 nMappedSize = 0;
+		uint8 const *pMappedData = ( nNumBytes > 0 && m_bMapDataFiles ) ? GetMappedDataFile( handle.m_nFileNumber, nMappedSize ) : NULL;
+		if ( pMappedData && nDesiredPos + nNumBytes <= nMappedSize )
+		{
+			// straight from the page cache, no file handle or cache line involved
+			memcpy( pOutData, pMappedData + nDesiredPos, nNumBytes );
+			handle.m_nCurrentFileOffset += nNumBytes;
+			nRet += nNumBytes;
+		}
+		else if ( nNumBytes > 0 )
 		{
 			FileHandleTracker_t &fHandle = GetFileHandle( handle.m_nFileNumber );
-			int nDesiredPos = handle.m_nFileOffset + handle.m_nCurrentFileOffset - handle.m_nMetaDataSize;
 			int nRead;
 			fHandle.m_Mutex.Lock();
-			if ( handle.m_nFileNumber == VPKFILENUMBER_EMBEDDED_IN_DIR_FILE )
-			{
-				// for file data in the directory header, all offsets are relative to the size of the dir header.
-				nDesiredPos += m_nDirectoryDataSize + sizeof( VPKDirHeader_t );
-			}
 
 			if ( m_PackedStoreReadCache.BCanSatisfyFromReadCache( (uint8 *)pOutData, handle, fHandle, nDesiredPos, nNumBytes, nRead ) )
 			{
@@ -1302,53 +1786,200 @@ void CPackedStore::DiscardChunkHashes( int iChunkFileIndex )
 	}
 }
 
+// Chunk files are hashed in 1MB fractions
+static const int k_nFileFractionSize = 0x00100000;
+
+// Fractions are read in pieces this size
+static const int k_nHashReadSize = 256*1024;
+
+void CPackedStore::CloseWriteHandle( void )
+{
+	if ( m_hWriteHandle != FILESYSTEM_INVALID_HANDLE )
+	{
+		m_pFileSystem->Close( m_hWriteHandle );
+		m_hWriteHandle = FILESYSTEM_INVALID_HANDLE;
+		m_nWriteHandleChunk = -1;
+		m_nWriteHandleSize = 0;
+	}
+}
+
+void CPackedStore::HashChunkFraction( ChunkHashFraction_t &fraction )
+{
+	// Every fraction gets its own handle, the tracked ones are shared with
+	// their seek position
+	MD5Context_t ctx;
+	memset(&ctx, 0, sizeof(MD5Context_t));
+	MD5Init(&ctx);
+
+	int nRemaining = fraction.m_cbChunkLen;
+	if ( nRemaining > 0 )
+	{
+		char szDataFileName[MAX_PATH];
+		GetDataFileName( szDataFileName, sizeof(szDataFileName), fraction.m_nPackFileNumber );
+		FileHandle_t hFile = m_pFileSystem->Open( szDataFileName, "rb" );
+		if ( hFile )
+		{
+			uint8 *pBuffer = (uint8 *)malloc( k_nHashReadSize );
+			m_pFileSystem->Seek( hFile, fraction.m_nFileFraction, FILESYSTEM_SEEK_HEAD );
+			while ( nRemaining > 0 )
+			{
+				int nRead = m_pFileSystem->Read( pBuffer, MIN( nRemaining, k_nHashReadSize ), hFile );
+				if ( nRead <= 0 )
+					break;
+				MD5Update(&ctx, pBuffer, nRead);
+				nRemaining -= nRead;
+			}
+			free( pBuffer );
+			m_pFileSystem->Close( hFile );
+		}
+	}
+	MD5Final( fraction.m_md5contents.bits, &ctx);
+}
+
+// Lay out the fractions of a chunk the same way hashing it one fraction at a time
+// would: a file that is a multiple of the fraction size still gets an empty
+// fraction at its end
+static void AddChunkFractions( CUtlVector<ChunkHashFraction_t> &fractions, int iChunkFileIndex, int64 nFileSize )
+{
+	for ( int nFileFraction = 0; nFileFraction <= nFileSize; nFileFraction += k_nFileFractionSize )
+	{
+		ChunkHashFraction_t &fraction = fractions[ fractions.AddToTail() ];
+		memset( &fraction, 0, sizeof( fraction ) );
+		fraction.m_nPackFileNumber = iChunkFileIndex;
+		fraction.m_nFileFraction = nFileFraction;
+		fraction.m_cbChunkLen = MIN( nFileSize - nFileFraction, (int64)k_nFileFractionSize );
+	}
+}
+
+void CPackedStore::HashChunkFractions( const CUtlVector<int> &chunkFileIndices )
+{
+	CloseWriteHandle();
+
+	CUtlVector<ChunkHashFraction_t> fractions;
+	FOR_EACH_VEC( chunkFileIndices, it )
+	{
+		char szDataFileName[MAX_PATH];
+		GetDataFileName( szDataFileName, sizeof(szDataFileName), chunkFileIndices[it] );
+		int64 nFileSize = MAX( (int)m_pFileSystem->Size( szDataFileName ), 0 );
+
+		AddChunkFractions( fractions, chunkFileIndices[it], nFileSize );
+	}
+
+	CParallelProcessor<ChunkHashFraction_t, CMemberFuncJobItemProcessor<ChunkHashFraction_t, CPackedStore, CPackedStore> > processor( "CPackedStore::HashChunkFraction" );
+	processor.m_ItemProcessor.Init( this, &CPackedStore::HashChunkFraction );
+	processor.Run( fractions.Base(), fractions.Count(), INT_MAX, m_pThreadPool );
+
+	// the sort vector puts them in the same order whichever thread finished first
+	FOR_EACH_VEC( fractions, i )
+	{
+		m_vecChunkHashFraction.Insert( fractions[i] );
+	}
+}
+
 void CPackedStore::HashChunkFile( int iChunkFileIndex )
 {
 	AUTO_LOCK( m_Mutex );
-	static const int k_nFileFractionSize = 0x00100000; // 1 MB
 
 	// Purge any hashes we already have for this chunk.
 	DiscardChunkHashes( iChunkFileIndex );
 
-	CPackedStoreFileHandle VPKHandle = GetHandleForHashingFiles();
-	VPKHandle.m_nFileNumber = iChunkFileIndex;
-
-	int nFileFraction = 0;
-	while ( 1 )
-	{
-		FileHash_t filehash;
-
-		// VPKHandle.m_nFileNumber;
-		// nFileFraction;
-		int64 fileSize = 0;
-		// if we have never hashed this before - do it now
-		HashEntirePackFile( VPKHandle, fileSize, nFileFraction, k_nFileFractionSize, filehash );
-		ChunkHashFraction_t fileHashFraction;
-		fileHashFraction.m_cbChunkLen = filehash.m_cbFileLen;
-		fileHashFraction.m_nPackFileNumber = VPKHandle.m_nFileNumber;
-		fileHashFraction.m_nFileFraction = nFileFraction;
-		Q_memcpy( fileHashFraction.m_md5contents.bits, filehash.m_md5contents.bits, sizeof(fileHashFraction.m_md5contents) );
-		m_vecChunkHashFraction.Insert( fileHashFraction );
-		// move to next section
-		nFileFraction += k_nFileFractionSize;
-		// if we are at EOF we are done
-		if ( nFileFraction > fileSize )
-			break;
+	if ( !TakePendingChunkHash( iChunkFileIndex ) )
+	{
+		CUtlVector<int> chunkFileIndices;
+		chunkFileIndices.AddToTail( iChunkFileIndex );
+		HashChunkFractions( chunkFileIndices );
 	}
 }
 
 
 void CPackedStore::HashAllChunkFiles()
 {
+	AUTO_LOCK( m_Mutex );
+
 	// Rebuild the directory hash tables.  The main reason to do this is
 	// so that the highest chunk number is correct, in case chunks have
 	// been removed.
 	BuildHashTables();
 
-	// make brand new hashes
+	// make brand new hashes. Chunks AddFile() finished have been hashed while the
+	// later ones were written, the fractions of the rest are spread over the pool together
 	m_vecChunkHashFraction.Purge();
+	CUtlVector<int> chunkFileIndices;
 	for ( int iChunkFileIndex = 0 ; iChunkFileIndex <= GetHighestChunkFileIndex() ; ++iChunkFileIndex )
-		HashChunkFile( iChunkFileIndex );
+	{
+		if ( !TakePendingChunkHash( iChunkFileIndex ) )
+		{
+			chunkFileIndices.AddToTail( iChunkFileIndex );
+		}
+	}
+	DiscardPendingChunkHashes();
+
+	HashChunkFractions( chunkFileIndices );
+}
+
+void CPackedStore::QueueChunkHash( int iChunkFileIndex, int64 nFileSize )
+{
+	IThreadPool *pThreadPool = m_pThreadPool ? m_pThreadPool : g_pThreadPool;
+	if ( !pThreadPool )
+		return;
+
+	PendingChunkHash_t *pPending = new PendingChunkHash_t;
+	pPending->m_nChunkFileIndex = iChunkFileIndex;
+	pPending->m_nFileSize = nFileSize;
+	AddChunkFractions( pPending->m_Fractions, iChunkFileIndex, nFileSize );
+	pPending->m_pJob = pThreadPool->QueueCall( this, &CPackedStore::HashPendingChunk, pPending );
+	m_PendingChunkHashes.AddToTail( pPending );
+}
+
+void CPackedStore::HashPendingChunk( PendingChunkHash_t *pPending )
+{
+	FOR_EACH_VEC( pPending->m_Fractions, i )
+	{
+		HashChunkFraction( pPending->m_Fractions[i] );
+	}
+}
+
+// Use the hashes made while AddFile() went on to later chunks, if the chunk
+// is still what was hashed
+bool CPackedStore::TakePendingChunkHash( int iChunkFileIndex )
+{
+	FOR_EACH_VEC( m_PendingChunkHashes, it )
+	{
+		PendingChunkHash_t *pPending = m_PendingChunkHashes[it];
+		if ( pPending->m_nChunkFileIndex != iChunkFileIndex )
+			continue;
+
+		pPending->m_pJob->WaitForFinish();
+		pPending->m_pJob->Release();
+		m_PendingChunkHashes.Remove( it );
+
+		char szDataFileName[MAX_PATH];
+		GetDataFileName( szDataFileName, sizeof(szDataFileName), iChunkFileIndex );
+		bool bValid = ( m_pFileSystem->Size( szDataFileName ) == pPending->m_nFileSize );
+		if ( bValid )
+		{
+			FOR_EACH_VEC( pPending->m_Fractions, i )
+			{
+				m_vecChunkHashFraction.Insert( pPending->m_Fractions[i] );
+			}
+		}
+
+		delete pPending;
+		return bValid;
+	}
+
+	return false;
+}
+
+void CPackedStore::DiscardPendingChunkHashes( void )
+{
+	FOR_EACH_VEC( m_PendingChunkHashes, it )
+	{
+		m_PendingChunkHashes[it]->m_pJob->Abort();
+		m_PendingChunkHashes[it]->m_pJob->WaitForFinish();
+		m_PendingChunkHashes[it]->m_pJob->Release();
+	}
+	m_PendingChunkHashes.PurgeAndDeleteElements();
 }
 
 void CPackedStore::ComputeDirectoryHash( MD5Value_t &md5Directory )
@@ -1356,7 +1987,7 @@ void CPackedStore::ComputeDirectoryHash( MD5Value_t &md5Directory )
 	MD5Context_t ctx;
 	memset(&ctx, 0, sizeof(MD5Context_t));
 	MD5Init(&ctx);
-	MD5Update(&ctx, m_DirectoryData.Base(), m_DirectoryData.Count() );
+	MD5Update(&ctx, ( uint8 const * )DirectoryData(), DirectoryDataSize() );
 	MD5Final( md5Directory.bits, &ctx);
 }
 
@@ -1428,6 +2059,10 @@ void CPackedStore::GetPackFileName( CPackedStoreFileHandle &handle, char *pchFil
 FileHandleTracker_t & CPackedStore::GetFileHandle( int nFileNumber )
 {
 	AUTO_LOCK( m_Mutex );
+
+	// flush what AddFile() wrote before reading it back
+	CloseWriteHandle();
+
 	int nFileHandleIdx = nFileNumber % ARRAYSIZE( m_FileHandles );
 
 	if ( m_FileHandles[nFileHandleIdx].m_nFileNumber == nFileNumber )
@@ -1486,6 +2121,8 @@ bool CPackedStore::RemoveFileFromDirectory( const char *pszName )
 
 bool CPackedStore::InternalRemoveFileFromDirectory( const char *pszName )
 {
+	UnmapDirectory();
+
 	CPackedStoreFileHandle pData = OpenFile( pszName );
 	if ( !pData )
 		return false;
@@ -1508,6 +2145,7 @@ void CPackedStore::AddFileToDirectory( const VPKContentFileInfo_t &info )
 
 	// First, remove it if it's already there,
 	// without rebuilding the hash tables
+	UnmapDirectory();
 	InternalRemoveFileFromDirectory( info.m_sName );
 
 	// let's build out a header
@@ -1645,8 +2283,15 @@ ePackedStoreAddResultCode CPackedStore::AddFile( char const *pFile, uint16 nMeta
 			dirEntry.m_idxChunk = m_nHighestChunkFileIndex;
 
 			// Append to most recent chunk
-			GetDataFileName( szDataFileName, sizeof(szDataFileName), m_nHighestChunkFileIndex );
-			dirEntry.m_iOffsetInChunk = g_pFullFileSystem->Size( szDataFileName );
+			if ( m_hWriteHandle != FILESYSTEM_INVALID_HANDLE && m_nWriteHandleChunk == m_nHighestChunkFileIndex )
+			{
+				dirEntry.m_iOffsetInChunk = m_nWriteHandleSize;
+			}
+			else
+			{
+				GetDataFileName( szDataFileName, sizeof(szDataFileName), m_nHighestChunkFileIndex );
+				dirEntry.m_iOffsetInChunk = g_pFullFileSystem->Size( szDataFileName );
+			}
 			if ( (int)dirEntry.m_iOffsetInChunk <= 0 ) // technical wrong, but we shouldn't have 2GB chunks.  (Sort of defeats the whole purpose.)
 			{
 				// Note, there is one possible failure case.  if we have a file whose data
@@ -1667,17 +2312,32 @@ ePackedStoreAddResultCode CPackedStore::AddFile( char const *pFile, uint16 nMeta
 
 		m_nHighestChunkFileIndex = MAX( m_nHighestChunkFileIndex, dirEntry.m_idxChunk );
 
-		// write the actual data
-		GetDataFileName( szDataFileName, sizeof(szDataFileName), dirEntry.m_idxChunk );
-		FileHandle_t fHandle = m_pFileSystem->Open( szDataFileName, "rb+" );
-		if ( !fHandle && dirEntry.m_iOffsetInChunk == 0 )
-			fHandle = m_pFileSystem->Open( szDataFileName, "wb" );
-		if ( !fHandle )
-			Error( "Cannot open %s for writing", szDataFileName );
-
-		m_pFileSystem->Seek( fHandle, dirEntry.m_iOffsetInChunk, FILESYSTEM_SEEK_HEAD );
-		m_pFileSystem->Write( pDataStart, nBytesInChunk, fHandle );
-		m_pFileSystem->Close( fHandle );
+		// write the actual data, the chunk stays open for the next file
+		if ( m_hWriteHandle == FILESYSTEM_INVALID_HANDLE || m_nWriteHandleChunk != dirEntry.m_idxChunk )
+		{
+			int iFinishedChunk = ( m_hWriteHandle != FILESYSTEM_INVALID_HANDLE && m_nWriteHandleChunk < dirEntry.m_idxChunk ) ? m_nWriteHandleChunk : -1;
+			int64 nFinishedChunkSize = m_nWriteHandleSize;
+
+			CloseWriteHandle();
+
+			// nothing is appended to a chunk once the next one is started, hash it while that is written
+			if ( iFinishedChunk >= 0 )
+			{
+				QueueChunkHash( iFinishedChunk, nFinishedChunkSize );
+			}
+
+			GetDataFileName( szDataFileName, sizeof(szDataFileName), dirEntry.m_idxChunk );
+			m_hWriteHandle = m_pFileSystem->Open( szDataFileName, "rb+" );
+			if ( !m_hWriteHandle && dirEntry.m_iOffsetInChunk == 0 )
+				m_hWriteHandle = m_pFileSystem->Open( szDataFileName, "wb" );
+			if ( !m_hWriteHandle )
+				Error( "Cannot open %s for writing", szDataFileName );
+			m_nWriteHandleChunk = dirEntry.m_idxChunk;
+		}
+
+		m_pFileSystem->Seek( m_hWriteHandle, dirEntry.m_iOffsetInChunk, FILESYSTEM_SEEK_HEAD );
+		m_pFileSystem->Write( pDataStart, nBytesInChunk, m_hWriteHandle );
+		m_nWriteHandleSize = dirEntry.m_iOffsetInChunk + nBytesInChunk;
 
 		// Force on the use of the "dir" file
 		m_bUseDirFile = true;
@@ -55,6 +55,39 @@ struct VPKDirHeaderOld_t
 };
 
 
+// Perfect hash index of all files in the directory, written after the signature
+// (4 byte aligned) so older readers never look at it:
+//
+//	VPKDirIndexHeader_t
+//	uint32 displacement[m_nNumBuckets]
+//	VPKDirIndexSlot_t slot[m_nNumSlots]
+//
+// A file's 64 bit hash picks a bucket, the bucket's displacement picks the slot.
+// Every file lands in a slot of its own, the slot is checked against the name.
+#define VPK_INDEX_MARKER 0x494b5056							// "VPKI"
+#define VPK_INDEX_VERSION 1
+#define VPK_INDEX_INVALID_OFFSET 0xffffffff
+
+struct VPKDirIndexHeader_t
+{
+	int32 m_nIndexMarker;
+	int32 m_nVersion;
+	int32 m_nDirectorySize;									// of the directory the index was built for
+	uint8 m_DirectoryMD5[16];								// ditto
+	uint32 m_nSeed;
+	int32 m_nNumBuckets;
+	int32 m_nNumSlots;
+	int32 m_nHighestChunkFileIndex;
+};
+
+struct VPKDirIndexSlot_t
+{
+	uint32 m_nExtOffset;									// offsets of the names in the directory data,
+	uint32 m_nDirOffset;									// m_nNameOffset is VPK_INDEX_INVALID_OFFSET
+	uint32 m_nNameOffset;									// for empty slots
+};
+
+
 #include "vpklib/packedstore.h"
 
 
@@ -28,6 +28,9 @@
 
 class CJobThread;
 
+// Job thread running on this thread, if any
+static CTHREADLOCALPTR( CJobThread ) g_pCurrentJobThread;
+
 //-----------------------------------------------------------------------------
 
 inline void ServiceJobAndRelease( CJob *pJob, int iThread = -1 )
@@ -176,6 +179,107 @@ private:
 
 } ALIGN16_POST;
 
+//-----------------------------------------------------------------------------
+// Job deque of one thread of a work stealing pool. The owning thread pushes
+// and pops at the back (LIFO, its data is still in cache), other threads
+// steal from the front (FIFO, the oldest jobs). Every priority has its own
+// ring so the highest priority job is always taken first.
+//-----------------------------------------------------------------------------
+
+class CJobDeque
+{
+public:
+	CJobDeque( CInterlockedInt *pPoolCounts ) :
+		m_pPoolCounts( pPoolCounts )
+	{
+		memset( m_Rings, 0, sizeof( m_Rings ) );
+	}
+
+	~CJobDeque()
+	{
+		for ( int i = 0; i < ARRAYSIZE( m_Rings ); i++ )
+		{
+			free( m_Rings[i].m_ppJobs );
+		}
+	}
+
+	void PushBack( CJob *pJob )
+	{
+		pJob->AddRef();
+
+		JobPriority_t priority = pJob->GetPriority();
+		AUTO_LOCK( m_mutex );
+		Ring_t &ring = m_Rings[priority];
+		if ( ring.m_nCount == ring.m_nSize )
+		{
+			Grow( ring );
+		}
+		ring.m_ppJobs[( ring.m_iHead + ring.m_nCount ) & ( ring.m_nSize - 1 )] = pJob;
+		ring.m_nCount++;
+		m_pPoolCounts[priority]++;
+	}
+
+	bool PopBack( JobPriority_t priority, CJob **ppJob )
+	{
+		if ( !m_Rings[priority].m_nCount )
+			return false;
+
+		AUTO_LOCK( m_mutex );
+		Ring_t &ring = m_Rings[priority];
+		if ( !ring.m_nCount )
+			return false;
+
+		ring.m_nCount--;
+		*ppJob = ring.m_ppJobs[( ring.m_iHead + ring.m_nCount ) & ( ring.m_nSize - 1 )];
+		m_pPoolCounts[priority]--;
+		return true;
+	}
+
+	bool PopFront( JobPriority_t priority, CJob **ppJob )
+	{
+		if ( !m_Rings[priority].m_nCount )
+			return false;
+
+		AUTO_LOCK( m_mutex );
+		Ring_t &ring = m_Rings[priority];
+		if ( !ring.m_nCount )
+			return false;
+
+		*ppJob = ring.m_ppJobs[ring.m_iHead];
+		ring.m_iHead = ( ring.m_iHead + 1 ) & ( ring.m_nSize - 1 );
+		ring.m_nCount--;
+		m_pPoolCounts[priority]--;
+		return true;
+	}
+
+private:
+	struct Ring_t
+	{
+		CJob			**m_ppJobs;
+		int				m_nSize;		// power of two
+		int				m_iHead;
+		volatile int	m_nCount;		// read unlocked to skip empty rings
+	};
+
+	static void Grow( Ring_t &ring )
+	{
+		int nNewSize = ( ring.m_nSize ) ? ring.m_nSize * 2 : 64;
+		CJob **ppJobs = (CJob **)malloc( nNewSize * sizeof( CJob * ) );
+		for ( int i = 0; i < ring.m_nCount; i++ )
+		{
+			ppJobs[i] = ring.m_ppJobs[( ring.m_iHead + i ) & ( ring.m_nSize - 1 )];
+		}
+		free( ring.m_ppJobs );
+		ring.m_ppJobs = ppJobs;
+		ring.m_nSize = nNewSize;
+		ring.m_iHead = 0;
+	}
+
+	Ring_t				m_Rings[JP_HIGH + 1];
+	CInterlockedInt		*m_pPoolCounts;		// jobs of each priority in all deques of the pool
+	CThreadFastMutex	m_mutex;
+};
+
 //-----------------------------------------------------------------------------
 //
 // CThreadPool
@@ -264,6 +368,15 @@ private:
 	CJob *PeekJob();
 	CJob *GetDummyJob();
 
+	//-----------------------------------------------------
+	// Work stealing
+	//-----------------------------------------------------
+	void PushStealableJob( CJob *pJob );
+	CJob *StealJob( int iThief, JobPriority_t priority );
+	CJob *PopStealableJob( int iThread );
+	bool HasStealableJobs();
+	CThreadEvent &GetJobAvailableEvent()	{ return ( m_bWorkStealing ) ? (CThreadEvent &)m_StealableJobEvent : m_SharedQueue.GetEventHandle(); }
+
 	//-----------------------------------------------------
 	// Thread functions
 	//-----------------------------------------------------
@@ -285,6 +398,16 @@ private:
 	//	and the main thread coming in and "helping" with jobs breaks that pretty nicely. This flag states that
 	//	only the threadpool threads should execute these jobs.
 	bool					m_bExecOnThreadPoolThreadsOnly;
+
+	// In work stealing mode jobs go to the deque of one thread instead of the
+	// shared queue, m_StealableJobEvent is set while any deque has jobs
+	bool					m_bWorkStealing;
+	CUtlVector<CJobDeque *>	m_Deques;
+	CInterlockedInt			m_nStealableJobs[JP_HIGH + 1];
+	CInterlockedInt			m_iNextDeque;
+	CThreadManualEvent		m_StealableJobEvent;
+	CInterlockedInt			m_nStealableJobSignaled;	// skips setting the event again on every push
+	CThreadFastMutex		m_StealableJobResetMutex;
 };
 
 //-----------------------------------------------------------------------------
@@ -318,6 +441,11 @@ public:
 			// Cap the GlobPool threads at 4.
 			startParams.nThreadsMax = 4;
 		}
+
+		if ( CommandLine()->FindParm( "-threadpool_workstealing" ) )
+		{
+			startParams.bWorkStealing = true;
+		}
 		return CThreadPool::Start( startParams, "Glob" );
 	}
 
@@ -368,7 +496,7 @@ private:
 		HANDLE	 waitHandles[NUM_EVENTS];
 		
 		waitHandles[CALL_FROM_MASTER]	= GetCallHandle().GetHandle();
-		waitHandles[SHARED_QUEUE]		= m_SharedQueue.GetEventHandle().GetHandle();
+		waitHandles[SHARED_QUEUE]		= m_pOwner->GetJobAvailableEvent().GetHandle();
 		waitHandles[DIRECT_QUEUE] 		= m_DirectQueue.GetEventHandle().GetHandle();
 		
 #ifdef _DEBUG
@@ -386,7 +514,7 @@ private:
 		while( !bSet )
 		{
 			// Jobs are typically enqueued to the shared job queue so wait on it first.
-			bSet = m_SharedQueue.GetEventHandle().Wait( nWaitTime );
+			bSet = m_pOwner->GetJobAvailableEvent().Wait( nWaitTime );
 			if( !bSet )
 				bSet = m_DirectQueue.GetEventHandle().Wait( 10 );
 			if ( !bSet )
@@ -411,6 +539,8 @@ private:
 
 		tmZone( TELEMETRY_LEVEL0, TMZF_NONE, "%s", __FUNCTION__ );
 
+		g_pCurrentJobThread = this;
+
 		m_pOwner->m_nIdleThreads++;
 		m_IdleEvent.Set();
 		while (!bExit && ( ( waitResult = Wait() ) != WAIT_FAILED ) )
@@ -461,7 +591,15 @@ private:
 				{
 					if ( !m_DirectQueue.Pop( &pJob) )
 					{
-						if ( !m_SharedQueue.Pop( &pJob ) )
+						if ( m_pOwner->m_bWorkStealing )
+						{
+							pJob = m_pOwner->PopStealableJob( m_iThread );
+							if ( !pJob )
+							{
+								break;
+							}
+						}
+						else if ( !m_SharedQueue.Pop( &pJob ) )
 						{
 							// Nothing to process, return to wait state
 							break;
@@ -486,9 +624,23 @@ private:
 		}
 		m_pOwner->m_nIdleThreads--;
 		m_IdleEvent.Reset();
+		g_pCurrentJobThread = NULL;
 		return 0;
 	}
 
+public:
+	CThreadPool *GetOwner()
+	{
+		return m_pOwner;
+	}
+
+	int GetThreadIndex()
+	{
+		return m_iThread;
+	}
+
+private:
+
 	CJobQueue			m_DirectQueue;
 	CJobQueue &			m_SharedQueue;
 	CThreadPool *		m_pOwner;
@@ -510,7 +662,8 @@ IThreadPool *g_pThreadPool = &g_ThreadPool;
 CThreadPool::CThreadPool() :
 	m_nIdleThreads( 0 ),
 	m_nJobs( 0 ),
-	m_nSuspend( 0 )
+	m_nSuspend( 0 ),
+	m_bWorkStealing( false )
 {
 }
 
@@ -618,7 +771,7 @@ int CThreadPool::YieldWait( CThreadEvent **pEvents, int nEvents, bool bWaitAll,
 	timeout = 0;
 	while ( ( result = CThreadEvent::WaitForMultiple( nEvents, pEvents, bWaitAll, timeout ) ) == TW_TIMEOUT )
 	{
-		if ( !m_bExecOnThreadPoolThreadsOnly && m_SharedQueue.Pop( &pJob ) )
+		if ( !m_bExecOnThreadPoolThreadsOnly && ( m_bWorkStealing ? ( ( pJob = PopStealableJob( -1 ) ) != NULL ) : m_SharedQueue.Pop( &pJob ) ) )
 		{
 			ServiceJobAndRelease( pJob );
 			m_nJobs--;
@@ -725,6 +878,11 @@ void CThreadPool::InsertJobInQueue( CJob *pJob )
 		int iThread = pJob->GetServiceThread();
 		if ( iThread == -1 || !m_Threads.IsValidIndex( iThread ) )
 		{
+			if ( m_bWorkStealing )
+			{
+				PushStealableJob( pJob );
+				return;
+			}
 			pQueue = &m_SharedQueue;
 		}
 		else
@@ -773,7 +931,14 @@ void CThreadPool::ChangePriority( CJob *pJob, JobPriority_t priority )
 	if ( pJob->GetPriority() < priority )
 	{
 		pJob->SetPriority( priority );
-		m_SharedQueue.Push( pJob );
+		if ( m_bWorkStealing )
+		{
+			PushStealableJob( pJob );
+		}
+		else
+		{
+			m_SharedQueue.Push( pJob );
+		}
 	}
 	else
 	{
@@ -847,6 +1012,28 @@ int CThreadPool::ExecuteToPriority( JobPriority_t iToPriority, JobFilter_t pfnFi
 			m_nJobs--;
 			nExecuted++;
 		}
+
+		while ( ( pJob = StealJob( -1, (JobPriority_t)iCurPriority ) ) != NULL )
+		{
+			if ( pfnFilter && !(*pfnFilter)( pJob ) )
+			{
+				if ( pJob->CanExecute() )
+				{
+					jobsToPutBack.EnsureCapacity( nJobsTotal );
+					jobsToPutBack.AddToTail( pJob );
+				}
+				else
+				{
+					m_nJobs--;
+					pJob->Release(); // see above
+				}
+				continue;
+			}
+
+			ServiceJobAndRelease( pJob );
+			m_nJobs--;
+			nExecuted++;
+		}
 	}
 
 	for ( i = 0; i < jobsToPutBack.Count(); i++ )
@@ -877,6 +1064,16 @@ int CThreadPool::AbortAll()
 		iAborted++;
 	}
 
+	for ( int iPriority = JP_HIGH; iPriority >= 0; --iPriority )
+	{
+		while ( ( pJob = StealJob( -1, (JobPriority_t)iPriority ) ) != NULL )
+		{
+			pJob->Abort();
+			pJob->Release();
+			iAborted++;
+		}
+	}
+
 	for ( int i = 0; i < m_Threads.Count(); i++ )
 	{
 		CJobQueue &queue = m_Threads[i]->AccessDirectQueue();
@@ -980,6 +1177,17 @@ bool CThreadPool::Start( const ThreadPoolStartParams_t &startParams, const char
 	m_Threads.EnsureCapacity( nThreads );
 	m_IdleEvents.EnsureCapacity( nThreads );
 
+	m_bWorkStealing = startParams.bWorkStealing;
+	if ( m_bWorkStealing )
+	{
+		// deques exist before any thread can look for work in them
+		m_Deques.EnsureCapacity( nThreads );
+		for ( int i = 0; i < nThreads; i++ )
+		{
+			m_Deques.AddToTail( new CJobDeque( m_nStealableJobs ) );
+		}
+	}
+
 	if ( !pszName )
 	{
 		pszName = ( startParams.bIOThreads ) ? "IOJobX" : "CmpJobX";
@@ -1108,6 +1316,21 @@ bool CThreadPool::Stop( int timeout )
 		delete m_Threads[i];
 	}
 
+	// no thread can steal anymore, abort whatever is left in the deques
+	CJob *pJob;
+	for ( int iPriority = JP_HIGH; iPriority >= 0; --iPriority )
+	{
+		while ( ( pJob = StealJob( -1, (JobPriority_t)iPriority ) ) != NULL )
+		{
+			pJob->Abort();
+			pJob->Release();
+		}
+	}
+	m_Deques.PurgeAndDeleteElements();
+	m_nStealableJobSignaled = 0;
+	m_StealableJobEvent.Reset();
+	m_bWorkStealing = false;
+
 	m_nJobs = 0;
 	m_SharedQueue.Flush();
 	m_nIdleThreads = 0;
@@ -1117,6 +1340,100 @@ bool CThreadPool::Stop( int timeout )
 	return true;
 }
 
+//---------------------------------------------------------
+// Work stealing
+//---------------------------------------------------------
+
+void CThreadPool::PushStealableJob( CJob *pJob )
+{
+	// a pool thread keeps the jobs it creates, other threads spread them
+	CJobThread *pCurrent = g_pCurrentJobThread;
+	int iDeque;
+	if ( pCurrent && pCurrent->GetOwner() == this )
+	{
+		iDeque = pCurrent->GetThreadIndex();
+	}
+	else
+	{
+		iDeque = (unsigned)( m_iNextDeque++ ) % (unsigned)m_Deques.Count();
+	}
+
+	m_Deques[iDeque]->PushBack( pJob );
+	if ( !m_nStealableJobSignaled && m_nStealableJobSignaled.AssignIf( 0, 1 ) )
+	{
+		m_StealableJobEvent.Set();
+	}
+}
+
+//---------------------------------------------------------
+
+CJob *CThreadPool::StealJob( int iThief, JobPriority_t priority )
+{
+	if ( !m_nStealableJobs[priority] )
+	{
+		return NULL;
+	}
+
+	// start with the thief's neighbour so thieves don't all hit the same deque
+	CJob *pJob;
+	int nDeques = m_Deques.Count();
+	for ( int i = 1; i <= nDeques; i++ )
+	{
+		int iVictim = ( iThief + i ) % nDeques;
+		if ( iVictim != iThief && m_Deques[iVictim]->PopFront( priority, &pJob ) )
+		{
+			return pJob;
+		}
+	}
+	return NULL;
+}
+
+//---------------------------------------------------------
+
+CJob *CThreadPool::PopStealableJob( int iThread )
+{
+	CJob *pJob;
+	for ( int iPriority = JP_HIGH; iPriority >= 0; --iPriority )
+	{
+		if ( iThread != -1 && m_Deques[iThread]->PopBack( (JobPriority_t)iPriority, &pJob ) )
+		{
+			return pJob;
+		}
+
+		if ( ( pJob = StealJob( iThread, (JobPriority_t)iPriority ) ) != NULL )
+		{
+			return pJob;
+		}
+	}
+
+	// Out of work. A job pushed before the reset is seen by HasStealableJobs(),
+	// one pushed after it sets the event again. Resets are serialized so one
+	// thread can't clear the event another one just set for a pending job.
+	AUTO_LOCK( m_StealableJobResetMutex );
+	m_nStealableJobSignaled = 0;
+	m_StealableJobEvent.Reset();
+	if ( HasStealableJobs() )
+	{
+		m_nStealableJobSignaled = 1;
+		m_StealableJobEvent.Set();
+	}
+	return NULL;
+}
+
+//---------------------------------------------------------
+
+bool CThreadPool::HasStealableJobs()
+{
+	for ( int iPriority = JP_HIGH; iPriority >= 0; --iPriority )
+	{
+		if ( m_nStealableJobs[iPriority] )
+		{
+			return true;
+		}
+	}
+	return false;
+}
+
 //---------------------------------------------------------
 
 CJob *CThreadPool::GetDummyJob()